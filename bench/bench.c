@@ -0,0 +1,1376 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Program pogocache-bench is a load generator for Pogocache. It speaks the
+// RESP, Memcache, HTTP and Postgres wire protocols and prints its results
+// as JSON.
+//
+// Each thread runs an epoll loop over its share of the connections, and
+// each connection keeps up to --pipeline requests in flight. Without
+// --rate the connections send as fast as the server answers (closed loop).
+// With --rate each connection sends on a fixed schedule and latency is
+// measured from the time a request was meant to be sent, so that a server
+// stall is charged to every request that queued up behind it (open loop).
+// For the closed loop the corrected percentiles are derived afterwards
+// from the raw histogram, using the average interval between requests on
+// one pipeline slot of a connection as the expected interval.
+//
+//   ./pogocache-bench -p 9401 --proto resp -c 50 -t 4 -P 1 --duration 10
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+enum proto { RESP, MEMCACHE, HTTP, POSTGRES };
+
+static const char *protonames[] = { "resp", "memcache", "http", "postgres" };
+
+enum keydist { UNIFORM, ZIPFIAN, HOTSPOT };
+
+static const char *keydistnames[] = { "uniform", "zipfian", "hotspot" };
+
+// Reply classes
+enum { REPLY_OK, REPLY_MISS, REPLY_ERR };
+
+#define MAXSIZES 16
+
+// Value sizes are either fixed, uniform over a range, or picked from a
+// weighted list.
+struct sizedist {
+    int n;                  // number of entries, or 0 for a range
+    size_t min;
+    size_t max;
+    size_t sizes[MAXSIZES];
+    double cum[MAXSIZES];   // cumulative weights
+};
+
+struct opts {
+    const char *host;
+    const char *port;
+    const char *unixsock;
+    const char *auth;
+    enum proto proto;
+    int conns;
+    int threads;
+    int pipeline;
+    double duration;        // seconds
+    int64_t requests;       // total, overrides duration when > 0
+    double rate;            // total requests/sec, 0 for closed loop
+    uint64_t keyspace;
+    const char *keyprefix;
+    enum keydist keydist;
+    double zipftheta;
+    double hotkeys;         // fraction of the keyspace that is hot
+    double hotops;          // fraction of the operations on the hot keys
+    struct sizedist vsize;
+    const char *vsizespec;
+    int setratio;
+    int getratio;
+    bool prefill;
+    uint64_t seed;
+};
+
+static struct opts opts = {
+    .host = "127.0.0.1",
+    .port = "9401",
+    .proto = RESP,
+    .conns = 50,
+    .threads = 4,
+    .pipeline = 1,
+    .duration = 10,
+    .keyspace = 100000,
+    .keyprefix = "key:",
+    .keydist = UNIFORM,
+    .zipftheta = 0.99,
+    .hotkeys = 0.2,
+    .hotops = 0.8,
+    .vsizespec = "32",
+    .setratio = 1,
+    .getratio = 10,
+    .seed = 1,
+};
+
+static int64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+static void fatal(const char *msg) {
+    fprintf(stderr, "# %s\n", msg);
+    exit(1);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Latency histogram
+////////////////////////////////////////////////////////////////////////////
+
+// Values below 128 ns have their own bucket. Above that each power of two
+// is split into 64 buckets, which keeps the error under 1.6%.
+#define HSUBBITS 6
+#define HSUB (1<<HSUBBITS)
+#define HBUCKETS ((64-HSUBBITS-1)*HSUB)
+
+struct hist {
+    uint64_t counts[HBUCKETS];
+    uint64_t n;
+    double sum;
+    uint64_t min;
+    uint64_t max;
+};
+
+static int hist_bucket(uint64_t v) {
+    if (v < 2*HSUB) {
+        return v;
+    }
+    int shift = 63-__builtin_clzll(v)-HSUBBITS;
+    return (shift+1)*HSUB+(int)((v>>shift)-HSUB);
+}
+
+static uint64_t hist_lower(int i) {
+    if (i < 2*HSUB) {
+        return i;
+    }
+    int shift = i/HSUB-1;
+    return (uint64_t)(HSUB+i%HSUB)<<shift;
+}
+
+static uint64_t hist_width(int i) {
+    return i < 2*HSUB ? 1 : (uint64_t)1<<(i/HSUB-1);
+}
+
+static void hist_init(struct hist *h) {
+    memset(h, 0, sizeof(struct hist));
+    h->min = UINT64_MAX;
+}
+
+static void hist_record_n(struct hist *h, uint64_t v, uint64_t count) {
+    h->counts[hist_bucket(v)] += count;
+    h->n += count;
+    h->sum += (double)v*count;
+    h->min = v < h->min ? v : h->min;
+    h->max = v > h->max ? v : h->max;
+}
+
+static void hist_record(struct hist *h, uint64_t v) {
+    hist_record_n(h, v, 1);
+}
+
+// Record a value and the samples that a stall of that length kept from
+// being taken: v-interval, v-2*interval, ... down to interval. The
+// synthetic samples are added a bucket at a time.
+static void hist_record_corrected(struct hist *h, uint64_t v, uint64_t count,
+    uint64_t interval)
+{
+    hist_record_n(h, v, count);
+    if (interval == 0 || v <= interval) {
+        return;
+    }
+    uint64_t m = v-interval;
+    while (m >= interval) {
+        int i = hist_bucket(m);
+        uint64_t lo = hist_lower(i);
+        lo = lo > interval ? lo : interval;
+        uint64_t k = (m-lo)/interval+1;
+        h->counts[i] += k*count;
+        h->n += k*count;
+        h->sum += ((double)m*k-(double)interval*k*(k-1)/2)*count;
+        m -= k*interval;
+        uint64_t last = m+interval;
+        h->min = last < h->min ? last : h->min;
+    }
+}
+
+static void hist_merge(struct hist *dst, const struct hist *src) {
+    for (int i = 0; i < HBUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->n += src->n;
+    dst->sum += src->sum;
+    dst->min = src->min < dst->min ? src->min : dst->min;
+    dst->max = src->max > dst->max ? src->max : dst->max;
+}
+
+// Rebuild a histogram as if every sample had been recorded with
+// hist_record_corrected.
+static void hist_correct(struct hist *dst, const struct hist *src,
+    uint64_t interval)
+{
+    hist_init(dst);
+    for (int i = 0; i < HBUCKETS; i++) {
+        if (src->counts[i]) {
+            uint64_t v = hist_lower(i)+hist_width(i)/2;
+            hist_record_corrected(dst, v, src->counts[i], interval);
+        }
+    }
+    if (src->n) {
+        dst->min = src->min < dst->min ? src->min : dst->min;
+        dst->max = src->max;
+    }
+}
+
+static uint64_t hist_percentile(const struct hist *h, double p) {
+    if (h->n == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)ceil(p/100*h->n);
+    target = target == 0 ? 1 : target;
+    uint64_t seen = 0;
+    for (int i = 0; i < HBUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            uint64_t v = hist_lower(i)+hist_width(i)/2;
+            v = v < h->min ? h->min : v;
+            return v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+static void hist_print_json(const struct hist *h, const char *indent) {
+    static const double ps[] = { 50, 90, 99, 99.9, 99.99 };
+    static const char *names[] = { "p50", "p90", "p99", "p999", "p9999" };
+    printf("{\n");
+    printf("%s  \"min\": %.3f,\n", indent, h->n ? h->min/1e3 : 0);
+    printf("%s  \"mean\": %.3f,\n", indent, h->n ? h->sum/h->n/1e3 : 0);
+    for (int i = 0; i < 5; i++) {
+        printf("%s  \"%s\": %.3f,\n", indent, names[i],
+            hist_percentile(h, ps[i])/1e3);
+    }
+    printf("%s  \"max\": %.3f\n", indent, h->max/1e3);
+    printf("%s}", indent);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Keys and values
+////////////////////////////////////////////////////////////////////////////
+
+static uint64_t rng_next(uint64_t *s) {
+    // splitmix64
+    uint64_t z = (*s += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+static double rng_double(uint64_t *s) {
+    return (rng_next(s)>>11)*(1.0/9007199254740992.0);
+}
+
+// Zipfian constants, from "Quickly Generating Billion-Record Synthetic
+// Databases" by Gray et al.
+static double zipf_zetan;
+static double zipf_alpha;
+static double zipf_eta;
+static double zipf_half;
+
+static void zipf_init(uint64_t n, double theta) {
+    double zeta2 = 1+pow(0.5, theta);
+    zipf_zetan = 0;
+    for (uint64_t i = 1; i <= n; i++) {
+        zipf_zetan += 1/pow((double)i, theta);
+    }
+    zipf_alpha = 1/(1-theta);
+    zipf_eta = (1-pow(2.0/n, 1-theta))/(1-zeta2/zipf_zetan);
+    zipf_half = 1+pow(0.5, theta);
+}
+
+static uint64_t fnv64(uint64_t x) {
+    uint64_t h = 0xCBF29CE484222325;
+    for (int i = 0; i < 8; i++) {
+        h ^= x & 0xFF;
+        h *= 0x100000001B3;
+        x >>= 8;
+    }
+    return h;
+}
+
+static uint64_t next_key(uint64_t *rng) {
+    uint64_t n = opts.keyspace;
+    switch (opts.keydist) {
+    case ZIPFIAN: {
+        double u = rng_double(rng);
+        double uz = u*zipf_zetan;
+        uint64_t rank;
+        if (uz < 1) {
+            rank = 0;
+        } else if (uz < zipf_half) {
+            rank = 1;
+        } else {
+            rank = (uint64_t)(n*pow(zipf_eta*u-zipf_eta+1, zipf_alpha));
+        }
+        // Scatter the popular ranks over the keyspace.
+        return fnv64(rank < n ? rank : n-1)%n;
+    }
+    case HOTSPOT: {
+        uint64_t hot = (uint64_t)(n*opts.hotkeys);
+        hot = hot == 0 ? 1 : hot;
+        if (hot >= n || rng_double(rng) < opts.hotops) {
+            return rng_next(rng)%hot;
+        }
+        return hot+rng_next(rng)%(n-hot);
+    }
+    default:
+        return rng_next(rng)%n;
+    }
+}
+
+static size_t next_vsize(uint64_t *rng) {
+    struct sizedist *d = &opts.vsize;
+    if (d->n == 0) {
+        if (d->max == d->min) {
+            return d->min;
+        }
+        return d->min+rng_next(rng)%(d->max-d->min+1);
+    }
+    double x = rng_double(rng)*d->cum[d->n-1];
+    for (int i = 0; i < d->n-1; i++) {
+        if (x < d->cum[i]) {
+            return d->sizes[i];
+        }
+    }
+    return d->sizes[d->n-1];
+}
+
+// Parse "N", "MIN-MAX", or "N:WEIGHT,N:WEIGHT,...".
+static bool parse_sizedist(const char *spec, struct sizedist *d) {
+    memset(d, 0, sizeof(struct sizedist));
+    char *end;
+    if (!strchr(spec, ':')) {
+        d->min = strtoull(spec, &end, 10);
+        d->max = d->min;
+        if (*end == '-') {
+            d->max = strtoull(end+1, &end, 10);
+        }
+        return end != spec && *end == '\0' && d->max >= d->min;
+    }
+    const char *p = spec;
+    double total = 0;
+    while (*p) {
+        if (d->n == MAXSIZES) {
+            return false;
+        }
+        d->sizes[d->n] = strtoull(p, &end, 10);
+        if (end == p || *end != ':') {
+            return false;
+        }
+        p = end+1;
+        double w = strtod(p, &end);
+        if (end == p || w <= 0 || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+        total += w;
+        d->cum[d->n++] = total;
+        if (d->sizes[d->n-1] > d->max) {
+            d->max = d->sizes[d->n-1];
+        }
+        p = *end == ',' ? end+1 : end;
+    }
+    return d->n > 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Buffers
+////////////////////////////////////////////////////////////////////////////
+
+struct bbuf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+static void bbuf_ensure(struct bbuf *b, size_t n) {
+    if (b->cap-b->len >= n) {
+        return;
+    }
+    size_t cap = b->cap == 0 ? 4096 : b->cap;
+    while (cap-b->len < n) {
+        cap *= 2;
+    }
+    b->data = realloc(b->data, cap);
+    if (!b->data) {
+        abort();
+    }
+    b->cap = cap;
+}
+
+static void bbuf_append(struct bbuf *b, const void *data, size_t len) {
+    bbuf_ensure(b, len);
+    memcpy(b->data+b->len, data, len);
+    b->len += len;
+}
+
+static void bbuf_printf(struct bbuf *b, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(0, 0, fmt, ap);
+    va_end(ap);
+    bbuf_ensure(b, n+1);
+    va_start(ap, fmt);
+    vsnprintf(b->data+b->len, n+1, fmt, ap);
+    va_end(ap);
+    b->len += n;
+}
+
+// Drop the first n bytes.
+static void bbuf_shift(struct bbuf *b, size_t n) {
+    memmove(b->data, b->data+n, b->len-n);
+    b->len -= n;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Protocols
+////////////////////////////////////////////////////////////////////////////
+
+static char *valdata;       // a pattern that values are cut from
+
+static void pg_message(struct bbuf *out, char type, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(0, 0, fmt, ap);
+    va_end(ap);
+    size_t start = out->len;
+    bbuf_ensure(out, 5+n+1);
+    out->data[out->len++] = type;
+    out->len += 4;
+    va_start(ap, fmt);
+    vsnprintf(out->data+out->len, n+1, fmt, ap);
+    va_end(ap);
+    out->len += n+1;
+    uint32_t size = htonl(out->len-start-1);
+    memcpy(out->data+start+1, &size, 4);
+}
+
+static void encode_set(struct bbuf *out, const char *key, size_t klen,
+    size_t vlen)
+{
+    const char *val = valdata;
+    switch (opts.proto) {
+    case RESP:
+        bbuf_printf(out, "*3\r\n$3\r\nSET\r\n$%zu\r\n%s\r\n$%zu\r\n",
+            klen, key, vlen);
+        bbuf_append(out, val, vlen);
+        bbuf_append(out, "\r\n", 2);
+        break;
+    case MEMCACHE:
+        bbuf_printf(out, "set %s 0 0 %zu\r\n", key, vlen);
+        bbuf_append(out, val, vlen);
+        bbuf_append(out, "\r\n", 2);
+        break;
+    case HTTP:
+        bbuf_printf(out, "PUT /%s HTTP/1.1\r\nHost: %s\r\n"
+            "Content-Length: %zu\r\n", key, opts.host, vlen);
+        if (opts.auth) {
+            bbuf_printf(out, "Authorization: Bearer %s\r\n", opts.auth);
+        }
+        bbuf_append(out, "\r\n", 2);
+        bbuf_append(out, val, vlen);
+        break;
+    case POSTGRES:
+        pg_message(out, 'Q', "SET %s '%.*s'", key, (int)vlen, val);
+        break;
+    }
+}
+
+static void encode_get(struct bbuf *out, const char *key, size_t klen) {
+    switch (opts.proto) {
+    case RESP:
+        bbuf_printf(out, "*2\r\n$3\r\nGET\r\n$%zu\r\n%s\r\n", klen, key);
+        break;
+    case MEMCACHE:
+        bbuf_printf(out, "get %s\r\n", key);
+        break;
+    case HTTP:
+        bbuf_printf(out, "GET /%s HTTP/1.1\r\nHost: %s\r\n", key, opts.host);
+        if (opts.auth) {
+            bbuf_printf(out, "Authorization: Bearer %s\r\n", opts.auth);
+        }
+        bbuf_append(out, "\r\n", 2);
+        break;
+    case POSTGRES:
+        pg_message(out, 'Q', "GET %s", key);
+        break;
+    }
+}
+
+// Each reply parser returns the length of the first reply in data, zero if
+// it's incomplete, or -1 if it's invalid.
+
+static ssize_t resp_len(const char *data, size_t len, int depth) {
+    if (len == 0) {
+        return 0;
+    }
+    if (depth > 32) {
+        return -1;
+    }
+    const char *end = memchr(data, '\n', len);
+    if (!end) {
+        return 0;
+    }
+    size_t n = end-data+1;
+    long long x;
+    switch (data[0]) {
+    case '+': case '-': case ':':
+        return n;
+    case '$':
+        x = strtoll(data+1, 0, 10);
+        if (x < 0) {
+            return n;
+        }
+        return len-n < (size_t)x+2 ? 0 : (ssize_t)(n+x+2);
+    case '*':
+        x = strtoll(data+1, 0, 10);
+        for (long long i = 0; i < x; i++) {
+            ssize_t m = resp_len(data+n, len-n, depth+1);
+            if (m <= 0) {
+                return m;
+            }
+            n += m;
+        }
+        return n;
+    default:
+        return -1;
+    }
+}
+
+static ssize_t reply_resp(const char *data, size_t len, int *class) {
+    ssize_t n = resp_len(data, len, 0);
+    if (n > 0) {
+        if (data[0] == '-') {
+            *class = REPLY_ERR;
+        } else if (data[0] == '$' && data[1] == '-') {
+            *class = REPLY_MISS;
+        } else {
+            *class = REPLY_OK;
+        }
+    }
+    return n;
+}
+
+static bool hasprefix(const char *data, size_t len, const char *prefix) {
+    size_t n = strlen(prefix);
+    return len >= n && memcmp(data, prefix, n) == 0;
+}
+
+static ssize_t reply_memcache(const char *data, size_t len, int *class) {
+    const char *end = memchr(data, '\n', len);
+    if (!end) {
+        return 0;
+    }
+    size_t n = end-data+1;
+    if (!hasprefix(data, n, "VALUE ")) {
+        if (hasprefix(data, n, "END")) {
+            *class = REPLY_MISS;
+        } else if (hasprefix(data, n, "ERROR") ||
+            hasprefix(data, n, "CLIENT_ERROR") ||
+            hasprefix(data, n, "SERVER_ERROR"))
+        {
+            *class = REPLY_ERR;
+        } else {
+            *class = REPLY_OK;
+        }
+        return n;
+    }
+    // VALUE <key> <flags> <bytes> [<cas>]
+    const char *p = data+6;
+    for (int i = 0; i < 2; i++) {
+        p = memchr(p, ' ', end-p);
+        if (!p) {
+            return -1;
+        }
+        p++;
+    }
+    size_t vlen = strtoull(p, 0, 10);
+    if (len-n < vlen+2+5) {
+        return 0;
+    }
+    if (!hasprefix(data+n+vlen+2, 5, "END\r\n")) {
+        return -1;
+    }
+    *class = REPLY_OK;
+    return n+vlen+2+5;
+}
+
+static ssize_t reply_http(const char *data, size_t len, int *class) {
+    const char *end = memmem(data, len, "\r\n\r\n", 4);
+    if (!end) {
+        return 0;
+    }
+    size_t hdrlen = end-data+4;
+    if (!hasprefix(data, len, "HTTP/") || hdrlen < 13) {
+        return -1;
+    }
+    int status = atoi(data+9);
+    size_t clen = 0;
+    const char *p = data;
+    while ((p = memchr(p, '\n', end-p)) && p < end) {
+        p++;
+        if (strncasecmp(p, "Content-Length:", 15) == 0) {
+            clen = strtoull(p+15, 0, 10);
+        }
+    }
+    if (len-hdrlen < clen) {
+        return 0;
+    }
+    *class = status == 404 ? REPLY_MISS : status < 300 ? REPLY_OK : REPLY_ERR;
+    return hdrlen+clen;
+}
+
+// A Postgres reply is every message up to and including ReadyForQuery.
+static ssize_t reply_postgres(const char *data, size_t len, int *class) {
+    size_t n = 0;
+    bool row = false;
+    bool err = false;
+    while (len-n >= 5) {
+        uint32_t size;
+        memcpy(&size, data+n+1, 4);
+        size = ntohl(size);
+        if (size < 4) {
+            return -1;
+        }
+        if (len-n < size+1) {
+            return 0;
+        }
+        char type = data[n];
+        n += size+1;
+        if (type == 'D') {
+            row = true;
+        } else if (type == 'E') {
+            err = true;
+        } else if (type == 'C') {
+            // "SET 1", "GET 0", ...
+            const char *tag = data+n-size+4;
+            if (size >= 10 && memcmp(tag, "GET 0", 5) == 0) {
+                row = false;
+            } else {
+                row = true;
+            }
+        } else if (type == 'Z') {
+            *class = err ? REPLY_ERR : row ? REPLY_OK : REPLY_MISS;
+            return n;
+        }
+    }
+    return 0;
+}
+
+static ssize_t parse_reply(const char *data, size_t len, int *class) {
+    switch (opts.proto) {
+    case RESP:
+        return reply_resp(data, len, class);
+    case MEMCACHE:
+        return reply_memcache(data, len, class);
+    case HTTP:
+        return reply_http(data, len, class);
+    default:
+        return reply_postgres(data, len, class);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Connections
+////////////////////////////////////////////////////////////////////////////
+
+static struct addrinfo *addrs;
+
+static int dial(void) {
+    int fd;
+    if (opts.unixsock) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        strncpy(addr.sun_path, opts.unixsock, sizeof(addr.sun_path)-1);
+        fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+        if (fd == -1 ||
+            connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+        {
+            perror("# connect");
+            exit(1);
+        }
+        return fd;
+    }
+    fd = socket(addrs->ai_family, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, addrs->ai_addr, addrs->ai_addrlen) == -1) {
+        perror("# connect");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void writeall(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0) {
+            perror("# write");
+            exit(1);
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// Read the reply to a handshake message, blocking.
+static void readreply(int fd, struct bbuf *in,
+    ssize_t(*parse)(const char*, size_t, int*), int *class)
+{
+    in->len = 0;
+    while (1) {
+        ssize_t n = parse(in->data, in->len, class);
+        if (n < 0) {
+            fatal("invalid reply during handshake");
+        }
+        if (n > 0) {
+            bbuf_shift(in, n);
+            return;
+        }
+        bbuf_ensure(in, 4096);
+        n = read(fd, in->data+in->len, in->cap-in->len);
+        if (n <= 0) {
+            fatal("server closed during handshake");
+        }
+        in->len += n;
+    }
+}
+
+// Open a connection and get it ready for commands.
+static int handshake(void) {
+    int fd = dial();
+    struct bbuf b = { 0 };
+    int class;
+    if (opts.proto == POSTGRES) {
+        const char params[] = "user\0bench\0database\0bench\0";
+        uint32_t hdr[2] = { htonl(8+sizeof(params)), htonl(0x00030000) };
+        bbuf_append(&b, hdr, 8);
+        bbuf_append(&b, params, sizeof(params));
+        writeall(fd, b.data, b.len);
+        b.len = 0;
+        bbuf_ensure(&b, 9);
+        // AuthenticationCleartextPassword is the only request we answer.
+        ssize_t n = 0;
+        while (n < 9) {
+            ssize_t m = read(fd, b.data+n, 9-n);
+            if (m <= 0) {
+                fatal("server closed during handshake");
+            }
+            n += m;
+        }
+        if (b.data[0] != 'R') {
+            fatal("postgres startup failed");
+        }
+        if (b.data[8] == 3) {
+            if (!opts.auth) {
+                fatal("server requires --auth");
+            }
+            b.len = 0;
+            pg_message(&b, 'p', "%s", opts.auth);
+            writeall(fd, b.data, b.len);
+        }
+        readreply(fd, &b, reply_postgres, &class);
+    } else if (opts.proto == RESP && opts.auth) {
+        bbuf_printf(&b, "*2\r\n$4\r\nAUTH\r\n$%zu\r\n%s\r\n",
+            strlen(opts.auth), opts.auth);
+        writeall(fd, b.data, b.len);
+        readreply(fd, &b, reply_resp, &class);
+    } else {
+        class = REPLY_OK;
+    }
+    free(b.data);
+    if (class == REPLY_ERR) {
+        fatal("auth failed");
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+struct req {
+    int64_t intended;   // when it was meant to be sent
+    int64_t sent;       // when it was queued for writing
+    bool get;
+};
+
+struct conn {
+    int fd;
+    bool writing;       // EPOLLOUT is armed
+    struct bbuf out;
+    size_t outpos;
+    struct bbuf in;
+    struct req *reqs;   // in flight, a ring of 'pipeline' entries
+    int head;
+    int count;
+    int64_t next;       // next scheduled send, open loop only
+    int64_t interval;
+};
+
+struct worker {
+    pthread_t th;
+    int id;
+    int epfd;
+    struct conn *conns;
+    int nconns;
+    uint64_t rng;
+    int64_t budget;     // requests left to send, or -1 for no limit
+    uint64_t prefill;   // next key to prefill
+    uint64_t prefillend;
+    bool prefilling;
+    int64_t start;
+    int64_t end;
+    int64_t last;       // time of the last reply
+    struct hist raw;
+    struct hist sched;  // from the intended send time, open loop only
+    uint64_t gets;
+    uint64_t sets;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t errors;
+    uint64_t bytesin;
+    uint64_t bytesout;
+};
+
+static void conn_arm(struct worker *w, struct conn *c, bool writing) {
+    if (c->writing == writing) {
+        return;
+    }
+    struct epoll_event ev = {
+        .events = EPOLLIN | (writing ? EPOLLOUT : 0),
+        .data.ptr = c,
+    };
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->writing = writing;
+}
+
+static void conn_add(struct worker *w, struct conn *c) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1) {
+        perror("# epoll_ctl");
+        exit(1);
+    }
+    c->writing = false;
+}
+
+// HTTP connections are closed by the server after each reply.
+static void conn_redial(struct worker *w, struct conn *c) {
+    close(c->fd);
+    c->fd = handshake();
+    c->out.len = 0;
+    c->outpos = 0;
+    c->in.len = 0;
+    conn_add(w, c);
+}
+
+static void conn_flush(struct worker *w, struct conn *c) {
+    while (c->outpos < c->out.len) {
+        ssize_t n = write(c->fd, c->out.data+c->outpos, c->out.len-c->outpos);
+        if (n == -1) {
+            if (errno == EAGAIN) {
+                conn_arm(w, c, true);
+                return;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            fatal("server closed");
+        }
+        c->outpos += n;
+        w->bytesout += n;
+    }
+    c->out.len = 0;
+    c->outpos = 0;
+    conn_arm(w, c, false);
+}
+
+// Queue as many requests as the pipeline and schedule allow.
+static void conn_fill(struct worker *w, struct conn *c, int64_t tnow) {
+    while (c->count < opts.pipeline) {
+        bool get;
+        uint64_t key;
+        if (w->prefilling) {
+            if (w->prefill == w->prefillend) {
+                break;
+            }
+            key = w->prefill++;
+            get = false;
+        } else {
+            if (w->budget == 0 || tnow >= w->end) {
+                break;
+            }
+            if (c->interval && c->next > tnow) {
+                break;
+            }
+            key = next_key(&w->rng);
+            get = rng_next(&w->rng)%(opts.setratio+opts.getratio) >=
+                (uint64_t)opts.setratio;
+            if (w->budget > 0) {
+                w->budget--;
+            }
+        }
+        char kbuf[256];
+        int klen = snprintf(kbuf, sizeof(kbuf), "%s%" PRIu64,
+            opts.keyprefix, key);
+        if (get) {
+            encode_get(&c->out, kbuf, klen);
+        } else {
+            encode_set(&c->out, kbuf, klen, next_vsize(&w->rng));
+        }
+        struct req *r = &c->reqs[(c->head+c->count)%opts.pipeline];
+        r->sent = tnow;
+        r->intended = c->interval ? c->next : tnow;
+        r->get = get;
+        c->count++;
+        if (c->interval) {
+            c->next += c->interval;
+        }
+    }
+    if (c->out.len > c->outpos) {
+        conn_flush(w, c);
+    }
+}
+
+static void conn_read(struct worker *w, struct conn *c) {
+    bool eof = false;
+    while (1) {
+        bbuf_ensure(&c->in, 16384);
+        ssize_t n = read(c->fd, c->in.data+c->in.len, c->in.cap-c->in.len);
+        if (n == -1) {
+            if (errno == EAGAIN) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            fatal("server closed");
+        }
+        if (n == 0) {
+            eof = true;
+            break;
+        }
+        c->in.len += n;
+        w->bytesin += n;
+        if (c->in.len < c->in.cap) {
+            break;
+        }
+    }
+    int64_t tnow = now();
+    size_t pos = 0;
+    while (c->count > 0) {
+        int class;
+        ssize_t n = parse_reply(c->in.data+pos, c->in.len-pos, &class);
+        if (n < 0) {
+            fatal("invalid reply");
+        }
+        if (n == 0) {
+            break;
+        }
+        pos += n;
+        struct req *r = &c->reqs[c->head];
+        c->head = (c->head+1)%opts.pipeline;
+        c->count--;
+        w->last = tnow;
+        if (w->prefilling) {
+            continue;
+        }
+        hist_record(&w->raw, tnow-r->sent);
+        if (c->interval) {
+            hist_record(&w->sched, tnow-r->intended);
+        }
+        if (r->get) {
+            w->gets++;
+            if (class == REPLY_OK) {
+                w->hits++;
+            } else if (class == REPLY_MISS) {
+                w->misses++;
+            }
+        } else {
+            w->sets++;
+        }
+        if (class == REPLY_ERR) {
+            w->errors++;
+        }
+    }
+    bbuf_shift(&c->in, pos);
+    if (eof && (c->count > 0 || opts.proto != HTTP)) {
+        fatal("server closed");
+    }
+    if (opts.proto == HTTP && (pos > 0 || eof)) {
+        conn_redial(w, c);
+    }
+}
+
+static void *worker_run(void *arg) {
+    struct worker *w = arg;
+    struct epoll_event evs[64];
+    int64_t grace = 0;
+    while (1) {
+        int64_t tnow = now();
+        int inflight = 0;
+        int64_t due = INT64_MAX;
+        for (int i = 0; i < w->nconns; i++) {
+            struct conn *c = &w->conns[i];
+            conn_fill(w, c, tnow);
+            inflight += c->count;
+            if (c->interval && !w->prefilling && c->count < opts.pipeline &&
+                c->next < due)
+            {
+                due = c->next;
+            }
+        }
+        bool done = w->prefilling ? w->prefill == w->prefillend :
+            (w->budget == 0 || tnow >= w->end);
+        if (done) {
+            if (inflight == 0) {
+                break;
+            }
+            // Give the stragglers a moment, but don't wait forever.
+            if (grace == 0) {
+                grace = tnow+2000000000;
+            } else if (tnow > grace) {
+                fprintf(stderr, "# %d requests never answered\n", inflight);
+                break;
+            }
+        }
+        int timeout = 100;
+        if (due != INT64_MAX && !done) {
+            // Spin when the next send is less than a millisecond away.
+            int64_t wait = (due-tnow)/1000000;
+            timeout = wait < timeout ? (int)wait : timeout;
+            timeout = timeout < 0 ? 0 : timeout;
+        }
+        int n = epoll_wait(w->epfd, evs, 64, timeout);
+        if (n == -1 && errno != EINTR) {
+            perror("# epoll_wait");
+            exit(1);
+        }
+        for (int i = 0; i < n; i++) {
+            struct conn *c = evs[i].data.ptr;
+            if (evs[i].events & EPOLLOUT) {
+                conn_flush(w, c);
+            }
+            if (evs[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR)) {
+                conn_read(w, c);
+            }
+        }
+    }
+    return 0;
+}
+
+static void run_workers(struct worker *workers) {
+    for (int i = 0; i < opts.threads; i++) {
+        if (pthread_create(&workers[i].th, 0, worker_run, &workers[i])) {
+            fatal("pthread_create failed");
+        }
+    }
+    for (int i = 0; i < opts.threads; i++) {
+        pthread_join(workers[i].th, 0);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Main
+////////////////////////////////////////////////////////////////////////////
+
+static void usage(void) {
+    fprintf(stderr,
+"Usage: pogocache-bench [options]\n"
+"\n"
+"  -h host                 server host              (default: 127.0.0.1)\n"
+"  -p port                 server port              (default: 9401)\n"
+"  -s path                 unix socket, instead of host and port\n"
+"  --auth passwd           auth password            (default: none)\n"
+"  --proto name            resp, memcache, http, postgres (default: resp)\n"
+"  -c conns                total connections        (default: 50)\n"
+"  -t threads              client threads           (default: 4)\n"
+"  -P depth                requests in flight per connection (default: 1)\n"
+"  --duration secs         length of the run        (default: 10)\n"
+"  -n requests             total requests, instead of --duration\n"
+"  --rate ops              target requests/sec over all connections,\n"
+"                          0 to send as fast as possible (default: 0)\n"
+"  --keyspace n            number of distinct keys  (default: 100000)\n"
+"  --keyprefix str         key prefix               (default: key:)\n"
+"  --keydist name          uniform, zipfian, hotspot (default: uniform)\n"
+"  --zipf theta            zipfian skew, 0 < theta < 1 (default: 0.99)\n"
+"  --hotspot keys:ops      fraction of keys that get the given fraction of\n"
+"                          operations               (default: 0.2:0.8)\n"
+"  --valsize spec          N, MIN-MAX, or N:WEIGHT,N:WEIGHT,...\n"
+"                          value sizes in bytes     (default: 32)\n"
+"  --ratio set:get         write to read ratio      (default: 1:10)\n"
+"  --prefill               set every key before the run\n"
+"  --seed n                random seed              (default: 1)\n"
+    );
+    exit(1);
+}
+
+static int64_t intarg(const char *s, int64_t min) {
+    char *end;
+    long long x = strtoll(s, &end, 10);
+    if (end == s || *end || x < min) {
+        usage();
+    }
+    return x;
+}
+
+static double floatarg(const char *s) {
+    char *end;
+    double x = strtod(s, &end);
+    if (end == s || *end || !(x >= 0)) {
+        usage();
+    }
+    return x;
+}
+
+static void parse_args(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (strcmp(a, "--prefill") == 0) {
+            opts.prefill = true;
+            continue;
+        }
+        if (i+1 == argc) {
+            usage();
+        }
+        const char *v = argv[++i];
+        if (strcmp(a, "-h") == 0) {
+            opts.host = v;
+        } else if (strcmp(a, "-p") == 0) {
+            opts.port = v;
+        } else if (strcmp(a, "-s") == 0) {
+            opts.unixsock = v;
+        } else if (strcmp(a, "--auth") == 0) {
+            opts.auth = v;
+        } else if (strcmp(a, "--proto") == 0) {
+            int p = -1;
+            for (int j = 0; j < 4; j++) {
+                if (strcmp(v, protonames[j]) == 0) {
+                    p = j;
+                }
+            }
+            if (p == -1) {
+                usage();
+            }
+            opts.proto = p;
+        } else if (strcmp(a, "-c") == 0) {
+            opts.conns = intarg(v, 1);
+        } else if (strcmp(a, "-t") == 0) {
+            opts.threads = intarg(v, 1);
+        } else if (strcmp(a, "-P") == 0) {
+            opts.pipeline = intarg(v, 1);
+        } else if (strcmp(a, "--duration") == 0) {
+            opts.duration = floatarg(v);
+        } else if (strcmp(a, "-n") == 0) {
+            opts.requests = intarg(v, 1);
+        } else if (strcmp(a, "--rate") == 0) {
+            opts.rate = floatarg(v);
+        } else if (strcmp(a, "--keyspace") == 0) {
+            opts.keyspace = intarg(v, 1);
+        } else if (strcmp(a, "--keyprefix") == 0) {
+            opts.keyprefix = v;
+        } else if (strcmp(a, "--keydist") == 0) {
+            int d = -1;
+            for (int j = 0; j < 3; j++) {
+                if (strcmp(v, keydistnames[j]) == 0) {
+                    d = j;
+                }
+            }
+            if (d == -1) {
+                usage();
+            }
+            opts.keydist = d;
+        } else if (strcmp(a, "--zipf") == 0) {
+            opts.zipftheta = floatarg(v);
+            if (opts.zipftheta <= 0 || opts.zipftheta >= 1) {
+                usage();
+            }
+        } else if (strcmp(a, "--hotspot") == 0) {
+            if (sscanf(v, "%lf:%lf", &opts.hotkeys, &opts.hotops) != 2 ||
+                opts.hotkeys <= 0 || opts.hotkeys > 1 ||
+                opts.hotops < 0 || opts.hotops > 1)
+            {
+                usage();
+            }
+        } else if (strcmp(a, "--valsize") == 0) {
+            opts.vsizespec = v;
+        } else if (strcmp(a, "--ratio") == 0) {
+            if (sscanf(v, "%d:%d", &opts.setratio, &opts.getratio) != 2 ||
+                opts.setratio < 0 || opts.getratio < 0 ||
+                opts.setratio+opts.getratio == 0)
+            {
+                usage();
+            }
+        } else if (strcmp(a, "--seed") == 0) {
+            opts.seed = intarg(v, 0);
+        } else {
+            usage();
+        }
+    }
+    if (!parse_sizedist(opts.vsizespec, &opts.vsize)) {
+        usage();
+    }
+    if (opts.threads > opts.conns) {
+        opts.threads = opts.conns;
+    }
+    if (opts.proto == HTTP && opts.pipeline > 1) {
+        // The server answers one request per HTTP connection.
+        fprintf(stderr, "# http does not pipeline, using -P 1\n");
+        opts.pipeline = 1;
+    }
+    if (opts.proto == MEMCACHE && opts.auth) {
+        fatal("memcache does not support --auth");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    parse_args(argc, argv);
+    if (!opts.unixsock) {
+        struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
+        int err = getaddrinfo(opts.host, opts.port, &hints, &addrs);
+        if (err) {
+            fprintf(stderr, "# %s: %s\n", opts.host, gai_strerror(err));
+            return 1;
+        }
+    }
+    if (opts.keydist == ZIPFIAN) {
+        zipf_init(opts.keyspace, opts.zipftheta);
+    }
+    size_t maxval = opts.vsize.max;
+    valdata = malloc(maxval+1);
+    for (size_t i = 0; i < maxval; i++) {
+        valdata[i] = 'a'+i%26;
+    }
+
+    struct worker *workers = calloc(opts.threads, sizeof(struct worker));
+    int64_t perconn = opts.rate > 0 ?
+        (int64_t)(1e9/(opts.rate/opts.conns)) : 0;
+    for (int i = 0; i < opts.threads; i++) {
+        struct worker *w = &workers[i];
+        w->id = i;
+        w->rng = opts.seed*0x9E3779B97F4A7C15+i;
+        w->nconns = opts.conns/opts.threads+(i < opts.conns%opts.threads);
+        w->conns = calloc(w->nconns, sizeof(struct conn));
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (!w->conns || w->epfd == -1) {
+            fatal("out of resources");
+        }
+        for (int j = 0; j < w->nconns; j++) {
+            struct conn *c = &w->conns[j];
+            c->fd = handshake();
+            c->reqs = calloc(opts.pipeline, sizeof(struct req));
+            c->interval = perconn;
+            conn_add(w, c);
+        }
+        hist_init(&w->raw);
+        hist_init(&w->sched);
+    }
+
+    if (opts.prefill) {
+        fprintf(stderr, "# prefilling %" PRIu64 " keys\n", opts.keyspace);
+        for (int i = 0; i < opts.threads; i++) {
+            struct worker *w = &workers[i];
+            w->prefilling = true;
+            w->prefill = opts.keyspace*i/opts.threads;
+            w->prefillend = opts.keyspace*(i+1)/opts.threads;
+        }
+        run_workers(workers);
+        for (int i = 0; i < opts.threads; i++) {
+            workers[i].prefilling = false;
+        }
+    }
+
+    fprintf(stderr, "# running %s with %d connections\n",
+        protonames[opts.proto], opts.conns);
+    int64_t start = now();
+    for (int i = 0; i < opts.threads; i++) {
+        struct worker *w = &workers[i];
+        w->start = start;
+        w->end = opts.requests > 0 ? INT64_MAX :
+            start+(int64_t)(opts.duration*1e9);
+        w->budget = opts.requests > 0 ? opts.requests/opts.threads+
+            (i < opts.requests%opts.threads) : -1;
+        w->last = start;
+        for (int j = 0; j < w->nconns; j++) {
+            // Stagger the schedules so the connections don't send in step.
+            w->conns[j].next = start+(perconn*(i+j*opts.threads))/opts.conns;
+        }
+    }
+    run_workers(workers);
+
+    struct hist raw, sched, corrected;
+    hist_init(&raw);
+    hist_init(&sched);
+    uint64_t gets = 0, sets = 0, hits = 0, misses = 0, errors = 0;
+    uint64_t bytesin = 0, bytesout = 0;
+    int64_t last = start;
+    for (int i = 0; i < opts.threads; i++) {
+        struct worker *w = &workers[i];
+        hist_merge(&raw, &w->raw);
+        hist_merge(&sched, &w->sched);
+        gets += w->gets;
+        sets += w->sets;
+        hits += w->hits;
+        misses += w->misses;
+        errors += w->errors;
+        bytesin += w->bytesin;
+        bytesout += w->bytesout;
+        last = w->last > last ? w->last : last;
+    }
+    double elapsed = (last-start)/1e9;
+    uint64_t ops = gets+sets;
+    uint64_t interval = 0;
+    if (opts.rate > 0) {
+        corrected = sched;
+    } else {
+        // The average time between requests on one pipeline slot.
+        double slots = (double)opts.conns*opts.pipeline;
+        interval = ops ? (uint64_t)(elapsed*1e9*slots/ops) : 0;
+        hist_correct(&corrected, &raw, interval);
+    }
+
+    printf("{\n");
+    printf("  \"proto\": \"%s\",\n", protonames[opts.proto]);
+    printf("  \"connections\": %d,\n", opts.conns);
+    printf("  \"threads\": %d,\n", opts.threads);
+    printf("  \"pipeline\": %d,\n", opts.pipeline);
+    printf("  \"rate\": %.0f,\n", opts.rate);
+    printf("  \"keyspace\": %" PRIu64 ",\n", opts.keyspace);
+    printf("  \"keydist\": \"%s\",\n", keydistnames[opts.keydist]);
+    printf("  \"valsize\": \"%s\",\n", opts.vsizespec);
+    printf("  \"ratio\": \"%d:%d\",\n", opts.setratio, opts.getratio);
+    printf("  \"seconds\": %.3f,\n", elapsed);
+    printf("  \"ops\": %" PRIu64 ",\n", ops);
+    printf("  \"ops_per_sec\": %.0f,\n", elapsed > 0 ? ops/elapsed : 0);
+    printf("  \"sets\": %" PRIu64 ",\n", sets);
+    printf("  \"gets\": %" PRIu64 ",\n", gets);
+    printf("  \"hits\": %" PRIu64 ",\n", hits);
+    printf("  \"misses\": %" PRIu64 ",\n", misses);
+    printf("  \"errors\": %" PRIu64 ",\n", errors);
+    printf("  \"bytes_out\": %" PRIu64 ",\n", bytesout);
+    printf("  \"bytes_in\": %" PRIu64 ",\n", bytesin);
+    printf("  \"expected_interval_us\": %.3f,\n", interval/1e3);
+    printf("  \"latency_us\": ");
+    hist_print_json(&raw, "  ");
+    printf(",\n  \"latency_corrected_us\": ");
+    hist_print_json(&corrected, "  ");
+    printf("\n}\n");
+    return errors > 0;
+}
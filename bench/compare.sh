@@ -0,0 +1,23 @@
+#!/bin/bash
+
+# ./compare.sh [<enginebench options>]
+#
+# Runs enginebench-base and then enginebench with the same options, and
+# prints the results for each configuration in pairs, with the
+# change in ops/sec. Build both with 'make compare BASE=<git revision>'.
+
+set -e
+cd $(dirname "${BASH_SOURCE[0]}")
+
+./enginebench-base --label base "$@" > base.out
+./enginebench --label head "$@" > head.out
+awk '
+    NR == FNR { base[FNR] = $0; ops[FNR] = $11; next }
+    FNR == 1 { print $0 "   change"; next }
+    {
+        print base[FNR]
+        delta = ops[FNR] > 0 ? ($11-ops[FNR])*100/ops[FNR] : 0
+        printf "%s %+7.1f%%\n", $0, delta
+    }
+' base.out head.out
+rm -f base.out head.out
@@ -0,0 +1,431 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Program enginebench measures the pogocache.c engine in-process, without
+// the network. It runs store, load, iter, sweep and delete over every
+// combination of the given thread counts, shard counts, load factors, key
+// and value sizes, sixpack and CAS settings, and prints one line per
+// operation.
+//
+// Lock contention is counted through the pogocache_opts.yield callback,
+// which the engine calls each time it fails to take a shard lock.
+//
+//   ./enginebench -n 1000000 -t 1,4,8 --shards 4096 --valsize 32,1024
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pogocache.h"
+
+#define MAXLIST 16
+
+struct list {
+    int n;
+    int64_t vals[MAXLIST];
+};
+
+static struct {
+    int64_t nkeys;
+    struct list threads;
+    struct list shards;
+    struct list loadfactors;
+    struct list keysizes;
+    struct list valsizes;
+    struct list sixpack;        // 1 for sixpack, 0 for not
+    struct list cas;
+    int ttlpct;                 // percent of keys stored with a ttl
+    int64_t ttl;                // nanoseconds
+    bool json;
+    const char *label;
+} opts = {
+    .nkeys = 1000000,
+    .threads = { 1, { 1 } },
+    .shards = { 1, { 4096 } },
+    .loadfactors = { 1, { 75 } },
+    .keysizes = { 1, { 16 } },
+    .valsizes = { 1, { 32 } },
+    .sixpack = { 1, { 1 } },
+    .cas = { 1, { 0 } },
+    .ttl = POGOCACHE_SECOND,
+};
+
+// The current configuration.
+struct config {
+    int threads;
+    int shards;
+    int loadfactor;
+    int keysize;
+    int valsize;
+    bool sixpack;
+    bool cas;
+};
+
+static int64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+static __thread uint64_t yields;
+
+static void yield(void *udata) {
+    (void)udata;
+    yields++;
+}
+
+enum op { STORE, LOAD, ITER, SWEEP, DELETE, NOPS };
+
+static const char *opnames[] = { "store", "load", "iter", "sweep", "delete" };
+
+struct worker {
+    pthread_t th;
+    int id;
+    struct pogocache *cache;
+    const struct config *cfg;
+    pthread_barrier_t *barrier;
+    enum op op;
+    int64_t count;      // operations done
+    uint64_t yields;
+    uint64_t rng;
+    char *val;
+    char *out;          // load destination
+    int64_t sweeptime;
+};
+
+// Write key i into buf, padded to keysize with sixpack-friendly chars.
+static void makekey(char *buf, int keysize, int64_t i) {
+    memset(buf, 'k', keysize);
+    for (int j = keysize-1; j >= 0 && (i > 0 || j == keysize-1); j--) {
+        buf[j] = '0'+i%10;
+        i /= 10;
+    }
+}
+
+static uint64_t rng_next(uint64_t *s) {
+    uint64_t z = (*s += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+static void load_entry(int shard, int64_t time, const void *key,
+    size_t keylen, const void *value, size_t valuelen, int64_t expires,
+    uint32_t flags, uint64_t cas, struct pogocache_update **update,
+    void *udata)
+{
+    (void)shard, (void)time, (void)key, (void)keylen, (void)expires;
+    (void)flags, (void)cas, (void)update;
+    memcpy(udata, value, valuelen);
+}
+
+static int iter_entry(int shard, int64_t time, const void *key,
+    size_t keylen, const void *value, size_t valuelen, int64_t expires,
+    uint32_t flags, uint64_t cas, void *udata)
+{
+    (void)shard, (void)time, (void)key, (void)keylen, (void)value;
+    (void)valuelen, (void)expires, (void)flags, (void)cas;
+    (*(int64_t*)udata)++;
+    return POGOCACHE_ITER_CONTINUE;
+}
+
+static void *worker_run(void *arg) {
+    struct worker *w = arg;
+    const struct config *cfg = w->cfg;
+    int64_t start = opts.nkeys*w->id/cfg->threads;
+    int64_t end = opts.nkeys*(w->id+1)/cfg->threads;
+    int nshards = pogocache_nshards(w->cache);
+    int shardstart = nshards*w->id/cfg->threads;
+    int shardend = nshards*(w->id+1)/cfg->threads;
+    char key[256];
+    yields = 0;
+    w->count = 0;
+    pthread_barrier_wait(w->barrier);
+    switch (w->op) {
+    case STORE:
+        for (int64_t i = start; i < end; i++) {
+            makekey(key, cfg->keysize, i);
+            struct pogocache_store_opts sopts = { 0 };
+            if ((int)(rng_next(&w->rng)%100) < opts.ttlpct) {
+                sopts.ttl = opts.ttl;
+            }
+            pogocache_store(w->cache, key, cfg->keysize, w->val,
+                cfg->valsize, &sopts);
+        }
+        w->count = end-start;
+        break;
+    case LOAD: {
+        struct pogocache_load_opts lopts = {
+            .entry = load_entry,
+            .udata = w->out,
+        };
+        for (int64_t i = start; i < end; i++) {
+            // Random order so the cache lines aren't warm.
+            int64_t k = start+rng_next(&w->rng)%(end-start);
+            makekey(key, cfg->keysize, k);
+            pogocache_load(w->cache, key, cfg->keysize, &lopts);
+        }
+        w->count = end-start;
+        break;
+    }
+    case ITER:
+        for (int i = shardstart; i < shardend; i++) {
+            struct pogocache_iter_opts iopts = {
+                .oneshard = true,
+                .oneshardidx = i,
+                .entry = iter_entry,
+                .udata = &w->count,
+            };
+            pogocache_iter(w->cache, &iopts);
+        }
+        break;
+    case SWEEP:
+        for (int i = shardstart; i < shardend; i++) {
+            struct pogocache_sweep_opts sopts = {
+                .time = w->sweeptime,
+                .oneshard = true,
+                .oneshardidx = i,
+            };
+            size_t swept, kept;
+            pogocache_sweep(w->cache, &swept, &kept, &sopts);
+            w->count += swept+kept;
+        }
+        break;
+    case DELETE:
+        for (int64_t i = start; i < end; i++) {
+            makekey(key, cfg->keysize, i);
+            pogocache_delete(w->cache, key, cfg->keysize, 0);
+        }
+        w->count = end-start;
+        break;
+    default:
+        break;
+    }
+    w->yields = yields;
+    return 0;
+}
+
+static void print_result(const struct config *cfg, enum op op, int64_t count,
+    int64_t elapsed, double bytesperkey, uint64_t nyields)
+{
+    double opsec = elapsed > 0 ? count/(elapsed/1e9) : 0;
+    double nsop = count > 0 ? (double)elapsed/count : 0;
+    const char *label = opts.label ? opts.label : "";
+    if (opts.json) {
+        printf("{\"label\":\"%s\",\"threads\":%d,\"shards\":%d,"
+            "\"loadfactor\":%d,\"keysize\":%d,\"valsize\":%d,"
+            "\"sixpack\":%s,\"cas\":%s,\"ttlpct\":%d,\"op\":\"%s\","
+            "\"ops\":%" PRId64 ",\"ops_per_sec\":%.0f,\"ns_per_op\":%.1f,"
+            "\"bytes_per_key\":%.1f,\"yields\":%" PRIu64 "}\n",
+            label, cfg->threads, cfg->shards, cfg->loadfactor, cfg->keysize,
+            cfg->valsize, cfg->sixpack ? "true" : "false",
+            cfg->cas ? "true" : "false", opts.ttlpct, opnames[op], count,
+            opsec, nsop, bytesperkey, nyields);
+    } else {
+        printf("%-8s %3d %6d %3d %4d %6d %-3s %-3s %3d%% %-6s %12.0f %9.1f "
+            "%9.1f %10" PRIu64 "\n", label, cfg->threads, cfg->shards,
+            cfg->loadfactor, cfg->keysize, cfg->valsize,
+            cfg->sixpack ? "yes" : "no", cfg->cas ? "yes" : "no",
+            opts.ttlpct, opnames[op], opsec, nsop, bytesperkey, nyields);
+    }
+    fflush(stdout);
+}
+
+static void run(const struct config *cfg) {
+    struct pogocache_opts popts = {
+        .yield = yield,
+        .usecas = cfg->cas,
+        .nosixpack = !cfg->sixpack,
+        .nshards = cfg->shards,
+        .loadfactor = cfg->loadfactor,
+    };
+    struct pogocache *cache = pogocache_new(&popts);
+    if (!cache) {
+        fprintf(stderr, "# pogocache_new failed\n");
+        exit(1);
+    }
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, 0, cfg->threads+1);
+    struct worker *workers = calloc(cfg->threads, sizeof(struct worker));
+    if (!workers) {
+        abort();
+    }
+    for (int i = 0; i < cfg->threads; i++) {
+        workers[i].id = i;
+        workers[i].cache = cache;
+        workers[i].cfg = cfg;
+        workers[i].barrier = &barrier;
+        workers[i].rng = i+1;
+        workers[i].val = malloc(cfg->valsize+1);
+        workers[i].out = malloc(cfg->valsize+1);
+        memset(workers[i].val, 'v', cfg->valsize);
+    }
+    // Expire everything with a ttl for the sweep.
+    int64_t sweeptime = pogocache_now()+opts.ttl+POGOCACHE_SECOND*3600;
+    for (int op = 0; op < NOPS; op++) {
+        for (int i = 0; i < cfg->threads; i++) {
+            workers[i].op = op;
+            workers[i].sweeptime = sweeptime;
+            pthread_create(&workers[i].th, 0, worker_run, &workers[i]);
+        }
+        pthread_barrier_wait(&barrier);
+        int64_t start = now();
+        int64_t count = 0;
+        uint64_t nyields = 0;
+        for (int i = 0; i < cfg->threads; i++) {
+            pthread_join(workers[i].th, 0);
+            count += workers[i].count;
+            nyields += workers[i].yields;
+        }
+        int64_t elapsed = now()-start;
+        size_t nentries = pogocache_count(cache, 0);
+        double bytesperkey = nentries ?
+            (double)pogocache_size(cache, 0)/nentries : 0;
+        print_result(cfg, op, count, elapsed, bytesperkey, nyields);
+    }
+    for (int i = 0; i < cfg->threads; i++) {
+        free(workers[i].val);
+        free(workers[i].out);
+    }
+    free(workers);
+    pthread_barrier_destroy(&barrier);
+    pogocache_free(cache);
+}
+
+static void usage(void) {
+    fprintf(stderr,
+"Usage: enginebench [options]\n"
+"\n"
+"Options that take a list run every value, e.g. '-t 1,2,4,8'.\n"
+"\n"
+"  -n keys                 keys per run             (default: 1000000)\n"
+"  -t list                 threads                  (default: 1)\n"
+"  --shards list           number of shards         (default: 4096)\n"
+"  --loadfactor list       hashmap load factor      (default: 75)\n"
+"  --keysize list          key size in bytes        (default: 16)\n"
+"  --valsize list          value size in bytes      (default: 32)\n"
+"  --sixpack yes/no/both   sixpack compress keys    (default: yes)\n"
+"  --cas yes/no/both       use compare and store    (default: no)\n"
+"  --ttlpct percent        keys stored with a ttl   (default: 0)\n"
+"  --ttl ms                the ttl                  (default: 1000)\n"
+"  --label name            tag each result line\n"
+"  --json                  print JSON lines\n"
+    );
+    exit(1);
+}
+
+static void parse_list(const char *s, struct list *list, int64_t min) {
+    list->n = 0;
+    while (*s) {
+        char *end;
+        long long x = strtoll(s, &end, 10);
+        if (end == s || x < min || list->n == MAXLIST ||
+            (*end != ',' && *end != '\0'))
+        {
+            usage();
+        }
+        list->vals[list->n++] = x;
+        s = *end == ',' ? end+1 : end;
+    }
+    if (list->n == 0) {
+        usage();
+    }
+}
+
+static void parse_yesno(const char *s, struct list *list) {
+    if (strcmp(s, "yes") == 0) {
+        *list = (struct list){ 1, { 1 } };
+    } else if (strcmp(s, "no") == 0) {
+        *list = (struct list){ 1, { 0 } };
+    } else if (strcmp(s, "both") == 0) {
+        *list = (struct list){ 2, { 0, 1 } };
+    } else {
+        usage();
+    }
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (strcmp(a, "--json") == 0) {
+            opts.json = true;
+            continue;
+        }
+        if (i+1 == argc) {
+            usage();
+        }
+        const char *v = argv[++i];
+        struct list one;
+        if (strcmp(a, "-n") == 0) {
+            parse_list(v, &one, 1);
+            opts.nkeys = one.vals[0];
+        } else if (strcmp(a, "-t") == 0) {
+            parse_list(v, &opts.threads, 1);
+        } else if (strcmp(a, "--shards") == 0) {
+            parse_list(v, &opts.shards, 1);
+        } else if (strcmp(a, "--loadfactor") == 0) {
+            parse_list(v, &opts.loadfactors, 55);
+        } else if (strcmp(a, "--keysize") == 0) {
+            parse_list(v, &opts.keysizes, 1);
+        } else if (strcmp(a, "--valsize") == 0) {
+            parse_list(v, &opts.valsizes, 0);
+        } else if (strcmp(a, "--sixpack") == 0) {
+            parse_yesno(v, &opts.sixpack);
+        } else if (strcmp(a, "--cas") == 0) {
+            parse_yesno(v, &opts.cas);
+        } else if (strcmp(a, "--ttlpct") == 0) {
+            parse_list(v, &one, 0);
+            opts.ttlpct = one.vals[0] > 100 ? 100 : one.vals[0];
+        } else if (strcmp(a, "--ttl") == 0) {
+            parse_list(v, &one, 1);
+            opts.ttl = one.vals[0]*POGOCACHE_MILLISECOND;
+        } else if (strcmp(a, "--label") == 0) {
+            opts.label = v;
+        } else {
+            usage();
+        }
+    }
+    // Keys must be long enough to hold every index.
+    int digits = snprintf(0, 0, "%" PRId64, opts.nkeys);
+    for (int i = 0; i < opts.keysizes.n; i++) {
+        if (opts.keysizes.vals[i] < digits || opts.keysizes.vals[i] > 255) {
+            fprintf(stderr, "# keysize must be %d to 255 for %" PRId64
+                " keys\n", digits, opts.nkeys);
+            return 1;
+        }
+    }
+    if (!opts.json) {
+        printf("%-8s %3s %6s %3s %4s %6s %-3s %-3s %4s %-6s %12s %9s %9s "
+            "%10s\n", "label", "thr", "shards", "lf", "key", "val", "six",
+            "cas", "ttl", "op", "ops/sec", "ns/op", "bytes/key", "yields");
+    }
+    struct config cfg;
+    for (int a = 0; a < opts.threads.n; a++)
+    for (int b = 0; b < opts.shards.n; b++)
+    for (int c = 0; c < opts.loadfactors.n; c++)
+    for (int d = 0; d < opts.keysizes.n; d++)
+    for (int e = 0; e < opts.valsizes.n; e++)
+    for (int f = 0; f < opts.sixpack.n; f++)
+    for (int g = 0; g < opts.cas.n; g++) {
+        cfg.threads = opts.threads.vals[a];
+        cfg.shards = opts.shards.vals[b];
+        cfg.loadfactor = opts.loadfactors.vals[c];
+        cfg.keysize = opts.keysizes.vals[d];
+        cfg.valsize = opts.valsizes.vals[e];
+        cfg.sixpack = opts.sixpack.vals[f];
+        cfg.cas = opts.cas.vals[g];
+        run(&cfg);
+    }
+    return 0;
+}
@@ -0,0 +1,645 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Program evictsim runs a key access trace through the eviction code of
+// pogocache.c under a range of memory budgets and prints the hit ratio at
+// each, to help pick --maxmemory.
+//
+// The trace is either a DEBUG CAPTURE file or a synthetic zipfian stream.
+// GET, MGET and their variants are lookups, SET and SETEX are stores and
+// DEL is a delete. With --fill, which is the default, a missed lookup
+// stores the key as a look-aside cache would, sized by the last SET of that
+// key or --valsize.
+//
+// The 'engine' policy is pogocache.c itself. Memory is counted through the
+// pogocache_opts malloc and free functions, and every store made while the
+// count is over the budget is flagged lowmem, the same as the server does
+// when its RSS is over --maxmemory, so it goes through auto_evict_entry.
+// The 'lru' policy is an exact LRU over the same budget, with entries sized
+// as their key and value plus the engine's average overhead per entry, as a
+// reference for how close the engine gets.
+//
+//   ./evictsim trace.cap
+//   ./evictsim --zipf 1000000:0.99:10000000 --valsize 200 --points 20
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <malloc.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pogocache.h"
+#include "trace.h"
+
+#define MAXLIST 64
+
+enum kind { LOOKUP, STORE, DELETE };
+
+struct op {
+    uint32_t key;
+    uint8_t kind;
+    uint32_t vallen;    // stored size, or the fill size of a lookup
+    int64_t time;       // microseconds
+    int64_t ttl;        // nanoseconds, zero for none
+};
+
+struct key {
+    const char *data;
+    uint32_t len;
+};
+
+static struct {
+    const char *path;
+    int64_t zipfkeys;
+    double zipftheta;
+    int64_t zipfops;
+    int64_t valsize;
+    bool fill;
+    int shards;
+    int points;
+    double sizes[MAXLIST];      // megabytes
+    int nsizes;
+    bool engine;
+    bool lru;
+    bool json;
+} opts = {
+    .valsize = 100,
+    .fill = true,
+    .shards = 256,
+    .points = 10,
+    .engine = true,
+    .lru = true,
+};
+
+static struct op *ops;
+static size_t nops;
+static struct key *keys;
+static size_t nkeys;
+
+////////////////////////////////////////////////////////////////////////////
+// key interning
+////////////////////////////////////////////////////////////////////////////
+
+static uint32_t *table;     // key index+1, zero for empty
+static size_t tablecap;
+static size_t keyscap;
+
+static uint64_t hashkey(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint64_t h = 0xCBF29CE484222325;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001B3;
+    }
+    return h;
+}
+
+static void *xrealloc(void *ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (!ptr) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void table_grow(void) {
+    size_t ncap = tablecap == 0 ? 1024 : tablecap*2;
+    uint32_t *ntable = calloc(ncap, sizeof(uint32_t));
+    if (!ntable) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < nkeys; i++) {
+        size_t j = hashkey(keys[i].data, keys[i].len)&(ncap-1);
+        while (ntable[j]) {
+            j = (j+1)&(ncap-1);
+        }
+        ntable[j] = i+1;
+    }
+    free(table);
+    table = ntable;
+    tablecap = ncap;
+}
+
+// Returns the index of the key, adding it if it's new. The key data must
+// outlive the simulation.
+static uint32_t intern(const void *data, size_t len) {
+    if (nkeys*2 >= tablecap) {
+        table_grow();
+    }
+    size_t j = hashkey(data, len)&(tablecap-1);
+    while (table[j]) {
+        struct key *k = &keys[table[j]-1];
+        if (k->len == len && memcmp(k->data, data, len) == 0) {
+            return table[j]-1;
+        }
+        j = (j+1)&(tablecap-1);
+    }
+    if (nkeys == keyscap) {
+        keyscap = keyscap == 0 ? 1024 : keyscap*2;
+        keys = xrealloc(keys, keyscap*sizeof(struct key));
+    }
+    keys[nkeys] = (struct key){ data, len };
+    table[j] = nkeys+1;
+    return nkeys++;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// trace loading
+////////////////////////////////////////////////////////////////////////////
+
+static size_t opscap;
+static uint32_t *lastsize;      // last stored size per key, for fills
+static size_t lastsizecap;
+
+static void add_op(enum kind kind, uint32_t key, uint32_t vallen, int64_t time,
+    int64_t ttl)
+{
+    if (nops == opscap) {
+        opscap = opscap == 0 ? 4096 : opscap*2;
+        ops = xrealloc(ops, opscap*sizeof(struct op));
+    }
+    if (key >= lastsizecap) {
+        size_t ncap = lastsizecap == 0 ? 1024 : lastsizecap;
+        while (ncap <= key) {
+            ncap *= 2;
+        }
+        lastsize = xrealloc(lastsize, ncap*sizeof(uint32_t));
+        memset(lastsize+lastsizecap, 0, (ncap-lastsizecap)*sizeof(uint32_t));
+        lastsizecap = ncap;
+    }
+    if (kind == STORE) {
+        lastsize[key] = vallen;
+    } else if (kind == LOOKUP) {
+        vallen = lastsize[key] ? lastsize[key] : opts.valsize;
+    }
+    ops[nops++] = (struct op){ key, kind, vallen, time, ttl };
+}
+
+static bool argnum(const struct trace_arg *arg, int64_t *x) {
+    if (!arg->data || arg->len == 0 || arg->len > 18) {
+        return false;
+    }
+    char buf[20];
+    memcpy(buf, arg->data, arg->len);
+    buf[arg->len] = '\0';
+    char *end;
+    *x = strtoll(buf, &end, 10);
+    return *end == '\0';
+}
+
+static bool argeq(const struct trace_arg *arg, const char *s) {
+    size_t n = strlen(s);
+    if (!arg->data || arg->len != n) {
+        return false;
+    }
+    return strncasecmp((const char*)arg->data, s, n) == 0;
+}
+
+static uint64_t load_trace(void) {
+    static struct trace trace;
+    static struct trace_rec rec;
+    if (!trace_open(&trace, opts.path)) {
+        exit(1);
+    }
+    uint64_t other = 0;
+    while (trace_next(&trace, &rec)) {
+        struct trace_arg *a = rec.args;
+        if ((trace_cmdeq(&rec, "get") || trace_cmdeq(&rec, "mget") ||
+            trace_cmdeq(&rec, "mgets")) && rec.nargs >= 2)
+        {
+            for (int i = 1; i < rec.nargs; i++) {
+                add_op(LOOKUP, intern(a[i].data, a[i].len), 0, rec.time, 0);
+            }
+        } else if (trace_cmdeq(&rec, "set") && rec.nargs >= 3) {
+            int64_t ttl = 0;
+            for (int i = 3; i+1 < rec.nargs; i++) {
+                int64_t x;
+                if (argeq(&a[i], "ex") && argnum(&a[i+1], &x)) {
+                    ttl = x*POGOCACHE_SECOND;
+                } else if (argeq(&a[i], "px") && argnum(&a[i+1], &x)) {
+                    ttl = x*POGOCACHE_MILLISECOND;
+                }
+            }
+            add_op(STORE, intern(a[1].data, a[1].len), a[2].len, rec.time,
+                ttl);
+        } else if (trace_cmdeq(&rec, "setex") && rec.nargs == 4) {
+            int64_t x = 0;
+            argnum(&a[2], &x);
+            add_op(STORE, intern(a[1].data, a[1].len), a[3].len, rec.time,
+                x*POGOCACHE_SECOND);
+        } else if (trace_cmdeq(&rec, "del") && rec.nargs >= 2) {
+            for (int i = 1; i < rec.nargs; i++) {
+                add_op(DELETE, intern(a[i].data, a[i].len), 0, rec.time, 0);
+            }
+        } else {
+            other++;
+        }
+    }
+    // The key data points into the trace, which stays loaded.
+    return other;
+}
+
+// Zipfian keys, from "Quickly Generating Billion-Record Synthetic
+// Databases" by Gray et al., scattered over the keyspace.
+static void gen_zipf(void) {
+    uint64_t n = opts.zipfkeys;
+    double theta = opts.zipftheta;
+    double zeta2 = 1+pow(0.5, theta);
+    double zetan = 0;
+    for (uint64_t i = 1; i <= n; i++) {
+        zetan += 1/pow((double)i, theta);
+    }
+    double alpha = 1/(1-theta);
+    double eta = (1-pow(2.0/n, 1-theta))/(1-zeta2/zetan);
+    char *names = xrealloc(0, n*24);
+    for (uint64_t i = 0; i < n; i++) {
+        int len = snprintf(names+i*24, 24, "k%010" PRIu64, i);
+        intern(names+i*24, len);
+    }
+    uint64_t rng = 0x9E3779B97F4A7C15;
+    for (int64_t i = 0; i < opts.zipfops; i++) {
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+        double u = (rng>>11)*(1.0/9007199254740992.0);
+        double uz = u*zetan;
+        uint64_t rank;
+        if (uz < 1) {
+            rank = 0;
+        } else if (uz < zeta2) {
+            rank = 1;
+        } else {
+            rank = (uint64_t)(n*pow(eta*u-eta+1, alpha));
+            rank = rank < n ? rank : n-1;
+        }
+        uint64_t key = (rank*0x9E3779B97F4A7C15)%n;
+        add_op(LOOKUP, key, 0, i, 0);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+// engine policy
+////////////////////////////////////////////////////////////////////////////
+
+static int64_t allocated = 0;
+static uint64_t evictions = 0;
+
+static void *sim_malloc(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr) {
+        allocated += malloc_usable_size(ptr);
+    }
+    return ptr;
+}
+
+static void sim_free(void *ptr) {
+    if (ptr) {
+        allocated -= malloc_usable_size(ptr);
+        free(ptr);
+    }
+}
+
+static void sim_evicted(int shard, int reason, int64_t time, const void *key,
+    size_t keylen, const void *value, size_t valuelen, int64_t expires,
+    uint32_t flags, uint64_t cas, void *udata)
+{
+    (void)shard, (void)time, (void)key, (void)keylen, (void)value;
+    (void)valuelen, (void)expires, (void)flags, (void)cas, (void)udata;
+    evictions += reason == POGOCACHE_REASON_LOWMEM;
+}
+
+struct result {
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t evictions;
+    int64_t base;           // bytes used by the empty cache
+    int64_t peak;           // bytes
+    int64_t used;           // bytes at the end
+    size_t count;           // entries at the end
+    size_t kvbytes;         // key and value bytes at the end
+};
+
+static char zeros[1<<20];
+
+// Trace time starts at zero, so shift it past the engine's own epoch.
+#define TIMEBASE POGOCACHE_HOUR
+
+static size_t kvsum;
+
+static int sum_entry(int shard, int64_t time, const void *key, size_t keylen,
+    const void *val, size_t vallen, int64_t expires, uint32_t flags,
+    uint64_t cas, void *udata)
+{
+    (void)shard, (void)time, (void)key, (void)val, (void)expires;
+    (void)flags, (void)cas, (void)udata;
+    kvsum += keylen+vallen;
+    return POGOCACHE_ITER_CONTINUE;
+}
+
+// Runs the ops through the engine. A budget of zero is unlimited.
+static struct result run_engine(int64_t budget) {
+    struct result res = { 0 };
+    allocated = 0;
+    evictions = 0;
+    struct pogocache_opts popts = {
+        .malloc = sim_malloc,
+        .free = sim_free,
+        .evicted = sim_evicted,
+        .nshards = opts.shards,
+    };
+    struct pogocache *cache = pogocache_new(&popts);
+    if (!cache) {
+        fprintf(stderr, "pogocache_new failed\n");
+        exit(1);
+    }
+    res.base = allocated;
+    for (size_t i = 0; i < nops; i++) {
+        struct op *op = &ops[i];
+        struct key *key = &keys[op->key];
+        int64_t time = TIMEBASE+op->time*POGOCACHE_MICROSECOND;
+        bool store = op->kind == STORE;
+        if (op->kind == LOOKUP) {
+            res.lookups++;
+            struct pogocache_load_opts lopts = { .time = time };
+            if (pogocache_load(cache, key->data, key->len, &lopts) ==
+                POGOCACHE_FOUND)
+            {
+                res.hits++;
+            } else {
+                store = opts.fill;
+            }
+        } else if (op->kind == DELETE) {
+            struct pogocache_delete_opts dopts = { .time = time };
+            pogocache_delete(cache, key->data, key->len, &dopts);
+        }
+        if (store) {
+            struct pogocache_store_opts sopts = {
+                .time = time,
+                .ttl = op->ttl,
+                .lowmem = budget > 0 && allocated > budget,
+            };
+            size_t vallen = op->vallen < sizeof(zeros) ? op->vallen :
+                sizeof(zeros);
+            pogocache_store(cache, key->data, key->len, zeros, vallen,
+                &sopts);
+        }
+        if (allocated > res.peak) {
+            res.peak = allocated;
+        }
+    }
+    res.evictions = evictions;
+    res.used = allocated;
+    res.count = pogocache_count(cache, 0);
+    kvsum = 0;
+    struct pogocache_iter_opts iopts = { .entry = sum_entry };
+    pogocache_iter(cache, &iopts);
+    res.kvbytes = kvsum;
+    pogocache_free(cache);
+    return res;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// exact lru policy
+////////////////////////////////////////////////////////////////////////////
+
+#define NIL UINT32_MAX
+
+struct lruent {
+    uint32_t prev;
+    uint32_t next;
+    uint32_t size;      // zero when not cached
+    int64_t expires;    // microseconds, zero for none
+};
+
+struct lru {
+    struct lruent *ents;
+    uint32_t head;      // most recent
+    uint32_t tail;
+    int64_t used;
+};
+
+static void lru_remove(struct lru *lru, uint32_t k) {
+    struct lruent *e = &lru->ents[k];
+    if (e->prev != NIL) {
+        lru->ents[e->prev].next = e->next;
+    } else {
+        lru->head = e->next;
+    }
+    if (e->next != NIL) {
+        lru->ents[e->next].prev = e->prev;
+    } else {
+        lru->tail = e->prev;
+    }
+    lru->used -= e->size;
+    e->size = 0;
+}
+
+static void lru_push(struct lru *lru, uint32_t k, uint32_t size) {
+    struct lruent *e = &lru->ents[k];
+    e->size = size;
+    e->prev = NIL;
+    e->next = lru->head;
+    if (lru->head != NIL) {
+        lru->ents[lru->head].prev = k;
+    } else {
+        lru->tail = k;
+    }
+    lru->head = k;
+    lru->used += size;
+}
+
+// Runs the ops through an exact LRU. Entries cost their key and value plus
+// 'overhead' bytes.
+static struct result run_lru(int64_t budget, double overhead) {
+    struct result res = { 0 };
+    struct lru lru = { .head = NIL, .tail = NIL };
+    lru.ents = calloc(nkeys, sizeof(struct lruent));
+    if (!lru.ents) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < nops; i++) {
+        struct op *op = &ops[i];
+        struct lruent *e = &lru.ents[op->key];
+        if (e->size && e->expires && e->expires <= op->time) {
+            lru_remove(&lru, op->key);
+        }
+        bool store = op->kind == STORE;
+        if (op->kind == LOOKUP) {
+            res.lookups++;
+            if (e->size) {
+                res.hits++;
+                uint32_t size = e->size;
+                lru_remove(&lru, op->key);
+                lru_push(&lru, op->key, size);
+                continue;
+            }
+            store = opts.fill;
+        } else if (op->kind == DELETE && e->size) {
+            lru_remove(&lru, op->key);
+        }
+        if (!store) {
+            continue;
+        }
+        if (e->size) {
+            lru_remove(&lru, op->key);
+        }
+        e->expires = op->ttl ? op->time+op->ttl/POGOCACHE_MICROSECOND : 0;
+        lru_push(&lru, op->key, keys[op->key].len+op->vallen+
+            (uint32_t)overhead);
+        while (budget > 0 && lru.used > budget && lru.tail != lru.head) {
+            lru_remove(&lru, lru.tail);
+            res.evictions++;
+        }
+        if (lru.used > res.peak) {
+            res.peak = lru.used;
+        }
+    }
+    free(lru.ents);
+    return res;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// main
+////////////////////////////////////////////////////////////////////////////
+
+static void print_result(const char *policy, int64_t budget, double pct,
+    const struct result *res)
+{
+    double ratio = res->lookups ? (double)res->hits/res->lookups : 0;
+    if (opts.json) {
+        printf("{\"policy\":\"%s\",\"budget_mb\":%.3f,\"budget_pct\":%.1f,"
+            "\"lookups\":%" PRIu64 ",\"hits\":%" PRIu64 ","
+            "\"hit_ratio\":%.4f,\"evictions\":%" PRIu64 "}\n", policy,
+            budget/1048576.0, pct, res->lookups, res->hits, ratio,
+            res->evictions);
+    } else {
+        printf("%-7s %10.2f MB %6.1f%% %12" PRIu64 " lookups  %7.3f%% hits "
+            "%12" PRIu64 " evictions\n", policy, budget/1048576.0, pct,
+            res->lookups, ratio*100, res->evictions);
+    }
+    fflush(stdout);
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: evictsim [options] [trace]\n"
+        "  --zipf keys:theta:ops  synthetic lookups instead of a trace\n"
+        "  --valsize n            size of values with no SET (default: 100)\n"
+        "  --fill yes/no          store missed lookups (default: yes)\n"
+        "  --shards n             engine shards (default: 256)\n"
+        "  --points n             budgets as 1/n steps of the footprint\n"
+        "                         (default: 10)\n"
+        "  --sizes list           budgets in MB, instead of --points\n"
+        "  --policy list          engine,lru (default: both)\n"
+        "  --json                 print one JSON object per line\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i+1 < argc ? argv[i+1] : 0;
+        if (strcmp(arg, "--json") == 0) {
+            opts.json = true;
+        } else if (arg[0] != '-') {
+            opts.path = arg;
+        } else if (!val) {
+            usage();
+        } else if (strcmp(arg, "--zipf") == 0) {
+            if (sscanf(val, "%" SCNi64 ":%lf:%" SCNi64, &opts.zipfkeys,
+                &opts.zipftheta, &opts.zipfops) != 3 || opts.zipfkeys < 2 ||
+                !(opts.zipftheta > 0 && opts.zipftheta < 1) ||
+                opts.zipfops < 1)
+            {
+                usage();
+            }
+            i++;
+        } else if (strcmp(arg, "--valsize") == 0) {
+            opts.valsize = atoll(val); i++;
+        } else if (strcmp(arg, "--fill") == 0) {
+            opts.fill = strcmp(val, "yes") == 0; i++;
+        } else if (strcmp(arg, "--shards") == 0) {
+            opts.shards = atoi(val); i++;
+        } else if (strcmp(arg, "--points") == 0) {
+            opts.points = atoi(val); i++;
+        } else if (strcmp(arg, "--sizes") == 0) {
+            const char *s = val;
+            while (*s && opts.nsizes < MAXLIST) {
+                char *end;
+                opts.sizes[opts.nsizes++] = strtod(s, &end);
+                s = *end == ',' ? end+1 : end;
+            }
+            i++;
+        } else if (strcmp(arg, "--policy") == 0) {
+            opts.engine = strstr(val, "engine") != 0;
+            opts.lru = strstr(val, "lru") != 0;
+            i++;
+        } else {
+            usage();
+        }
+    }
+    if ((!opts.path) == (!opts.zipfkeys) || opts.points < 1 ||
+        opts.shards < 1 || opts.valsize < 0)
+    {
+        usage();
+    }
+    uint64_t other = 0;
+    if (opts.path) {
+        other = load_trace();
+    } else {
+        gen_zipf();
+    }
+    if (nops == 0) {
+        fprintf(stderr, "no lookups, stores or deletes in the trace\n");
+        return 1;
+    }
+    // An unlimited run gives the footprint the budgets are relative to,
+    // and the engine's overhead per entry for the lru policy.
+    struct result full = run_engine(0);
+    double overhead = full.count ? (double)(full.used-full.base-
+        (int64_t)full.kvbytes)/full.count : 0;
+    overhead = overhead < 0 ? 0 : overhead;
+    if (!opts.json) {
+        printf("%zu ops over %zu keys (%" PRIu64 " other commands skipped)\n",
+            nops, nkeys, other);
+        printf("footprint %.2f MB, %zu entries, %.0f bytes overhead per "
+            "entry, %.3f%% hits unlimited\n", full.peak/1048576.0,
+            full.count, overhead,
+            full.lookups ? 100.0*full.hits/full.lookups : 0);
+    }
+    int n = opts.nsizes > 0 ? opts.nsizes : opts.points;
+    for (int i = 0; i < n; i++) {
+        int64_t budget;
+        if (opts.nsizes > 0) {
+            budget = (int64_t)(opts.sizes[i]*1048576);
+        } else {
+            budget = full.peak*(i+1)/opts.points;
+        }
+        double pct = full.peak ? 100.0*budget/full.peak : 0;
+        if (opts.engine) {
+            struct result res = run_engine(budget);
+            print_result("engine", budget, pct, &res);
+        }
+        if (opts.lru) {
+            // The lru has no fixed cost, only entries.
+            struct result res = run_lru(budget-full.base, overhead);
+            print_result("lru", budget, pct, &res);
+        }
+    }
+    free(ops);
+    free(keys);
+    free(table);
+    free(lastsize);
+    return 0;
+}
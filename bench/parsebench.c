@@ -0,0 +1,433 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Program parsebench runs parse_command over recorded request streams and
+// reports the throughput of each wire protocol parser, along with the
+// number of xmalloc and xrealloc calls per command.
+//
+// A corpus is the raw bytes a client sends on one connection, so it can be
+// a capture of real traffic. The corpora in the corpus directory are made
+// by 'parsebench --record corpus'.
+//
+//   ./parsebench corpus/*.corpus
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "parse.h"
+#include "xmalloc.h"
+
+// The parsers are linked without the rest of the server. These stand in
+// for the flags and the connection and stats functions they reference.
+const char *version = "parsebench";
+const char *auth = "";
+const bool useauth = false;
+const bool usetrackallocs = true;
+const int useallocator = 0;
+
+bool conn_istls(struct conn *conn) { (void)conn; return false; }
+struct pg *conn_pg(struct conn *conn) { (void)conn; return 0; }
+const char *conn_password(struct conn *conn) { (void)conn; return ""; }
+void conn_setauth(struct conn *conn, bool authorized) {
+    (void)conn, (void)authorized;
+}
+void conn_write_error(struct conn *conn, const char *err) {
+    (void)conn, (void)err;
+}
+void conn_write_raw(struct conn *conn, const void *data, size_t len) {
+    (void)conn, (void)data, (void)len;
+}
+void conn_write_raw_cstr(struct conn *conn, const char *cstr) {
+    (void)conn, (void)cstr;
+}
+bool pg_execute(struct conn *conn) { (void)conn; return false; }
+void stat_store_too_large_incr(struct conn *conn) { (void)conn; }
+void stat_auth_cmds_incr(struct conn *conn) { (void)conn; }
+void stat_auth_errors_incr(struct conn *conn) { (void)conn; }
+
+static int64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+static const char *protoname(int proto) {
+    switch (proto) {
+    case PROTO_RESP:     return "resp";
+    case PROTO_MEMCACHE: return "memcache";
+    case PROTO_HTTP:     return "http";
+    case PROTO_POSTGRES: return "postgres";
+    default:             return "unknown";
+    }
+}
+
+struct result {
+    int proto;
+    size_t commands;    // per pass
+    size_t allocs;      // per pass
+};
+
+// Parse the whole corpus once, the way evdata does for one connection.
+// Returns false if the corpus has a protocol error.
+static bool pass(const char *data, size_t len, struct result *res) {
+    struct args args = { 0 };
+    struct pg *pg = 0;
+    int proto = 0;
+    bool noreply = false;
+    int httpvers = 0;
+    bool keepalive = false;
+    size_t commands = 0;
+    size_t allocs = xallocs_total();
+    bool ok = true;
+    while (len > 0) {
+        ssize_t n = parse_command(data, len, &args, &proto, &noreply,
+            &httpvers, &keepalive, &pg);
+        if (n <= 0) {
+            fprintf(stderr, "# %s\n", n == 0 ? "incomplete command" :
+                parse_lasterror());
+            ok = false;
+            break;
+        }
+        if (args.len > 0) {
+            commands++;
+        } else if (proto == PROTO_POSTGRES) {
+            pg_respond(0, pg);
+        }
+        data += n;
+        len -= n;
+    }
+    args_free(&args);
+    if (pg) {
+        pg_free(pg);
+    }
+    res->proto = proto;
+    res->commands = commands;
+    res->allocs = xallocs_total()-allocs;
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Corpus recording
+////////////////////////////////////////////////////////////////////////////
+
+#define NCOMMANDS 1000
+
+struct bbuf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+static void bbuf_append(struct bbuf *b, const void *data, size_t len) {
+    if (b->cap-b->len < len) {
+        while (b->cap-b->len < len) {
+            b->cap = b->cap == 0 ? 4096 : b->cap*2;
+        }
+        b->data = realloc(b->data, b->cap);
+        if (!b->data) {
+            abort();
+        }
+    }
+    memcpy(b->data+b->len, data, len);
+    b->len += len;
+}
+
+static void bbuf_cstr(struct bbuf *b, const char *cstr) {
+    bbuf_append(b, cstr, strlen(cstr));
+}
+
+static void bbuf_i16(struct bbuf *b, int x) {
+    uint8_t bytes[2] = { x>>8, x };
+    bbuf_append(b, bytes, 2);
+}
+
+static void bbuf_i32(struct bbuf *b, int32_t x) {
+    uint8_t bytes[4] = { x>>24, x>>16, x>>8, x };
+    bbuf_append(b, bytes, 4);
+}
+
+// Write the Postgres message length that starts at 'start'.
+static void pg_finish(struct bbuf *b, size_t start) {
+    int32_t size = b->len-start;
+    uint8_t bytes[4] = { size>>24, size>>16, size>>8, size };
+    memcpy(b->data+start, bytes, 4);
+}
+
+static void pg_begin(struct bbuf *b, char type, size_t *start) {
+    bbuf_append(b, &type, 1);
+    *start = b->len;
+    bbuf_i32(b, 0);
+}
+
+static uint64_t rng = 1;
+
+static uint64_t rand_next(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static void make_value(char *val, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        val[i] = 'a'+rand_next()%26;
+    }
+    val[len] = '\0';
+}
+
+// Pipelined GETs and SETs, one in ten a SET.
+static void record_resp(struct bbuf *b) {
+    char line[512];
+    char val[257];
+    for (int i = 0; i < NCOMMANDS; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "user:%" PRIu64, rand_next()%100000);
+        if (i%10 == 0) {
+            make_value(val, 32+rand_next()%225);
+            snprintf(line, sizeof(line),
+                "*3\r\n$3\r\nSET\r\n$%zu\r\n%s\r\n$%zu\r\n%s\r\n",
+                strlen(key), key, strlen(val), val);
+        } else {
+            snprintf(line, sizeof(line), "*2\r\n$3\r\nGET\r\n$%zu\r\n%s\r\n",
+                strlen(key), key);
+        }
+        bbuf_cstr(b, line);
+    }
+}
+
+// Multi-gets of 1 to 32 keys, one in ten commands a set.
+static void record_memcache(struct bbuf *b) {
+    char line[512];
+    char val[257];
+    for (int i = 0; i < NCOMMANDS; i++) {
+        if (i%10 == 0) {
+            make_value(val, 32+rand_next()%225);
+            snprintf(line, sizeof(line), "set user:%" PRIu64 " 0 0 %zu\r\n"
+                "%s\r\n", rand_next()%100000, strlen(val), val);
+            bbuf_cstr(b, line);
+            continue;
+        }
+        bbuf_cstr(b, "get");
+        int nkeys = 1+rand_next()%32;
+        for (int j = 0; j < nkeys; j++) {
+            snprintf(line, sizeof(line), " user:%" PRIu64,
+                rand_next()%100000);
+            bbuf_cstr(b, line);
+        }
+        bbuf_cstr(b, "\r\n");
+    }
+}
+
+// Requests with the headers a typical client library sends.
+static void record_http(struct bbuf *b) {
+    char line[1024];
+    char val[257];
+    for (int i = 0; i < NCOMMANDS; i++) {
+        uint64_t key = rand_next()%100000;
+        if (i%10 == 0) {
+            make_value(val, 32+rand_next()%225);
+            snprintf(line, sizeof(line),
+                "PUT /user:%" PRIu64 "?ttl=3600 HTTP/1.1\r\n"
+                "Host: localhost:9401\r\n"
+                "User-Agent: python-requests/2.31.0\r\n"
+                "Accept-Encoding: gzip, deflate\r\n"
+                "Accept: */*\r\n"
+                "Connection: keep-alive\r\n"
+                "Content-Type: text/plain\r\n"
+                "Content-Length: %zu\r\n"
+                "\r\n%s", key, strlen(val), val);
+        } else {
+            snprintf(line, sizeof(line),
+                "GET /user:%" PRIu64 " HTTP/1.1\r\n"
+                "Host: localhost:9401\r\n"
+                "User-Agent: Mozilla/5.0 (X11; Linux x86_64) "
+                "AppleWebKit/537.36 (KHTML, like Gecko) "
+                "Chrome/124.0.0.0 Safari/537.36\r\n"
+                "Accept: text/html,application/xhtml+xml,*/*;q=0.8\r\n"
+                "Accept-Language: en-US,en;q=0.9\r\n"
+                "Accept-Encoding: gzip, deflate, br\r\n"
+                "Cache-Control: no-cache\r\n"
+                "Connection: keep-alive\r\n"
+                "\r\n", key);
+        }
+        bbuf_cstr(b, line);
+    }
+}
+
+// A startup message followed by the extended query protocol, as sent by
+// drivers that use server-side parameters: Parse, Bind, Describe, Execute,
+// and Sync for every command.
+static void record_postgres(struct bbuf *b) {
+    size_t start;
+    bbuf_append(b, "\0\0\0\0", 4);
+    bbuf_i32(b, 0x00030000);
+    const char params[] = "user\0bench\0database\0bench\0"
+        "client_encoding\0UTF8\0application_name\0parsebench\0";
+    bbuf_append(b, params, sizeof(params));
+    pg_finish(b, 0);
+    char key[32];
+    char val[257];
+    for (int i = 0; i < NCOMMANDS; i++) {
+        bool set = i%10 == 0;
+        snprintf(key, sizeof(key), "user:%" PRIu64, rand_next()%100000);
+        pg_begin(b, 'P', &start);
+        bbuf_append(b, "", 1);
+        bbuf_cstr(b, set ? "SET $1 $2" : "GET $1");
+        bbuf_append(b, "", 1);
+        bbuf_i16(b, 0);
+        pg_finish(b, start);
+        pg_begin(b, 'B', &start);
+        bbuf_append(b, "", 1);
+        bbuf_append(b, "", 1);
+        bbuf_i16(b, 0);
+        bbuf_i16(b, set ? 2 : 1);
+        bbuf_i32(b, strlen(key));
+        bbuf_cstr(b, key);
+        if (set) {
+            make_value(val, 32+rand_next()%225);
+            bbuf_i32(b, strlen(val));
+            bbuf_cstr(b, val);
+        }
+        bbuf_i16(b, 0);
+        pg_finish(b, start);
+        pg_begin(b, 'D', &start);
+        bbuf_append(b, "P", 1);
+        bbuf_append(b, "", 1);
+        pg_finish(b, start);
+        pg_begin(b, 'E', &start);
+        bbuf_append(b, "", 1);
+        bbuf_i32(b, 0);
+        pg_finish(b, start);
+        pg_begin(b, 'S', &start);
+        pg_finish(b, start);
+    }
+}
+
+static void record(const char *dir) {
+    static const struct {
+        const char *name;
+        void (*record)(struct bbuf *b);
+    } corpora[] = {
+        { "resp", record_resp },
+        { "memcache", record_memcache },
+        { "http", record_http },
+        { "postgres", record_postgres },
+    };
+    for (size_t i = 0; i < sizeof(corpora)/sizeof(corpora[0]); i++) {
+        struct bbuf b = { 0 };
+        corpora[i].record(&b);
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s.corpus", dir, corpora[i].name);
+        FILE *f = fopen(path, "wb");
+        if (!f || fwrite(b.data, 1, b.len, f) != b.len || fclose(f)) {
+            perror(path);
+            exit(1);
+        }
+        fprintf(stderr, "# wrote %s (%zu bytes)\n", path, b.len);
+        free(b.data);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Main
+////////////////////////////////////////////////////////////////////////////
+
+static char *readfile(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    struct bbuf b = { 0 };
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        bbuf_append(&b, chunk, n);
+    }
+    fclose(f);
+    *len = b.len;
+    return b.data;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: parsebench [--time secs] [--json] corpus...\n"
+        "       parsebench --record dir\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    double secs = 1;
+    bool json = false;
+    int first = argc;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0 && i+1 < argc) {
+            record(argv[i+1]);
+            return 0;
+        } else if (strcmp(argv[i], "--time") == 0 && i+1 < argc) {
+            secs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (argv[i][0] == '-') {
+            usage();
+        } else {
+            first = i;
+            break;
+        }
+    }
+    if (first == argc) {
+        usage();
+    }
+    if (!json) {
+        printf("%-24s %-8s %9s %9s %10s %10s %11s\n", "corpus", "proto",
+            "bytes", "commands", "MB/sec", "ns/cmd", "allocs/cmd");
+    }
+    int status = 0;
+    for (int i = first; i < argc; i++) {
+        size_t len;
+        char *data = readfile(argv[i], &len);
+        struct result res;
+        // One pass to warm up and to check the corpus.
+        if (!pass(data, len, &res) || res.commands == 0) {
+            fprintf(stderr, "# %s: invalid corpus\n", argv[i]);
+            free(data);
+            status = 1;
+            continue;
+        }
+        int64_t passes = 0;
+        int64_t start = now();
+        int64_t elapsed;
+        do {
+            pass(data, len, &res);
+            passes++;
+            elapsed = now()-start;
+        } while (elapsed < secs*1e9);
+        double mbsec = (double)len*passes/(elapsed/1e9)/(1024*1024);
+        double nscmd = (double)elapsed/passes/res.commands;
+        double allocs = (double)res.allocs/res.commands;
+        if (json) {
+            printf("{\"corpus\":\"%s\",\"proto\":\"%s\",\"bytes\":%zu,"
+                "\"commands\":%zu,\"mb_per_sec\":%.1f,\"ns_per_cmd\":%.1f,"
+                "\"allocs_per_cmd\":%.2f}\n", argv[i], protoname(res.proto),
+                len, res.commands, mbsec, nscmd, allocs);
+        } else {
+            printf("%-24s %-8s %9zu %9zu %10.1f %10.1f %11.2f\n", argv[i],
+                protoname(res.proto), len, res.commands, mbsec, nscmd,
+                allocs);
+        }
+        free(data);
+    }
+    return status;
+}
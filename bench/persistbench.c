@@ -0,0 +1,726 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Program persistbench measures the save and load paths of a running
+// server. For each dataset shape it fills the cache with DEBUG POPULATE,
+// then for each thread count it runs SAVE and LOAD with THREADS, and last
+// it restarts the server with --persist to time a cold start.
+//
+// Each operation reports MB/s of the saved file, entries/s, the peak RSS
+// above what the server used before the operation started, and the GET
+// latency seen by a fixed-rate foreground client before and during it.
+//
+//   ./persistbench --server ../pogocache --shapes 1000000x16,100000x4096
+//   ./persistbench -t 1,2,4,0 --shapes 2000000x64:60-600 --json
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAXLIST 16
+
+struct shape {
+    int64_t count;
+    int64_t valsize;
+    int ttlmin;     // seconds, zero for no ttl
+    int ttlmax;
+};
+
+static struct {
+    const char *server;
+    int port;
+    const char *dir;
+    int nthreads[MAXLIST];      // zero means FAST
+    int nnthreads;
+    struct shape shapes[MAXLIST];
+    int nshapes;
+    int fgrate;                 // foreground GETs per second
+    int srvthreads;
+    bool restart;
+    bool json;
+} opts = {
+    .server = "../pogocache",
+    .port = 9480,
+    .dir = "/tmp",
+    .nthreads = { 1, 0 },
+    .nnthreads = 2,
+    .shapes = { { 1000000, 16, 0, 0 }, { 100000, 1024, 0, 0 } },
+    .nshapes = 2,
+    .fgrate = 2000,
+    .srvthreads = 0,
+    .restart = true,
+};
+
+static int64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*INT64_C(1000000000)+ts.tv_nsec;
+}
+
+static void sleepns(int64_t ns) {
+    if (ns <= 0) {
+        return;
+    }
+    struct timespec ts = { ns/1000000000, ns%1000000000 };
+    nanosleep(&ts, 0);
+}
+
+static void fatal(const char *msg) {
+    fprintf(stderr, "persistbench: %s\n", msg);
+    exit(1);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// server process
+////////////////////////////////////////////////////////////////////////////
+
+static pid_t srvpid = 0;
+
+static void server_kill(void) {
+    if (srvpid > 0) {
+        kill(srvpid, SIGKILL);
+        waitpid(srvpid, 0, 0);
+        srvpid = 0;
+    }
+}
+
+// Starts the server, with persist as the --persist file when not null. The
+// server output goes to persistbench.log.
+static void server_start(const char *persist) {
+    char port[16];
+    char threads[16];
+    snprintf(port, sizeof(port), "%d", opts.port);
+    snprintf(threads, sizeof(threads), "%d", opts.srvthreads);
+    const char *argv[16];
+    int argc = 0;
+    argv[argc++] = opts.server;
+    argv[argc++] = "-p";
+    argv[argc++] = port;
+    if (opts.srvthreads > 0) {
+        argv[argc++] = "--threads";
+        argv[argc++] = threads;
+    }
+    if (persist) {
+        argv[argc++] = "--persist";
+        argv[argc++] = persist;
+    }
+    argv[argc] = 0;
+    pid_t pid = fork();
+    if (pid == -1) {
+        fatal("fork failed");
+    }
+    if (pid == 0) {
+        FILE *f = fopen("persistbench.log", "a");
+        if (f) {
+            dup2(fileno(f), 1);
+            dup2(fileno(f), 2);
+        }
+        execv(opts.server, (char**)argv);
+        perror("execv");
+        _exit(1);
+    }
+    srvpid = pid;
+}
+
+// Returns the resident set size of the server in bytes.
+static int64_t server_rss(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)srvpid);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    char line[256];
+    int64_t rss = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "VmRSS:", 6) == 0) {
+            rss = strtoll(line+6, 0, 10)*1024;
+            break;
+        }
+    }
+    fclose(f);
+    return rss;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// RESP client
+////////////////////////////////////////////////////////////////////////////
+
+struct client {
+    int fd;
+    char buf[65536];
+    size_t len;
+    size_t pos;
+};
+
+static bool client_dial(struct client *c) {
+    memset(c, 0, sizeof(struct client));
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd == -1) {
+        return false;
+    }
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opts.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(c->fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        close(c->fd);
+        c->fd = -1;
+        return false;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return true;
+}
+
+static void client_close(struct client *c) {
+    if (c->fd != -1) {
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+static bool client_fill(struct client *c) {
+    if (c->pos > 0) {
+        memmove(c->buf, c->buf+c->pos, c->len-c->pos);
+        c->len -= c->pos;
+        c->pos = 0;
+    }
+    if (c->len == sizeof(c->buf)) {
+        return false;
+    }
+    ssize_t n = read(c->fd, c->buf+c->len, sizeof(c->buf)-c->len);
+    if (n <= 0) {
+        return false;
+    }
+    c->len += n;
+    return true;
+}
+
+// Reads one CRLF terminated line into line, without the CRLF.
+static bool client_line(struct client *c, char *line, size_t cap) {
+    while (1) {
+        char *s = c->buf+c->pos;
+        char *e = memmem(s, c->len-c->pos, "\r\n", 2);
+        if (e) {
+            size_t n = e-s;
+            if (n >= cap) {
+                n = cap-1;
+            }
+            memcpy(line, s, n);
+            line[n] = '\0';
+            c->pos += (e-s)+2;
+            return true;
+        }
+        if (!client_fill(c)) {
+            return false;
+        }
+    }
+}
+
+// Reads one reply. Integer replies are stored in ival, and an error reply
+// is returned as false with its message printed.
+static bool client_reply(struct client *c, int64_t *ival) {
+    char line[512];
+    if (!client_line(c, line, sizeof(line))) {
+        return false;
+    }
+    switch (line[0]) {
+    case '+':
+        return true;
+    case ':':
+        if (ival) {
+            *ival = strtoll(line+1, 0, 10);
+        }
+        return true;
+    case '$': {
+        int64_t n = strtoll(line+1, 0, 10);
+        if (n < 0) {
+            return true;
+        }
+        while (c->len-c->pos < (size_t)n+2) {
+            if (c->len == sizeof(c->buf) && c->pos == 0) {
+                // Larger than the buffer, discard what is there.
+                n -= c->len;
+                c->len = 0;
+            }
+            if (!client_fill(c)) {
+                return false;
+            }
+        }
+        c->pos += n+2;
+        return true;
+    }
+    case '*': {
+        int64_t n = strtoll(line+1, 0, 10);
+        for (int64_t i = 0; i < n; i++) {
+            if (!client_reply(c, 0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    default:
+        fprintf(stderr, "persistbench: server: %s\n", line);
+        return false;
+    }
+}
+
+// Sends a space separated command as an inline command and waits for the
+// reply.
+static bool client_do(struct client *c, int64_t *ival, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static bool client_do(struct client *c, int64_t *ival, const char *fmt, ...) {
+    char cmd[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(cmd, sizeof(cmd)-2, fmt, ap);
+    va_end(ap);
+    memcpy(cmd+n, "\r\n", 2);
+    n += 2;
+    if (write(c->fd, cmd, n) != n) {
+        return false;
+    }
+    return client_reply(c, ival);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// foreground load and rss sampling
+////////////////////////////////////////////////////////////////////////////
+
+enum phase { PHASE_NONE, PHASE_IDLE, PHASE_OP, NPHASES };
+
+struct samples {
+    int64_t *vals;
+    size_t len;
+    size_t cap;
+};
+
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static struct samples samples[NPHASES];
+static atomic_int phase = PHASE_NONE;
+static atomic_bool done = false;
+static atomic_int_least64_t peakrss = 0;
+static int64_t fgkeys = 1;
+
+static void samples_add(int ph, int64_t val) {
+    pthread_mutex_lock(&mu);
+    struct samples *s = &samples[ph];
+    if (s->len == s->cap) {
+        s->cap = s->cap == 0 ? 4096 : s->cap*2;
+        s->vals = realloc(s->vals, s->cap*sizeof(int64_t));
+        if (!s->vals) {
+            fatal("out of memory");
+        }
+    }
+    s->vals[s->len++] = val;
+    pthread_mutex_unlock(&mu);
+}
+
+static void samples_reset(void) {
+    pthread_mutex_lock(&mu);
+    for (int i = 0; i < NPHASES; i++) {
+        samples[i].len = 0;
+    }
+    pthread_mutex_unlock(&mu);
+}
+
+static int cmpi64(const void *a, const void *b) {
+    int64_t x = *(int64_t*)a;
+    int64_t y = *(int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+struct latency {
+    int64_t count;
+    double p50;
+    double p99;
+    double max;
+};
+
+// Returns the latency percentiles of a phase, in microseconds.
+static struct latency samples_latency(int ph) {
+    struct latency lat = { 0 };
+    pthread_mutex_lock(&mu);
+    struct samples *s = &samples[ph];
+    if (s->len > 0) {
+        qsort(s->vals, s->len, sizeof(int64_t), cmpi64);
+        lat.count = s->len;
+        lat.p50 = s->vals[(s->len-1)*50/100]/1e3;
+        lat.p99 = s->vals[(s->len-1)*99/100]/1e3;
+        lat.max = s->vals[s->len-1]/1e3;
+    }
+    pthread_mutex_unlock(&mu);
+    return lat;
+}
+
+// Sends GETs at a fixed rate on its own connection. Latency is taken from
+// when each request was due, not when it was sent, so a stalled server is
+// charged for the requests that queued behind the stall.
+static void *foreground(void *arg) {
+    (void)arg;
+    struct client c;
+    if (!client_dial(&c)) {
+        fatal("foreground dial failed");
+    }
+    uint64_t rng = 0x9E3779B97F4A7C15;
+    int64_t interval = 1000000000/opts.fgrate;
+    int64_t due = now();
+    while (!atomic_load(&done)) {
+        int ph = atomic_load(&phase);
+        if (ph == PHASE_NONE) {
+            sleepns(1000000);
+            due = now();
+            continue;
+        }
+        sleepns(due-now());
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+        if (!client_do(&c, 0, "GET pb:%" PRIu64, rng%fgkeys)) {
+            fatal("foreground GET failed");
+        }
+        int64_t end = now();
+        if (atomic_load(&phase) == ph) {
+            samples_add(ph, end-due);
+        }
+        due += interval;
+        if (end-due > INT64_C(1000000000)) {
+            // More than a second behind, don't flood the server once it
+            // comes back.
+            due = end;
+        }
+    }
+    client_close(&c);
+    return 0;
+}
+
+// Tracks the peak RSS of the server while an operation is running.
+static void *rsssampler(void *arg) {
+    (void)arg;
+    while (!atomic_load(&done)) {
+        if (atomic_load(&phase) == PHASE_OP) {
+            int64_t rss = server_rss();
+            if (rss > atomic_load(&peakrss)) {
+                atomic_store(&peakrss, rss);
+            }
+        }
+        sleepns(2000000);
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// benchmark
+////////////////////////////////////////////////////////////////////////////
+
+struct result {
+    double secs;
+    int64_t peakextra;
+    struct latency idle;
+    struct latency during;
+};
+
+static void shape_str(const struct shape *shape, char *buf, size_t cap) {
+    if (shape->ttlmax > 0) {
+        snprintf(buf, cap, "%" PRIi64 "x%" PRIi64 ":%d-%d", shape->count,
+            shape->valsize, shape->ttlmin, shape->ttlmax);
+    } else {
+        snprintf(buf, cap, "%" PRIi64 "x%" PRIi64, shape->count,
+            shape->valsize);
+    }
+}
+
+static void threads_str(int nthreads, char *buf, size_t cap) {
+    if (nthreads == 0) {
+        snprintf(buf, cap, "FAST");
+    } else {
+        snprintf(buf, cap, "THREADS %d", nthreads);
+    }
+}
+
+// Runs one SAVE or LOAD, measuring a second of idle foreground latency
+// first.
+static struct result run_op(struct client *c, const char *op,
+    const char *path, int nthreads)
+{
+    struct result res = { 0 };
+    char tstr[32];
+    threads_str(nthreads, tstr, sizeof(tstr));
+    samples_reset();
+    atomic_store(&phase, PHASE_IDLE);
+    sleepns(1000000000);
+    int64_t base = server_rss();
+    atomic_store(&peakrss, base);
+    atomic_store(&phase, PHASE_OP);
+    int64_t start = now();
+    if (!client_do(c, 0, "%s %s %s %s", op, strcmp(op, "SAVE") == 0 ? "TO" :
+        "FROM", path, tstr))
+    {
+        fatal("save or load failed");
+    }
+    res.secs = (now()-start)/1e9;
+    atomic_store(&phase, PHASE_NONE);
+    int64_t rss = server_rss();
+    if (rss > atomic_load(&peakrss)) {
+        atomic_store(&peakrss, rss);
+    }
+    res.peakextra = atomic_load(&peakrss)-base;
+    res.idle = samples_latency(PHASE_IDLE);
+    res.during = samples_latency(PHASE_OP);
+    return res;
+}
+
+static void print_result(const struct shape *shape, const char *op,
+    int nthreads, int64_t fsize, int64_t entries, const struct result *res)
+{
+    char sstr[64];
+    shape_str(shape, sstr, sizeof(sstr));
+    double mb = fsize/1024.0/1024.0;
+    if (opts.json) {
+        printf("{\"shape\":\"%s\",\"op\":\"%s\",\"threads\":%d,"
+            "\"entries\":%" PRIi64 ",\"file_mb\":%.3f,\"secs\":%.4f,"
+            "\"mb_per_sec\":%.1f,\"entries_per_sec\":%.0f,"
+            "\"peak_extra_rss_mb\":%.1f,"
+            "\"idle_p50_us\":%.1f,\"idle_p99_us\":%.1f,\"idle_max_us\":%.1f,"
+            "\"during_p50_us\":%.1f,\"during_p99_us\":%.1f,"
+            "\"during_max_us\":%.1f,\"during_samples\":%" PRIi64 "}\n",
+            sstr, op, nthreads, entries, mb, res->secs, mb/res->secs,
+            entries/res->secs, res->peakextra/1024.0/1024.0,
+            res->idle.p50, res->idle.p99, res->idle.max,
+            res->during.p50, res->during.p99, res->during.max,
+            res->during.count);
+    } else if (strcmp(op, "restart") == 0) {
+        printf("%-18s %-7s %-10s %8.3f secs %8.1f MB/s %10.0f ents/s\n",
+            sstr, op, "", res->secs, mb/res->secs, entries/res->secs);
+    } else {
+        char tstr[32];
+        threads_str(nthreads, tstr, sizeof(tstr));
+        printf("%-18s %-7s %-10s %8.3f secs %8.1f MB/s %10.0f ents/s "
+            "%7.1f MB rss  p99 %.0f -> %.0f us (max %.0f us)\n",
+            sstr, op, tstr, res->secs, mb/res->secs, entries/res->secs,
+            res->peakextra/1024.0/1024.0, res->idle.p99, res->during.p99,
+            res->during.max);
+    }
+    fflush(stdout);
+}
+
+// Waits for the server to answer a PING, returning false after timeout
+// nanoseconds.
+static bool wait_ready(struct client *c, int64_t timeout) {
+    int64_t start = now();
+    while (now()-start < timeout) {
+        if (client_dial(c)) {
+            if (client_do(c, 0, "PING")) {
+                return true;
+            }
+            client_close(c);
+        }
+        sleepns(1000000);
+    }
+    return false;
+}
+
+static void run_shape(const struct shape *shape) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/persistbench-%d.dat", opts.dir,
+        (int)getpid());
+    server_start(0);
+    struct client c;
+    if (!wait_ready(&c, INT64_C(10000000000))) {
+        fatal("server did not start");
+    }
+    int64_t entries = 0;
+    if (shape->ttlmax > 0) {
+        client_do(&c, 0, "DEBUG POPULATE %" PRIi64 " pb %" PRIi64 " %d-%d",
+            shape->count, shape->valsize, shape->ttlmin, shape->ttlmax);
+    } else {
+        client_do(&c, 0, "DEBUG POPULATE %" PRIi64 " pb %" PRIi64,
+            shape->count, shape->valsize);
+    }
+    client_do(&c, &entries, "DBSIZE");
+    fgkeys = shape->count > 0 ? shape->count : 1;
+    atomic_store(&done, false);
+    pthread_t fgth, rssth;
+    pthread_create(&fgth, 0, foreground, 0);
+    pthread_create(&rssth, 0, rsssampler, 0);
+    for (int i = 0; i < opts.nnthreads; i++) {
+        int nthreads = opts.nthreads[i];
+        struct result res = run_op(&c, "SAVE", path, nthreads);
+        struct stat st;
+        if (stat(path, &st) == -1) {
+            fatal("save file missing");
+        }
+        print_result(shape, "save", nthreads, st.st_size, entries, &res);
+        if (!client_do(&c, 0, "FLUSHALL SYNC")) {
+            fatal("flushall failed");
+        }
+        res = run_op(&c, "LOAD", path, nthreads);
+        client_do(&c, &entries, "DBSIZE");
+        print_result(shape, "load", nthreads, st.st_size, entries, &res);
+    }
+    atomic_store(&done, true);
+    pthread_join(fgth, 0);
+    pthread_join(rssth, 0);
+    client_close(&c);
+    server_kill();
+    if (opts.restart) {
+        // The server loads the persist file before it accepts commands,
+        // so the first reply marks the end of the restart.
+        struct stat st;
+        stat(path, &st);
+        struct result res = { 0 };
+        int64_t start = now();
+        server_start(path);
+        if (!wait_ready(&c, INT64_C(600000000000))) {
+            fatal("server did not restart");
+        }
+        res.secs = (now()-start)/1e9;
+        client_do(&c, &entries, "DBSIZE");
+        client_close(&c);
+        server_kill();
+        print_result(shape, "restart", 0, st.st_size, entries, &res);
+    }
+    unlink(path);
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: persistbench [options]\n"
+        "  --server path    pogocache binary (default: ../pogocache)\n"
+        "  -p port          port to run the server on (default: 9480)\n"
+        "  --dir path       directory for the save file (default: /tmp)\n"
+        "  --shapes list    COUNTxSIZE[:TTLMIN-TTLMAX],...\n"
+        "                   (default: 1000000x16,100000x1024)\n"
+        "  -t list          SAVE/LOAD threads, 0 for FAST (default: 1,0)\n"
+        "  --fgrate n       foreground GETs per second (default: 2000)\n"
+        "  --srvthreads n   server --threads (default: server default)\n"
+        "  --norestart      skip the restart measurement\n"
+        "  --json           print one JSON object per line\n");
+    exit(1);
+}
+
+static void parse_shapes(const char *s) {
+    opts.nshapes = 0;
+    while (*s) {
+        if (opts.nshapes == MAXLIST) {
+            usage();
+        }
+        struct shape *shape = &opts.shapes[opts.nshapes++];
+        memset(shape, 0, sizeof(struct shape));
+        char *end;
+        shape->count = strtoll(s, &end, 10);
+        if (*end != 'x' || shape->count < 1) {
+            usage();
+        }
+        shape->valsize = strtoll(end+1, &end, 10);
+        if (shape->valsize < 0) {
+            usage();
+        }
+        if (*end == ':') {
+            shape->ttlmin = strtol(end+1, &end, 10);
+            if (*end != '-') {
+                usage();
+            }
+            shape->ttlmax = strtol(end+1, &end, 10);
+            // DEBUG POPULATE needs a non-empty range.
+            if (shape->ttlmin < 1 || shape->ttlmax <= shape->ttlmin) {
+                usage();
+            }
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end) {
+            usage();
+        }
+        s = end;
+    }
+}
+
+static void parse_threads(const char *s) {
+    opts.nnthreads = 0;
+    while (*s) {
+        if (opts.nnthreads == MAXLIST) {
+            usage();
+        }
+        char *end;
+        long n = strtol(s, &end, 10);
+        if (end == s || n < 0 || n > 1024) {
+            usage();
+        }
+        opts.nthreads[opts.nnthreads++] = n;
+        if (*end == ',') {
+            end++;
+        } else if (*end) {
+            usage();
+        }
+        s = end;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i+1 < argc ? argv[i+1] : 0;
+        if (strcmp(arg, "--json") == 0) {
+            opts.json = true;
+        } else if (strcmp(arg, "--norestart") == 0) {
+            opts.restart = false;
+        } else if (!val) {
+            usage();
+        } else if (strcmp(arg, "--server") == 0) {
+            opts.server = val; i++;
+        } else if (strcmp(arg, "-p") == 0) {
+            opts.port = atoi(val); i++;
+        } else if (strcmp(arg, "--dir") == 0) {
+            opts.dir = val; i++;
+        } else if (strcmp(arg, "--shapes") == 0) {
+            parse_shapes(val); i++;
+        } else if (strcmp(arg, "-t") == 0) {
+            parse_threads(val); i++;
+        } else if (strcmp(arg, "--fgrate") == 0) {
+            opts.fgrate = atoi(val); i++;
+        } else if (strcmp(arg, "--srvthreads") == 0) {
+            opts.srvthreads = atoi(val); i++;
+        } else {
+            usage();
+        }
+    }
+    if (opts.fgrate < 1 || opts.port < 1 || opts.nshapes == 0 ||
+        opts.nnthreads == 0)
+    {
+        usage();
+    }
+    if (access(opts.server, X_OK) == -1) {
+        fatal("server binary not found, use --server");
+    }
+    signal(SIGPIPE, SIG_IGN);
+    atexit(server_kill);
+    for (int i = 0; i < opts.nshapes; i++) {
+        run_shape(&opts.shapes[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,417 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Program pogocache-replay re-issues a trace recorded by DEBUG CAPTURE
+// against a server, at the recorded speed or faster.
+//
+// Commands are sent in trace order, each at its recorded time divided by
+// the speed. Each recorded connection is mapped onto one of --conns
+// sockets, so the commands of a connection keep their order. All commands
+// are sent as RESP, which every protocol is translated to before it is
+// captured. Elided values are replayed as 'x' bytes of the same length.
+//
+//   ./pogocache-replay -p 9401 --speed 2 trace.cap
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace.h"
+
+static struct {
+    const char *host;
+    const char *port;
+    double speed;       // zero for as fast as possible
+    int conns;
+    bool json;
+    const char *path;
+} opts = {
+    .host = "127.0.0.1",
+    .port = "9401",
+    .speed = 1,
+    .conns = 64,
+};
+
+static int64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*INT64_C(1000000000)+ts.tv_nsec;
+}
+
+struct samples {
+    int64_t *vals;
+    size_t len;
+    size_t cap;
+};
+
+static void samples_add(struct samples *s, int64_t val) {
+    if (s->len == s->cap) {
+        s->cap = s->cap == 0 ? 4096 : s->cap*2;
+        s->vals = realloc(s->vals, s->cap*sizeof(int64_t));
+        if (!s->vals) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    s->vals[s->len++] = val;
+}
+
+static int cmpi64(const void *a, const void *b) {
+    int64_t x = *(int64_t*)a;
+    int64_t y = *(int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double samples_pct(struct samples *s, int pct) {
+    if (s->len == 0) {
+        return 0;
+    }
+    return s->vals[(s->len-1)*pct/100]/1e3;
+}
+
+struct sock {
+    int fd;
+    char *out;
+    size_t outlen;
+    size_t outcap;
+    char *in;
+    size_t inlen;
+    size_t incap;
+    int64_t *sent;      // send times of the commands waiting for replies
+    size_t nsent;
+    size_t sentcap;
+    size_t sentpos;
+    bool writing;       // registered for EPOLLOUT
+};
+
+static struct sock *socks;
+static int epfd;
+static struct samples latency;
+static struct samples lag;
+static uint64_t replies = 0;
+static uint64_t errors = 0;
+static uint64_t nils = 0;
+static uint64_t pending = 0;
+
+static void grow(char **data, size_t *cap, size_t need) {
+    if (need <= *cap) {
+        return;
+    }
+    size_t n = *cap == 0 ? 4096 : *cap;
+    while (n < need) {
+        n *= 2;
+    }
+    *data = realloc(*data, n);
+    if (!*data) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    *cap = n;
+}
+
+static void dial(struct sock *s) {
+    struct addrinfo hints = { 0 }, *ai;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(opts.host, opts.port, &hints, &ai) != 0) {
+        fprintf(stderr, "cannot resolve %s\n", opts.host);
+        exit(1);
+    }
+    s->fd = socket(ai->ai_family, SOCK_STREAM, 0);
+    if (s->fd == -1 || connect(s->fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+        perror("connect");
+        exit(1);
+    }
+    freeaddrinfo(ai);
+    int one = 1;
+    setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL)|O_NONBLOCK);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev);
+}
+
+// Returns the length of the complete RESP reply at the start of data, or
+// zero if it is incomplete. Counts errors and nils along the way.
+static size_t parse_reply(const char *data, size_t len, int *err, int *nil) {
+    const char *e = memmem(data, len, "\r\n", 2);
+    if (!e) {
+        return 0;
+    }
+    size_t hdr = e-data+2;
+    long long n = strtoll(data+1, 0, 10);
+    switch (data[0]) {
+    case '-':
+        (*err)++;
+        return hdr;
+    case '$':
+        if (n < 0) {
+            (*nil)++;
+            return hdr;
+        }
+        return len-hdr < (size_t)n+2 ? 0 : hdr+n+2;
+    case '*': {
+        if (n < 0) {
+            (*nil)++;
+            return hdr;
+        }
+        size_t pos = hdr;
+        for (long long i = 0; i < n; i++) {
+            size_t m = parse_reply(data+pos, len-pos, err, nil);
+            if (m == 0) {
+                return 0;
+            }
+            pos += m;
+        }
+        return pos;
+    }
+    default:
+        return hdr;
+    }
+}
+
+static void sock_read(struct sock *s) {
+    while (1) {
+        grow(&s->in, &s->incap, s->inlen+65536);
+        ssize_t n = read(s->fd, s->in+s->inlen, s->incap-s->inlen);
+        if (n == -1 && errno == EAGAIN) {
+            break;
+        }
+        if (n <= 0) {
+            fprintf(stderr, "server closed connection\n");
+            exit(1);
+        }
+        s->inlen += n;
+    }
+    int64_t t = now();
+    size_t pos = 0;
+    while (pos < s->inlen) {
+        int err = 0, nil = 0;
+        size_t n = parse_reply(s->in+pos, s->inlen-pos, &err, &nil);
+        if (n == 0) {
+            break;
+        }
+        pos += n;
+        errors += err;
+        nils += nil;
+        replies++;
+        pending--;
+        if (s->sentpos < s->nsent) {
+            samples_add(&latency, t-s->sent[s->sentpos++]);
+        }
+    }
+    memmove(s->in, s->in+pos, s->inlen-pos);
+    s->inlen -= pos;
+    if (s->sentpos == s->nsent) {
+        s->sentpos = 0;
+        s->nsent = 0;
+    }
+}
+
+static void sock_flush(struct sock *s) {
+    size_t pos = 0;
+    while (pos < s->outlen) {
+        ssize_t n = write(s->fd, s->out+pos, s->outlen-pos);
+        if (n == -1) {
+            if (errno == EAGAIN) {
+                break;
+            }
+            perror("write");
+            exit(1);
+        }
+        pos += n;
+    }
+    memmove(s->out, s->out+pos, s->outlen-pos);
+    s->outlen -= pos;
+    bool writing = s->outlen > 0;
+    if (writing != s->writing) {
+        struct epoll_event ev = {
+            .events = EPOLLIN|(writing?EPOLLOUT:0),
+            .data.ptr = s,
+        };
+        epoll_ctl(epfd, EPOLL_CTL_MOD, s->fd, &ev);
+        s->writing = writing;
+    }
+}
+
+// Services the sockets until the deadline.
+static void poll_until(int64_t deadline) {
+    struct epoll_event evs[64];
+    while (1) {
+        int64_t wait = deadline-now();
+        int ms = wait <= 0 ? 0 : (int)((wait+999999)/1000000);
+        int n = epoll_wait(epfd, evs, 64, ms);
+        for (int i = 0; i < n; i++) {
+            struct sock *s = evs[i].data.ptr;
+            if (evs[i].events&EPOLLOUT) {
+                sock_flush(s);
+            }
+            if (evs[i].events&(EPOLLIN|EPOLLHUP|EPOLLERR)) {
+                sock_read(s);
+            }
+        }
+        if (now() >= deadline) {
+            break;
+        }
+    }
+}
+
+static void append_resp(struct sock *s, const struct trace_rec *rec) {
+    char hdr[32];
+    int n = snprintf(hdr, sizeof(hdr), "*%d\r\n", rec->nargs);
+    size_t need = s->outlen+n;
+    for (int i = 0; i < rec->nargs; i++) {
+        need += 32+rec->args[i].len;
+    }
+    grow(&s->out, &s->outcap, need);
+    memcpy(s->out+s->outlen, hdr, n);
+    s->outlen += n;
+    for (int i = 0; i < rec->nargs; i++) {
+        const struct trace_arg *arg = &rec->args[i];
+        s->outlen += sprintf(s->out+s->outlen, "$%zu\r\n", arg->len);
+        if (arg->data) {
+            memcpy(s->out+s->outlen, arg->data, arg->len);
+        } else {
+            memset(s->out+s->outlen, 'x', arg->len);
+        }
+        s->outlen += arg->len;
+        memcpy(s->out+s->outlen, "\r\n", 2);
+        s->outlen += 2;
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: pogocache-replay [options] trace\n"
+        "  -h host       server host (default: 127.0.0.1)\n"
+        "  -p port       server port (default: 9401)\n"
+        "  --speed n     replay speed, 0 for as fast as possible (default: 1)\n"
+        "  --conns n     sockets to spread the connections over (default: 64)\n"
+        "  --json        print the results as JSON\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i+1 < argc ? argv[i+1] : 0;
+        if (strcmp(arg, "--json") == 0) {
+            opts.json = true;
+        } else if (arg[0] != '-') {
+            opts.path = arg;
+        } else if (!val) {
+            usage();
+        } else if (strcmp(arg, "-h") == 0) {
+            opts.host = val; i++;
+        } else if (strcmp(arg, "-p") == 0) {
+            opts.port = val; i++;
+        } else if (strcmp(arg, "--speed") == 0) {
+            opts.speed = atof(val); i++;
+        } else if (strcmp(arg, "--conns") == 0) {
+            opts.conns = atoi(val); i++;
+        } else {
+            usage();
+        }
+    }
+    if (!opts.path || opts.speed < 0 || opts.conns < 1) {
+        usage();
+    }
+    signal(SIGPIPE, SIG_IGN);
+    struct trace trace;
+    if (!trace_open(&trace, opts.path)) {
+        return 1;
+    }
+    epfd = epoll_create1(0);
+    socks = calloc(opts.conns, sizeof(struct sock));
+    for (int i = 0; i < opts.conns; i++) {
+        socks[i].fd = -1;
+    }
+    static struct trace_rec rec;
+    uint64_t sent = 0;
+    uint64_t skipped = 0;
+    int64_t start = now();
+    int64_t span = 0;
+    while (trace_next(&trace, &rec)) {
+        // QUIT would close a socket that other connections share.
+        if (trace_cmdeq(&rec, "quit")) {
+            skipped++;
+            continue;
+        }
+        int64_t due = start;
+        if (opts.speed > 0) {
+            due += (int64_t)(rec.time*1000/opts.speed);
+            if (due > now()) {
+                poll_until(due);
+            }
+        }
+        span = rec.time;
+        struct sock *s = &socks[rec.connid%opts.conns];
+        if (s->fd == -1) {
+            dial(s);
+        }
+        int64_t t = now();
+        samples_add(&lag, opts.speed > 0 && t > due ? t-due : 0);
+        if (s->nsent == s->sentcap) {
+            s->sentcap = s->sentcap == 0 ? 64 : s->sentcap*2;
+            s->sent = realloc(s->sent, s->sentcap*sizeof(int64_t));
+        }
+        s->sent[s->nsent++] = t;
+        append_resp(s, &rec);
+        sock_flush(s);
+        pending++;
+        sent++;
+        if (opts.speed == 0 && pending > 1024) {
+            poll_until(now());
+        }
+    }
+    int64_t drain = now()+INT64_C(10000000000);
+    while (pending > 0 && now() < drain) {
+        poll_until(now()+1000000);
+    }
+    double elapsed = (now()-start)/1e9;
+    qsort(latency.vals, latency.len, sizeof(int64_t), cmpi64);
+    qsort(lag.vals, lag.len, sizeof(int64_t), cmpi64);
+    if (opts.json) {
+        printf("{\"trace\":\"%s\",\"speed\":%g,\"sent\":%" PRIu64 ","
+            "\"skipped\":%" PRIu64 ",\"replies\":%" PRIu64 ","
+            "\"errors\":%" PRIu64 ",\"nils\":%" PRIu64 ","
+            "\"trace_secs\":%.3f,\"elapsed_secs\":%.3f,\"ops_per_sec\":%.0f,"
+            "\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f},"
+            "\"lag_us\":{\"p50\":%.1f,\"p99\":%.1f}}\n",
+            opts.path, opts.speed, sent, skipped, replies, errors, nils,
+            span/1e6, elapsed, sent/elapsed,
+            samples_pct(&latency, 50), samples_pct(&latency, 99),
+            latency.len ? latency.vals[(latency.len-1)*999/1000]/1e3 : 0,
+            samples_pct(&lag, 50), samples_pct(&lag, 99));
+    } else {
+        printf("%" PRIu64 " commands (%" PRIu64 " skipped) from a %.3f sec "
+            "trace in %.3f secs, %.0f ops/sec\n", sent, skipped, span/1e6,
+            elapsed, sent/elapsed);
+        printf("%" PRIu64 " replies, %" PRIu64 " errors, %" PRIu64 " nils\n",
+            replies, errors, nils);
+        printf("latency p50 %.1f us, p99 %.1f us; send lag p50 %.1f us, "
+            "p99 %.1f us\n", samples_pct(&latency, 50),
+            samples_pct(&latency, 99), samples_pct(&lag, 50),
+            samples_pct(&lag, 99));
+    }
+    trace_close(&trace);
+    return pending > 0 || errors > 0;
+}
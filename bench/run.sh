@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# ./run.sh [<pogocache-bench options>]
+#
+# Starts ../pogocache and runs pogocache-bench once for each protocol.
+# The results are written to results.json as an array.
+# Environment: PORT (default 9479), THREADS (server threads, default 4),
+# PROTOS (default "resp memcache http postgres").
+
+set -e
+cd $(dirname "${BASH_SOURCE[0]}")
+
+PORT=${PORT:-9479}
+THREADS=${THREADS:-4}
+PROTOS=${PROTOS:-"resp memcache http postgres"}
+
+if [[ ! -x ../pogocache ]]; then
+    echo "../pogocache not found, run 'make' first" >&2
+    exit 1
+fi
+make -s
+
+../pogocache -p $PORT --threads $THREADS > server.log 2>&1 &
+pid=$!
+trap "kill $pid 2>/dev/null || true" EXIT
+sleep 0.2
+
+out=results.json
+echo "[" > $out
+first=1
+for proto in $PROTOS; do
+    if [[ $first == 0 ]]; then
+        echo "," >> $out
+    fi
+    first=0
+    ./pogocache-bench -p $PORT --proto $proto --prefill "$@" >> $out
+done
+echo "]" >> $out
+cat $out
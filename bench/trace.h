@@ -0,0 +1,154 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Reader for the traces written by DEBUG CAPTURE. The format is described
+// in src/capture.c.
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAXARGS 4096
+
+struct trace {
+    uint8_t *data;
+    size_t len;
+    size_t pos;
+    int64_t start;      // unix time of the capture start, nanoseconds
+    bool hashed;        // keys are hashed and long values are elided
+    int64_t time;       // microseconds since the capture start
+};
+
+struct trace_arg {
+    const uint8_t *data;    // null when elided
+    size_t len;
+};
+
+struct trace_rec {
+    int64_t time;       // microseconds since the capture start
+    uint64_t connid;
+    int proto;
+    int nargs;
+    struct trace_arg args[TRACE_MAXARGS];
+};
+
+static inline bool trace_varint(struct trace *t, uint64_t *x) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && t->pos < t->len; shift += 7) {
+        uint8_t b = t->data[t->pos++];
+        v |= (uint64_t)(b&127) << shift;
+        if (b < 128) {
+            *x = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Reads the whole trace into memory. Prints an error and returns false on
+// failure.
+static inline bool trace_open(struct trace *t, const char *path) {
+    memset(t, 0, sizeof(struct trace));
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    size_t cap = 1<<20;
+    t->data = malloc(cap);
+    while (t->data) {
+        t->len += fread(t->data+t->len, 1, cap-t->len, f);
+        if (t->len < cap) {
+            break;
+        }
+        cap *= 2;
+        t->data = realloc(t->data, cap);
+    }
+    fclose(f);
+    if (!t->data) {
+        fprintf(stderr, "%s: out of memory\n", path);
+        return false;
+    }
+    if (t->len < 24 || memcmp(t->data, "POGOCAP1", 8) != 0) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        free(t->data);
+        t->data = 0;
+        return false;
+    }
+    for (int i = 0; i < 8; i++) {
+        t->start |= (int64_t)t->data[8+i] << (i*8);
+    }
+    t->hashed = t->data[16]&1;
+    t->pos = 24;
+    return true;
+}
+
+static inline void trace_close(struct trace *t) {
+    free(t->data);
+    t->data = 0;
+}
+
+// Reads the next record. Returns false at the end of the trace, or when
+// the rest of it is truncated.
+static inline bool trace_next(struct trace *t, struct trace_rec *rec) {
+    uint64_t delta, connid, proto, nargs;
+    if (!trace_varint(t, &delta) || !trace_varint(t, &connid) ||
+        !trace_varint(t, &proto) || !trace_varint(t, &nargs) ||
+        nargs == 0 || nargs > TRACE_MAXARGS)
+    {
+        return false;
+    }
+    t->time += delta;
+    rec->time = t->time;
+    rec->connid = connid;
+    rec->proto = proto;
+    rec->nargs = nargs;
+    for (uint64_t i = 0; i < nargs; i++) {
+        uint64_t x;
+        if (!trace_varint(t, &x)) {
+            return false;
+        }
+        rec->args[i].len = x>>1;
+        if (x&1) {
+            rec->args[i].data = 0;
+        } else {
+            if (t->len-t->pos < rec->args[i].len) {
+                return false;
+            }
+            rec->args[i].data = t->data+t->pos;
+            t->pos += rec->args[i].len;
+        }
+    }
+    return true;
+}
+
+// Returns true if the record's command name matches, ignoring case.
+static inline bool trace_cmdeq(const struct trace_rec *rec, const char *name) {
+    size_t n = strlen(name);
+    if (rec->args[0].len != n || !rec->args[0].data) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        char c = rec->args[0].data[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 32;
+        }
+        if (c != name[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,354 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Unit pogoshm.c is the client side of the shared-memory transport.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+#include "shmring.h"
+#include "pogoshm.h"
+
+struct pogoshm {
+    int fd;
+    struct shmhdr *hdr;
+    int spins;
+    bool closed;
+    char *in;           // responses taken off the ring, not yet consumed
+    size_t inlen;
+    size_t incap;
+    size_t inpos;
+    char *out;          // scratch space for commands
+    size_t outcap;
+};
+
+static int futex_wait(atomic_uint *addr, unsigned val, int64_t nanos) {
+    struct timespec ts = { nanos/1000000000, nanos%1000000000 };
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, 0, 0);
+}
+
+static int recvfd(int sock) {
+    char byte;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } cbuf;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = cbuf.buf,
+        .msg_controllen = sizeof(cbuf.buf),
+    };
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n != 1) {
+        if (n == 0) {
+            errno = ECONNRESET;
+        }
+        return -1;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+struct pogoshm *pogoshm_connect(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    strcpy(addr.sun_path, path);
+    int sock = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        return 0;
+    }
+    // The server creates the rings once the socket is readable.
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        send(sock, "H", 1, MSG_NOSIGNAL) != 1)
+    {
+        close(sock);
+        return 0;
+    }
+    int mfd = recvfd(sock);
+    if (mfd == -1) {
+        close(sock);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(mfd, &st) == -1 || (size_t)st.st_size < sizeof(struct shmhdr)) {
+        close(mfd);
+        close(sock);
+        errno = EPROTO;
+        return 0;
+    }
+    struct shmhdr *hdr = mmap(0, sizeof(struct shmhdr), PROT_READ|PROT_WRITE,
+        MAP_SHARED, mfd, 0);
+    close(mfd);
+    if (hdr == MAP_FAILED) {
+        close(sock);
+        return 0;
+    }
+    if (hdr->magic != SHM_MAGIC || hdr->version != SHM_VERSION ||
+        hdr->ringsize != SHM_RINGSIZE)
+    {
+        munmap(hdr, sizeof(struct shmhdr));
+        close(sock);
+        errno = EPROTO;
+        return 0;
+    }
+    struct pogoshm *shm = malloc(sizeof(struct pogoshm));
+    if (!shm) {
+        munmap(hdr, sizeof(struct shmhdr));
+        close(sock);
+        return 0;
+    }
+    memset(shm, 0, sizeof(struct pogoshm));
+    shm->fd = sock;
+    shm->hdr = hdr;
+    return shm;
+}
+
+void pogoshm_close(struct pogoshm *shm) {
+    if (!shm) {
+        return;
+    }
+    munmap(shm->hdr, sizeof(struct shmhdr));
+    close(shm->fd);
+    free(shm->in);
+    free(shm->out);
+    free(shm);
+}
+
+void pogoshm_setspin(struct pogoshm *shm, int spins) {
+    shm->spins = spins < 0 ? 0 : spins;
+}
+
+// Returns true if the server has closed the socket.
+static bool server_gone(struct pogoshm *shm) {
+    if (!shm->closed) {
+        char byte;
+        ssize_t n = recv(shm->fd, &byte, 1, MSG_PEEK|MSG_DONTWAIT);
+        if (n == 0 || (n == -1 && errno != EAGAIN)) {
+            shm->closed = true;
+        }
+    }
+    return shm->closed;
+}
+
+// Move everything from the response ring to the input buffer.
+static void take(struct pogoshm *shm) {
+    size_t avail = shmring_len(&shm->hdr->resp);
+    if (avail == 0) {
+        return;
+    }
+    if (avail > SHM_RINGSIZE) {
+        shm->closed = true;
+        return;
+    }
+    if (shm->inpos > 0) {
+        // Drop what has been consumed.
+        memmove(shm->in, shm->in+shm->inpos, shm->inlen-shm->inpos);
+        shm->inlen -= shm->inpos;
+        shm->inpos = 0;
+    }
+    if (shm->incap-shm->inlen < avail) {
+        size_t cap = shm->incap == 0 ? 4096 : shm->incap;
+        while (cap-shm->inlen < avail) {
+            cap *= 2;
+        }
+        char *in = realloc(shm->in, cap);
+        if (!in) {
+            abort();
+        }
+        shm->in = in;
+        shm->incap = cap;
+    }
+    shm->inlen += shmring_read(&shm->hdr->resp, shm->in+shm->inlen, avail);
+}
+
+// Wait until there's something on the response ring.
+static int wait_ring(struct pogoshm *shm) {
+    struct shmring *ring = &shm->hdr->resp;
+    for (int i = 0; ; i++) {
+        if (shmring_len(ring) > 0) {
+            return 0;
+        }
+        if (i < shm->spins) {
+            continue;
+        }
+        // Ask the server for a wakeup and make sure nothing arrived in the
+        // meantime, then sleep.
+        unsigned seq = atomic_load(&ring->seq);
+        atomic_store(&ring->waiting, 1);
+        atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (shmring_len(ring) > 0) {
+            atomic_store(&ring->waiting, 0);
+            continue;
+        }
+        if (futex_wait(&ring->seq, seq, 100000000) == -1 &&
+            errno == ETIMEDOUT && server_gone(shm))
+        {
+            return -1;
+        }
+    }
+}
+
+int pogoshm_write(struct pogoshm *shm, const void *data, size_t len) {
+    struct shmring *ring = &shm->hdr->req;
+    const char *p = data;
+    while (len > 0) {
+        size_t n = shmring_write(ring, p, len);
+        if (n == SHMRING_BROKEN) {
+            shm->closed = true;
+            return -1;
+        }
+        if (n > 0) {
+            atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (atomic_exchange(&ring->waiting, 0)) {
+                if (send(shm->fd, "!", 1, MSG_NOSIGNAL|MSG_DONTWAIT) == -1 &&
+                    errno != EAGAIN)
+                {
+                    shm->closed = true;
+                    return -1;
+                }
+            }
+            p += n;
+            len -= n;
+            continue;
+        }
+        // The request ring is full. Keep draining responses so that the
+        // server can make progress.
+        take(shm);
+        if (server_gone(shm)) {
+            return -1;
+        }
+        sched_yield();
+    }
+    return 0;
+}
+
+ssize_t pogoshm_read(struct pogoshm *shm, void *data, size_t len) {
+    if (shm->inpos == shm->inlen) {
+        if (wait_ring(shm) == -1) {
+            return 0;
+        }
+        take(shm);
+    }
+    size_t n = shm->inlen-shm->inpos;
+    n = n < len ? n : len;
+    memcpy(data, shm->in+shm->inpos, n);
+    shm->inpos += n;
+    return n;
+}
+
+int pogoshm_command(struct pogoshm *shm, int argc, const char *argv[],
+    const size_t argvlen[])
+{
+    size_t size = 32;
+    for (int i = 0; i < argc; i++) {
+        size += argvlen[i]+32;
+    }
+    if (shm->outcap < size) {
+        char *out = realloc(shm->out, size);
+        if (!out) {
+            abort();
+        }
+        shm->out = out;
+        shm->outcap = size;
+    }
+    char *p = shm->out;
+    p += sprintf(p, "*%d\r\n", argc);
+    for (int i = 0; i < argc; i++) {
+        p += sprintf(p, "$%zu\r\n", argvlen[i]);
+        memcpy(p, argv[i], argvlen[i]);
+        p += argvlen[i];
+        *(p++) = '\r';
+        *(p++) = '\n';
+    }
+    return pogoshm_write(shm, shm->out, p-shm->out);
+}
+
+// Returns the length of the RESP value at data, zero if incomplete, or -1
+// if invalid.
+static ssize_t resp_len(const char *data, size_t len, int depth) {
+    if (len == 0) {
+        return 0;
+    }
+    if (depth > 32) {
+        return -1;
+    }
+    const char *end = memchr(data, '\n', len);
+    if (!end) {
+        return 0;
+    }
+    size_t n = end-data+1;
+    long long x;
+    switch (data[0]) {
+    case '+': case '-': case ':':
+        return n;
+    case '$':
+        x = strtoll(data+1, 0, 10);
+        if (x < 0) {
+            return n;
+        }
+        return len-n < (size_t)x+2 ? 0 : (ssize_t)(n+x+2);
+    case '*':
+        x = strtoll(data+1, 0, 10);
+        for (long long i = 0; i < x; i++) {
+            ssize_t m = resp_len(data+n, len-n, depth+1);
+            if (m <= 0) {
+                return m;
+            }
+            n += m;
+        }
+        return n;
+    default:
+        return -1;
+    }
+}
+
+int pogoshm_reply(struct pogoshm *shm, const char **reply, size_t *len) {
+    while (1) {
+        ssize_t n = resp_len(shm->in+shm->inpos, shm->inlen-shm->inpos, 0);
+        if (n == -1) {
+            return -1;
+        }
+        if (n > 0) {
+            *reply = shm->in+shm->inpos;
+            *len = n;
+            shm->inpos += n;
+            return 0;
+        }
+        // Incomplete, wait for more.
+        if (wait_ring(shm) == -1) {
+            return -1;
+        }
+        take(shm);
+    }
+}
@@ -0,0 +1,49 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Client library for the Pogocache shared-memory transport (Linux only).
+// Start the server with '--shmsock path' and connect to the same path.
+// The connection is a byte stream, just like a socket, so any protocol the
+// server speaks can be used. Helpers are provided for RESP.
+//
+// A connection must only be used by one thread at a time.
+#ifndef POGOSHM_H
+#define POGOSHM_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct pogoshm;
+
+// Connect to a server shmsock. Returns NULL and sets errno on failure.
+struct pogoshm *pogoshm_connect(const char *path);
+void pogoshm_close(struct pogoshm *shm);
+
+// Number of times to poll for a response before sleeping on the futex.
+// Busy-polling trades a cpu core for lower latency. Default 0.
+void pogoshm_setspin(struct pogoshm *shm, int spins);
+
+// Write all bytes to the server. Returns 0 or -1 if the server is gone.
+int pogoshm_write(struct pogoshm *shm, const void *data, size_t len);
+
+// Read at least one byte, blocking until the server responds. Returns the
+// number of bytes read, or 0 if the server is gone.
+ssize_t pogoshm_read(struct pogoshm *shm, void *data, size_t len);
+
+// Write a RESP command.
+int pogoshm_command(struct pogoshm *shm, int argc, const char *argv[],
+    const size_t argvlen[]);
+
+// Read one complete RESP reply. The reply stays valid until the next call
+// on the connection. Returns 0 or -1 if the server is gone or
+// sent an invalid reply.
+int pogoshm_reply(struct pogoshm *shm, const char **reply, size_t *len);
+
+#endif
@@ -0,0 +1,228 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Program shmbench measures request round trips over the shared-memory
+// transport, and optionally over a unix socket for comparison.
+//
+//   ./shmbench -m /tmp/pogocache.shm [-s /tmp/pogocache.sock] [-n 100000]
+//              [-P 1] [-d 16] [--spin 10000]
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "pogoshm.h"
+
+// A transport is either shm or a plain unix socket.
+struct transport {
+    struct pogoshm *shm;
+    int fd;
+    char *in;
+    size_t inlen;
+    size_t incap;
+};
+
+static int64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+static int cmpi64(const void *a, const void *b) {
+    int64_t x = *(int64_t*)a;
+    int64_t y = *(int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int unix_connect(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("# connect");
+        exit(1);
+    }
+    return fd;
+}
+
+static void twrite(struct transport *t, const char *data, size_t len) {
+    if (t->shm) {
+        if (pogoshm_write(t->shm, data, len) == -1) {
+            fprintf(stderr, "# server closed\n");
+            exit(1);
+        }
+        return;
+    }
+    while (len > 0) {
+        ssize_t n = write(t->fd, data, len);
+        if (n <= 0) {
+            perror("# write");
+            exit(1);
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// Read 'nreplies' replies. Only simple strings and bulk strings are
+// expected, so a reply is a single line or a bulk header and its data.
+static void tread(struct transport *t, int nreplies) {
+    int replies = 0;
+    size_t pos = 0;
+    t->inlen = 0;
+    while (replies < nreplies) {
+        // parse what we have
+        while (replies < nreplies) {
+            char *nl = memchr(t->in+pos, '\n', t->inlen-pos);
+            if (!nl) {
+                break;
+            }
+            size_t end = nl-t->in+1;
+            if (t->in[pos] == '$' && t->in[pos+1] != '-') {
+                size_t n = strtoull(t->in+pos+1, 0, 10);
+                if (t->inlen < end+n+2) {
+                    break;
+                }
+                end += n+2;
+            }
+            pos = end;
+            replies++;
+        }
+        if (replies == nreplies) {
+            break;
+        }
+        if (t->incap-t->inlen < 65536) {
+            t->incap = t->incap*2+65536;
+            t->in = realloc(t->in, t->incap);
+            if (!t->in) {
+                abort();
+            }
+        }
+        ssize_t n;
+        if (t->shm) {
+            n = pogoshm_read(t->shm, t->in+t->inlen, t->incap-t->inlen);
+        } else {
+            n = read(t->fd, t->in+t->inlen, t->incap-t->inlen);
+        }
+        if (n <= 0) {
+            fprintf(stderr, "# server closed\n");
+            exit(1);
+        }
+        t->inlen += n;
+    }
+}
+
+static void bench(const char *name, struct transport *t, const char *cmd,
+    int n, int pipeline, int dsize)
+{
+    char *val = malloc(dsize+1);
+    memset(val, 'x', dsize);
+    val[dsize] = '\0';
+    size_t cap = (64+dsize)*pipeline;
+    char *buf = malloc(cap);
+    int nrounds = (n+pipeline-1)/pipeline;
+    int64_t *lats = malloc(sizeof(int64_t)*nrounds);
+    int64_t start = now();
+    int k = 0;
+    for (int r = 0; r < nrounds; r++) {
+        size_t len = 0;
+        for (int i = 0; i < pipeline; i++, k++) {
+            char key[32];
+            int klen = snprintf(key, sizeof(key), "key:%d", k%100000);
+            if (strcmp(cmd, "SET") == 0) {
+                len += sprintf(buf+len, "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n"
+                    "$%d\r\n%s\r\n", klen, key, dsize, val);
+            } else {
+                len += sprintf(buf+len, "*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n",
+                    klen, key);
+            }
+        }
+        int64_t t0 = now();
+        twrite(t, buf, len);
+        tread(t, pipeline);
+        lats[r] = now()-t0;
+    }
+    int64_t elapsed = now()-start;
+    qsort(lats, nrounds, sizeof(int64_t), cmpi64);
+    double sum = 0;
+    for (int i = 0; i < nrounds; i++) {
+        sum += lats[i];
+    }
+    printf("%-5s %-4s %9.0f ops/sec  avg %7.2f us  p50 %7.2f us  "
+        "p99 %7.2f us\n", name, cmd, (double)k/(elapsed/1e9),
+        sum/nrounds/1e3, lats[nrounds/2]/1e3, lats[nrounds*99/100]/1e3);
+    free(lats);
+    free(buf);
+    free(val);
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: shmbench -m shmsock [-s unixsock] [-n requests] "
+        "[-P pipeline] [-d datasize] [--spin count]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    const char *shmsock = 0;
+    const char *unixsock = 0;
+    int n = 100000;
+    int pipeline = 1;
+    int dsize = 16;
+    int spins = 0;
+    for (int i = 1; i < argc; i++) {
+        if (i+1 == argc) {
+            usage();
+        }
+        if (strcmp(argv[i], "-m") == 0) {
+            shmsock = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0) {
+            unixsock = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0) {
+            n = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-P") == 0) {
+            pipeline = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            dsize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--spin") == 0) {
+            spins = atoi(argv[++i]);
+        } else {
+            usage();
+        }
+    }
+    if (!shmsock || n <= 0 || pipeline <= 0 || dsize < 0) {
+        usage();
+    }
+    struct transport shm = { .fd = -1 };
+    shm.shm = pogoshm_connect(shmsock);
+    if (!shm.shm) {
+        perror("# pogoshm_connect");
+        return 1;
+    }
+    pogoshm_setspin(shm.shm, spins);
+    bench("shm", &shm, "SET", n, pipeline, dsize);
+    bench("shm", &shm, "GET", n, pipeline, dsize);
+    pogoshm_close(shm.shm);
+    free(shm.in);
+    if (unixsock) {
+        struct transport unx = { .fd = unix_connect(unixsock) };
+        bench("unix", &unx, "SET", n, pipeline, dsize);
+        bench("unix", &unx, "GET", n, pipeline, dsize);
+        close(unx.fd);
+        free(unx.in);
+    }
+    return 0;
+}
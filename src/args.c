@@ -82,7 +82,12 @@ void args_clear(struct args *args) {
 
 void args_free(struct args *args) {
     args_clear(args);
+    // Unused slots may still hold capacity from earlier commands.
+    for (size_t i = 0; i < args->cap; i++) {
+        buf_clear(&args->bufs[i]);
+    }
     xfree(args->bufs);
+    memset(args, 0, sizeof(struct args));
 }
 
 void args_print(struct args *args) {
@@ -0,0 +1,191 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Unit capture.c records incoming commands into a binary trace file, for
+// replaying with pogocache-replay or simulating with evictsim.
+//
+// The file starts with a 24 byte header:
+//
+//   "POGOCAP1"  magic
+//   u64         unix time of the capture start, nanoseconds
+//   u8          flags (CAPTURE_HASHED)
+//   7 bytes     reserved
+//
+// followed by one record per command, using unsigned varints:
+//
+//   time        microseconds since the previous record
+//   connid      connection id
+//   proto       protocol the command arrived on (PROTO_*)
+//   nargs       number of arguments
+//   args        nargs times: (len<<1)|elided, then len bytes unless elided
+//
+// Commands are sampled by a hash of their first key, so a sampled key has
+// all of its accesses recorded. Commands without keys are sampled by
+// connection. With hashed keys, the keys are replaced by 16 hex digits of a
+// hash keyed by a secret that is thrown away when the capture stops, and
+// arguments longer than 16 bytes, such as values, are recorded only by
+// their length.
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "capture.h"
+#include "hashmap.h"
+#include "util.h"
+#include "sys.h"
+#include "xmalloc.h"
+
+// Arguments up to this long are kept when values are elided. Command names,
+// options and small integers are short.
+#define MAXKEPT 16
+
+atomic_bool capturing = false;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *file = 0;
+static struct capture_opts copts;
+static uint64_t secret[2];
+static uint64_t threshold;      // sampled when hash < threshold
+static int64_t last;            // time of the last record
+static atomic_uint_least64_t recorded;
+static atomic_uint_least64_t skipped;
+static atomic_uint_least64_t bytes;
+
+bool capture_start(const char *path, struct capture_opts *opts) {
+    pthread_mutex_lock(&lock);
+    if (file) {
+        pthread_mutex_unlock(&lock);
+        errno = EBUSY;
+        return false;
+    }
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    setvbuf(f, 0, _IOFBF, 1<<20);
+    uint8_t hdr[CAPTURE_HDRSIZE] = { 0 };
+    memcpy(hdr, CAPTURE_MAGIC, 8);
+    write_u64(hdr+8, sys_unixnow());
+    hdr[16] = opts->hashkeys ? CAPTURE_HASHED : 0;
+    if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) {
+        fclose(f);
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    copts = *opts;
+    secret[0] = sys_seed();
+    secret[1] = sys_seed();
+    if (copts.sample >= 1) {
+        threshold = UINT64_MAX;
+    } else {
+        threshold = (uint64_t)(copts.sample*(double)UINT64_MAX);
+    }
+    last = sys_now();
+    atomic_store(&recorded, 0);
+    atomic_store(&skipped, 0);
+    atomic_store(&bytes, sizeof(hdr));
+    file = f;
+    atomic_store(&capturing, true);
+    pthread_mutex_unlock(&lock);
+    return true;
+}
+
+static void stop_locked(void) {
+    if (file) {
+        atomic_store(&capturing, false);
+        fclose(file);
+        file = 0;
+        memset(secret, 0, sizeof(secret));
+    }
+}
+
+void capture_stop(void) {
+    pthread_mutex_lock(&lock);
+    stop_locked();
+    pthread_mutex_unlock(&lock);
+}
+
+void capture_get_stats(struct capture_stats *stats) {
+    stats->active = atomic_load(&capturing);
+    stats->recorded = atomic_load(&recorded);
+    stats->skipped = atomic_load(&skipped);
+    stats->bytes = atomic_load(&bytes);
+}
+
+static uint64_t hash(const void *data, size_t len) {
+    return hashmap_sip(data, len, secret[0], secret[1]);
+}
+
+static void hexhash(uint64_t h, char out[CAPTURE_HASHLEN]) {
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < CAPTURE_HASHLEN; i++) {
+        out[i] = hex[(h>>(60-i*4))&15];
+    }
+}
+
+// Records one command. The first key is at args index 'firstkey', and
+// there are 'nkeys' keys in a row.
+void capture_command(uint64_t connid, int proto, struct args *args,
+    int firstkey, int nkeys)
+{
+    uint64_t h;
+    if (nkeys > 0) {
+        h = hash(args->bufs[firstkey].data, args->bufs[firstkey].len);
+    } else {
+        h = hash(&connid, sizeof(uint64_t));
+    }
+    if (h >= threshold) {
+        atomic_fetch_add(&skipped, 1);
+        return;
+    }
+    struct buf rec = { 0 };
+    uint8_t num[10];
+    buf_append(&rec, num, varint_write_u64(num, connid));
+    buf_append(&rec, num, varint_write_u64(num, proto));
+    buf_append(&rec, num, varint_write_u64(num, args->len));
+    for (size_t i = 0; i < args->len; i++) {
+        const char *data = args->bufs[i].data;
+        size_t len = args->bufs[i].len;
+        bool iskey = (int)i >= firstkey && (int)i < firstkey+nkeys;
+        char hkey[CAPTURE_HASHLEN];
+        if (copts.hashkeys && iskey) {
+            hexhash(hash(data, len), hkey);
+            data = hkey;
+            len = CAPTURE_HASHLEN;
+        }
+        bool elided = copts.hashkeys && !iskey && i > 0 && len > MAXKEPT;
+        buf_append(&rec, num, varint_write_u64(num, (len<<1)|elided));
+        if (!elided) {
+            buf_append(&rec, data, len);
+        }
+    }
+    pthread_mutex_lock(&lock);
+    if (file) {
+        int64_t now = sys_now();
+        int64_t delta = now > last ? (now-last)/MICROSECOND : 0;
+        last += delta*MICROSECOND;
+        int n = varint_write_u64(num, delta);
+        if (fwrite(num, 1, n, file) != (size_t)n ||
+            fwrite(rec.data, 1, rec.len, file) != rec.len)
+        {
+            printf("# Capture failed: %s\n", strerror(errno));
+            stop_locked();
+        } else {
+            atomic_fetch_add(&recorded, 1);
+            uint64_t total = atomic_fetch_add(&bytes, n+rec.len)+n+rec.len;
+            if (copts.maxbytes > 0 && total >= (uint64_t)copts.maxbytes) {
+                stop_locked();
+            }
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    buf_clear(&rec);
+}
@@ -0,0 +1,45 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "args.h"
+
+#define CAPTURE_MAGIC "POGOCAP1"
+#define CAPTURE_HDRSIZE 24
+#define CAPTURE_HASHED 1    // header flag, keys are hashed
+#define CAPTURE_HASHLEN 16  // length of a hashed key, in hex digits
+
+// Set while a capture is running, checked before calling capture_command.
+extern atomic_bool capturing;
+
+struct capture_opts {
+    double sample;      // fraction of keys to record, 0 to 1
+    bool hashkeys;      // replace keys with keyed hashes and elide values
+    int64_t maxbytes;   // stop after writing this many bytes, zero for none
+};
+
+struct capture_stats {
+    bool active;
+    uint64_t recorded;
+    uint64_t skipped;
+    uint64_t bytes;
+};
+
+bool capture_start(const char *path, struct capture_opts *opts);
+void capture_stop(void);
+void capture_get_stats(struct capture_stats *stats);
+void capture_command(uint64_t connid, int proto, struct args *args,
+    int firstkey, int nkeys);
+
+#endif
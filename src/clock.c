@@ -0,0 +1,187 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Coarse clock. Commands need the time for entry expiry, TTLs, and the LRU
+// stamps, and reading it from the system for every command adds up. Each
+// event loop thread instead reads it once per pass with clock_refresh() and
+// clock_now() returns that. The time seen by a command is when its pass
+// started, so it's behind by at most the time a pass takes, which is the
+// processing of up to --queuesize events. Threads that never refresh, such
+// as the background workers, read the time on each call. Durations that are
+// measured and printed should still use sys_now().
+//
+// The time is nanoseconds on the same monotonic clock as sys_now(). With
+// --clocksource tsc it's read from the x86 timestamp counter and converted
+// with a rate measured at startup. The ticker measures the rate again each
+// second and moves the anchor to the system clock, so the two never drift
+// apart by more than the counter does in a second. A thread's clock never
+// goes backwards when the anchor moves.
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "clock.h"
+#include "sys.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVETSC
+#endif
+
+#define CALWAIT 20000  // microseconds between the startup rate samples
+
+static bool usetsc = false;
+static __thread int64_t cached = 0;
+
+#ifdef HAVETSC
+
+// The anchor, guarded by a sequence count that's odd while it's written.
+static atomic_uint calseq = 0;
+static atomic_uint_fast64_t caltsc = 0;  // counter at the anchor
+static atomic_int_fast64_t calns = 0;    // system time at the anchor
+static atomic_uint_fast64_t calmult = 0; // nanoseconds per tick, 32.32
+
+// Last anchor, only used by the ticker.
+static uint64_t lasttsc = 0;
+static int64_t lastns = 0;
+
+static bool invariant(void) {
+    unsigned int a, b, c, d;
+    // Leaf 0x80000007, edx bit 8: the counter runs at a constant rate in
+    // every power state.
+    return __get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1<<8));
+}
+
+// Pairs the counter with the system time.
+static void sample(uint64_t *tsc, int64_t *ns) {
+    uint64_t t0 = __rdtsc();
+    *ns = sys_now();
+    uint64_t t1 = __rdtsc();
+    *tsc = t0+(t1-t0)/2;
+}
+
+static void anchor(uint64_t tsc, int64_t ns, uint64_t mult) {
+    unsigned seq = atomic_load_explicit(&calseq, __ATOMIC_RELAXED);
+    atomic_store_explicit(&calseq, seq+1, __ATOMIC_RELAXED);
+    atomic_thread_fence(__ATOMIC_RELEASE);
+    atomic_store_explicit(&caltsc, tsc, __ATOMIC_RELAXED);
+    atomic_store_explicit(&calns, ns, __ATOMIC_RELAXED);
+    atomic_store_explicit(&calmult, mult, __ATOMIC_RELAXED);
+    atomic_store_explicit(&calseq, seq+2, __ATOMIC_RELEASE);
+    lasttsc = tsc;
+    lastns = ns;
+}
+
+// Returns the rate between the last anchor and this one, or zero if the
+// counter didn't move forward.
+static uint64_t rate(uint64_t tsc, int64_t ns) {
+    if (tsc <= lasttsc || ns <= lastns) {
+        return 0;
+    }
+    return (uint64_t)(((unsigned __int128)(ns-lastns)<<32)/(tsc-lasttsc));
+}
+
+static int64_t tsc_now(void) {
+    unsigned seq;
+    uint64_t tsc0, mult;
+    int64_t ns;
+    do {
+        seq = atomic_load_explicit(&calseq, __ATOMIC_ACQUIRE);
+        tsc0 = atomic_load_explicit(&caltsc, __ATOMIC_RELAXED);
+        ns = atomic_load_explicit(&calns, __ATOMIC_RELAXED);
+        mult = atomic_load_explicit(&calmult, __ATOMIC_RELAXED);
+        atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq&1) || seq != atomic_load_explicit(&calseq,
+        __ATOMIC_RELAXED));
+    int64_t ticks = (int64_t)(__rdtsc()-tsc0);
+    return ns+(int64_t)(((__int128)ticks*mult)>>32);
+}
+
+static bool tsc_init(void) {
+    if (!invariant()) {
+        fprintf(stderr, "# The timestamp counter isn't invariant\n");
+        return false;
+    }
+    uint64_t tsc;
+    int64_t ns;
+    sample(&tsc, &ns);
+    lasttsc = tsc;
+    lastns = ns;
+    usleep(CALWAIT);
+    sample(&tsc, &ns);
+    uint64_t mult = rate(tsc, ns);
+    if (mult == 0) {
+        fprintf(stderr, "# The timestamp counter isn't running\n");
+        return false;
+    }
+    anchor(tsc, ns, mult);
+    return true;
+}
+
+#endif
+
+static int64_t readclock(void) {
+#ifdef HAVETSC
+    if (usetsc) {
+        return tsc_now();
+    }
+#endif
+    return sys_now();
+}
+
+// Picks the time source. Returns false if the timestamp counter was asked
+// for and can't be used, in which case the system clock is used.
+bool clock_init(bool tsc) {
+    usetsc = false;
+    if (!tsc) {
+        return true;
+    }
+#ifdef HAVETSC
+    usetsc = tsc_init();
+#else
+    fprintf(stderr, "# The timestamp counter is only supported on x86-64\n");
+#endif
+    return usetsc;
+}
+
+const char *clock_source(void) {
+    return usetsc ? "tsc" : "os";
+}
+
+// Reads the time and caches it for clock_now() on this thread.
+int64_t clock_refresh(void) {
+    int64_t now = readclock();
+    if (now > cached) {
+        cached = now;
+    }
+    return cached;
+}
+
+// Returns the time cached by the last clock_refresh() on this thread.
+int64_t clock_now(void) {
+    return cached > 0 ? cached : readclock();
+}
+
+// Called by the ticker about once a second.
+void clock_tick(void) {
+#ifdef HAVETSC
+    if (usetsc) {
+        uint64_t tsc;
+        int64_t ns;
+        sample(&tsc, &ns);
+        uint64_t mult = rate(tsc, ns);
+        if (mult > 0) {
+            anchor(tsc, ns, mult);
+        }
+    }
+#endif
+}
@@ -22,6 +22,8 @@
 #include <fcntl.h>
 #include <sys/resource.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <math.h>
 #include "save.h"
 #include "parse.h"
 #include "util.h"
@@ -31,13 +33,21 @@
 #include "xmalloc.h"
 #include "pogocache.h"
 #include "stats.h"
+#include "workload.h"
+#include "capture.h"
+#include "config.h"
+#include "defrag.h"
+#include "evictor.h"
+#include "livetune.h"
+#include "clock.h"
+#include "traffic.h"
+#include "ttlpolicy.h"
+#include "probes.h"
 
 // from main.c
 extern const uint64_t seed;
 extern const char *path;
-extern const int verb;
-extern const char *auth;
-extern const bool useauth;
+extern atomic_int verb;
 extern const char *persist;
 extern const int nthreads;
 extern const char *version;
@@ -45,13 +55,25 @@ extern const char *githash;
 extern atomic_int_fast64_t flush_delay;
 extern atomic_bool sweep;
 extern atomic_bool lowmem;
-extern const int nshards;
+extern atomic_bool useevict;
+extern atomic_size_t memlimit;
 extern const int narenas;
 extern const int64_t procstart;
 extern const int maxconns;
+extern const bool usesharednothing;
+extern const bool usebatching;
 
 extern struct pogocache *cache;
 
+// While the commands of a batch group are executing, this is the batch that
+// holds the lock for the group's shard. See evcommand_flush.
+static __thread struct pogocache *grpcache = 0;
+
+// Returns the cache handle for key operations of batchable commands.
+static struct pogocache *opcache(void) {
+    return grpcache ? grpcache : cache;
+}
+
 struct set_entry_context {
     bool written;
     struct conn *conn;
@@ -84,6 +106,8 @@ static void execSET(struct conn *conn, const char *cmdname,
     bool xx, bool get, bool keepttl, uint32_t flags, uint64_t cas, bool withcas)
 {
     stat_cmd_set_incr(conn);
+    // With KEEPTTL this is only used when there's no live entry to keep.
+    expires = ttlpolicy_expires(key, keylen, now, expires);
     struct set_entry_context ctx = { .conn = conn, .cmdname = cmdname };
     struct pogocache_store_opts opts = {
         .time = now,
@@ -95,10 +119,11 @@ static void execSET(struct conn *conn, const char *cmdname,
         .nx = nx,
         .xx = xx,
         .lowmem = atomic_load_explicit(&lowmem, __ATOMIC_ACQUIRE),
+        .noevict = !atomic_load_explicit(&useevict, __ATOMIC_RELAXED),
         .entry = get?set_entry:0,
         .udata = get?&ctx:0,
     };
-    int status = pogocache_store(cache, key, keylen, val, vallen, &opts);
+    int status = pogocache_store(opcache(), key, keylen, val, vallen, &opts);
     if (status == POGOCACHE_NOMEM) {
         stat_store_no_memory_incr(conn);
         conn_write_error(conn, ERR_OUT_OF_MEMORY);
@@ -184,7 +209,7 @@ static void cmdSET(struct conn *conn, struct args *args) {
         conn_write_error(conn, ERR_WRONG_NUM_ARGS);
         return;
     }
-    int64_t now = sys_now();
+    int64_t now = clock_now();
     const char *key = args->bufs[1].data;
     size_t keylen = args->bufs[1].len;
     const char *val = args->bufs[2].data;
@@ -300,7 +325,7 @@ static void cmdSETEX(struct conn *conn, struct args *args) {
         conn_write_error(conn, ERR_WRONG_NUM_ARGS);
         return;
     }
-    int64_t now = sys_now();
+    int64_t now = clock_now();
     int64_t ex = 0;
     const char *key = args->bufs[1].data;
     size_t keylen = args->bufs[1].len;
@@ -310,7 +335,7 @@ static void cmdSETEX(struct conn *conn, struct args *args) {
         return;
     }
     ex = int64_mul_clamp(ex, SECOND);
-    ex = int64_add_clamp(sys_now(), ex);
+    ex = int64_add_clamp(clock_now(), ex);
     const char *val = args->bufs[3].data;
     size_t vallen = args->bufs[3].len;
     execSET(conn, "SETEX", now, key, keylen, val, vallen, ex, 0, 0, 0, 0, 0, 0,
@@ -397,7 +422,7 @@ static void cmdGET(struct conn *conn, struct args *args) {
         conn_write_error(conn, ERR_WRONG_NUM_ARGS);
         return;
     }
-    int64_t now = sys_now();
+    int64_t now = clock_now();
     const char *key = args->bufs[1].data;
     size_t keylen = args->bufs[1].len;
     struct get_entry_context ctx = { 
@@ -405,6 +430,7 @@ static void cmdGET(struct conn *conn, struct args *args) {
     };
     struct pogocache_load_opts opts = {
         .time = now,
+        .readonly = true,
         .entry = get_entry,
         .udata = &ctx,
     };
@@ -412,7 +438,7 @@ static void cmdGET(struct conn *conn, struct args *args) {
     if (proto == PROTO_POSTGRES) {
         pg_write_row_desc(conn, (const char*[]){ "value" }, 1);
     }
-    int status = pogocache_load(cache, key, keylen, &opts);
+    int status = pogocache_load(opcache(), key, keylen, &opts);
     if (status == POGOCACHE_NOTFOUND) {
         stat_get_misses_incr(conn);
         if (proto == PROTO_HTTP) {
@@ -439,7 +465,7 @@ static void cmdMGET(struct conn *conn, struct args *args) {
         conn_write_error(conn, ERR_WRONG_NUM_ARGS);
         return;
     }
-    int64_t now = sys_now();
+    int64_t now = clock_now();
     struct get_entry_context ctx = { 
         .conn = conn,
         .mget = true,
@@ -447,6 +473,7 @@ static void cmdMGET(struct conn *conn, struct args *args) {
     };
     struct pogocache_load_opts opts = {
         .time = now,
+        .readonly = true,
         .entry = get_entry,
         .udata = &ctx,
     };
@@ -462,7 +489,7 @@ static void cmdMGET(struct conn *conn, struct args *args) {
         stat_cmd_get_incr(conn);
         const char *key = args->bufs[i].data;
         size_t keylen = args->bufs[i].len;
-        int status = pogocache_load(cache, key, keylen, &opts);
+        int status = pogocache_load(opcache(), key, keylen, &opts);
         if (status == POGOCACHE_NOTFOUND) {
             stat_get_misses_incr(conn);
             if (proto == PROTO_RESP) {
@@ -587,7 +614,7 @@ static void cmdKEYS(struct conn *conn, struct args *args) {
         conn_write_error(conn, ERR_WRONG_NUM_ARGS);
         return;
     }
-    int64_t now = sys_now();
+    int64_t now = clock_now();
     const char *pattern = args->bufs[1].data;
     size_t plen = args->bufs[1].len;
     struct keys_ctx *ctx = xmalloc(sizeof(struct keys_ctx));
@@ -608,7 +635,7 @@ static void cmdDEL(struct conn *conn, struct args *args) {
         conn_write_error(conn, ERR_WRONG_NUM_ARGS);
         return;
     }
-    int64_t now = sys_now();
+    int64_t now = clock_now();
     struct pogocache_delete_opts opts = {
         .time = now,
     };
@@ -653,7 +680,7 @@ static void cmdDBSIZE(struct conn *conn, struct args *args) {
         conn_write_error(conn, ERR_WRONG_NUM_ARGS);
         return;
     }
-    struct pogocache_count_opts opts = { .time = sys_now() };
+    struct pogocache_count_opts opts = { .time = clock_now() };
     size_t count = pogocache_count(cache, &opts);
     if (conn_proto(conn) == PROTO_POSTGRES) {
         pg_write_simple_row_i64_ready(conn, "count", count, "DBSIZE");
@@ -683,6 +710,9 @@ static void bgflushwork(void *udata) {
     (void)udata;
     atomic_store(&flush_delay, 0);
     int64_t now = sys_now();
+    // Keep the shards from being split while they're cleared in ranges.
+    pogocache_pin(cache);
+    int nshards = pogocache_nshards(cache);
     int nprocs = sys_nprocs();
     if (nprocs > nshards) {
         nprocs = nshards;
@@ -715,6 +745,7 @@ static void bgflushwork(void *udata) {
             pthread_join(ctx->th, 0);
         }
     }
+    pogocache_unpin(cache);
     xfree(ctxs);
 }
 
@@ -766,7 +797,7 @@ static void cmdFLUSHALL(struct conn *conn, struct args *args) {
             delay = 0;
         }
         delay = int64_mul_clamp(delay, SECOND);
-        delay = int64_add_clamp(delay, sys_now());
+        delay = int64_add_clamp(delay, clock_now());
         atomic_store(&flush_delay, delay);
         // ticker will check the delay and perform the flush
         if (conn_proto(conn) == PROTO_POSTGRES) {
@@ -779,7 +810,9 @@ static void cmdFLUSHALL(struct conn *conn, struct args *args) {
         }
     } else {
         // Flush database is slow. cmdname is static and thread safe
-        conn_bgwork(conn, bgflushwork, bgflushdone, (void*)cmdname);
+        if (!conn_bgwork(conn, bgflushwork, bgflushdone, (void*)cmdname)) {
+            conn_write_error(conn, "ERR failed to do work");
+        }
         return;
     }
     return;
@@ -790,7 +823,7 @@ err_syntax:
 
 struct bgsaveloadctx {
     bool ok;          // true = success, false = out of disk space
-    bool fast;        // use all the proccesing power, otherwise one thread.
+    int nthreads;     // number of threads, zero for one per processor
     char *path;       // path to file
     bool load;        // otherwise save
 };
@@ -800,9 +833,9 @@ static void bgsaveloadwork(void *udata) {
     int64_t start = sys_now();
     int status;
     if (ctx->load) {
-        status = load(ctx->path, ctx->fast, 0);
+        status = load(ctx->path, ctx->nthreads, 0);
     } else {
-        status = save(ctx->path, ctx->fast);
+        status = save(ctx->path, ctx->nthreads);
     }
     printf(". %s finished %.3f secs\n", ctx->load?"load":"save", 
         (sys_now()-start)/1e9);
@@ -831,16 +864,23 @@ static void bgsaveloaddone(struct conn *conn, void *udata) {
     xfree(ctx);
 }
 
-// SAVE [TO <path>] [FAST]
-// LOAD [FROM <path>] [FAST]
+// SAVE [TO <path>] [FAST] [THREADS <n>]
+// LOAD [FROM <path>] [FAST] [THREADS <n>]
 static void cmdSAVELOAD(struct conn *conn, struct args *args) {
     bool load = argeq(args, 0, "load");
-    bool fast = false;
+    int64_t nthreads = 1;
     const char *path = persist;
     size_t plen = strlen(persist);
     for (size_t i = 1; i < args->len; i++) {
         if (argeq(args, i, "fast")) {
-            fast = true;
+            nthreads = 0;
+        } else if (argeq(args, i, "threads")) {
+            i++;
+            if (i == args->len || !argi64(args, i, &nthreads) ||
+                nthreads < 1 || nthreads > 1024)
+            {
+                goto err_syntax;
+            }
         } else if ((load && argeq(args, i, "from")) || 
             (!load && argeq(args, i, "to")))
         {
@@ -860,7 +900,7 @@ static void cmdSAVELOAD(struct conn *conn, struct args *args) {
     }
     struct bgsaveloadctx *ctx = xmalloc(sizeof(struct bgsaveloadctx));
     memset(ctx, 0, sizeof(struct bgsaveloadctx));
-    ctx->fast = fast;
+    ctx->nthreads = nthreads;
     ctx->path = xmalloc(plen+1);
     ctx->load = load;
     memcpy(ctx->path, path, plen);
@@ -919,7 +959,7 @@ static void cmdTTL(struct conn *conn, struct args *args) {
     bool pttl = argeq(args, 0, "pttl");
     struct ttlctx ctx = { .conn = conn, .pttl = pttl };
     struct pogocache_load_opts opts = {
-        .time = sys_now(),
+        .time = clock_now(),
         .entry = ttl_entry,
         .notouch = true,
         .udata = &ctx,
@@ -963,7 +1003,7 @@ static void cmdEXPIRE(struct conn *conn, struct args *args) {
         conn_write_error(conn, ERR_WRONG_NUM_ARGS);
         return;
     }
-    int64_t now = sys_now();
+    int64_t now = clock_now();
     const char *key = args->bufs[1].data;
     size_t keylen = args->bufs[1].len;
     int64_t expires;
@@ -973,6 +1013,7 @@ static void cmdEXPIRE(struct conn *conn, struct args *args) {
     }
     expires = int64_mul_clamp(expires, POGOCACHE_SECOND);
     expires = int64_add_clamp(now, expires);
+    expires = ttlpolicy_expires(key, keylen, now, expires);
     struct pogocache_update ctx = { .expires = expires };
     struct pogocache_load_opts lopts = { 
         .time = now,
@@ -997,7 +1038,7 @@ static void cmdEXISTS(struct conn *conn, struct args *args) {
         conn_write_error(conn, ERR_WRONG_NUM_ARGS);
         return;
     }
-    int64_t now = sys_now();
+    int64_t now = clock_now();
     int64_t count = 0;
     struct pogocache_load_opts opts = {
         .time = now,
@@ -1157,6 +1198,7 @@ struct populate_ctx {
     bool randex;
     int randmin;
     int randmax;
+    uint64_t seed;
 };
 
 static void *populate_entry(void *arg) {
@@ -1172,7 +1214,10 @@ static void *populate_entry(void *arg) {
             .time = now,
         };
         if (ctx->randex) {
-            int ex = (rand()%(ctx->randmax-ctx->randmin))+ctx->randmin;
+            int ex = ctx->randmin;
+            if (ctx->randmax > ctx->randmin) {
+                ex += rand_next(&ctx->seed)%(ctx->randmax-ctx->randmin);
+            }
             opts.ttl = ex*POGOCACHE_SECOND;
         }
         pogocache_store(cache, key, keylen, ctx->val, ctx->vallen, &opts);
@@ -1229,8 +1274,10 @@ static void cmdDEBUG_populate(struct conn *conn, struct args *args) {
     memset(ctxs, 0, nprocs*sizeof(struct populate_ctx));
     size_t group = count/nprocs;
     size_t start = 0;
+    uint64_t seed = sys_seed();
     for (int i = 0; i < nprocs; i++) {
         struct populate_ctx *ctx = &ctxs[i];
+        ctx->seed = rand_next(&seed);
         ctx->start = start;
         if (i == nprocs-1) {
             ctx->count = count-start;
@@ -1271,6 +1318,228 @@ static void cmdDEBUG_populate(struct conn *conn, struct args *args) {
     }
 }
 
+// Copies the argument at idx into a C string. Returns false when it does
+// not fit.
+static bool argstr(struct args *args, int idx, char *buf, size_t cap) {
+    size_t len = args->bufs[idx].len;
+    if (len >= cap) {
+        return false;
+    }
+    memcpy(buf, args->bufs[idx].data, len);
+    buf[len] = '\0';
+    return true;
+}
+
+// DEBUG WORKLOAD <count> <prefix> [KEYS SEQ|UNIFORM|ZIPF|HOTSET]
+//     [THETA <skew>] [HOT <keys-pct> <stores-pct>] [KEYSPACE <n>]
+//     [SIZE <n>|<min-max>|<n:weight,...>] [DATA ZERO|TEXT|RANDOM]
+//     [TTL <min-max>] [TTLPCT <pct>] [HISTOGRAM <path>]
+// DEBUG WORKLOAD 1000000 user KEYS ZIPF SIZE 16:70,256:25,4096:5 DATA TEXT
+// DEBUG WORKLOAD 1000000 sess HISTOGRAM /tmp/prod.hist DATA RANDOM
+// The count is the number of stores. Keys other than SEQ repeat, so they
+// leave fewer keys than that.
+static void cmdDEBUG_workload(struct conn *conn, struct args *args) {
+    if (args->len < 3) {
+        conn_write_error(conn, ERR_WRONG_NUM_ARGS);
+        return;
+    }
+    int64_t count;
+    if (!argi64(args, 1, &count) || count < 0) {
+        conn_write_error(conn, ERR_SYNTAX_ERROR);
+        return;
+    }
+    struct workload wl;
+    workload_init(&wl, count, args->bufs[2].data, args->bufs[2].len);
+    char *histpath = 0;
+    char str[256];
+    for (size_t i = 3; i < args->len; i++) {
+        if (i+1 == args->len) {
+            goto err_syntax;
+        }
+        if (argeq(args, i, "keys")) {
+            i++;
+            if (argeq(args, i, "seq")) {
+                wl.keys = WORKLOAD_SEQ;
+            } else if (argeq(args, i, "uniform")) {
+                wl.keys = WORKLOAD_UNIFORM;
+            } else if (argeq(args, i, "zipf")) {
+                wl.keys = WORKLOAD_ZIPF;
+            } else if (argeq(args, i, "hotset")) {
+                wl.keys = WORKLOAD_HOTSET;
+            } else {
+                goto err_syntax;
+            }
+        } else if (argeq(args, i, "theta")) {
+            i++;
+            if (!argstr(args, i, str, sizeof(str))) {
+                goto err_syntax;
+            }
+            wl.theta = strtod(str, 0);
+            if (!(wl.theta > 0 && wl.theta < 1)) {
+                goto err_syntax;
+            }
+        } else if (argeq(args, i, "hot")) {
+            int64_t keyspct, storespct;
+            if (i+2 >= args->len || !argi64(args, i+1, &keyspct) || 
+                !argi64(args, i+2, &storespct) || keyspct < 1 || 
+                keyspct > 100 || storespct < 0 || storespct > 100)
+            {
+                goto err_syntax;
+            }
+            wl.hotkeys = keyspct/100.0;
+            wl.hotops = storespct/100.0;
+            i += 2;
+        } else if (argeq(args, i, "keyspace")) {
+            i++;
+            if (!argi64(args, i, &wl.keyspace) || wl.keyspace < 1) {
+                goto err_syntax;
+            }
+        } else if (argeq(args, i, "size")) {
+            i++;
+            if (!argstr(args, i, str, sizeof(str)) || 
+                !workload_parse_sizes(&wl, str))
+            {
+                goto err_syntax;
+            }
+        } else if (argeq(args, i, "data")) {
+            i++;
+            if (argeq(args, i, "zero")) {
+                wl.data = WORKLOAD_ZERO;
+            } else if (argeq(args, i, "text")) {
+                wl.data = WORKLOAD_TEXT;
+            } else if (argeq(args, i, "random")) {
+                wl.data = WORKLOAD_RANDOM;
+            } else {
+                goto err_syntax;
+            }
+        } else if (argeq(args, i, "ttl")) {
+            i++;
+            if (!argstr(args, i, str, sizeof(str))) {
+                goto err_syntax;
+            }
+            char *end;
+            wl.ttlmin = strtoll(str, &end, 10);
+            wl.ttlmax = wl.ttlmin;
+            if (*end == '-') {
+                wl.ttlmax = strtoll(end+1, &end, 10);
+            }
+            if (*end || wl.ttlmin < 1 || wl.ttlmax < wl.ttlmin) {
+                goto err_syntax;
+            }
+        } else if (argeq(args, i, "ttlpct")) {
+            i++;
+            int64_t pct;
+            if (!argi64(args, i, &pct) || pct < 0 || pct > 100) {
+                goto err_syntax;
+            }
+            wl.ttlpct = pct;
+        } else if (argeq(args, i, "histogram")) {
+            i++;
+            xfree(histpath);
+            histpath = xmalloc(args->bufs[i].len+1);
+            memcpy(histpath, args->bufs[i].data, args->bufs[i].len);
+            histpath[args->bufs[i].len] = '\0';
+        } else {
+            goto err_syntax;
+        }
+    }
+    if (histpath) {
+        if (!workload_load_histogram(&wl, histpath)) {
+            xfree(histpath);
+            conn_write_error(conn, "ERR invalid or missing histogram file");
+            return;
+        }
+        xfree(histpath);
+    }
+    workload_run(&wl);
+    workload_free(&wl);
+    if (conn_proto(conn) == PROTO_POSTGRES) {
+        pg_write_completef(conn, "DEBUG WORKLOAD %" PRIi64, count);
+        pg_write_ready(conn, 'I');
+    } else {
+        conn_write_string(conn, "OK");
+    }
+    return;
+err_syntax:
+    xfree(histpath);
+    workload_free(&wl);
+    conn_write_error(conn, ERR_SYNTAX_ERROR);
+}
+
+// DEBUG CAPTURE START <path> [SAMPLE <ratio>] [HASHKEYS] [MAXBYTES <n>]
+// DEBUG CAPTURE STOP
+// DEBUG CAPTURE STATUS
+static void cmdDEBUG_capture(struct conn *conn, struct args *args) {
+    if (args->len < 2) {
+        conn_write_error(conn, ERR_WRONG_NUM_ARGS);
+        return;
+    }
+    if (argeq(args, 1, "stop") && args->len == 2) {
+        capture_stop();
+    } else if (argeq(args, 1, "status") && args->len == 2) {
+        struct capture_stats stats;
+        capture_get_stats(&stats);
+        char line[256];
+        snprintf(line, sizeof(line), "active=%s recorded=%" PRIu64 
+            " skipped=%" PRIu64 " bytes=%" PRIu64, stats.active?"yes":"no",
+            stats.recorded, stats.skipped, stats.bytes);
+        if (conn_proto(conn) == PROTO_POSTGRES) {
+            pg_write_simple_row_str_ready(conn, "capture", line, 
+                "DEBUG CAPTURE");
+        } else {
+            conn_write_bulk_cstr(conn, line);
+        }
+        return;
+    } else if (argeq(args, 1, "start") && args->len >= 3) {
+        char path[PATH_MAX];
+        if (!argstr(args, 2, path, sizeof(path))) {
+            goto err_syntax;
+        }
+        struct capture_opts opts = { .sample = 1 };
+        for (size_t i = 3; i < args->len; i++) {
+            char str[64];
+            if (argeq(args, i, "hashkeys")) {
+                opts.hashkeys = true;
+            } else if (argeq(args, i, "sample") && i+1 < args->len) {
+                i++;
+                if (!argstr(args, i, str, sizeof(str))) {
+                    goto err_syntax;
+                }
+                char *end;
+                opts.sample = strtod(str, &end);
+                if (*end || !(opts.sample > 0 && opts.sample <= 1)) {
+                    goto err_syntax;
+                }
+            } else if (argeq(args, i, "maxbytes") && i+1 < args->len) {
+                i++;
+                if (!argi64(args, i, &opts.maxbytes) || opts.maxbytes < 0) {
+                    goto err_syntax;
+                }
+            } else {
+                goto err_syntax;
+            }
+        }
+        if (!capture_start(path, &opts)) {
+            char errmsg[256];
+            snprintf(errmsg, sizeof(errmsg), "ERR capture failed: %s", 
+                errno == EBUSY ? "already capturing" : strerror(errno));
+            conn_write_error(conn, errmsg);
+            return;
+        }
+    } else {
+        goto err_syntax;
+    }
+    if (conn_proto(conn) == PROTO_POSTGRES) {
+        pg_write_completef(conn, "DEBUG CAPTURE");
+        pg_write_ready(conn, 'I');
+    } else {
+        conn_write_string(conn, "OK");
+    }
+    return;
+err_syntax:
+    conn_write_error(conn, ERR_SYNTAX_ERROR);
+}
+
 struct dbg_detach_ctx {
     int64_t now;
     int64_t then;
@@ -1308,6 +1577,81 @@ static void cmdDEBUG_detach(struct conn *conn, struct args *args) {
     }
 }
 
+// Storage details of a single key, loaded without touching the entry.
+struct keyinfo {
+    struct pogocache_entry_info info;
+    int shard;
+    int64_t now;
+    size_t keylen;
+    size_t vallen;
+    int64_t expires;
+    uint32_t flags;
+    uint64_t cas;
+};
+
+static void keyinfo_entry(int shard, int64_t time, const void *key,
+    size_t keylen, const void *value, size_t valuelen, int64_t expires,
+    uint32_t flags, uint64_t cas, struct pogocache_update **update, void *udata)
+{
+    (void)key, (void)value, (void)update;
+    struct keyinfo *ki = udata;
+    ki->shard = shard;
+    ki->now = time;
+    ki->keylen = keylen;
+    ki->vallen = valuelen;
+    ki->expires = expires;
+    ki->flags = flags;
+    ki->cas = cas;
+}
+
+static bool keyinfo_load(struct args *args, int idx, struct keyinfo *ki) {
+    memset(ki, 0, sizeof(struct keyinfo));
+    struct pogocache_load_opts opts = {
+        .time = clock_now(),
+        .notouch = true,
+        .info = &ki->info,
+        .entry = keyinfo_entry,
+        .udata = ki,
+    };
+    return pogocache_load(cache, args->bufs[idx].data, args->bufs[idx].len,
+        &opts) == POGOCACHE_FOUND;
+}
+
+// Values are always stored inline with the entry, so the encoding is that
+// of the key.
+static const char *keyinfo_encoding(struct keyinfo *ki) {
+    return ki->info.sixpacked ? "sixpack" : "raw";
+}
+
+// DEBUG OBJECT key
+static void cmdDEBUG_object(struct conn *conn, struct args *args) {
+    if (args->len != 2) {
+        conn_write_error(conn, ERR_SYNTAX_ERROR);
+        return;
+    }
+    struct keyinfo ki;
+    if (!keyinfo_load(args, 1, &ki)) {
+        conn_write_error(conn, "ERR no such key");
+        return;
+    }
+    double ttl = ki.expires > 0 ? (ki.expires-ki.now)/1e9 : -1;
+    char line[512];
+    snprintf(line, sizeof(line), "shard:%d encoding:%s keylen:%zu "
+        "stored_keylen:%zu vallen:%zu memsize:%zu usable:%zu bucket:%zu "
+        "dib:%d idle:%.3f ttl:%.3f flags:%" PRIu32 " cas:%" PRIu64,
+        ki.shard, keyinfo_encoding(&ki), ki.keylen, ki.info.rawkeylen,
+        ki.vallen, ki.info.memsize, ki.info.usable, ki.info.bucketsize,
+        ki.info.dib, ki.info.idle/1e9, ttl, ki.flags, ki.cas);
+    if (conn_proto(conn) == PROTO_POSTGRES) {
+        pg_write_simple_row_str_ready(conn, "object", line, "DEBUG");
+    } else {
+        conn_write_string(conn, line);
+    }
+}
+
+// defined below, next to the stats helpers it uses.
+static void cmdDEBUG_shards(struct conn *conn, struct args *args);
+
 // DEBUG subcommand (args...)
 static void cmdDEBUG(struct conn *conn, struct args *args) {
     if (args->len <= 1) {
@@ -1318,6 +1662,14 @@ static void cmdDEBUG(struct conn *conn, struct args *args) {
     args = &(struct args){ .bufs = args->bufs+1, .len = args->len-1 };
     if (argeq(args, 0, "populate")) {
         cmdDEBUG_populate(conn, args);
+    } else if (argeq(args, 0, "workload")) {
+        cmdDEBUG_workload(conn, args);
+    } else if (argeq(args, 0, "capture")) {
+        cmdDEBUG_capture(conn, args);
+    } else if (argeq(args, 0, "object")) {
+        cmdDEBUG_object(conn, args);
+    } else if (argeq(args, 0, "shards")) {
+        cmdDEBUG_shards(conn, args);
     } else if (argeq(args, 0, "detach")) {
         cmdDEBUG_detach(conn, args);
     } else {
@@ -1373,7 +1725,7 @@ static void cmdTOUCH(struct conn *conn, struct args *args) {
         conn_write_error(conn, ERR_WRONG_NUM_ARGS);
         return;
     }
-    int64_t now = sys_now();
+    int64_t now = clock_now();
     int64_t touched = 0;
     struct pogocache_load_opts opts = { 
         .time = now,
@@ -1436,7 +1788,7 @@ static void execINCRDECR(struct conn *conn, const char *key, size_t keylen,
 {
     bool hit = false;
     bool miss = false;
-    int64_t now = sys_now();
+    int64_t now = clock_now();
     struct get64ctx ctx = { .isunsigned = isunsigned };
     struct pogocache *batch = pogocache_begin(cache);
     struct pogocache_load_opts gopts = {
@@ -1486,7 +1838,8 @@ static void execINCRDECR(struct conn *conn, const char *key, size_t keylen,
     }
     struct pogocache_store_opts sopts = {
         .time = now,
-        .expires = ctx.expires, 
+        .expires = found ? ctx.expires :
+            ttlpolicy_expires(key, keylen, now, 0),
         .flags = ctx.flags, 
         .cas = ctx.cas,
         .udata = &ctx,
@@ -1634,7 +1987,7 @@ static void append_entry(int shard, int64_t time, const void *key,
 
 // APPEND <key> <value>
 static void cmdAPPEND(struct conn *conn, struct args *args) {
-    int64_t now = sys_now();
+    int64_t now = clock_now();
     if (args->len != 3) {
         conn_write_error(conn, ERR_WRONG_NUM_ARGS);
         return;
@@ -1667,6 +2020,7 @@ static void cmdAPPEND(struct conn *conn, struct args *args) {
         len = vallen;
         struct pogocache_store_opts sopts = {
             .time = now,
+            .expires = ttlpolicy_expires(key, keylen, now, 0),
         };
         status = pogocache_store(batch, key, keylen, val, vallen, &sopts);
     } else {
@@ -1727,8 +2081,9 @@ static void cmdAUTH(struct conn *conn, struct args *args) {
         conn_write_error(conn, ERR_WRONG_NUM_ARGS);
         return;
     }
-    if (args->bufs[1].len != strlen(auth) || 
-        memcmp(auth, args->bufs[1].data, args->bufs[1].len) != 0)
+    const char *password = conn_password(conn);
+    if (args->bufs[1].len != strlen(password) || 
+        memcmp(password, args->bufs[1].data, args->bufs[1].len) != 0)
     {
         stat_auth_errors_incr(0);
         goto wrongpass;
@@ -1822,6 +2177,7 @@ static void stats(struct conn *conn) {
     stats_printf(&stats, "pid %d", getpid());
     stats_printf(&stats, "uptime %.0f", (sys_now()-procstart)/1e9);
     stats_printf(&stats, "time %.0f", sys_unixnow()/1e9);
+    stats_printf(&stats, "clock_source %s", clock_source());
     stats_printf(&stats, "product %s", "pogocache");
     stats_printf(&stats, "version %s", version);
     stats_printf(&stats, "githash %s", githash);
@@ -1837,6 +2193,32 @@ static void stats(struct conn *conn) {
     stats_printf(&stats, "curr_connections %zu", net_nconns());
     stats_printf(&stats, "total_connections %zu", net_tconns());
     stats_printf(&stats, "rejected_connections %zu", net_rconns());
+    int nlisteners = net_nlisteners();
+    for (int i = 0; i < nlisteners; i++) {
+        struct net_listenstats ls;
+        net_listenstats(i, &ls);
+        if (ls.name) {
+            stats_printf(&stats, "listener_%s_connections %zu", ls.name,
+                ls.conns);
+            stats_printf(&stats, "listener_%s_total_connections %" PRIu64,
+                ls.name, ls.accepted);
+            stats_printf(&stats, "listener_%s_rejected_connections %" PRIu64,
+                ls.name, ls.rejected);
+        }
+    }
+    int nclasses = traffic_nclasses();
+    for (int i = 0; i < nclasses; i++) {
+        struct traffic_stats ts;
+        traffic_stats(i, &ts);
+        stats_printf(&stats, "class_%s_connections %zu", ts.name, ts.conns);
+        stats_printf(&stats, "class_%s_deferred %" PRIu64, ts.name,
+            ts.deferred);
+        stats_printf(&stats, "class_%s_shed %" PRIu64, ts.name, ts.shed);
+        stats_printf(&stats, "class_%s_bg_shed %" PRIu64, ts.name,
+            ts.bgshed);
+        stats_printf(&stats, "class_%s_bg_running %d", ts.name,
+            ts.bgrunning);
+    }
     stats_printf(&stats, "cmd_get %" PRIu64, stat_cmd_get());
     stats_printf(&stats, "cmd_set %" PRIu64, stat_cmd_set());
     stats_printf(&stats, "cmd_flush %" PRIu64, stat_cmd_flush());
@@ -1855,10 +2237,56 @@ static void stats(struct conn *conn) {
     stats_printf(&stats, "store_no_memory %" PRIu64, stat_store_no_memory());
     stats_printf(&stats, "auth_cmds %" PRIu64, stat_auth_cmds());
     stats_printf(&stats, "auth_errors %" PRIu64, stat_auth_errors());
-    stats_printf(&stats, "threads %d", nthreads);
+    stats_printf(&stats, "threads %d", net_nthreads());
+    stats_printf(&stats, "shards %d", pogocache_nshards(cache));
+    stats_printf(&stats, "shared_nothing %s", usesharednothing?"yes":"no");
+    stats_printf(&stats, "cmd_forwarded %" PRIu64, stat_cmd_forwarded());
+    stats_printf(&stats, "idle_closed %" PRIu64, stat_idle_closed());
+    stats_printf(&stats, "idle_compacted %" PRIu64, stat_idle_compacted());
+    struct net_loopstats loop;
+    net_loopstats(&loop);
+    stats_printf(&stats, "loop_passes %" PRIu64, loop.passes);
+    stats_printf(&stats, "loop_events %" PRIu64, loop.events);
+    stats_printf(&stats, "loop_full_passes %" PRIu64, loop.fullpasses);
+    stats_printf(&stats, "write_stalls %" PRIu64, loop.writestalls);
+    stats_printf(&stats, "queuesize %d", net_queuesize());
+    stats_printf(&stats, "busypoll %d", net_busypoll());
+    struct pogocache_counters counters;
+    pogocache_counters(cache, &counters);
+    stats_printf(&stats, "evictions %" PRIu64, counters.evictions);
+    struct evictor_stats estats;
+    evictor_stats(&estats);
+    stats_printf(&stats, "bg_evictions %" PRIu64, estats.evicted);
+    stats_printf(&stats, "bg_evicted_bytes %" PRIu64, estats.freed);
+    stats_printf(&stats, "bg_evict_rate %" PRIu64, estats.rate);
+    stats_printf(&stats, "lock_waits %" PRIu64, counters.lockwaits);
+    stats_printf(&stats, "map_grows %" PRIu64, counters.grows);
+    stats_printf(&stats, "map_shrinks %" PRIu64, counters.shrinks);
+    stats_printf(&stats, "hot_reads %" PRIu64, counters.hotreads);
+    stats_printf(&stats, "hot_promotions %" PRIu64, counters.hotpromotions);
+    struct ttlpolicy_stats tstats;
+    ttlpolicy_stats(&tstats);
+    stats_printf(&stats, "ttl_policies %d", tstats.policies);
+    stats_printf(&stats, "ttl_defaulted %" PRIu64, tstats.defaulted);
+    stats_printf(&stats, "ttl_capped %" PRIu64, tstats.capped);
+    stats_printf(&stats, "ttl_jittered %" PRIu64, tstats.jittered);
+    stats_printf(&stats, "livetune_changes %" PRIu64, livetune_decisions());
     struct sys_meminfo meminfo;
     sys_getmeminfo(&meminfo);
     stats_printf(&stats, "rss %zu", meminfo.rss);
+    struct defrag_stats dstats;
+    defrag_stats(&dstats);
+    stats_printf(&stats, "frag_ratio %.2f", defrag_ratio());
+    stats_printf(&stats, "defrag_cycles %" PRIu64, dstats.cycles);
+    stats_printf(&stats, "defrag_moved %" PRIu64, dstats.moved);
+    stats_printf(&stats, "defrag_moved_bytes %" PRIu64, dstats.movedbytes);
+    size_t limit = atomic_load(&memlimit);
+    if (limit < SIZE_MAX && estats.usage > 0) {
+        // Room left under maxmemory, by the evictors' estimate.
+        stats_printf(&stats, "mem_usage %zu", estats.usage);
+        stats_printf(&stats, "mem_headroom %zu",
+            estats.usage < limit ? limit-estats.usage : 0);
+    }
     struct pogocache_size_opts sopts = { .entriesonly=true };
     stats_printf(&stats, "bytes %zu", pogocache_size(cache, &sopts));
     stats_printf(&stats, "curr_items %zu", pogocache_count(cache, 0));
@@ -1874,53 +2302,508 @@ static void cmdSTATS(struct conn *conn, struct args *args) {
     return;
 }
 
+// Structural statistics of the cache are collected by a background worker
+// because every entry is visited, one shard at a time.
+#define MEMSTATS_ALL    0 // MEMORY STATS
+#define MEMSTATS_SHARD  1 // DEBUG SHARDS index
+#define MEMSTATS_SHARDS 2 // DEBUG SHARDS
+
+struct memstats_ctx {
+    int mode;
+    int shardidx;
+    struct stats stats;
+};
+
+static double ratio(double a, double b) {
+    return b == 0 ? 0 : a/b;
+}
+
+static void memstats_hist(struct stats *stats, const char *name, 
+    size_t hist[POGOCACHE_NHIST])
+{
+    for (int i = 0; i < POGOCACHE_NHIST; i++) {
+        if (hist[i] == 0) {
+            continue;
+        }
+        size_t lo = i == 0 ? 0 : (size_t)1<<(i-1);
+        size_t hi = ((size_t)1<<i)-1;
+        if (i == POGOCACHE_NHIST-1) {
+            stats_printf(stats, "%s_%zu+ %zu", name, lo, hist[i]);
+        } else if (lo >= hi) {
+            stats_printf(stats, "%s_%zu %zu", name, lo, hist[i]);
+        } else {
+            stats_printf(stats, "%s_%zu-%zu %zu", name, lo, hi, hist[i]);
+        }
+    }
+}
+
+static void memstats_summary(struct stats *stats, struct pogocache_stats *ps) {
+    stats_printf(stats, "entries %zu", ps->count);
+    stats_printf(stats, "buckets %zu", ps->nbuckets);
+    stats_printf(stats, "load_factor %.3f", ratio(ps->count, ps->nbuckets));
+    stats_printf(stats, "max_dib %d", ps->maxdib);
+    stats_printf(stats, "avg_dib %.3f", ratio(ps->dibsum, ps->count));
+    stats_printf(stats, "entry_bytes %zu", ps->entsize);
+    stats_printf(stats, "entry_usable_bytes %zu", ps->entusable);
+    stats_printf(stats, "map_bytes %zu", ps->mapsize);
+    stats_printf(stats, "map_usable_bytes %zu", ps->mapusable);
+    if (ps->entusable > 0) {
+        // The bytes the allocator reserved beyond what the entries asked for.
+        stats_printf(stats, "entry_overhead_bytes %zu",
+            ps->entusable-ps->entsize);
+        stats_printf(stats, "entry_overhead_ratio %.3f",
+            ratio(ps->entusable, ps->entsize));
+    }
+}
+
+static void memstats_work(void *udata) {
+    struct memstats_ctx *ctx = udata;
+    struct stats *stats = &ctx->stats;
+    struct pogocache_stats ps;
+    if (ctx->mode == MEMSTATS_SHARD) {
+        struct pogocache_stats_opts opts = {
+            .oneshard = true,
+            .oneshardidx = ctx->shardidx,
+        };
+        pogocache_stats(cache, &ps, &opts);
+        stats_printf(stats, "shard %d", ctx->shardidx);
+        memstats_summary(stats, &ps);
+        memstats_hist(stats, "key_len", ps.keyhist);
+        memstats_hist(stats, "value_len", ps.valhist);
+        return;
+    }
+    // Visit each shard on its own to find the skew between them.
+    struct pogocache_stats total = { 0 };
+    size_t mincount = SIZE_MAX;
+    size_t maxcount = 0;
+    int maxshard = 0;
+    int maxdibshard = 0;
+    double sumsq = 0;
+    int nshards = pogocache_nshards(cache);
+    for (int i = 0; i < nshards; i++) {
+        struct pogocache_stats_opts opts = {
+            .oneshard = true,
+            .oneshardidx = i,
+        };
+        pogocache_stats(cache, &ps, &opts);
+        if (ctx->mode == MEMSTATS_SHARDS) {
+            stats_printf(stats, "shard_%d entries=%zu buckets=%zu load=%.3f "
+                "max_dib=%d avg_dib=%.3f bytes=%zu usable=%zu", i, ps.count,
+                ps.nbuckets, ratio(ps.count, ps.nbuckets), ps.maxdib,
+                ratio(ps.dibsum, ps.count), ps.entsize, ps.entusable);
+            continue;
+        }
+        mincount = ps.count < mincount ? ps.count : mincount;
+        if (ps.count > maxcount) {
+            maxcount = ps.count;
+            maxshard = i;
+        }
+        if (ps.maxdib > total.maxdib) {
+            maxdibshard = i;
+        }
+        sumsq += (double)ps.count*ps.count;
+        total.nshards += ps.nshards;
+        total.count += ps.count;
+        total.nbuckets += ps.nbuckets;
+        total.maxdib = ps.maxdib > total.maxdib ? ps.maxdib : total.maxdib;
+        total.dibsum += ps.dibsum;
+        total.entsize += ps.entsize;
+        total.entusable += ps.entusable;
+        total.mapsize += ps.mapsize;
+        total.mapusable += ps.mapusable;
+        for (int j = 0; j < POGOCACHE_NHIST; j++) {
+            total.keyhist[j] += ps.keyhist[j];
+            total.valhist[j] += ps.valhist[j];
+        }
+    }
+    if (ctx->mode == MEMSTATS_SHARDS) {
+        return;
+    }
+    double mean = ratio(total.count, nshards);
+    double var = ratio(sumsq, nshards)-mean*mean;
+    stats_printf(stats, "shards %d", nshards);
+    memstats_summary(stats, &total);
+    stats_printf(stats, "shard_entries_min %zu", nshards ? mincount : 0);
+    stats_printf(stats, "shard_entries_max %zu", maxcount);
+    stats_printf(stats, "shard_entries_stddev %.3f", var > 0 ? sqrt(var) : 0);
+    stats_printf(stats, "fullest_shard %d", maxshard);
+    stats_printf(stats, "max_dib_shard %d", maxdibshard);
+    memstats_hist(stats, "key_len", total.keyhist);
+    memstats_hist(stats, "value_len", total.valhist);
+}
+
+static void memstats_done(struct conn *conn, void *udata) {
+    struct memstats_ctx *ctx = udata;
+    stats_end(&ctx->stats, conn);
+    xfree(ctx);
+}
+
+static void memstats(struct conn *conn, int mode, int shardidx) {
+    struct memstats_ctx *ctx = xmalloc(sizeof(struct memstats_ctx));
+    memset(ctx, 0, sizeof(struct memstats_ctx));
+    ctx->mode = mode;
+    ctx->shardidx = shardidx;
+    stats_begin(&ctx->stats);
+    if (!conn_bgwork(conn, memstats_work, memstats_done, ctx)) {
+        conn_write_error(conn, "ERR failed to do work");
+        args_free(&ctx->stats.args);
+        xfree(ctx);
+    }
+}
+
+static void write_keyinfo_null(struct conn *conn, const char *desc,
+    const char *tag)
+{
+    if (conn_proto(conn) == PROTO_POSTGRES) {
+        pg_write_row_desc(conn, (const char*[]){ desc }, 1);
+        pg_write_completef(conn, "%s 0", tag);
+        pg_write_ready(conn, 'I');
+    } else {
+        conn_write_null(conn);
+    }
+}
+
+// MEMORY USAGE key [SAMPLES count]
+static void memory_usage(struct conn *conn, struct args *args) {
+    // SAMPLES is accepted for compatibility, but every key is exact.
+    if (args->len != 3 && !(args->len == 5 && argeq(args, 3, "samples"))) {
+        conn_write_error(conn, ERR_SYNTAX_ERROR);
+        return;
+    }
+    struct keyinfo ki;
+    if (!keyinfo_load(args, 2, &ki)) {
+        write_keyinfo_null(conn, "bytes", "MEMORY");
+        return;
+    }
+    int64_t bytes = ki.info.memsize+ki.info.bucketsize;
+    if (conn_proto(conn) == PROTO_POSTGRES) {
+        pg_write_simple_row_i64_ready(conn, "bytes", bytes, "MEMORY");
+    } else {
+        conn_write_int(conn, bytes);
+    }
+}
+
+// MEMORY STATS
+// MEMORY USAGE key [SAMPLES count]
+static void cmdMEMORY(struct conn *conn, struct args *args) {
+    if (args->len <= 1) {
+        conn_write_error(conn, ERR_WRONG_NUM_ARGS);
+        return;
+    }
+    if (argeq(args, 1, "usage")) {
+        memory_usage(conn, args);
+        return;
+    }
+    if (!argeq(args, 1, "stats")) {
+        conn_write_error(conn, "ERR unknown subcommand");
+        return;
+    }
+    if (args->len != 2) {
+        conn_write_error(conn, ERR_SYNTAX_ERROR);
+        return;
+    }
+    memstats(conn, MEMSTATS_ALL, 0);
+}
+
+// OBJECT ENCODING|IDLETIME|FREQ key
+static void cmdOBJECT(struct conn *conn, struct args *args) {
+    if (args->len != 3) {
+        conn_write_error(conn, ERR_WRONG_NUM_ARGS);
+        return;
+    }
+    bool encoding = argeq(args, 1, "encoding");
+    bool idletime = argeq(args, 1, "idletime");
+    if (argeq(args, 1, "freq")) {
+        conn_write_error(conn, "ERR access frequency is not tracked");
+        return;
+    }
+    if (!encoding && !idletime) {
+        conn_write_error(conn, "ERR unknown subcommand");
+        return;
+    }
+    const char *desc = encoding ? "encoding" : "idletime";
+    struct keyinfo ki;
+    if (!keyinfo_load(args, 2, &ki)) {
+        write_keyinfo_null(conn, desc, "OBJECT");
+        return;
+    }
+    if (conn_proto(conn) == PROTO_POSTGRES) {
+        if (encoding) {
+            pg_write_simple_row_str_ready(conn, desc, keyinfo_encoding(&ki),
+                "OBJECT");
+        } else {
+            pg_write_simple_row_i64_ready(conn, desc, ki.info.idle/SECOND,
+                "OBJECT");
+        }
+    } else if (encoding) {
+        conn_write_bulk_cstr(conn, keyinfo_encoding(&ki));
+    } else {
+        conn_write_int(conn, ki.info.idle/SECOND);
+    }
+}
+
+// DEBUG SHARDS [index]
+static void cmdDEBUG_shards(struct conn *conn, struct args *args) {
+    if (args->len == 1) {
+        memstats(conn, MEMSTATS_SHARDS, 0);
+        return;
+    }
+    if (args->len != 2) {
+        conn_write_error(conn, ERR_SYNTAX_ERROR);
+        return;
+    }
+    int64_t idx;
+    if (!argi64(args, 1, &idx) || idx < 0 || idx >= pogocache_nshards(cache)) {
+        conn_write_error(conn, "ERR invalid shard index");
+        return;
+    }
+    memstats(conn, MEMSTATS_SHARD, idx);
+}
+
+// CLIENT SETCLASS name
+static void client_setclass(struct conn *conn, struct args *args) {
+    if (args->len != 3) {
+        conn_write_error(conn, ERR_SYNTAX_ERROR);
+        return;
+    }
+    int class = traffic_find(args->bufs[2].data, args->bufs[2].len);
+    if (class < 0) {
+        conn_write_error(conn, "ERR unknown traffic class");
+        return;
+    }
+    conn_setclass(conn, class);
+    if (conn_proto(conn) == PROTO_POSTGRES) {
+        pg_write_complete(conn, "CLIENT OK");
+        pg_write_ready(conn, 'I');
+    } else {
+        conn_write_string(conn, "OK");
+    }
+}
+
+// CLIENT GETCLASS
+static void client_getclass(struct conn *conn, struct args *args) {
+    if (args->len != 2) {
+        conn_write_error(conn, ERR_SYNTAX_ERROR);
+        return;
+    }
+    const char *name = traffic_name(conn_class(conn));
+    if (conn_proto(conn) == PROTO_POSTGRES) {
+        pg_write_simple_row_str_ready(conn, "class", name, "CLIENT");
+    } else {
+        conn_write_bulk_cstr(conn, name);
+    }
+}
+
+// CLIENT LIST
+// CLIENT SETCLASS name
+// CLIENT GETCLASS
+static void cmdCLIENT(struct conn *conn, struct args *args) {
+    if (args->len <= 1) {
+        conn_write_error(conn, ERR_WRONG_NUM_ARGS);
+        return;
+    }
+    if (argeq(args, 1, "setclass")) {
+        client_setclass(conn, args);
+        return;
+    }
+    if (argeq(args, 1, "getclass")) {
+        client_getclass(conn, args);
+        return;
+    }
+    if (!argeq(args, 1, "list")) {
+        conn_write_error(conn, "ERR unknown subcommand");
+        return;
+    }
+    if (args->len != 2) {
+        conn_write_error(conn, ERR_SYNTAX_ERROR);
+        return;
+    }
+    struct buf buf = { 0 };
+    conn_client_list(&buf);
+    if (conn_proto(conn) == PROTO_POSTGRES) {
+        pg_write_row_desc(conn, (const char*[]){ "client" }, 1);
+        size_t count = 0;
+        size_t i = 0;
+        while (i < buf.len) {
+            char *line = buf.data+i;
+            char *end = memchr(line, '\n', buf.len-i);
+            size_t n = end-line;
+            pg_write_row_data(conn, (const char*[]){ line }, 
+                (size_t[]){ n }, 1);
+            i += n+1;
+            count++;
+        }
+        pg_write_completef(conn, "CLIENT %zu", count);
+        pg_write_ready(conn, 'I');
+    } else {
+        conn_write_bulk(conn, buf.data, buf.len);
+    }
+    buf_clear(&buf);
+}
+
+struct config_ctx {
+    struct args *args;      // patterns, from index 2
+    struct args out;        // name value pairs
+};
+
+static void config_match(const char *name, const char *value, void *udata) {
+    struct config_ctx *ctx = udata;
+    for (size_t i = 2; i < ctx->args->len; i++) {
+        if (match(ctx->args->bufs[i].data, ctx->args->bufs[i].len, name,
+            strlen(name), 0))
+        {
+            // Copy the terminators too, which keeps an empty value from
+            // leaving a null buffer.
+            args_append(&ctx->out, name, strlen(name)+1, false);
+            args_append(&ctx->out, value, strlen(value)+1, false);
+            ctx->out.bufs[ctx->out.len-2].len--;
+            ctx->out.bufs[ctx->out.len-1].len--;
+            break;
+        }
+    }
+}
+
+// CONFIG GET pattern [pattern ...]
+static void config_get(struct conn *conn, struct args *args) {
+    if (args->len < 3) {
+        conn_write_error(conn, ERR_WRONG_NUM_ARGS);
+        return;
+    }
+    // Option names are lowercase.
+    for (size_t i = 2; i < args->len; i++) {
+        for (size_t j = 0; j < args->bufs[i].len; j++) {
+            args->bufs[i].data[j] = tolower(args->bufs[i].data[j]);
+        }
+    }
+    struct config_ctx ctx = { .args = args };
+    config_iter(config_match, &ctx);
+    size_t n = ctx.out.len/2;
+    if (conn_proto(conn) == PROTO_POSTGRES) {
+        pg_write_row_desc(conn, (const char*[]){ "name", "value" }, 2);
+        for (size_t i = 0; i < n; i++) {
+            struct buf *b = &ctx.out.bufs[i*2];
+            pg_write_row_data(conn, (const char*[]){ b[0].data, b[1].data },
+                (size_t[]){ b[0].len, b[1].len }, 2);
+        }
+        pg_write_completef(conn, "CONFIG %zu", n);
+        pg_write_ready(conn, 'I');
+    } else {
+        conn_write_array(conn, n*2);
+        for (size_t i = 0; i < n*2; i++) {
+            conn_write_bulk(conn, ctx.out.bufs[i].data, ctx.out.bufs[i].len);
+        }
+    }
+    args_free(&ctx.out);
+}
+
+// CONFIG SET name value
+// CONFIG REWRITE
+static void cmdCONFIG(struct conn *conn, struct args *args) {
+    if (args->len <= 1) {
+        conn_write_error(conn, ERR_WRONG_NUM_ARGS);
+        return;
+    }
+    char name[64];
+    char value[256];
+    char err[256];
+    if (argeq(args, 1, "get")) {
+        config_get(conn, args);
+        return;
+    } else if (argeq(args, 1, "set")) {
+        if (args->len != 4) {
+            conn_write_error(conn, ERR_WRONG_NUM_ARGS);
+            return;
+        }
+        if (!argstr(args, 2, name, sizeof(name)) ||
+            !argstr(args, 3, value, sizeof(value)))
+        {
+            conn_write_error(conn, ERR_SYNTAX_ERROR);
+            return;
+        }
+        for (char *p = name; *p; p++) {
+            *p = tolower(*p);
+        }
+        if (!config_set(name, value, err, sizeof(err))) {
+            conn_write_error(conn, err);
+            return;
+        }
+    } else if (argeq(args, 1, "rewrite")) {
+        if (args->len != 2) {
+            conn_write_error(conn, ERR_WRONG_NUM_ARGS);
+            return;
+        }
+        if (!config_rewrite(err, sizeof(err))) {
+            conn_write_error(conn, err);
+            return;
+        }
+    } else {
+        conn_write_error(conn, "ERR unknown subcommand");
+        return;
+    }
+    if (conn_proto(conn) == PROTO_POSTGRES) {
+        pg_write_completef(conn, "CONFIG");
+        pg_write_ready(conn, 'I');
+    } else {
+        conn_write_string(conn, "OK");
+    }
+}
+
 // Commands hash table. Lazy loaded per thread.
 // Simple open addressing using case-insensitive fnv1a hashes.
 static int nbuckets;
 static struct cmd *buckets;
 
+#define KEYS_NONE  0 // command has no keys, or they need no shard
+#define KEYS_FIRST 1 // the first argument is the key
+#define KEYS_ALL   2 // all arguments are keys
+
 struct cmd {
     const char *name;
     void (*func)(struct conn *conn, struct args *args);
+    int keys;
 };
 
 static struct cmd cmds[] = {
-    { "set",       cmdSET      }, // pg
-    { "get",       cmdGET      }, // pg
-    { "del",       cmdDEL      }, // pg
-    { "mget",      cmdMGET     }, // pg
-    { "mgets",     cmdMGET     }, // pg cas detected
-    { "ttl",       cmdTTL      }, // pg
-    { "pttl",      cmdTTL      }, // pg
-    { "expire",    cmdEXPIRE   }, // pg
-    { "setex",     cmdSETEX    }, // pg
-    { "dbsize",    cmdDBSIZE   }, // pg
-    { "quit",      cmdQUIT     }, // pg
-    { "echo",      cmdECHO     }, // pg
-    { "exists",    cmdEXISTS   }, // pg
-    { "flushdb",   cmdFLUSHALL }, // pg
-    { "flushall",  cmdFLUSHALL }, // pg
-    { "flush",     cmdFLUSHALL }, // pg
-    { "purge",     cmdPURGE    }, // pg
-    { "sweep",     cmdSWEEP    }, // pg
-    { "keys",      cmdKEYS     }, // pg
-    { "ping",      cmdPING     }, // pg
-    { "touch",     cmdTOUCH    }, // pg
-    { "debug",     cmdDEBUG    }, // pg
-    { "incrby",    cmdINCRBY   }, // pg
-    { "decrby",    cmdDECRBY   }, // pg
-    { "incr",      cmdINCR     }, // pg
-    { "decr",      cmdDECR     }, // pg
-    { "uincrby",   cmdINCRBY   }, // pg unsigned detected in signed operation
-    { "udecrby",   cmdDECRBY   }, // pg unsigned detected in signed operation
-    { "uincr",     cmdINCR     }, // pg unsigned detected in signed operation
-    { "udecr",     cmdDECR     }, // pg unsigned detected in signed operation
-    { "append",    cmdAPPEND   }, // pg
-    { "prepend",   cmdPREPEND  }, // pg
-    { "auth",      cmdAUTH     }, // pg
-    { "save",      cmdSAVELOAD }, // pg
-    { "load",      cmdSAVELOAD }, // pg
-    { "stats",     cmdSTATS    }, // pg memcache style stats
+    { "set",       cmdSET,      KEYS_FIRST }, // pg
+    { "get",       cmdGET,      KEYS_FIRST }, // pg
+    { "del",       cmdDEL,      KEYS_ALL   }, // pg
+    { "mget",      cmdMGET,     KEYS_ALL   }, // pg
+    { "mgets",     cmdMGET,     KEYS_ALL   }, // pg cas detected
+    { "ttl",       cmdTTL,      KEYS_FIRST }, // pg
+    { "pttl",      cmdTTL,      KEYS_FIRST }, // pg
+    { "expire",    cmdEXPIRE,   KEYS_FIRST }, // pg
+    { "setex",     cmdSETEX,    KEYS_FIRST }, // pg
+    { "dbsize",    cmdDBSIZE,   KEYS_NONE  }, // pg
+    { "quit",      cmdQUIT,     KEYS_NONE  }, // pg
+    { "echo",      cmdECHO,     KEYS_NONE  }, // pg
+    { "exists",    cmdEXISTS,   KEYS_ALL   }, // pg
+    { "flushdb",   cmdFLUSHALL, KEYS_NONE  }, // pg
+    { "flushall",  cmdFLUSHALL, KEYS_NONE  }, // pg
+    { "flush",     cmdFLUSHALL, KEYS_NONE  }, // pg
+    { "purge",     cmdPURGE,    KEYS_NONE  }, // pg
+    { "sweep",     cmdSWEEP,    KEYS_NONE  }, // pg
+    { "keys",      cmdKEYS,     KEYS_NONE  }, // pg
+    { "ping",      cmdPING,     KEYS_NONE  }, // pg
+    { "touch",     cmdTOUCH,    KEYS_ALL   }, // pg
+    { "debug",     cmdDEBUG,    KEYS_NONE  }, // pg
+    { "incrby",    cmdINCRBY,   KEYS_FIRST }, // pg
+    { "decrby",    cmdDECRBY,   KEYS_FIRST }, // pg
+    { "incr",      cmdINCR,     KEYS_FIRST }, // pg
+    { "decr",      cmdDECR,     KEYS_FIRST }, // pg
+    { "uincrby",   cmdINCRBY,   KEYS_FIRST }, // pg unsigned detected in signed operation
+    { "udecrby",   cmdDECRBY,   KEYS_FIRST }, // pg unsigned detected in signed operation
+    { "uincr",     cmdINCR,     KEYS_FIRST }, // pg unsigned detected in signed operation
+    { "udecr",     cmdDECR,     KEYS_FIRST }, // pg unsigned detected in signed operation
+    { "append",    cmdAPPEND,   KEYS_FIRST }, // pg
+    { "prepend",   cmdPREPEND,  KEYS_FIRST }, // pg
+    { "auth",      cmdAUTH,     KEYS_NONE  }, // pg
+    { "save",      cmdSAVELOAD, KEYS_NONE  }, // pg
+    { "load",      cmdSAVELOAD, KEYS_NONE  }, // pg
+    { "stats",     cmdSTATS,    KEYS_NONE  }, // pg memcache style stats
+    { "client",    cmdCLIENT,   KEYS_NONE  }, // pg
+    { "memory",    cmdMEMORY,   KEYS_NONE  }, // pg
+    { "object",    cmdOBJECT,   KEYS_NONE  }, // pg
+    { "config",    cmdCONFIG,   KEYS_NONE  }, // pg
 };
 
 static void build_commands_table(void) {
@@ -1971,12 +2854,194 @@ static struct cmd *get_cmd(const char *name, size_t namelen) {
     }
 }
 
+// Returns the thread that owns the shards for all keys of the command.
+// Returns -1 when the command has no keys, or when the keys are spread over
+// more than one thread.
+static int cmd_owner(struct cmd *cmd, struct args *args) {
+    if (cmd->keys == KEYS_NONE || args->len < 2) {
+        return -1;
+    }
+    size_t nkeys = cmd->keys == KEYS_FIRST ? 1 : args->len-1;
+    int owner = -1;
+    for (size_t i = 1; i <= nkeys; i++) {
+        int shard = pogocache_shard(cache, args->bufs[i].data, 
+            args->bufs[i].len);
+        int thread = shard%nthreads;
+        if (owner != -1 && thread != owner) {
+            return -1;
+        }
+        owner = thread;
+    }
+    return owner;
+}
+
+// Cross-connection batching, enabled with --batching.
+// Single key GET and SET commands that arrive during an event loop pass are
+// queued rather than executed. When the pass is done, or when a command that
+// can't be queued shows up, the queue is sorted by shard and the commands
+// for each shard run under one lock acquisition. Replies are captured per
+// command and then copied to their connections in the original order.
+
+#define MAXBATCHBUF 1048576 // Maximum retained batch buffer size
+
+struct batchop {
+    struct conn *conn;
+    struct cmd *cmd;
+    int shard;
+    int index;          // position in queue
+    size_t argsoff;     // offset of copied args in arena
+    int nargs;
+    size_t outoff;      // offset of captured reply in replies
+    size_t outlen;
+};
+
+struct batchq {
+    struct batchop *ops;
+    struct batchop **sorted;
+    int len;
+    int cap;
+    struct buf arena;   // copied args, each a size_t length and the bytes
+    struct buf replies; // captured replies
+    struct args args;   // args for the executing command
+};
+
+static __thread struct batchq batchq;
+
+static bool batchable(struct conn *conn, struct cmd *cmd, struct args *args) {
+    int proto = conn_proto(conn);
+    if (proto != PROTO_RESP && proto != PROTO_MEMCACHE) {
+        return false;
+    }
+    return (cmd->func == cmdGET && args->len == 2) || 
+           (cmd->func == cmdMGET && args->len == 2) ||
+           (cmd->func == cmdSET && args->len >= 3);
+}
+
+static void batch_push(struct conn *conn, struct cmd *cmd, struct args *args) {
+    if (batchq.len == batchq.cap) {
+        batchq.cap = batchq.cap == 0 ? 64 : batchq.cap*2;
+        batchq.ops = xrealloc(batchq.ops, batchq.cap*sizeof(struct batchop));
+        batchq.sorted = xrealloc(batchq.sorted, 
+            batchq.cap*sizeof(struct batchop*));
+    }
+    struct batchop *op = &batchq.ops[batchq.len];
+    op->conn = conn;
+    op->cmd = cmd;
+    op->shard = pogocache_shard(cache, args->bufs[1].data, args->bufs[1].len);
+    op->index = batchq.len;
+    op->argsoff = batchq.arena.len;
+    op->nargs = args->len;
+    for (size_t i = 0; i < args->len; i++) {
+        size_t len = args->bufs[i].len;
+        buf_append(&batchq.arena, &len, sizeof(size_t));
+        buf_append(&batchq.arena, args->bufs[i].data, len);
+    }
+    batchq.len++;
+}
+
+static int batchop_compare(const void *a, const void *b) {
+    const struct batchop *opa = *(struct batchop**)a;
+    const struct batchop *opb = *(struct batchop**)b;
+    if (opa->shard != opb->shard) {
+        return opa->shard < opb->shard ? -1 : 1;
+    }
+    return opa->index < opb->index ? -1 : opa->index > opb->index;
+}
+
+static void batch_args(struct batchop *op) {
+    args_clear(&batchq.args);
+    const char *p = batchq.arena.data+op->argsoff;
+    for (int i = 0; i < op->nargs; i++) {
+        size_t len;
+        memcpy(&len, p, sizeof(size_t));
+        p += sizeof(size_t);
+        args_append(&batchq.args, p, len, true);
+        p += len;
+    }
+}
+
+static void batch_prefetch(struct pogocache *batch, struct batchop *op) {
+    const char *p = batchq.arena.data+op->argsoff;
+    size_t len0, len1;
+    memcpy(&len0, p, sizeof(size_t));
+    p += sizeof(size_t)+len0;
+    memcpy(&len1, p, sizeof(size_t));
+    pogocache_prefetch(batch, p+sizeof(size_t), len1);
+}
+
+// Execute all queued commands.
+void evcommand_flush(void) {
+    if (batchq.len == 0) {
+        return;
+    }
+    for (int i = 0; i < batchq.len; i++) {
+        batchq.sorted[i] = &batchq.ops[i];
+    }
+    qsort(batchq.sorted, batchq.len, sizeof(struct batchop*), 
+        batchop_compare);
+    int i = 0;
+    while (i < batchq.len) {
+        // Run the group of commands for one shard. The first command takes
+        // the shard lock and the rest reuse it, prefetching one ahead.
+        int shard = batchq.sorted[i]->shard;
+        struct pogocache *batch = pogocache_begin(cache);
+        grpcache = batch;
+        for (; i < batchq.len && batchq.sorted[i]->shard == shard; i++) {
+            struct batchop *op = batchq.sorted[i];
+            if (i+1 < batchq.len && batchq.sorted[i+1]->shard == shard) {
+                batch_prefetch(batch, batchq.sorted[i+1]);
+            }
+            batch_args(op);
+            size_t mark = conn_out_mark(op->conn);
+            op->cmd->func(op->conn, &batchq.args);
+            PROBE1(command__done, conn_id(op->conn));
+            op->outoff = batchq.replies.len;
+            conn_out_take(op->conn, mark, &batchq.replies);
+            op->outlen = batchq.replies.len-op->outoff;
+        }
+        grpcache = 0;
+        pogocache_end(batch);
+    }
+    // Scatter the replies in the original order.
+    for (i = 0; i < batchq.len; i++) {
+        struct batchop *op = &batchq.ops[i];
+        conn_write_raw(op->conn, batchq.replies.data+op->outoff, op->outlen);
+    }
+    args_clear(&batchq.args);
+    batchq.len = 0;
+    batchq.arena.len = 0;
+    batchq.replies.len = 0;
+    if (batchq.arena.cap > MAXBATCHBUF) {
+        buf_clear(&batchq.arena);
+    }
+    if (batchq.replies.cap > MAXBATCHBUF) {
+        buf_clear(&batchq.replies);
+    }
+}
+
+// Passes the command to the running capture. Debug commands, which include
+// the capture controls, and auth commands, which hold passwords, are not
+// recorded.
+static void capture(struct conn *conn, struct cmd *cmd, struct args *args) {
+    if (cmd && (cmd->func == cmdAUTH || cmd->func == cmdDEBUG)) {
+        return;
+    }
+    int firstkey = 0;
+    int nkeys = 0;
+    if (cmd && cmd->keys != KEYS_NONE && args->len > 1) {
+        firstkey = 1;
+        nkeys = cmd->keys == KEYS_FIRST ? 1 : (int)args->len-1;
+    }
+    capture_command(conn_id(conn), conn_proto(conn), args, firstkey, nkeys);
+}
+
 void evcommand(struct conn *conn, struct args *args) {
-    if (useauth && !conn_auth(conn)) {
+    if (*conn_password(conn) && !conn_auth(conn)) {
         if (conn_proto(conn) == PROTO_HTTP) {
             // Let HTTP traffic through.
             // The request has already been authorized in http.c
         } else {
+            evcommand_flush();
             cmdAUTH(conn, args);
             return;
         }
@@ -1986,10 +3051,36 @@ void evcommand(struct conn *conn, struct args *args) {
             args_print(args);
         }
     }
+    PROBE4(command__start, conn_id(conn), args->bufs[0].data,
+        args->bufs[0].len, args->len);
     struct cmd *cmd = get_cmd(args->bufs[0].data, args->bufs[0].len);
+    if (atomic_load_explicit(&capturing, __ATOMIC_RELAXED)) {
+        capture(conn, cmd, args);
+    }
     if (cmd) {
+        int owner = -1;
+        if (usesharednothing) {
+            owner = cmd_owner(cmd, args);
+            if (owner == conn_thread(conn)) {
+                owner = -1;
+            }
+        }
+        if (usebatching && owner == -1 && batchable(conn, cmd, args)) {
+            batch_push(conn, cmd, args);
+            return;
+        }
+        // Anything queued must run first to keep the replies in order.
+        evcommand_flush();
+        if (owner != -1 && conn_forward(conn, owner, cmd->func, args)) {
+            // Commands for shards owned by another thread are executed
+            // over there. Commands whose keys span threads, or that could
+            // not be forwarded, fall back to using the shard locks.
+            return;
+        }
         cmd->func(conn, args);
+        PROBE1(command__done, conn_id(conn));
     } else {
+        evcommand_flush();
         if (verb > 0) {
             printf("# Unknown command '%.*s'\n", (int)args->bufs[0].len,
                 args->bufs[0].data);
@@ -14,5 +14,6 @@
 #include "args.h"
 
 void evcommand(struct conn *conn, struct args *args);
+void evcommand_flush(void);
 
 #endif
@@ -0,0 +1,756 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Unit config.c loads the program options from a config file, and reads and
+// changes them at runtime for the CONFIG command.
+//
+// The file has one 'name = value' per line. Blank lines, lines starting with
+// '#' or ';', and '[section]' headers are skipped, and a '#' that follows a
+// space starts a comment. Names are the same as the program flags, such as
+// 'maxmemory' for --maxmemory, and the names used by config/runtime.conf are
+// accepted as well. Flags on the command line override the file.
+//
+// Only some options can be applied to a running server. The rest are shown
+// by CONFIG GET, but need a restart to change.
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "buf.h"
+#include "net.h"
+#include "pogocache.h"
+#include "sys.h"
+#include "ttlpolicy.h"
+#include "xmalloc.h"
+
+// from main.c
+extern char *port, *host, *persist, *unixsock, *shmsock, *udpport;
+extern char *reuseport, *tcpnodelay, *quickack, *usecas, *keepalive;
+extern char *maxmemory, *evict, *keysixpack, *auth, *tlsport, *tlscertfile;
+extern char *tlskeyfile, *tlscacertfile, *uring, *autotune, *sharednothing;
+extern char *batching, *configfile, *livetune, *defrag, *hotkeys;
+extern char *clocksource, *memcacheport, *respport, *httpport, *pgport;
+extern char *memcachesock, *respsock, *httpsock, *pgsock, *classes;
+extern char *ttlpolicy;
+extern int nthreads, maxthreads, nshards, backlog, queuesize, loadfactor;
+extern int tunemaxqueue, tunemaxpoll, tunemaxevict, tuneminload;
+extern int maxconns, idletimeout, idlecompact, maxbgwork, maxshards;
+extern int evictors, evicthigh, evictlow, defragratio, defragcpu;
+extern int classbudget, ratelimit;
+extern const size_t sysmem;
+extern const bool usesharednothing;
+extern atomic_int verb;
+extern atomic_size_t memlimit;
+extern atomic_bool useevict;
+extern atomic_bool uselivetune;
+extern atomic_bool usedefrag;
+extern atomic_bool lowmem;
+extern struct pogocache *cache;
+
+// min max robinhood load factor, same as main.c
+#define MINLOADFACTOR 55
+#define MAXLOADFACTOR 95
+
+struct param {
+    const char *name;
+    char **str;         // string option, or
+    int *num;           // integer option
+    // Applies a new value to the running server, returning an error message
+    // or null. Options without it can only be set at startup.
+    const char *(*apply)(const char *value);
+    int (*live)(void);  // reads the running value, when not in 'num'
+    bool secret;        // not shown by CONFIG GET
+    char *alloc;        // the string value, when it was set from here
+    bool dirty;         // changed with CONFIG SET, for CONFIG REWRITE
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool parse_int(const char *value, int min, int max, int *out) {
+    char *end;
+    errno = 0;
+    long x = strtol(value, &end, 10);
+    if (errno || end == value || *end || x < min || x > max) {
+        return false;
+    }
+    *out = x;
+    return true;
+}
+
+static int yesno(const char *value) {
+    return strcmp(value, "yes") == 0 ? 1 : strcmp(value, "no") == 0 ? 0 : -1;
+}
+
+// Parses a memory size, such as "4gb" or "80%", or "unlimited".
+bool config_parse_memory(const char *value, size_t *limit) {
+    if (strcmp(value, "unlimited") == 0) {
+        *limit = SIZE_MAX;
+        return true;
+    }
+    while (isspace(*value)) {
+        value++;
+    }
+    char *end;
+    errno = 0;
+    double mem = strtod(value, &end);
+    if (errno || !(mem > 0) || !isfinite(mem)) {
+        return false;
+    }
+    while (isspace(*end)) {
+        end++;
+    }
+    #define exteq(c) \
+        (tolower(end[0])==c&& (!end[1]||(tolower(end[1])=='b'&&!end[2])))
+    double mult;
+    if (strcmp(end, "") == 0) {
+        mult = 1;
+    } else if (strcmp(end, "%") == 0) {
+        mult = sysmem/100.0;
+    } else if (exteq('k')) {
+        mult = 1024.0;
+    } else if (exteq('m')) {
+        mult = 1024.0*1024.0;
+    } else if (exteq('g')) {
+        mult = 1024.0*1024.0*1024.0;
+    } else if (exteq('t')) {
+        mult = 1024.0*1024.0*1024.0*1024.0;
+    } else {
+        return false;
+    }
+    #undef exteq
+    *limit = mem*mult;
+    return true;
+}
+
+static const char *apply_maxmemory(const char *value) {
+    size_t limit;
+    if (!config_parse_memory(value, &limit)) {
+        return "invalid memory size";
+    }
+    atomic_store(&memlimit, limit);
+    if (limit == SIZE_MAX) {
+        atomic_store(&lowmem, false);
+    }
+    return 0;
+}
+
+static const char *apply_evict(const char *value) {
+    int yes = yesno(value);
+    if (yes == -1) {
+        return "must be yes or no";
+    }
+    atomic_store(&useevict, yes);
+    return 0;
+}
+
+static const char *apply_loadfactor(const char *value) {
+    int x;
+    if (!parse_int(value, MINLOADFACTOR, MAXLOADFACTOR, &x)) {
+        return "must be a percent from 55 to 95";
+    }
+    pogocache_set_loadfactor(cache, x);
+    return 0;
+}
+
+static const char *apply_threads(const char *value) {
+    int x;
+    if (usesharednothing) {
+        return "can't be changed with sharednothing";
+    }
+    if (!parse_int(value, 1, maxthreads, &x) || !net_set_nthreads(x)) {
+        return "must be between 1 and maxthreads";
+    }
+    return 0;
+}
+
+static const char *apply_maxbgwork(const char *value) {
+    int x;
+    if (!parse_int(value, 0, INT32_MAX, &x)) {
+        return "must be zero or more";
+    }
+    net_set_maxbgwork(x);
+    return 0;
+}
+
+static const char *apply_backlog(const char *value) {
+    int x;
+    if (!parse_int(value, 1, INT32_MAX, &x) || !net_set_backlog(x)) {
+        return "must be one or more";
+    }
+    return 0;
+}
+
+static const char *apply_verbosity(const char *value) {
+    int x;
+    if (!parse_int(value, 0, 3, &x)) {
+        return "must be from 0 to 3";
+    }
+    atomic_store(&verb, x);
+    return 0;
+}
+
+static const char *apply_livetune(const char *value) {
+    int yes = yesno(value);
+    if (yes == -1) {
+        return "must be yes or no";
+    }
+    atomic_store(&uselivetune, yes);
+    return 0;
+}
+
+// The evictors read the watermarks each time they check the memory.
+static const char *apply_evicthigh(const char *value) {
+    int x;
+    return parse_int(value, evictlow+1, 100, &x) ? 0 :
+        "must be a percent above evictlow";
+}
+
+static const char *apply_evictlow(const char *value) {
+    int x;
+    return parse_int(value, 1, evicthigh-1, &x) ? 0 :
+        "must be a percent below evicthigh";
+}
+
+static const char *apply_defrag(const char *value) {
+    int yes = yesno(value);
+    if (yes == -1) {
+        return "must be yes or no";
+    }
+    atomic_store(&usedefrag, yes);
+    return 0;
+}
+
+// The defragmenter reads its limits before each cycle and step.
+static const char *apply_defragratio(const char *value) {
+    int x;
+    return parse_int(value, 101, 1000, &x) ? 0 :
+        "must be a percent from 101 to 1000";
+}
+
+static const char *apply_defragcpu(const char *value) {
+    int x;
+    return parse_int(value, 1, 100, &x) ? 0 : "must be a percent from 1 to 100";
+}
+
+// The live tuner reads its limits each time it runs.
+static const char *apply_tunemaxpoll(const char *value) {
+    int x;
+    return parse_int(value, 0, INT32_MAX, &x) ? 0 : "must be zero or more";
+}
+
+static const char *apply_tunemaxevict(const char *value) {
+    int x;
+    return parse_int(value, 1, 64, &x) ? 0 : "must be from 1 to 64";
+}
+
+static const char *apply_tuneminload(const char *value) {
+    int x;
+    return parse_int(value, MINLOADFACTOR, MAXLOADFACTOR, &x) ? 0 :
+        "must be a percent from 55 to 95";
+}
+
+static atomic_bool resharding;
+
+// Splits shards in the background until the target is reached. The pause
+// between splits leaves the shard locks to the event loops.
+static void *reshardwork(void *arg) {
+    (void)arg;
+    do {
+        int from = pogocache_nshards(cache);
+        int to = pogocache_reshard_target(cache);
+        printf("# Resharding from %d to %d shards\n", from, to);
+        int64_t start = sys_now();
+        while (pogocache_reshard_step(cache)) {
+            usleep(50);
+        }
+        printf("# Resharding done (%.1f secs)\n", (sys_now()-start)/1e9);
+        atomic_store(&resharding, false);
+        // Pick up a target that was set while finishing.
+    } while (pogocache_nshards(cache) != pogocache_reshard_target(cache) &&
+        !atomic_exchange(&resharding, true));
+    return 0;
+}
+
+static const char *apply_shards(const char *value) {
+    int x;
+    if (!parse_int(value, 1, INT32_MAX, &x)) {
+        return "must be one or more";
+    }
+    if (x == pogocache_nshards(cache)) {
+        return 0;
+    }
+    if (pogocache_reshard_target(cache) != pogocache_nshards(cache)) {
+        return "a reshard is already running";
+    }
+    if (!pogocache_reshard(cache, x)) {
+        return "must be the current count doubled, up to maxshards";
+    }
+    if (!atomic_exchange(&resharding, true)) {
+        pthread_t th;
+        if (pthread_create(&th, 0, reshardwork, 0) != 0) {
+            atomic_store(&resharding, false);
+            return "can't start the reshard thread";
+        }
+        pthread_detach(th);
+    }
+    return 0;
+}
+
+static const char *apply_ttlpolicy(const char *value) {
+    return ttlpolicy_set(value);
+}
+
+static int live_shards(void) {
+    return pogocache_nshards(cache);
+}
+
+static int live_verbosity(void) {
+    return atomic_load(&verb);
+}
+
+static struct param params[] = {
+    { .name = "host",          .str = &host },
+    { .name = "port",          .str = &port },
+    { .name = "unixsock",      .str = &unixsock },
+    { .name = "shmsock",       .str = &shmsock },
+    { .name = "udpport",       .str = &udpport },
+    { .name = "memcacheport",  .str = &memcacheport },
+    { .name = "respport",      .str = &respport },
+    { .name = "httpport",      .str = &httpport },
+    { .name = "pgport",        .str = &pgport },
+    { .name = "memcachesock",  .str = &memcachesock },
+    { .name = "respsock",      .str = &respsock },
+    { .name = "httpsock",      .str = &httpsock },
+    { .name = "pgsock",        .str = &pgsock },
+    { .name = "threads",       .num = &nthreads, .apply = apply_threads,
+                               .live = net_nthreads },
+    { .name = "maxthreads",    .num = &maxthreads },
+    { .name = "maxmemory",     .str = &maxmemory, .apply = apply_maxmemory },
+    { .name = "evict",         .str = &evict, .apply = apply_evict },
+    { .name = "evictors",      .num = &evictors },
+    { .name = "evicthigh",     .num = &evicthigh, .apply = apply_evicthigh },
+    { .name = "evictlow",      .num = &evictlow, .apply = apply_evictlow },
+    { .name = "defrag",        .str = &defrag, .apply = apply_defrag },
+    { .name = "defragratio",   .num = &defragratio,
+                               .apply = apply_defragratio },
+    { .name = "defragcpu",     .num = &defragcpu, .apply = apply_defragcpu },
+    { .name = "persist",       .str = &persist },
+    { .name = "maxconns",      .num = &maxconns },
+    { .name = "idletimeout",   .num = &idletimeout },
+    { .name = "idlecompact",   .num = &idlecompact },
+    { .name = "maxbgwork",     .num = &maxbgwork, .apply = apply_maxbgwork },
+    { .name = "auth",          .str = &auth, .secret = true },
+    { .name = "tlsport",       .str = &tlsport },
+    { .name = "tlscert",       .str = &tlscertfile },
+    { .name = "tlskey",        .str = &tlskeyfile },
+    { .name = "tlscacert",     .str = &tlscacertfile },
+    { .name = "shards",        .num = &nshards, .apply = apply_shards,
+                               .live = live_shards },
+    { .name = "maxshards",     .num = &maxshards },
+    { .name = "backlog",       .num = &backlog, .apply = apply_backlog },
+    { .name = "queuesize",     .num = &queuesize },
+    { .name = "autotune",      .str = &autotune },
+    { .name = "livetune",      .str = &livetune, .apply = apply_livetune },
+    { .name = "tunemaxqueue",  .num = &tunemaxqueue },
+    { .name = "tunemaxpoll",   .num = &tunemaxpoll,
+                               .apply = apply_tunemaxpoll },
+    { .name = "tunemaxevict",  .num = &tunemaxevict,
+                               .apply = apply_tunemaxevict },
+    { .name = "tuneminload",   .num = &tuneminload,
+                               .apply = apply_tuneminload },
+    { .name = "reuseport",     .str = &reuseport },
+    { .name = "tcpnodelay",    .str = &tcpnodelay },
+    { .name = "keepalive",     .str = &keepalive },
+    { .name = "quickack",      .str = &quickack },
+    { .name = "uring",         .str = &uring },
+    { .name = "sharednothing", .str = &sharednothing },
+    { .name = "batching",      .str = &batching },
+    { .name = "loadfactor",    .num = &loadfactor, .apply = apply_loadfactor },
+    { .name = "sixpack",       .str = &keysixpack },
+    { .name = "cas",           .str = &usecas },
+    { .name = "hotkeys",       .str = &hotkeys },
+    { .name = "clocksource",   .str = &clocksource },
+    { .name = "classes",       .str = &classes },
+    { .name = "classbudget",   .num = &classbudget },
+    { .name = "ratelimit",     .num = &ratelimit },
+    { .name = "ttlpolicy",     .str = &ttlpolicy, .apply = apply_ttlpolicy },
+    { .name = "verbosity",     .apply = apply_verbosity,
+                               .live = live_verbosity },
+};
+
+#define NPARAMS ((int)(sizeof(params)/sizeof(struct param)))
+
+// The names used by config/runtime.conf. A few take their values in other
+// units and are converted.
+static const char *conv_megabytes(const char *value, char *buf, size_t cap) {
+    if (strcmp(value, "0") == 0) {
+        return "unlimited";
+    }
+    snprintf(buf, cap, "%smb", value);
+    return buf;
+}
+
+// The default ttl for every key is a policy for the empty prefix.
+static const char *conv_defaultttl(const char *value, char *buf, size_t cap) {
+    if (strcmp(value, "0") == 0) {
+        return "";
+    }
+    snprintf(buf, cap, ":default=%s", value);
+    return buf;
+}
+
+static const char *conv_policy(const char *value, char *buf, size_t cap) {
+    (void)buf, (void)cap;
+    // There's one eviction policy, so any policy name turns it on.
+    if (strcmp(value, "none") == 0 || strcmp(value, "noeviction") == 0) {
+        return "no";
+    }
+    return yesno(value) == -1 ? "yes" : value;
+}
+
+static const char *conv_level(const char *value, char *buf, size_t cap) {
+    (void)buf, (void)cap;
+    if (strcmp(value, "error") == 0 || strcmp(value, "warn") == 0 ||
+        strcmp(value, "warning") == 0 || strcmp(value, "info") == 0)
+    {
+        return "0";
+    } else if (strcmp(value, "verbose") == 0) {
+        return "1";
+    } else if (strcmp(value, "debug") == 0) {
+        return "2";
+    } else if (strcmp(value, "trace") == 0) {
+        return "3";
+    }
+    return value;
+}
+
+struct alias {
+    const char *name;
+    const char *param;
+    const char *(*conv)(const char *value, char *buf, size_t cap);
+};
+
+static struct alias aliases[] = {
+    { "bind",            "host",         0 },
+    { "workers",         "threads",      0 },
+    { "max_connections", "maxconns",     0 },
+    { "timeout",         "idletimeout",  0 },
+    { "max_memory",      "maxmemory",    conv_megabytes },
+    { "eviction_policy", "evict",        conv_policy },
+    { "level",           "verbosity",    conv_level },
+    { "tls_cert_file",   "tlscert",      0 },
+    { "tls_key_file",    "tlskey",       0 },
+    { "tls_ca_file",     "tlscacert",    0 },
+    { "memcache_port",   "memcacheport", 0 },
+    { "redis_port",      "respport",     0 },
+    { "http_port",       "httpport",     0 },
+    { "postgres_port",   "pgport",       0 },
+    { "rate_limit",      "ratelimit",    0 },
+    { "default_ttl",     "ttlpolicy",    conv_defaultttl },
+};
+
+static struct param *find_param(const char *name) {
+    for (int i = 0; i < NPARAMS; i++) {
+        if (strcmp(params[i].name, name) == 0) {
+            return &params[i];
+        }
+    }
+    return 0;
+}
+
+// Returns the option for a name in the file, converting the value if needed.
+static struct param *resolve(const char *name, const char **value, char *buf,
+    size_t cap)
+{
+    struct param *p = find_param(name);
+    if (p) {
+        return p;
+    }
+    for (size_t i = 0; i < sizeof(aliases)/sizeof(struct alias); i++) {
+        if (strcmp(aliases[i].name, name) == 0) {
+            if (aliases[i].conv && value) {
+                *value = aliases[i].conv(*value, buf, cap);
+            }
+            return find_param(aliases[i].param);
+        }
+    }
+    return 0;
+}
+
+static void store(struct param *p, const char *value) {
+    if (p->str) {
+        xfree(p->alloc);
+        size_t len = strlen(value);
+        p->alloc = xmalloc(len+1);
+        memcpy(p->alloc, value, len+1);
+        *p->str = p->alloc;
+    } else if (p->num && !p->live) {
+        *p->num = atoi(value);
+    }
+}
+
+static void format(struct param *p, char *buf, size_t cap) {
+    if (p->str) {
+        snprintf(buf, cap, "%s", *p->str);
+    } else {
+        snprintf(buf, cap, "%d", p->live ? p->live() : *p->num);
+    }
+}
+
+// Splits a line into a trimmed name and value. Returns false for lines
+// without an option.
+static bool parse_line(char *line, char **name, char **value) {
+    while (isspace(*line)) {
+        line++;
+    }
+    if (!*line || *line == '#' || *line == ';' || *line == '[') {
+        return false;
+    }
+    char *eq = strchr(line, '=');
+    if (!eq) {
+        *name = line;
+        *value = 0;
+        return true;
+    }
+    char *end = eq;
+    while (end > line && isspace(end[-1])) {
+        end--;
+    }
+    *end = '\0';
+    char *val = eq+1;
+    while (isspace(*val)) {
+        val++;
+    }
+    for (char *p = val; *p; p++) {
+        if (*p == '#' && p > val && isspace(p[-1])) {
+            *p = '\0';
+            break;
+        }
+    }
+    end = val+strlen(val);
+    while (end > val && isspace(end[-1])) {
+        end--;
+    }
+    *end = '\0';
+    *name = line;
+    *value = val;
+    return true;
+}
+
+static char *readfile(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return 0;
+    }
+    struct buf buf = { 0 };
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        buf_append(&buf, chunk, n);
+    }
+    fclose(f);
+    buf_append_byte(&buf, '\0');
+    *len = buf.len-1;
+    return buf.data;
+}
+
+// Loads the options from a config file at startup, before the command line
+// flags are parsed. Prints an error and returns false on failure.
+bool config_load(const char *path) {
+    size_t len;
+    char *data = readfile(path, &len);
+    if (!data) {
+        fprintf(stderr, "# Config file %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    int nunknown = 0;
+    char unknown[256] = "";
+    int lineno = 0;
+    char *line = data;
+    while (line < data+len) {
+        lineno++;
+        char *nl = strchr(line, '\n');
+        if (nl) {
+            *nl = '\0';
+        }
+        char *name, *value;
+        if (parse_line(line, &name, &value)) {
+            if (!value) {
+                fprintf(stderr, "# Config file %s:%d: expected name = value\n",
+                    path, lineno);
+                xfree(data);
+                return false;
+            }
+            char buf[64];
+            const char *val = value;
+            struct param *p = resolve(name, &val, buf, sizeof(buf));
+            if (!p) {
+                // List as many names as fit, then elide the rest.
+                size_t ulen = strlen(unknown);
+                if (ulen+strlen(name)+8 < sizeof(unknown)) {
+                    snprintf(unknown+ulen, sizeof(unknown)-ulen, "%s%s",
+                        nunknown > 0 ? ", " : "", name);
+                } else if (ulen < 4 || strcmp(unknown+ulen-3, "...") != 0) {
+                    snprintf(unknown+ulen, sizeof(unknown)-ulen, ", ...");
+                }
+                nunknown++;
+            } else if (!p->str && !p->num) {
+                const char *err = p->apply(val);
+                if (err) {
+                    fprintf(stderr, "# Config file %s:%d: %s %s\n", path,
+                        lineno, p->name, err);
+                    xfree(data);
+                    return false;
+                }
+            } else if (p->num) {
+                *p->num = atoi(val);
+            } else {
+                store(p, val);
+            }
+        }
+        line = nl ? nl+1 : data+len;
+    }
+    xfree(data);
+    if (nunknown > 0) {
+        printf("# Config file %s: ignored %d unsupported option%s (%s)\n",
+            path, nunknown, nunknown==1?"":"s", unknown);
+    }
+    return true;
+}
+
+// Changes an option on the running server.
+bool config_set(const char *name, const char *value, char *err,
+    size_t errcap)
+{
+    struct param *p = find_param(name);
+    if (!p) {
+        snprintf(err, errcap, "ERR unknown option '%s'", name);
+        return false;
+    }
+    if (!p->apply) {
+        snprintf(err, errcap, "ERR option '%s' can only be set at startup",
+            name);
+        return false;
+    }
+    pthread_mutex_lock(&lock);
+    const char *msg = p->apply(value);
+    if (msg) {
+        pthread_mutex_unlock(&lock);
+        snprintf(err, errcap, "ERR invalid '%s', %s", name, msg);
+        return false;
+    }
+    store(p, value);
+    p->dirty = true;
+    pthread_mutex_unlock(&lock);
+    return true;
+}
+
+// Calls iter for every option with its current value.
+void config_iter(void (*iter)(const char *name, const char *value,
+    void *udata), void *udata)
+{
+    char buf[256];
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < NPARAMS; i++) {
+        format(&params[i], buf, sizeof(buf));
+        char *pass = strstr(buf, ",auth=");
+        if (params[i].secret && *buf) {
+            strcpy(buf, "********");
+        } else if (pass) {
+            // A listener option with its own password.
+            strcpy(pass+6, "********");
+        }
+        iter(params[i].name, buf, udata);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void append_param(struct buf *out, struct param *p) {
+    char val[256];
+    format(p, val, sizeof(val));
+    buf_append(out, p->name, strlen(p->name));
+    buf_append(out, " = ", 3);
+    buf_append(out, val, strlen(val));
+    buf_append_byte(out, '\n');
+}
+
+// Writes the options changed with CONFIG SET back to the config file. Their
+// lines are replaced in place, keeping the rest of the file as it was, and
+// options that are not in the file yet are added to the end.
+bool config_rewrite(char *err, size_t errcap) {
+    if (!*configfile) {
+        snprintf(err, errcap, "ERR the server is running without a config "
+            "file");
+        return false;
+    }
+    pthread_mutex_lock(&lock);
+    size_t len = 0;
+    char *data = readfile(configfile, &len);
+    bool written[NPARAMS] = { 0 };
+    struct buf out = { 0 };
+    char *line = data;
+    while (data && line < data+len) {
+        char *nl = strchr(line, '\n');
+        size_t n = nl ? (size_t)(nl-line)+1 : strlen(line);
+        char copy[512];
+        snprintf(copy, sizeof(copy), "%.*s", (int)n, line);
+        char *name, *value;
+        struct param *p = 0;
+        if (parse_line(copy, &name, &value) && value) {
+            p = resolve(name, 0, 0, 0);
+        }
+        if (p && p->dirty) {
+            int i = p-params;
+            if (!written[i]) {
+                append_param(&out, p);
+                written[i] = true;
+            }
+        } else {
+            buf_append(&out, line, n);
+        }
+        line += n;
+    }
+    bool header = false;
+    for (int i = 0; i < NPARAMS; i++) {
+        if (params[i].dirty && !written[i]) {
+            if (!header) {
+                if (out.len > 0 && out.data[out.len-1] != '\n') {
+                    buf_append_byte(&out, '\n');
+                }
+                const char *hdr = "\n# Added by CONFIG REWRITE\n[pogocache]\n";
+                buf_append(&out, hdr, strlen(hdr));
+                header = true;
+            }
+            append_param(&out, &params[i]);
+        }
+    }
+    xfree(data);
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", configfile);
+    FILE *f = fopen(tmp, "wb");
+    bool ok = f && fwrite(out.data, 1, out.len, f) == out.len;
+    ok = f && fclose(f) == 0 && ok;
+    ok = ok && rename(tmp, configfile) == 0;
+    if (!ok) {
+        snprintf(err, errcap, "ERR rewriting %s: %s", configfile,
+            strerror(errno));
+        unlink(tmp);
+    }
+    buf_clear(&out);
+    pthread_mutex_unlock(&lock);
+    return ok;
+}
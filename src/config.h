@@ -0,0 +1,23 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+bool config_load(const char *path);
+bool config_parse_memory(const char *value, size_t *limit);
+bool config_set(const char *name, const char *value, char *err, size_t errcap);
+void config_iter(void (*iter)(const char *name, const char *value,
+    void *udata), void *udata);
+bool config_rewrite(char *err, size_t errcap);
+
+#endif
@@ -13,6 +13,7 @@
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include "net.h"
 #include "args.h"
 #include "cmds.h"
@@ -20,19 +21,29 @@
 #include "parse.h"
 #include "util.h"
 #include "helppage.h"
+#include "sys.h"
+#include "clock.h"
+#include "traffic.h"
 
 #define MAXPACKETSZ 1048576 // Maximum read packet size
 
+extern const char *auth;
+
 struct conn {
     struct net_conn *conn5; // originating connection
     struct buf packet;      // current incoming packet
     int proto;              // connection protocol (memcache, http, etc)
     bool auth;              // user is authorized
+    const char *password;   // password that authorizes, empty for none
+    struct traffic_client traffic;
     bool noreply;           // only for memcache
     bool keepalive;         // only for http
     int httpvers;           // only for http
     struct args args;       // command args, if any
     struct pg *pg;          // postgres context, only if proto is postgres
+    struct buf fwdbuf;      // copy of forwarded args, shared-nothing only
+    struct args fwdargs;    // forwarded args, points into fwdbuf
+    void(*fwdexec)(struct conn *conn, struct args *args);
 };
 
 bool conn_istls(struct conn *conn) {
@@ -51,6 +62,19 @@ void conn_setauth(struct conn *conn, bool ok) {
     conn->auth = ok;
 }
 
+const char *conn_password(struct conn *conn) {
+    return conn->password;
+}
+
+int conn_class(struct conn *conn) {
+    return conn->traffic.class;
+}
+
+void conn_setclass(struct conn *conn, int class) {
+    traffic_leave(&conn->traffic);
+    traffic_join(&conn->traffic, class);
+}
+
 bool conn_isclosed(struct conn *conn) {
     return net_conn_isclosed(conn->conn5);
 }
@@ -64,14 +88,33 @@ void evopened(struct net_conn *conn5, void *udata) {
     struct conn *conn = xmalloc(sizeof(struct conn));
     memset(conn, 0, sizeof(struct conn));
     conn->conn5 = conn5;
+    conn->password = auth;
+    int class = 0;
+    struct conn_listen *listen = net_conn_listen(conn5);
+    if (listen) {
+        // The listener only takes one protocol, so there's no sniffing.
+        conn->proto = listen->proto;
+        if (listen->auth) {
+            conn->password = listen->auth;
+        }
+        class = listen->class;
+    }
+    traffic_join(&conn->traffic, class);
+    if (net_conn_isdatagram(conn5)) {
+        // Only memcache has a udp protocol.
+        conn->proto = PROTO_MEMCACHE;
+    }
     net_conn_setudata(conn5, conn);
 }
 
 void evclosed(struct net_conn *conn5, void *udata) {
     (void)udata;
     struct conn *conn = net_conn_udata(conn5);
+    traffic_leave(&conn->traffic);
     buf_clear(&conn->packet);
     args_free(&conn->args);
+    buf_clear(&conn->fwdbuf);
+    args_free(&conn->fwdargs);
     pg_free(conn->pg);
     xfree(conn);
 }
@@ -87,6 +130,11 @@ void evdata(struct net_conn *conn5, const void *evdata, size_t evlen,
     if (conn_isclosed(conn)) {
         goto close;
     }
+    if (net_conn_isdatagram(conn5)) {
+        // Every datagram stands alone. Drop any partial request left over
+        // from the previous one.
+        conn->packet.len = 0;
+    }
 #ifdef DATASETOK
     if (evlen == 14 && memcmp(evdata, "*1\r\n$4\r\nPING\r\n", 14) == 0) {
         conn_write_raw(conn, "+PONG\r\n", 7);
@@ -110,7 +158,17 @@ void evdata(struct net_conn *conn5, const void *evdata, size_t evlen,
         data = conn->packet.data;
         copied = true;
     }
+    parse_auth = conn->password;
+    uint64_t pass = net_conn_pass(conn5);
+    bool datagram = net_conn_isdatagram(conn5);
     while (len > 0 && !conn_isclosed(conn)) {
+        if (!datagram && !traffic_ready(&conn->traffic, pass)) {
+            // The class has had its share of this pass. The rest waits for
+            // the next one.
+            traffic_defer(&conn->traffic);
+            net_conn_defer(conn5);
+            break;
+        }
         // Parse the command
         ssize_t n = parse_command(data, len, &conn->args, &conn->proto, 
             &conn->noreply, &conn->httpvers, &conn->keepalive, &conn->pg);
@@ -118,7 +176,9 @@ void evdata(struct net_conn *conn5, const void *evdata, size_t evlen,
             // Not enough data provided yet.
             break;
         } else if (n == -1) {
-            // Protocol error occurred.
+            // Protocol error occurred. Commands queued for batching must
+            // reply first.
+            evcommand_flush();
             conn_write_error(conn, parse_lasterror());
             if (conn->proto == PROTO_MEMCACHE) {
                 // Memcache doesn't close, but we'll need to know the last
@@ -140,6 +200,7 @@ void evdata(struct net_conn *conn5, const void *evdata, size_t evlen,
                 }
             } else if (conn->proto == PROTO_MEMCACHE) {
                 // Memcache simply returns a nondescript error.
+                evcommand_flush();
                 conn_write_error(conn, "ERROR");
             } else if (conn->proto == PROTO_HTTP) {
                 // HTTP must always return arguments.
@@ -155,7 +216,13 @@ void evdata(struct net_conn *conn5, const void *evdata, size_t evlen,
         } else if (conn->proto != PROTO_POSTGRES || 
             pg_precommand(conn, &conn->args, conn->pg))
         {
-            evcommand(conn, &conn->args);
+            traffic_charge(&conn->traffic, conn->args.len);
+            if (traffic_admit(&conn->traffic, clock_now())) {
+                evcommand(conn, &conn->args);
+            } else {
+                evcommand_flush();
+                conn_write_error(conn, ERR_RATE_LIMITED);
+            }
         }
         len -= n;
         data += n;
@@ -192,6 +259,7 @@ close:
 
 struct bgworkctx {
     struct conn *conn;
+    int class;
     void *udata;
     void(*work)(void *udata);
     void(*done)(struct conn *conn, void *udata);
@@ -205,6 +273,7 @@ static void work5(void *udata) {
 static void done5(struct net_conn *conn, void *udata) {
     (void)conn;
     struct bgworkctx *ctx = udata;
+    traffic_bgend(ctx->class);
     ctx->done(ctx->conn, ctx->udata);
     xfree(ctx);
 }
@@ -215,18 +284,147 @@ static void done5(struct net_conn *conn, void *udata) {
 bool conn_bgwork(struct conn *conn, void(*work)(void *udata), 
     void(*done)(struct conn *conn, void *udata), void *udata)
 {
+    int class = conn->traffic.class;
+    if (!traffic_bgbegin(class)) {
+        return false;
+    }
     struct bgworkctx *ctx = xmalloc(sizeof(struct bgworkctx));
     ctx->conn = conn;
+    ctx->class = class;
     ctx->udata = udata;
     ctx->work = work;
     ctx->done = done;
     if (!net_conn_bgwork(conn->conn5, work5, done5, ctx)) {
+        traffic_bgend(class);
         xfree(ctx);
         return false;
     }
     return true;
 }
 
+static void fwdwork(struct net_conn *conn5, void *udata) {
+    (void)conn5;
+    struct conn *conn = udata;
+    conn->fwdexec(conn, &conn->fwdargs);
+    args_clear(&conn->fwdargs);
+}
+
+// conn_forward executes the command on another thread. The args are copied
+// because the incoming packet is reused once this thread moves on.
+// Returns false when the command could not be forwarded, in which case the
+// caller should execute it.
+bool conn_forward(struct conn *conn, int thread, 
+    void(*exec)(struct conn *conn, struct args *args), struct args *args)
+{
+    if (conn->proto == PROTO_HTTP) {
+        // HTTP connections are closed after each command by evdata.
+        return false;
+    }
+    size_t size = 0;
+    for (size_t i = 0; i < args->len; i++) {
+        size += args->bufs[i].len;
+    }
+    conn->fwdbuf.len = 0;
+    buf_ensure(&conn->fwdbuf, size+1);
+    args_clear(&conn->fwdargs);
+    for (size_t i = 0; i < args->len; i++) {
+        char *data = conn->fwdbuf.data+conn->fwdbuf.len;
+        buf_append(&conn->fwdbuf, args->bufs[i].data, args->bufs[i].len);
+        args_append(&conn->fwdargs, data, args->bufs[i].len, true);
+    }
+    conn->fwdexec = exec;
+    if (!net_conn_forward(conn->conn5, thread, fwdwork, conn)) {
+        args_clear(&conn->fwdargs);
+        return false;
+    }
+    return true;
+}
+
+int conn_thread(struct conn *conn) {
+    return net_conn_thread(conn->conn5);
+}
+
+uint64_t conn_id(struct conn *conn) {
+    return net_conn_id(conn->conn5);
+}
+
+// Returns the current length of the output, for use with conn_out_take.
+size_t conn_out_mark(struct conn *conn) {
+    return net_conn_out_len(conn->conn5);
+}
+
+// Move all output that was written after mark into buf.
+void conn_out_take(struct conn *conn, size_t mark, struct buf *buf) {
+    size_t len = net_conn_out_len(conn->conn5);
+    if (len > mark) {
+        buf_append(buf, net_conn_out(conn->conn5)+mark, len-mark);
+        net_conn_out_setlen(conn->conn5, mark);
+    }
+}
+
+void evprocessed(void *udata) {
+    (void)udata;
+    evcommand_flush();
+}
+
+// The connection has been idle for a while. Release the buffers that will
+// be allocated again on demand. The packet is kept if it has partial data.
+void evidle(struct net_conn *conn5, void *udata) {
+    (void)udata;
+    struct conn *conn = net_conn_udata(conn5);
+    if (conn->packet.len == 0) {
+        buf_clear(&conn->packet);
+    }
+    args_free(&conn->args);
+    buf_clear(&conn->fwdbuf);
+    args_free(&conn->fwdargs);
+}
+
+// Returns the memory used by the connection buffers.
+// Only scalar fields are read, as this may be called from another thread.
+// Arguments are mostly zero-copy references into the packet, so their own
+// data is not counted.
+size_t conn_memsize(struct conn *conn) {
+    return sizeof(struct conn)+conn->packet.cap+
+        conn->args.cap*sizeof(struct buf)+conn->fwdbuf.cap+
+        conn->fwdargs.cap*sizeof(struct buf)+net_conn_memsize(conn->conn5);
+}
+
+static const char *proto_name(int proto) {
+    switch (proto) {
+    case PROTO_MEMCACHE: return "memcache";
+    case PROTO_POSTGRES: return "postgres";
+    case PROTO_HTTP:     return "http";
+    case PROTO_RESP:     return "resp";
+    default:             return "none";
+    }
+}
+
+static void client_line(struct net_conn *conn5, void *udata) {
+    struct buf *buf = udata;
+    struct conn *conn = net_conn_udata(conn5);
+    int64_t now = clock_now();
+    char addr[64];
+    net_conn_addr(conn5, addr, sizeof(addr));
+    char line[512];
+    size_t n = snprintf(line, sizeof(line), "id=%" PRIu64 " addr=%s fd=%d "
+        "thread=%d age=%" PRIi64 " idle=%" PRIi64 " proto=%s class=%s "
+        "qbuf=%zu qbuf-cap=%zu tot-mem=%zu\n", net_conn_id(conn5), addr,
+        net_conn_fd(conn5), net_conn_thread(conn5), 
+        (now-net_conn_created(conn5))/SECOND, 
+        (now-net_conn_lastactive(conn5))/SECOND, proto_name(conn->proto), 
+        traffic_name(conn->traffic.class), conn->packet.len,
+        conn->packet.cap, conn_memsize(conn));
+    buf_append(buf, line, n);
+}
+
+// Write a line for every connection into buf, in the style of the Redis
+// CLIENT LIST command. Fields of connections that belong to other threads
+// may be slightly stale.
+void conn_client_list(struct buf *buf) {
+    net_conn_list(client_line, buf);
+}
+
 static void writeln(struct conn *conn, char ch, const void *data, ssize_t len) {
     if (len < 0) {
         len = strlen(data);
@@ -300,6 +498,9 @@ static void write_error(struct conn *conn, const char *err, bool server) {
         } else if (strcmp(err, "Bad Request") == 0) {
             conn_write_http(conn, 400, "Bad Request", 
                 "Bad Request\r\n", -1);
+        } else if (strcmp(err, "rate limit exceeded") == 0) {
+            conn_write_http(conn, 429, "Too Many Requests",
+                "Too Many Requests\r\n", -1);
         } else {
             size_t sz = strlen(err)+32;
             char *err2 = xmalloc(sz);
@@ -315,7 +516,9 @@ static void write_error(struct conn *conn, const char *err, bool server) {
 
 void conn_write_error(struct conn *conn, const char *err) {
     bool server = false;
-    if (strcmp(err, ERR_OUT_OF_MEMORY) == 0) {
+    if (strcmp(err, ERR_OUT_OF_MEMORY) == 0 ||
+        strcmp(err, ERR_RATE_LIMITED) == 0)
+    {
         server = true;
     }
     write_error(conn, err, server);
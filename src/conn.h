@@ -23,10 +23,20 @@
 #define ERR_SYNTAX_ERROR        "ERR syntax error"
 #define ERR_INVALID_INTEGER     "ERR value is not an integer or out of range"
 #define ERR_OUT_OF_MEMORY       "ERR out of memory"
+#define ERR_RATE_LIMITED        "ERR rate limit exceeded"
 #define CLIENT_ERROR_BAD_FORMAT "CLIENT_ERROR bad command line format"
 #define CLIENT_ERROR_BAD_CHUNK  "CLIENT_ERROR bad data chunk"
 
 struct conn;
+struct args;
+
+// Settings of a listener that only takes one protocol, which are the udata
+// of its net_listen.
+struct conn_listen {
+    int proto;
+    const char *auth;       // password for its connections, null for --auth
+    int class;              // traffic class of its connections
+};
 
 void conn_close(struct conn *conn);
 bool conn_isclosed(struct conn *conn);
@@ -51,6 +61,9 @@ void resp_write_bulk(struct buf *buf, const void *data, size_t len);
 int conn_proto(struct conn *conn);
 bool conn_auth(struct conn *conn);
 void conn_setauth(struct conn *conn, bool authorized);
+const char *conn_password(struct conn *conn);
+int conn_class(struct conn *conn);
+void conn_setclass(struct conn *conn, int class);
 
 bool pg_execute(struct conn *conn);
 
@@ -74,6 +87,14 @@ void pg_write_simple_row_str_readyf(struct conn *conn, const char *desc,
 
 bool conn_bgwork(struct conn *conn, void(*work)(void *udata), 
     void(*done)(struct conn *conn, void *udata), void *udata);
+bool conn_forward(struct conn *conn, int thread, 
+    void(*exec)(struct conn *conn, struct args *args), struct args *args);
+int conn_thread(struct conn *conn);
+uint64_t conn_id(struct conn *conn);
+size_t conn_memsize(struct conn *conn);
+void conn_client_list(struct buf *buf);
+size_t conn_out_mark(struct conn *conn);
+void conn_out_take(struct conn *conn, size_t mark, struct buf *buf);
 
 void stat_cmd_get_incr(struct conn *conn);
 void stat_cmd_set_incr(struct conn *conn);
@@ -87,5 +108,7 @@ struct pg *conn_pg(struct conn *conn);
 void evopened(struct net_conn *conn, void *udata);
 void evclosed(struct net_conn *conn, void *udata);
 void evdata(struct net_conn *conn, const void *data, size_t len, void *udata);
+void evprocessed(void *udata);
+void evidle(struct net_conn *conn, void *udata);
 
 #endif
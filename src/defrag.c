@@ -0,0 +1,270 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Active defragmentation. After churn between value sizes the allocator is
+// left with pages that hold only a few live entries. Those pages can't be
+// given back to the system, so the resident size stays well above what's in
+// use. The allocator doesn't say which pages are sparse, so each cycle works
+// it out from the entries themselves:
+//
+//   1. Every entry is visited and its bytes are added to the pages it covers.
+//   2. Every entry on a page that is less than half used is offered a new
+//      allocation. The entry moves unless the new memory is on a page known
+//      to be no fuller than the old one. This packs the entries together and
+//      leaves the sparse pages empty.
+//   3. The empty pages are released with xpurge().
+//
+// A cycle starts when the resident size is more than --defragratio percent
+// of the memory in use. It goes one shard step at a time, each under that
+// shard's lock, and sleeps between steps to stay within --defragcpu percent
+// of one CPU.
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "defrag.h"
+#include "hashmap.h"
+#include "pogocache.h"
+#include "sys.h"
+#include "xmalloc.h"
+
+extern int defragratio, defragcpu;
+extern atomic_bool usedefrag;
+extern struct pogocache *cache;
+
+#define PAGESIZE 4096
+#define SPARSE   (PAGESIZE/2)       // pages with fewer live bytes are emptied
+#define MINWASTE (16*1024*1024)     // unused bytes before a cycle is worth it
+#define MAXHELD  65536              // refused allocations held per pass
+#define MAXWAIT  64                 // most seconds between cycles
+
+struct page {
+    uintptr_t page;
+    uint32_t live;   // bytes of entries on the page
+};
+
+static struct hashmap *pages;
+
+// Allocations that were refused in this pass. They're held until the pass
+// is done, otherwise the allocator would hand the same memory back for the
+// next entry. It's memory that was free already, so holding it doesn't add
+// to the resident size.
+static void **held = 0;
+static int nheld = 0;
+
+static atomic_uint_fast64_t cycles = 0;
+static atomic_uint_fast64_t moved = 0;
+static atomic_uint_fast64_t movedbytes = 0;
+static int64_t debt = 0; // nanoseconds of sleep owed to the cpu limit
+
+static uint64_t page_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const struct page *page = item;
+    return hashmap_murmur(&page->page, sizeof(uintptr_t), seed0, seed1);
+}
+
+static int page_compare(const void *a, const void *b, void *udata) {
+    (void)udata;
+    const struct page *pa = a;
+    const struct page *pb = b;
+    return pa->page < pb->page ? -1 : pa->page > pb->page;
+}
+
+static size_t usable(const void *ptr, size_t size) {
+    size_t n = xmalloc_size((void*)ptr);
+    return n > 0 ? n : size;
+}
+
+static void account(const void *ptr, size_t size, bool add) {
+    uintptr_t start = (uintptr_t)ptr;
+    uintptr_t end = start+size;
+    for (uintptr_t p = start/PAGESIZE; p <= (end-1)/PAGESIZE; p++) {
+        uintptr_t lo = start > p*PAGESIZE ? start : p*PAGESIZE;
+        uintptr_t hi = end < (p+1)*PAGESIZE ? end : (p+1)*PAGESIZE;
+        uint32_t n = hi-lo;
+        struct page key = { .page = p };
+        const struct page *page = hashmap_get(pages, &key);
+        key.live = page ? page->live : 0;
+        key.live = add ? key.live+n : key.live > n ? key.live-n : 0;
+        hashmap_set(pages, &key);
+    }
+}
+
+// Returns the live bytes of the fullest page that the memory covers, or -1
+// if no entries are known to be on those pages.
+static int64_t occupancy(const void *ptr, size_t size) {
+    uintptr_t start = (uintptr_t)ptr;
+    uintptr_t end = start+size;
+    int64_t occ = -1;
+    for (uintptr_t p = start/PAGESIZE; p <= (end-1)/PAGESIZE; p++) {
+        const struct page *page = hashmap_get(pages, &(struct page){.page=p});
+        if (page && page->live > occ) {
+            occ = page->live;
+        }
+    }
+    return occ;
+}
+
+static void *scan(const void *ptr, size_t size, void *udata) {
+    (void)udata;
+    account(ptr, usable(ptr, size), true);
+    return 0;
+}
+
+static void *relocate(const void *ptr, size_t size, void *udata) {
+    (void)udata;
+    if (size > PAGESIZE || nheld == MAXHELD) {
+        return 0;
+    }
+    size_t osize = usable(ptr, size);
+    int64_t occ = occupancy(ptr, osize);
+    if (occ >= SPARSE) {
+        return 0;
+    }
+    void *mem = xmalloc(size);
+    size_t nsize = usable(mem, size);
+    int64_t nocc = occupancy(mem, nsize);
+    if (nocc >= 0 && nocc <= occ) {
+        held[nheld++] = mem;
+        return 0;
+    }
+    account(ptr, osize, false);
+    account(mem, nsize, true);
+    atomic_fetch_add_explicit(&moved, 1, __ATOMIC_RELAXED);
+    atomic_fetch_add_explicit(&movedbytes, size, __ATOMIC_RELAXED);
+    return mem;
+}
+
+// Sleeps off the time owed for a step that took 'busy' nanoseconds.
+static void throttle(int64_t busy) {
+    int cpu = defragcpu;
+    debt += busy*(100-cpu)/cpu;
+    if (debt >= 1000000) {
+        int64_t start = sys_now();
+        usleep(debt/1000);
+        debt -= sys_now()-start;
+    }
+}
+
+static void release(void) {
+    for (int i = 0; i < nheld; i++) {
+        xfree(held[i]);
+    }
+    nheld = 0;
+}
+
+static void pass(void *(*fn)(const void *ptr, size_t size, void *udata)) {
+    int nshards = pogocache_nshards(cache);
+    for (int i = 0; i < nshards; i++) {
+        if (!atomic_load(&usedefrag)) {
+            return;
+        }
+        int cursor = 0;
+        do {
+            int64_t start = sys_now();
+            struct pogocache_defrag_opts opts = {
+                .shardidx = i,
+                .cursor = cursor,
+                .relocate = fn,
+            };
+            cursor = pogocache_defrag(cache, &opts);
+            throttle(sys_now()-start);
+        } while (cursor > 0);
+        if (nheld == MAXHELD) {
+            release();
+        }
+    }
+}
+
+// The blocks that the allocator maps on their own can't be fragmented, and
+// some are mostly untouched, such as the per-thread packet arrays. They're
+// left out of both sides, so the ratio is over the heap arenas.
+static void measure(size_t *rss, size_t *used) {
+    struct sys_meminfo meminfo;
+    sys_getmeminfo(&meminfo);
+    size_t mapped = xmalloc_mapped();
+    *rss = meminfo.rss > mapped ? meminfo.rss-mapped : 0;
+    *used = xmalloc_used();
+    if (*used == 0) {
+        *used = pogocache_size(cache, 0);
+    }
+}
+
+double defrag_ratio(void) {
+    size_t rss, used;
+    measure(&rss, &used);
+    return used > 0 ? (double)rss/used : 0;
+}
+
+// Returns the fragmentation after the cycle.
+static double cycle(double before) {
+    int64_t start = sys_now();
+    uint64_t moved0 = atomic_load(&moved);
+    pages = hashmap_new_with_allocator(xmalloc, xrealloc, xfree,
+        sizeof(struct page), 0, 0, 0, page_hash, page_compare, 0, 0);
+    held = xmalloc(sizeof(void*)*MAXHELD);
+    pass(scan);
+    pass(relocate);
+    release();
+    xfree(held);
+    hashmap_free(pages);
+    pages = 0;
+    xpurge();
+    atomic_fetch_add(&cycles, 1);
+    double after = defrag_ratio();
+    printf("# Defrag moved %" PRIu64 " entries, fragmentation %.2f -> %.2f "
+        "(%.1f secs)\n", atomic_load(&moved)-moved0, before, after,
+        (sys_now()-start)/1e9);
+    return after;
+}
+
+static void *defragger(void *arg) {
+    (void)arg;
+    int wait = 1; // seconds until the next cycle may start
+    while (1) {
+        sleep(wait);
+        if (!atomic_load(&usedefrag)) {
+            wait = 1;
+            continue;
+        }
+        size_t rss, used;
+        measure(&rss, &used);
+        if (used == 0 || rss < used+MINWASTE ||
+            (double)rss*100 < (double)used*defragratio)
+        {
+            continue;
+        }
+        double before = (double)rss/used;
+        double after = cycle(before);
+        // What's left may be memory that isn't in entries at all, so back
+        // off while the cycles aren't gaining much.
+        wait = after < before*0.95 ? 1 : wait < MAXWAIT ? wait*2 : MAXWAIT;
+    }
+    return 0;
+}
+
+void defrag_start(void) {
+    pthread_t th;
+    int ret = pthread_create(&th, 0, defragger, 0);
+    if (ret != 0) {
+        perror("# pthread_create(defrag)");
+        exit(1);
+    }
+    pthread_detach(th);
+}
+
+void defrag_stats(struct defrag_stats *stats) {
+    stats->cycles = atomic_load(&cycles);
+    stats->moved = atomic_load(&moved);
+    stats->movedbytes = atomic_load(&movedbytes);
+}
@@ -0,0 +1,25 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+#ifndef DEFRAG_H
+#define DEFRAG_H
+
+#include <stdint.h>
+
+struct defrag_stats {
+    uint64_t cycles;      // completed defrag cycles
+    uint64_t moved;       // entries moved to fuller pages
+    uint64_t movedbytes;  // bytes of those entries
+};
+
+void defrag_start(void);
+void defrag_stats(struct defrag_stats *stats);
+double defrag_ratio(void);
+
+#endif
@@ -0,0 +1,192 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Background eviction. Above the memory limit each new entry evicts one
+// from its own shard before the store returns, which puts the cost on the
+// writer and can't keep up with large values. The evictor threads start once
+// memory passes the high watermark and evict in batches, one shard at a time,
+// until it falls to the low watermark. Both are percents of maxmemory. The
+// inline eviction is then only reached when writes outrun the evictors.
+//
+// Resident memory doesn't go down when entries are freed, because the
+// allocator keeps the pages for reuse. So while memory is near the limit the
+// usage is kept as a running estimate. It starts at the resident size, and
+// at each check moves by the bytes the cache has gained or lost. Where the
+// resident size grew by more than the cache did, something else took that
+// memory, and the difference is added too. The estimate never goes above the
+// resident size. Below the high watermark the resident size alone is used,
+// since it can only overstate the usage.
+//
+// The first evictor checks the memory once a second while it's under the
+// low watermark, and every 10 ms above it.
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "evictor.h"
+#include "pogocache.h"
+#include "sys.h"
+
+extern int evicthigh, evictlow;
+extern atomic_size_t memlimit;
+extern atomic_bool useevict;
+extern struct pogocache *cache;
+
+#define BATCH    16     // entries evicted per shard lock
+#define INTERVAL 10000      // microseconds between checks near the limit
+#define IDLEINTERVAL 1000000 // microseconds between checks well under it
+
+static atomic_int nevictors = 0;
+static atomic_int_fast64_t target = 0;   // bytes left to evict
+static atomic_size_t usage = 0;          // see estimate()
+static atomic_uint_fast64_t evicted = 0;
+static atomic_uint_fast64_t freed = 0;
+static atomic_uint_fast64_t rate = 0;    // entries evicted in the last second
+static atomic_int interval = IDLEINTERVAL;
+
+// Last check, only used by the first evictor.
+static size_t rss0 = 0;
+static size_t bytes0 = 0;
+static size_t est0 = 0;
+static bool sampled = false;
+
+// The shards aren't locked, as this runs every check near the limit and
+// would otherwise hold up every writer that many times a second.
+static size_t cachebytes(void) {
+    struct pogocache_size_opts opts = { .entriesonly = true, .nolock = true };
+    return pogocache_size(cache, &opts);
+}
+
+static size_t estimate(size_t highmark) {
+    struct sys_meminfo meminfo;
+    sys_getmeminfo(&meminfo);
+    size_t rss = meminfo.rss;
+    if (rss < highmark) {
+        // Under the limit, there's no need to count bytes.
+        sampled = false;
+        return rss;
+    }
+    size_t bytes = cachebytes();
+    int64_t est = rss;
+    if (sampled) {
+        int64_t dbytes = (int64_t)bytes-(int64_t)bytes0;
+        int64_t drss = (int64_t)rss-(int64_t)rss0;
+        int64_t other = drss-(dbytes > 0 ? dbytes : 0);
+        est = (int64_t)est0+dbytes+(other > 0 ? other : 0);
+        est = est < 0 ? 0 : est > (int64_t)rss ? (int64_t)rss : est;
+    }
+    rss0 = rss;
+    bytes0 = bytes;
+    est0 = est;
+    sampled = true;
+    return est;
+}
+
+// Evicts from the shards that belong to this evictor until the target is
+// met. Returns false if there was nothing left to evict.
+static bool evictround(int id, int *shard) {
+    int nshards = pogocache_nshards(cache);
+    int n = atomic_load(&nevictors);
+    int empty = 0;
+    while (atomic_load_explicit(&target, __ATOMIC_RELAXED) > 0) {
+        if (*shard >= nshards) {
+            *shard = id;
+            nshards = pogocache_nshards(cache);
+        }
+        struct pogocache_evict_opts opts = {
+            .count = BATCH,
+            .shardidx = *shard,
+        };
+        *shard += n;
+        size_t count, size;
+        pogocache_evict(cache, &count, &size, &opts);
+        if (count == 0) {
+            if (++empty > nshards/n) {
+                return false;
+            }
+            continue;
+        }
+        empty = 0;
+        atomic_fetch_add_explicit(&evicted, count, __ATOMIC_RELAXED);
+        atomic_fetch_add_explicit(&freed, size, __ATOMIC_RELAXED);
+        atomic_fetch_sub_explicit(&target, size, __ATOMIC_RELAXED);
+    }
+    return true;
+}
+
+static void *evictor(void *arg) {
+    int id = (int)(intptr_t)arg;
+    int shard = id;
+    int64_t lastsec = 0;
+    uint64_t lastevicted = 0;
+    while (1) {
+        if (id == 0) {
+            size_t limit = atomic_load(&memlimit);
+            if (limit == SIZE_MAX) {
+                atomic_store(&usage, 0);
+                atomic_store(&interval, IDLEINTERVAL);
+            } else {
+                size_t high = limit/100*evicthigh;
+                size_t low = limit/100*evictlow;
+                size_t est = estimate(high);
+                atomic_store(&usage, est);
+                atomic_store(&interval, est < low ? IDLEINTERVAL : INTERVAL);
+                if (est > high && atomic_load(&useevict) &&
+                    atomic_load(&target) <= 0)
+                {
+                    atomic_store(&target, (int64_t)(est-low));
+                }
+            }
+            int64_t sec = sys_now()/1000000000;
+            if (sec != lastsec) {
+                uint64_t n = atomic_load(&evicted);
+                atomic_store(&rate, n-lastevicted);
+                lastevicted = n;
+                lastsec = sec;
+            }
+        }
+        if (atomic_load_explicit(&target, __ATOMIC_RELAXED) > 0) {
+            if (!evictround(id, &shard)) {
+                // The cache is empty, the memory is held elsewhere.
+                atomic_store(&target, 0);
+                sleep(1);
+            }
+        }
+        usleep(atomic_load_explicit(&interval, __ATOMIC_RELAXED));
+    }
+    return 0;
+}
+
+void evictor_start(int n) {
+    atomic_store(&nevictors, n);
+    for (int i = 0; i < n; i++) {
+        pthread_t th;
+        int ret = pthread_create(&th, 0, evictor, (void*)(intptr_t)i);
+        if (ret != 0) {
+            perror("# pthread_create(evictor)");
+            exit(1);
+        }
+        pthread_detach(th);
+    }
+}
+
+bool evictor_running(void) {
+    return atomic_load(&nevictors) > 0;
+}
+
+void evictor_stats(struct evictor_stats *stats) {
+    stats->usage = atomic_load(&usage);
+    stats->evicted = atomic_load(&evicted);
+    stats->freed = atomic_load(&freed);
+    stats->rate = atomic_load(&rate);
+}
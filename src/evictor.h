@@ -0,0 +1,28 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+#ifndef EVICTOR_H
+#define EVICTOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct evictor_stats {
+    size_t usage;      // estimated memory usage, zero without a limit
+    uint64_t evicted;  // entries evicted in the background
+    uint64_t freed;    // bytes freed by those entries
+    uint64_t rate;     // entries evicted in the last second
+};
+
+void evictor_start(int n);
+bool evictor_running(void);
+void evictor_stats(struct evictor_stats *stats);
+
+#endif
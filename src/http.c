@@ -18,8 +18,6 @@
 #include "util.h"
 #include "parse.h"
 
-extern const bool useauth;
-extern const char *auth;
 
 bool http_valid_key(const char *key, size_t len) {
     if (len == 0 || len > 250) {
@@ -183,7 +181,7 @@ readbody:
         return 0;
     }
     const char *body = p;
-    p = e;
+    p += bodylen;
 
     // check
     if (urilen == 0 || uri[0] != '/') {
@@ -335,16 +333,17 @@ readbody:
             goto unauthorized;
         }
     }
-    if (useauth || authvallen > 0) {
+    if (*parse_auth || authvallen > 0) {
         stat_auth_cmds_incr(0);
-        size_t authlen = strlen(auth);
-        if (authvallen != authlen || memcmp(auth, authval, authlen) != 0) {
+        size_t authlen = strlen(parse_auth);
+        if (authvallen != authlen || memcmp(parse_auth, authval, authlen) != 0)
+        {
             stat_auth_errors_incr(0);
             goto unauthorized;
         }
 
     }
-    return e-data;
+    return p-data;
 badreq:
     parse_seterror("Bad Request");
     return -1;
@@ -0,0 +1,313 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Live tuning. The startup tuning in performance_tuning.c picks its values
+// from the machine alone. This revisits some of them while the server runs,
+// going by what the event loops and the cache have been doing over the last
+// few seconds, and always within the limits given by the operator.
+//
+//   queuesize   events taken per pass. Raised while passes keep filling the
+//               queue, lowered while writes stall on full socket buffers.
+//   busypoll    empty polls before a thread waits. Raised under heavy
+//               traffic, lowered on lock contention or light traffic.
+//   evictbatch  entries evicted per store in low memory mode. Raised while
+//               memory stays above the limit.
+//   shrinkat    shard fill at which hashmaps shrink. Lowered when shards
+//               both grow and shrink in a window, which is resize churn.
+//   loadfactor  lowered when sampled probe lengths get long, raised back
+//               toward the configured value when they are short.
+//
+// Every change is printed.
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "livetune.h"
+#include "net.h"
+#include "performance_tuning.h"
+#include "pogocache.h"
+
+extern int queuesize, loadfactor;
+extern int tunemaxqueue, tunemaxpoll, tunemaxevict, tuneminload;
+extern atomic_bool uselivetune;
+extern atomic_bool lowmem;
+extern struct pogocache *cache;
+
+#define WINDOW       5   // seconds of metrics behind each decision
+#define SHRINKAT     10  // default shrinkat, as pogocache.c
+#define LFWINDOWS    12  // windows between load factor changes
+#define QUIETWINDOWS 12  // windows without resizes to restore shrinkat
+
+static struct {
+    bool started;
+    int ticks;                      // ticks in this window
+    int lowmemticks;                // ticks in low memory mode
+    uint64_t dibsum;                // sampled probe lengths
+    uint64_t dibcount;
+    int shard;                      // next shard to sample
+    int quiet;                      // windows without a resize
+    int lfwait;                     // windows until loadfactor may change
+    struct net_loopstats loop;      // at the start of the window
+    struct pogocache_counters counters;
+    uint64_t ops;
+    // current values
+    int queuesize;
+    int busypoll;
+    int evictbatch;
+    int shrinkat;
+    int loadfactor;
+} tune;
+
+static atomic_uint_fast64_t decisions = 0;
+
+uint64_t livetune_decisions(void) {
+    return atomic_load_explicit(&decisions, __ATOMIC_RELAXED);
+}
+
+static uint64_t ops(void) {
+    return stat_cmd_get()+stat_cmd_set();
+}
+
+static void start(void) {
+    memset(&tune, 0, sizeof(tune));
+    tune.started = true;
+    net_loopstats(&tune.loop);
+    pogocache_counters(cache, &tune.counters);
+    tune.ops = ops();
+    tune.queuesize = net_queuesize();
+    tune.busypoll = net_busypoll();
+    tune.evictbatch = 1;
+    tune.shrinkat = SHRINKAT;
+    tune.loadfactor = loadfactor;
+}
+
+static bool change(const char *name, int *cur, int val, const char *why) {
+    if (val == *cur) {
+        return false;
+    }
+    printf("# Livetune: %s %d -> %d (%s)\n", name, *cur, val, why);
+    *cur = val;
+    atomic_fetch_add_explicit(&decisions, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static int min(int a, int b) {
+    return a < b ? a : b;
+}
+
+static int max(int a, int b) {
+    return a > b ? a : b;
+}
+
+static void tune_queuesize(struct net_loopstats *loop) {
+    if (loop->passes == 0) {
+        return;
+    }
+    int maxq = tunemaxqueue > 0 ? tunemaxqueue : queuesize;
+    int q = tune.queuesize;
+    int full = loop->fullpasses*100/loop->passes;
+    double avg = (double)loop->events/loop->passes;
+    char why[96] = "";
+    if (loop->writestalls*4 > loop->passes) {
+        // Taking fewer events per pass means fewer replies waiting behind a
+        // client that isn't reading.
+        q = max(q/2, PERF_MIN_QUEUESIZE);
+        snprintf(why, sizeof(why), "%.1f write stalls per pass",
+            (double)loop->writestalls/loop->passes);
+    } else if (full >= 25) {
+        q = min(q*2, maxq);
+        snprintf(why, sizeof(why), "%d%% of passes filled the queue", full);
+    } else if (full == 0 && avg*8 < q && q > queuesize) {
+        q = max(q/2, queuesize);
+        snprintf(why, sizeof(why), "%.1f events per pass", avg);
+    } else if (full == 0 && loop->writestalls == 0 && q < queuesize) {
+        q = min(q*2, queuesize);
+        snprintf(why, sizeof(why), "writes no longer stall");
+    }
+    if (change("queuesize", &tune.queuesize, q, why)) {
+        net_set_queuesize(q);
+    }
+}
+
+static void tune_busypoll(struct net_loopstats *loop,
+    struct pogocache_counters *counters, uint64_t nops)
+{
+    int p = tune.busypoll;
+    double rate = (double)loop->events/WINDOW/net_nthreads();
+    double waits = nops > 0 ? (double)counters->lockwaits*1000/nops : 0;
+    char why[96] = "";
+    if (waits >= 10 && p > 0) {
+        // Spinning threads only add to the contention.
+        p /= 2;
+        snprintf(why, sizeof(why), "%.0f lock waits per 1000 commands",
+            waits);
+    } else if (rate >= 1000 && waits < 10) {
+        p = min(p > 0 ? p*2 : 8, tunemaxpoll);
+        snprintf(why, sizeof(why), "%.0f events/s per thread", rate);
+    } else if (rate < 100) {
+        p = 0;
+        snprintf(why, sizeof(why), "%.0f events/s per thread", rate);
+    }
+    if (change("busypoll", &tune.busypoll, p, why)) {
+        net_set_busypoll(p);
+    }
+}
+
+static void tune_evictbatch(struct pogocache_counters *counters) {
+    int n = tune.evictbatch;
+    char why[96] = "";
+    if (tune.lowmemticks == WINDOW && counters->evictions > 0) {
+        // Evicting one entry per new entry isn't bringing memory down.
+        n = min(n+1, tunemaxevict);
+        snprintf(why, sizeof(why), "%" PRIu64 " evictions, still low memory",
+            counters->evictions);
+    } else if (tune.lowmemticks == 0) {
+        n = max(n-1, 1);
+        snprintf(why, sizeof(why), "memory below the limit");
+    }
+    if (change("evictbatch", &tune.evictbatch, n, why)) {
+        pogocache_set_evictbatch(cache, n);
+    }
+}
+
+static void tune_shrinkat(struct pogocache_counters *counters) {
+    int s = tune.shrinkat;
+    char why[96] = "";
+    if (counters->grows > 0 && counters->shrinks > 0) {
+        tune.quiet = 0;
+        s = max(s/2, 1);
+        snprintf(why, sizeof(why), "%" PRIu64 " grows and %" PRIu64
+            " shrinks", counters->grows, counters->shrinks);
+    } else if (counters->grows > 0 || counters->shrinks > 0) {
+        tune.quiet = 0;
+    } else if (++tune.quiet >= QUIETWINDOWS) {
+        tune.quiet = 0;
+        s = min(s*2, SHRINKAT);
+        snprintf(why, sizeof(why), "no resizes for %d seconds",
+            QUIETWINDOWS*WINDOW);
+    }
+    if (change("shrinkat", &tune.shrinkat, s, why)) {
+        pogocache_set_shrinkat(cache, s);
+    }
+}
+
+static void tune_loadfactor(void) {
+    // A new load factor only takes hold as shards resize, so give it time
+    // before looking at the probe lengths again.
+    if (tune.lfwait > 0) {
+        tune.lfwait--;
+        return;
+    }
+    if (tune.dibcount < 1000) {
+        return;
+    }
+    int lf = tune.loadfactor;
+    double avg = (double)tune.dibsum/tune.dibcount;
+    if (avg > 2.5) {
+        lf = max(lf-5, min(tuneminload, loadfactor));
+    } else if (avg < 1.5) {
+        lf = min(lf+5, loadfactor);
+    }
+    char why[96] = "";
+    snprintf(why, sizeof(why), "average probe length %.2f", avg);
+    if (change("loadfactor", &tune.loadfactor, lf, why)) {
+        pogocache_set_loadfactor(cache, lf);
+        tune.lfwait = LFWINDOWS;
+    }
+}
+
+// Puts back the values from before tuning started.
+static void stop(void) {
+    const char *why = "livetune turned off";
+    if (change("queuesize", &tune.queuesize, queuesize, why)) {
+        net_set_queuesize(queuesize);
+    }
+    if (change("busypoll", &tune.busypoll, 0, why)) {
+        net_set_busypoll(0);
+    }
+    if (change("evictbatch", &tune.evictbatch, 1, why)) {
+        pogocache_set_evictbatch(cache, 1);
+    }
+    if (change("shrinkat", &tune.shrinkat, SHRINKAT, why)) {
+        pogocache_set_shrinkat(cache, SHRINKAT);
+    }
+    if (change("loadfactor", &tune.loadfactor, loadfactor, why)) {
+        pogocache_set_loadfactor(cache, loadfactor);
+    }
+    tune.started = false;
+}
+
+// Called once a second.
+void livetune_tick(void) {
+    if (!atomic_load_explicit(&uselivetune, __ATOMIC_RELAXED)) {
+        if (tune.started) {
+            stop();
+        }
+        return;
+    }
+    if (!tune.started) {
+        start();
+        return;
+    }
+    tune.lowmemticks += atomic_load_explicit(&lowmem, __ATOMIC_RELAXED);
+    // Probe lengths come from one shard per tick, which takes the lock of
+    // only that shard.
+    struct pogocache_stats stats;
+    struct pogocache_stats_opts sopts = {
+        .oneshard = true,
+        .oneshardidx = tune.shard++ % pogocache_nshards(cache),
+    };
+    pogocache_stats(cache, &stats, &sopts);
+    tune.dibsum += stats.dibsum;
+    tune.dibcount += stats.count;
+    if (++tune.ticks < WINDOW) {
+        return;
+    }
+
+    // Changes over the window
+    struct net_loopstats loop;
+    net_loopstats(&loop);
+    struct net_loopstats dloop = {
+        .passes = loop.passes-tune.loop.passes,
+        .events = loop.events-tune.loop.events,
+        .fullpasses = loop.fullpasses-tune.loop.fullpasses,
+        .writestalls = loop.writestalls-tune.loop.writestalls,
+    };
+    struct pogocache_counters counters;
+    pogocache_counters(cache, &counters);
+    struct pogocache_counters dcounters = {
+        .lockwaits = counters.lockwaits-tune.counters.lockwaits,
+        .evictions = counters.evictions-tune.counters.evictions,
+        .grows = counters.grows-tune.counters.grows,
+        .shrinks = counters.shrinks-tune.counters.shrinks,
+    };
+    uint64_t nops = ops();
+    uint64_t dops = nops-tune.ops;
+
+    tune_queuesize(&dloop);
+    if (tunemaxpoll > 0) {
+        tune_busypoll(&dloop, &dcounters, dops);
+    }
+    if (tunemaxevict > 1) {
+        tune_evictbatch(&dcounters);
+    }
+    tune_shrinkat(&dcounters);
+    tune_loadfactor();
+
+    tune.loop = loop;
+    tune.counters = counters;
+    tune.ops = nops;
+    tune.ticks = 0;
+    tune.lowmemticks = 0;
+    tune.dibsum = 0;
+    tune.dibcount = 0;
+}
@@ -0,0 +1,18 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+#ifndef LIVETUNE_H
+#define LIVETUNE_H
+
+#include <stdint.h>
+
+void livetune_tick(void);
+uint64_t livetune_decisions(void);
+
+#endif
@@ -28,24 +28,50 @@
 #include "sys.h"
 #include "cmds.h"
 #include "save.h"
+#include "capture.h"
+#include "config.h"
 #include "xmalloc.h"
 #include "util.h"
 #include "tls.h"
+#include "shm.h"
 #include "pogocache.h"
 #include "gitinfo.h"
 #include "uring.h"
 #include "performance_tuning.h"
+#include "defrag.h"
+#include "evictor.h"
+#include "livetune.h"
+#include "clock.h"
+#include "traffic.h"
+#include "ttlpolicy.h"
 
 // default user flags
 int nthreads = 0;             // number of client threads
+int maxthreads = 0;           // threads that CONFIG SET may grow to
 char *port = "9401";          // default tcp port (non-tls)
 char *host = "127.0.0.1";     // default hostname or ip address
 char *persist = "";           // file to load and save data to
 char *unixsock = "";          // use a unix socket
+char *shmsock = "";           // unix socket for shared-memory clients
+char *udpport = "";           // memcache udp port
+char *memcacheport = "";      // tcp port for memcache only
+char *respport = "";          // tcp port for resp only
+char *httpport = "";          // tcp port for http only
+char *pgport = "";            // tcp port for postgres only
+char *memcachesock = "";      // unix socket for memcache only
+char *respsock = "";          // unix socket for resp only
+char *httpsock = "";          // unix socket for http only
+char *pgsock = "";            // unix socket for postgres only
 char *reuseport = "no";       // reuse tcp port for other programs
 char *tcpnodelay = "yes";     // disable nagle's algorithm
 char *quickack = "no";        // enable quick acks
 char *usecas = "no";          // enable compare and store
+char *hotkeys = "yes";        // serve hot keys from per-thread copies
+char *clocksource = "os";     // time source for commands, os or tsc
+char *classes = "";           // traffic classes
+int classbudget = 1024;       // arguments per thread pass shared by classes
+int ratelimit = 0;            // commands per second per connection (0 = off)
+char *ttlpolicy = "";         // ttl policies by key prefix
 char *keepalive = "yes";      // socket keepalive setting
 int backlog = 0;              // network socket accept backlog (0 = auto-optimize)
 int queuesize = 0;            // event queue size (0 = auto-optimize)
@@ -64,6 +90,24 @@ int maxconns = 0;             // maximum number of sockets (0 = auto-optimize)
 char *noticker = "no";
 char *warmup = "yes";
 char *autotune = "yes";       // enable automatic performance tuning
+char *livetune = "no";        // keep tuning at runtime from live metrics
+int tunemaxqueue = 0;         // livetune queuesize limit (0 = 4x queuesize)
+int tunemaxpoll = 64;         // livetune busy poll limit (0 = never poll)
+int tunemaxevict = 8;         // livetune evictions per store limit
+int tuneminload = 60;         // livetune lowest load factor
+int evictors = 1;             // background eviction threads
+int evicthigh = 95;           // start evicting at percent of maxmemory
+int evictlow = 90;            // evict down to percent of maxmemory
+char *defrag = "no";          // move entries off sparse allocator pages
+int defragratio = 130;        // defrag above rss percent of memory in use
+int defragcpu = 10;           // defrag percent of one cpu
+char *sharednothing = "no";   // partition shards across threads
+char *batching = "no";        // batch commands across connections
+int idletimeout = 0;          // close idle connections, seconds (0 = never)
+int idlecompact = 10;         // release idle connection buffers, seconds
+int maxbgwork = 0;            // running background workers (0 = no limit)
+int maxshards = 0;            // shards for CONFIG SET (0 = 4x shards)
+char *configfile = "";        // config file, for CONFIG REWRITE
 
 // Global variables calculated in main().
 // These should never change during the lifetime of the process.
@@ -72,18 +116,17 @@ char *version;
 char *githash;
 uint64_t seed;
 size_t sysmem;
-size_t memlimit;
-int verb;           // verbosity, 0=no, 1=verbose, 2=very, 3=extremely
 bool usesixpack;
 int useallocator;
 bool usetrackallocs;
-bool useevict;
 int nshards;
 bool usetls;        // use tls security (pemfile required);
 bool useauth;       // use auth password
 bool usecolor;      // allow color in terminal
 char *useid;        // instance id (unique to every process run)
 int64_t procstart;  // proc start boot time, for uptime stat
+bool usesharednothing; // each thread owns a partition of the shards
+bool usebatching;      // group commands by shard for each event loop pass
 
 // Global atomic variable. These are safe to read and modify by other source
 // files, as long as those sources use "atomic_" methods.
@@ -93,6 +136,13 @@ atomic_bool sweep;               // mark for async sweep, asap
 atomic_bool registered;          // registration is active
 atomic_bool lowmem;              // system is in low memory mode.
 
+// Options that can be changed at runtime with CONFIG SET.
+atomic_int verb;       // verbosity, 0=no, 1=verbose, 2=very, 3=extremely
+atomic_size_t memlimit;          // low memory mode above this rss
+atomic_bool useevict;            // evict entries in low memory mode
+atomic_bool uselivetune;         // run the live tuner, see livetune.c
+atomic_bool usedefrag;           // run the defragmenter, see defrag.c
+
 struct pogocache *cache;
 
 // min max robinhood load factor (75% performs pretty well)
@@ -141,16 +191,49 @@ static void showhelp(FILE *file) {
     HOPT("-h hostname", "listening host", "%s", host);
     HOPT("-p port", "listening port", "%s", port);
     HOPT("-s socket", "unix socket file", "%s", *unixsock?unixsock:"none");
+    HOPT("--shmsock socket", "shared-memory client socket", "%s", 
+        *shmsock?shmsock:"none");
+    HOPT("--udpport port", "memcache udp port", "%s", 
+        *udpport?udpport:"none");
+    HOPT("--memcacheport port", "memcache only tcp port", "%s",
+        *memcacheport?memcacheport:"none");
+    HOPT("--respport port", "resp only tcp port", "%s",
+        *respport?respport:"none");
+    HOPT("--httpport port", "http only tcp port", "%s",
+        *httpport?httpport:"none");
+    HOPT("--pgport port", "postgres only tcp port", "%s",
+        *pgport?pgport:"none");
+    HOPT("--memcachesock socket", "memcache only unix socket", "%s",
+        *memcachesock?memcachesock:"none");
+    HOPT("--respsock socket", "resp only unix socket", "%s",
+        *respsock?respsock:"none");
+    HOPT("--httpsock socket", "http only unix socket", "%s",
+        *httpsock?httpsock:"none");
+    HOPT("--pgsock socket", "postgres only unix socket", "%s",
+        *pgsock?pgsock:"none");
 
     HOPT("-v,-vv,-vvv", "verbose logging level", noopt, "");
     HELP("\n");
     
     HELP("Additional options:\n");
     HOPT("--threads count", "number of threads", "%d", nprocs);
+    HOPT("--config path", "config file", "%s", *configfile?configfile:"none");
     HOPT("--maxmemory value", "set max memory usage", "%s", maxmemory);
     HOPT("--evict yes/no", "evict keys at maxmemory", "%s", evict);
+    HOPT("--evictors count", "background eviction threads", "%d", evictors);
+    HOPT("--evicthigh percent", "start evicting at % of max", "%d",
+        evicthigh);
+    HOPT("--evictlow percent", "evict down to % of max", "%d", evictlow);
+    HOPT("--defrag yes/no", "active defragmentation", "%s", defrag);
+    HOPT("--defragratio percent", "defrag above rss % of used", "%d",
+        defragratio);
+    HOPT("--defragcpu percent", "defrag cpu limit", "%d", defragcpu);
     HOPT("--persist path", "persistence file", "%s", *persist?persist:"none");
     HOPT("--maxconns conns", "maximum connections", "%s", maxconns==0?"auto":"custom");
+    HOPT("--idletimeout secs", "close idle connections", "%s", 
+        idletimeout==0?"never":"custom");
+    HOPT("--idlecompact secs", "release idle connection buffers", "%d", 
+        idlecompact);
     HELP("\n");
     
     HELP("Security options:\n");
@@ -165,16 +248,42 @@ static void showhelp(FILE *file) {
 
     HELP("Advanced options:\n");
     HOPT("--shards count", "number of shards", "%d", nshards);
+    HOPT("--maxshards count", "shards for CONFIG SET", "%s", "4x shards");
     HOPT("--backlog count", "accept backlog", "%s", backlog==0?"auto":"custom");
     HOPT("--queuesize count", "event queuesize size", "%s", queuesize==0?"auto":"custom");
+    HOPT("--maxthreads count", "threads for CONFIG SET", "%s",
+        maxthreads==0?"threads":"custom");
+    HOPT("--maxbgwork count", "running background workers", "%s",
+        maxbgwork==0?"unlimited":"custom");
     HOPT("--autotune yes/no", "enable auto performance tuning", "%s", autotune);
+    HOPT("--livetune yes/no", "keep tuning from live metrics", "%s", livetune);
+    HOPT("--tunemaxqueue count", "livetune queuesize limit", "%s",
+        tunemaxqueue==0?"auto":"custom");
+    HOPT("--tunemaxpoll count", "livetune busy poll limit", "%d",
+        tunemaxpoll);
+    HOPT("--tunemaxevict count", "livetune evictions per store", "%d",
+        tunemaxevict);
+    HOPT("--tuneminload percent", "livetune lowest load factor", "%d",
+        tuneminload);
     HOPT("--reuseport yes/no", "reuseport for tcp", "%s", reuseport);
     HOPT("--tcpnodelay yes/no", "disable nagle's algo", "%s", tcpnodelay);
     HOPT("--quickack yes/no", "use quickack (linux)", "%s", quickack);
     HOPT("--uring yes/no", "use uring (linux)", "%s", uring);
+    HOPT("--sharednothing yes/no", "partition shards by thread", "%s", 
+        sharednothing);
+    HOPT("--batching yes/no", "group commands by shard", "%s", batching);
     HOPT("--loadfactor percent", "hashmap load factor", "%d", loadfactor);
     HOPT("--keysixpack yes/no", "sixpack compress keys", "%s", keysixpack);
     HOPT("--cas yes/no", "use compare and store", "%s", usecas);
+    HOPT("--hotkeys yes/no", "copy hot keys to each thread", "%s", hotkeys);
+    HOPT("--clocksource os/tsc", "command time source", "%s", clocksource);
+    HOPT("--classes spec", "traffic classes", "%s", *classes?"custom":"none");
+    HOPT("--classbudget count", "arguments per pass for classes", "%d",
+        classbudget);
+    HOPT("--ratelimit count", "commands per second per client", "%s",
+        ratelimit==0?"unlimited":"custom");
+    HOPT("--ttlpolicy spec", "ttl policies by key prefix", "%s",
+        *ttlpolicy?"custom":"none");
     HELP("\n");
 }
 
@@ -187,42 +296,13 @@ static void showversion(FILE *file) {
 }
 
 static size_t calc_memlimit(char *maxmemory) {
-    if (strcmp(maxmemory, "unlimited") == 0) {
-        return SIZE_MAX;
-    }
-    char *oval = maxmemory;
-    while (isspace(*maxmemory)) {
-        maxmemory++;
-    }
-    char *end;
-    errno = 0;
-    double mem = strtod(maxmemory, &end);
-    if (errno || !(mem > 0) || !isfinite(mem)) {
-        goto fail;
-    }
-    while (isspace(*end)) {
-        end++;
-    }
-    #define exteq(c) \
-        (tolower(end[0])==c&& (!end[1]||(tolower(end[1])=='b'&&!end[2])))
-
-    if (strcmp(end, "") == 0) {
-        return mem;
-    } else if (strcmp(end, "%") == 0) {
-        return (((double)mem)/100.0) * sysmem;
-    } else if (exteq('k')) {
-        return mem*1024.0;
-    } else if (exteq('m')) {
-        return mem*1024.0*1024.0;
-    } else if (exteq('g')) {
-        return mem*1024.0*1024.0*1024.0;
-    } else if (exteq('t')) {
-        return mem*1024.0*1024.0*1024.0*1024.0;
-    }
-fail:
-    fprintf(stderr, "# Invalid maxmemory '%s'\n", oval);
-    showhelp(stderr);
-    exit(1);
+    size_t limit;
+    if (!config_parse_memory(maxmemory, &limit)) {
+        fprintf(stderr, "# Invalid maxmemory '%s'\n", maxmemory);
+        showhelp(stderr);
+        exit(1);
+    }
+    return limit;
 }
 
 static size_t setmaxrlimit(void) {
@@ -297,15 +377,75 @@ static void evicted(int shard, int reason, int64_t time, const void *key,
 
 static atomic_bool loaded = false;
 
-void sigterm(int sig) {
+// Listeners that only take one protocol, from options such as --respport.
+static struct net_listen listens[NET_MAXLISTENS];
+static struct conn_listen listenconfs[NET_MAXLISTENS];
+static int nlistens = 0;
+
+// Adds a listener for the protocol. The option is a port or socket file,
+// which may be followed by comma separated settings: "tls", "backlog=count",
+// "class=name", and "auth=password". The password is the rest of the option,
+// so it may have commas.
+static void addlisten(const char *name, const char *value, int proto,
+    bool sock)
+{
+    if (!*value || strcmp(value, "0") == 0) {
+        return;
+    }
+    char *spec = xmalloc(strlen(value)+1);
+    strcpy(spec, value);
+    struct net_listen *l = &listens[nlistens];
+    struct conn_listen *conf = &listenconfs[nlistens];
+    nlistens++;
+    conf->proto = proto;
+    l->name = name;
+    l->udata = conf;
+    char *next = strchr(spec, ',');
+    if (next) {
+        *next++ = '\0';
+    }
+    if (sock) {
+        l->path = spec;
+    } else {
+        l->port = spec;
+    }
+    while (next) {
+        char *opt = next;
+        if (strncmp(opt, "auth=", 5) == 0) {
+            conf->auth = opt+5;
+            break;
+        }
+        next = strchr(opt, ',');
+        if (next) {
+            *next++ = '\0';
+        }
+        if (strcmp(opt, "tls") == 0 && !sock) {
+            l->tls = true;
+        } else if (strncmp(opt, "backlog=", 8) == 0 && atoi(opt+8) > 0) {
+            l->backlog = atoi(opt+8);
+        } else if (strncmp(opt, "class=", 6) == 0 &&
+            traffic_find(opt+6, strlen(opt+6)) >= 0)
+        {
+            conf->class = traffic_find(opt+6, strlen(opt+6));
+        } else {
+            INVALID_FLAG(name, value);
+        }
+    }
+}
+
+// Runs on the signal thread rather than in a handler, so it may take locks
+// and do file io.
+static void sigterm(int sig) {
     if (sig == SIGINT || sig == SIGTERM) {
+        // Flush a running capture so the trace ends on a whole record.
+        capture_stop();
         if (!atomic_load(&loaded) || !*persist) {
             printf("# Pogocache exiting now\n");
             _Exit(0);
         }
         if (*persist) {
             printf("* Saving data to %s, please wait...\n", persist);
-            int ret = save(persist, true);
+            int ret = save(persist, 0);
             if (ret != 0) {
                 perror("# Save failed");
                 _Exit(1);
@@ -323,24 +463,47 @@ void sigterm(int sig) {
     }
 }
 
+// SIGINT and SIGTERM are blocked in every thread and taken here instead.
+static sigset_t termsigs;
+
+static void *sigwaiter(void *arg) {
+    (void)arg;
+    while (1) {
+        int sig;
+        if (sigwait(&termsigs, &sig) == 0) {
+            sigterm(sig);
+        }
+    }
+    return 0;
+}
+
 static void tick(void) {
+    clock_tick();
     if (!atomic_load_explicit(&loaded, __ATOMIC_ACQUIRE)) {
         return;
     }
     // Memory usage check
-    if (memlimit < SIZE_MAX) {
+    size_t limit = atomic_load(&memlimit);
+    if (limit < SIZE_MAX) {
         struct sys_meminfo meminfo;
         sys_getmeminfo(&meminfo);
         size_t memusage = meminfo.rss;
+        if (evictor_running()) {
+            // The evictors keep an estimate that allows for the memory the
+            // allocator holds on to after they free entries.
+            struct evictor_stats estats;
+            evictor_stats(&estats);
+            memusage = estats.usage;
+        }
         if (!lowmem) {
-            if (memusage > memlimit) {
+            if (memusage > limit) {
                 atomic_store(&lowmem, true);
                 if (verb > 0) {
                     printf("# Low memory mode on\n");
                 }
             }
         } else {
-            if (memusage < memlimit) {
+            if (memusage < limit) {
                 atomic_store(&lowmem, false);
                 if (verb > 0) {
                     printf("# Low memory mode off\n");
@@ -349,6 +512,8 @@ static void tick(void) {
         }
     }
 
+    livetune_tick();
+
     // Print allocations to terminal.
     if (usetrackallocs) {
         printf(". keys=%zu, allocs=%zu, conns=%zu\n",
@@ -378,7 +543,7 @@ static void listening(void *udata) {
             printf("* Loading data from %s, please wait...\n", persist);
             struct load_stats stats;
             int64_t start = sys_now();
-            int ret = load(persist, true, &stats);
+            int ret = load(persist, 0, &stats);
             if (ret != 0) {
                 perror("# Load failed");
                 _Exit(1);
@@ -393,6 +558,10 @@ static void listening(void *udata) {
         }
     }
     atomic_store(&loaded, true);
+    if (evictors > 0) {
+        evictor_start(evictors);
+    }
+    defrag_start();
 }
 
 static void yield(void *udata) {
@@ -403,10 +572,19 @@ static void yield(void *udata) {
 int main(int argc, char *argv[]) {
     procstart = sys_now();
 
-    // Intercept signals
+    // Intercept signals. This must come before any other thread starts, so
+    // they all inherit the mask.
     signal(SIGPIPE, SIG_IGN);
-    signal(SIGINT, sigterm);
-    signal(SIGTERM, sigterm);
+    sigemptyset(&termsigs);
+    sigaddset(&termsigs, SIGINT);
+    sigaddset(&termsigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &termsigs, 0);
+    pthread_t sigth;
+    if (pthread_create(&sigth, 0, sigwaiter, 0) != 0) {
+        perror("# pthread_create(sigwaiter)");
+        exit(1);
+    }
+    pthread_detach(sigth);
 
     // Line buffer logging so pipes will stream.
     setvbuf(stdout, 0, _IOLBF, 0);
@@ -438,6 +616,18 @@ int main(int argc, char *argv[]) {
     atomic_init(&sweep, false);
     atomic_init(&registered, false);
 
+    // The config file is loaded first, so that the flags override it.
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0 && i+1 < argc) {
+            configfile = argv[i+1];
+        } else if (strncmp(argv[i], "--config=", 9) == 0) {
+            configfile = argv[i]+9;
+        }
+    }
+    if (*configfile && !config_load(configfile)) {
+        exit(1);
+    }
+
     // Parse program flags
     for (int ii = 0; ii < 2; ii++) {
         bool dryrun = ii == 0;
@@ -459,11 +649,21 @@ int main(int argc, char *argv[]) {
             TFLAG("-vvv", verb = 3)
             AFLAG("port", port = flag)
             AFLAG("threads", nthreads = atoi(flag))
+            AFLAG("maxthreads", maxthreads = atoi(flag))
+            AFLAG("maxbgwork", maxbgwork = atoi(flag))
+            AFLAG("config", configfile = flag)
             AFLAG("shards", nshards = atoi(flag))
+            AFLAG("maxshards", maxshards = atoi(flag))
             AFLAG("backlog", backlog = atoi(flag))
             AFLAG("queuesize", queuesize = atoi(flag))
             AFLAG("maxmemory", maxmemory = flag)
             AFLAG("evict", evict = flag)
+            AFLAG("evictors", evictors = atoi(flag))
+            AFLAG("evicthigh", evicthigh = atoi(flag))
+            AFLAG("evictlow", evictlow = atoi(flag))
+            AFLAG("defrag", defrag = flag)
+            AFLAG("defragratio", defragratio = atoi(flag))
+            AFLAG("defragcpu", defragcpu = atoi(flag))
             AFLAG("reuseport", reuseport = flag)
             AFLAG("uring", uring = flag)
             AFLAG("tcpnodelay", tcpnodelay = flag)
@@ -471,7 +671,15 @@ int main(int argc, char *argv[]) {
             AFLAG("quickack", quickack = flag)
             AFLAG("trackallocs", trackallocs = flag)
             AFLAG("cas", usecas = flag)
+            AFLAG("hotkeys", hotkeys = flag)
+            AFLAG("clocksource", clocksource = flag)
+            AFLAG("classes", classes = flag)
+            AFLAG("classbudget", classbudget = atoi(flag))
+            AFLAG("ratelimit", ratelimit = atoi(flag))
+            AFLAG("ttlpolicy", ttlpolicy = flag)
             AFLAG("maxconns", maxconns = atoi(flag))
+            AFLAG("idletimeout", idletimeout = atoi(flag))
+            AFLAG("idlecompact", idlecompact = atoi(flag))
             AFLAG("loadfactor", loadfactor = atoi(flag))
             AFLAG("sixpack", keysixpack = flag)
             AFLAG("seed", seed = strtoull(flag, 0, 10))
@@ -480,6 +688,23 @@ int main(int argc, char *argv[]) {
             AFLAG("noticker", noticker = flag)
             AFLAG("warmup", warmup = flag)
             AFLAG("autotune", autotune = flag)
+            AFLAG("livetune", livetune = flag)
+            AFLAG("tunemaxqueue", tunemaxqueue = atoi(flag))
+            AFLAG("tunemaxpoll", tunemaxpoll = atoi(flag))
+            AFLAG("tunemaxevict", tunemaxevict = atoi(flag))
+            AFLAG("tuneminload", tuneminload = atoi(flag))
+            AFLAG("sharednothing", sharednothing = flag)
+            AFLAG("batching", batching = flag)
+            AFLAG("shmsock", shmsock = flag)
+            AFLAG("udpport", udpport = flag)
+            AFLAG("memcacheport", memcacheport = flag)
+            AFLAG("respport", respport = flag)
+            AFLAG("httpport", httpport = flag)
+            AFLAG("pgport", pgport = flag)
+            AFLAG("memcachesock", memcachesock = flag)
+            AFLAG("respsock", respsock = flag)
+            AFLAG("httpsock", httpsock = flag)
+            AFLAG("pgsock", pgsock = flag)
 #ifndef NOOPENSSL
             // TLS flags
             AFLAG("tlsport", tlsport = flag)
@@ -549,6 +774,25 @@ int main(int argc, char *argv[]) {
     } else {
         INVALID_FLAG("usecas", usecas);
     }
+    bool usehotkeys;
+    if (strcmp(hotkeys, "yes") == 0) {
+        usehotkeys = true;
+    } else if (strcmp(hotkeys, "no") == 0) {
+        usehotkeys = false;
+    } else {
+        INVALID_FLAG("hotkeys", hotkeys);
+    }
+    bool usetsc;
+    if (strcmp(clocksource, "tsc") == 0) {
+        usetsc = true;
+    } else if (strcmp(clocksource, "os") == 0) {
+        usetsc = false;
+    } else {
+        INVALID_FLAG("clocksource", clocksource);
+    }
+    if (!clock_init(usetsc)) {
+        fprintf(stderr, "# Using the system clock\n");
+    }
 
     // Auto-tune performance parameters if enabled
     bool useautotune;
@@ -621,6 +865,27 @@ int main(int argc, char *argv[]) {
         INVALID_FLAG("quickack", quickack);
     }
 
+    if (strcmp(sharednothing, "yes") == 0) {
+        usesharednothing = true;
+    } else if (strcmp(sharednothing, "no") == 0) {
+        usesharednothing = false;
+    } else {
+        INVALID_FLAG("sharednothing", sharednothing);
+    }
+
+    if (*shmsock && !shm_supported()) {
+        fprintf(stderr, "# Option --shmsock requires linux\n");
+        exit(1);
+    }
+
+    if (strcmp(batching, "yes") == 0) {
+        usebatching = true;
+    } else if (strcmp(batching, "no") == 0) {
+        usebatching = false;
+    } else {
+        INVALID_FLAG("batching", batching);
+    }
+
     if (strcmp(keysixpack, "yes") == 0) {
         usesixpack = true;
     } else if (strcmp(keysixpack, "no") == 0) {
@@ -635,6 +900,14 @@ int main(int argc, char *argv[]) {
     } else if (nthreads > 4096) {
         nthreads = 4096; 
     }
+    if (maxthreads < nthreads || usesharednothing) {
+        maxthreads = nthreads;
+    } else if (maxthreads > 4096) {
+        maxthreads = 4096;
+    }
+    if (maxbgwork < 0) {
+        maxbgwork = 0;
+    }
 
     if (nshards == 0) {
         nshards = calc_nshards(nthreads);
@@ -642,6 +915,11 @@ int main(int argc, char *argv[]) {
     if (nshards <= 0 || nshards > 65536) {
         nshards = 65536;
     }
+    if (maxshards == 0) {
+        maxshards = nshards*4;
+    }
+    maxshards = maxshards < nshards ? nshards :
+        maxshards > 65536*4 ? 65536*4 : maxshards;
 
     if (loadfactor < MINLOADFACTOR_RH) {
         loadfactor = MINLOADFACTOR_RH;
@@ -650,6 +928,12 @@ int main(int argc, char *argv[]) {
         loadfactor = MAXLOADFACTOR_RH;
         printf("# loadfactor maximum set to %d\n", MAXLOADFACTOR_RH);
     }
+    if (idletimeout < 0) {
+        idletimeout = 0;
+    }
+    if (idlecompact < 0) {
+        idlecompact = 0;
+    }
 
     // Enhanced queuesize validation with performance tuning bounds
     if (queuesize < PERF_MIN_QUEUESIZE) {
@@ -660,6 +944,41 @@ int main(int argc, char *argv[]) {
         printf("# queuesize adjusted to %d (maximum)\n", PERF_MAX_QUEUESIZE);
     }
 
+    if (strcmp(defrag, "yes") == 0) {
+        usedefrag = true;
+    } else if (strcmp(defrag, "no") == 0) {
+        usedefrag = false;
+    } else {
+        INVALID_FLAG("defrag", defrag);
+    }
+    defragratio = defragratio < 101 ? 101 : defragratio > 1000 ? 1000 :
+        defragratio;
+    defragcpu = defragcpu < 1 ? 1 : defragcpu > 100 ? 100 : defragcpu;
+
+    if (strcmp(livetune, "yes") == 0) {
+        uselivetune = true;
+    } else if (strcmp(livetune, "no") == 0) {
+        uselivetune = false;
+    } else {
+        INVALID_FLAG("livetune", livetune);
+    }
+    if (tunemaxqueue == 0) {
+        // The event queues are allocated for this many, so only leave room
+        // to grow when the live tuner is on from the start.
+        tunemaxqueue = uselivetune ? queuesize*4 : queuesize;
+    }
+    tunemaxqueue = tunemaxqueue < queuesize ? queuesize :
+        tunemaxqueue > PERF_MAX_QUEUESIZE ? PERF_MAX_QUEUESIZE : tunemaxqueue;
+    tunemaxpoll = tunemaxpoll < 0 ? 0 : tunemaxpoll;
+    tunemaxevict = tunemaxevict < 1 ? 1 : tunemaxevict > 64 ? 64 :
+        tunemaxevict;
+    tuneminload = tuneminload < MINLOADFACTOR_RH ? MINLOADFACTOR_RH :
+        tuneminload > MAXLOADFACTOR_RH ? MAXLOADFACTOR_RH : tuneminload;
+    evictors = evictors < 0 ? 0 : evictors > 64 ? 64 : evictors;
+    evicthigh = evicthigh < 2 ? 2 : evicthigh > 100 ? 100 : evicthigh;
+    evictlow = evictlow < 1 ? 1 : evictlow >= evicthigh ? evicthigh-1 :
+        evictlow;
+
     if (maxmemorymb) {
         size_t sz = strlen(maxmemorymb)+2;
         char *str = xmalloc(sz);
@@ -671,11 +990,33 @@ int main(int argc, char *argv[]) {
         port = "";
     }
 
+    if (!traffic_init(classes, classbudget, ratelimit)) {
+        exit(1);
+    }
+    if (ttlpolicy_set(ttlpolicy)) {
+        INVALID_FLAG("ttlpolicy", ttlpolicy);
+    }
+    addlisten("memcacheport", memcacheport, PROTO_MEMCACHE, false);
+    addlisten("respport", respport, PROTO_RESP, false);
+    addlisten("httpport", httpport, PROTO_HTTP, false);
+    addlisten("pgport", pgport, PROTO_POSTGRES, false);
+    addlisten("memcachesock", memcachesock, PROTO_MEMCACHE, true);
+    addlisten("respsock", respsock, PROTO_RESP, true);
+    addlisten("httpsock", httpsock, PROTO_HTTP, true);
+    addlisten("pgsock", pgsock, PROTO_POSTGRES, true);
+    bool listentls = false;
+    for (int i = 0; i < nlistens; i++) {
+        listentls = listentls || listens[i].tls;
+    }
+
     if (!*tlsport || strcmp(tlsport, "0") == 0) {
         usetls = false;
         tlsport = "";
     } else {
         usetls = true;
+    }
+    if (usetls || listentls) {
+        usetls = true;
         tls_init();
     }
 
@@ -696,12 +1037,15 @@ int main(int argc, char *argv[]) {
         .seed = seed,
         .malloc = xmalloc,
         .free = xfree,
+        .malloc_size = xmalloc_size,
         .nshards = nshards,
+        .maxshards = maxshards,
         .loadfactor = loadfactor,
         .usecas = usecasflag,
         .evicted = evicted,
         .allowshrink = true,
         .usethreadbatch = true,
+        .hotkeys = usehotkeys,
     };
     // opts.yield = 0;
 
@@ -731,14 +1075,26 @@ int main(int argc, char *argv[]) {
         keysixpack, usecas, *persist?persist:"none", useuring?"yes":"no");
     char tcp_addr[256];
     snprintf(tcp_addr, sizeof(tcp_addr), "%s:%s", host, port);
-    printf("* Network (port: %s, unixsocket: %s, backlog: %d, reuseport: %s, "
-        "maxconns: %d)\n", *port?port:"none", *unixsock?unixsock:"none",
-        backlog, reuseport, maxconns);
+    printf("* Network (port: %s, udpport: %s, unixsocket: %s, shmsocket: %s, "
+        "backlog: %d, reuseport: %s, maxconns: %d, idletimeout: %d, "
+        "idlecompact: %d)\n", *port?port:"none", *udpport?udpport:"none",
+        *unixsock?unixsock:"none", *shmsock?shmsock:"none", backlog, 
+        reuseport, maxconns, idletimeout, idlecompact);
+    for (int i = 0; i < nlistens; i++) {
+        struct net_listen *l = &listens[i];
+        struct conn_listen *conf = l->udata;
+        printf("* Listener (%s: %s, tls: %s, backlog: %d, auth: %s)\n",
+            l->name, l->path ? l->path : l->port, l->tls ? "yes" : "no",
+            l->backlog > 0 ? l->backlog : backlog,
+            !conf->auth ? (*auth ? "enabled" : "disabled") :
+            *conf->auth ? "own" : "disabled");
+    }
     printf("* Socket (tcpnodelay: %s, keepalive: %s, quickack: %s)\n",
         tcpnodelay, keepalive, quickack);
-    printf("* Threads (threads: %d, queuesize: %d)\n", nthreads, queuesize);
+    printf("* Threads (threads: %d, queuesize: %d, sharednothing: %s, "
+        "batching: %s)\n", nthreads, queuesize, sharednothing, batching);
     printf("* Shards (shards: %d, loadfactor: %d%%)\n", nshards, loadfactor);
-    printf("* Performance (autotune: %s)\n", autotune);
+    printf("* Performance (autotune: %s, livetune: %s)\n", autotune, livetune);
     
     // Print performance tuning summary if auto-tuning was used
     if (useautotune && perfconfig) {
@@ -773,6 +1129,8 @@ int main(int argc, char *argv[]) {
         .port = port,
         .tlsport = tlsport,
         .unixsock = unixsock,
+        .shmsock = shmsock,
+        .udpport = udpport,
         .reuseport = usereuseport,
         .tcpnodelay = usetcpnodelay,
         .keepalive = usekeepalive,
@@ -780,13 +1138,23 @@ int main(int argc, char *argv[]) {
         .backlog = backlog,
         .queuesize = queuesize,
         .nthreads = nthreads,
+        .maxthreads = maxthreads,
+        .maxbgwork = maxbgwork,
+        .maxqueuesize = tunemaxqueue,
         .nowarmup = strcmp(warmup, "no") == 0,
         .nouring = !useuring,
+        .sharednothing = usesharednothing,
+        .listens = listens,
+        .nlistens = nlistens,
         .listening = listening,
         .ready = ready,
         .data = evdata,
         .opened = evopened,
         .closed = evclosed,
+        .processed = usebatching ? evprocessed : 0,
+        .idle = evidle,
+        .idletimeout = (int64_t)idletimeout*SECOND,
+        .idlecompact = (int64_t)idlecompact*SECOND,
         .maxconns = maxconns,
     };
     
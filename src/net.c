@@ -37,21 +37,34 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #else
 #include <sys/event.h>
 #endif
 
 #include "uring.h"
+#include "sys.h"
+#include "clock.h"
 #include "stats.h"
 #include "net.h"
 #include "util.h"
 #include "tls.h"
+#include "shm.h"
 #include "xmalloc.h"
+#include "probes.h"
 
 #define PACKETSIZE 16384
 #define MINURINGEVENTS 2 // there must be at least 2 events for uring use
+#define FWDRINGSIZE 256  // forwarding ring capacity, power of two
+#define WHEELSLOTS 64    // idle timer wheel slots, one per second
+#define POOLMINSHIFT 4   // smallest pooled output buffer, 16 bytes
+#define POOLMAXSHIFT 16  // largest pooled output buffer, 64 KB
+#define POOLCLASSCAP 64  // maximum pooled buffers per size class
+#define UDPBATCH 32      // datagrams per recvmmsg and sendmmsg
+#define UDPPAYLOAD 1400  // response bytes per datagram, as memcached
+#define UDPHDRSIZE 8     // memcache udp frame header
 
-extern const int verb;
+extern atomic_int verb;
 
 static int setnonblock(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
@@ -196,6 +209,46 @@ static int evqueue(void) {
 #endif
 }
 
+// Create a notifier for waking up an event queue from another thread.
+// The fds[0] is the read side and fds[1] is the write side. On Linux this is
+// a single eventfd, otherwise it's a pipe.
+static int notifier(int fds[2]) {
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK);
+    if (fd == -1) {
+        return -1;
+    }
+    fds[0] = fd;
+    fds[1] = fd;
+    return 0;
+#else
+    if (pipe(fds) == -1) {
+        return -1;
+    }
+    if (setnonblock(fds[0]) == -1 || setnonblock(fds[1]) == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+static void notify(int fds[2]) {
+    uint64_t one = 1;
+    ssize_t n = write(fds[1], &one, sizeof(uint64_t));
+    (void)n; // EAGAIN means a wakeup is already pending
+}
+
+static void notifier_drain(int fds[2]) {
+    uint64_t vals[8];
+    while (read(fds[0], vals, sizeof(vals)) > 0) {
+#ifdef __linux__
+        break;
+#endif
+    }
+}
+
 struct bgworkctx { 
     void (*work)(void *udata);
     void (*done)(struct net_conn *conn, void *udata);
@@ -208,34 +261,93 @@ struct bgworkctx {
 
 struct net_conn {
     int fd;
+    uint64_t id;
     struct net_conn *next; // for hashmap bucket
+    int listener;           // index in listeners, -1 for none
+    struct net_conn *wprev; // for idle timer wheel slot
+    struct net_conn *wnext;
+    int64_t wdue;           // wheel tick that the connection is due
+    bool inwheel;
+    bool compacted;         // buffers were released while idle
+    int64_t created;
+    int64_t lastactive;
     bool closed;
     struct tls *tls;
+    struct shm *shm;        // shared-memory transport
+    bool datagram;          // stands in for udp senders, see qudp
+    bool pending;           // requests left unread or deferred, in ctx->pends
+    uint64_t readpass;      // pass that the pending read was queued
     void *udata;
     char *out;
     size_t outlen;
     size_t outcap;
     struct bgworkctx *bgctx;
     struct qthreadctx *ctx;
+    bool fwding;        // forwarded to another qthread
+    bool fwdpaused;     // reading paused while forwarded
+    void (*fwdwork)(struct net_conn *conn, void *udata);
+    void *fwdudata;
     unsigned stat_cmd_get;
     unsigned stat_cmd_set;
     unsigned stat_get_hits;
     unsigned stat_get_misses;
 };
 
+// Per-thread pool of output buffers, by power of two size class.
+// Only the qthreads use the pool, other threads go straight to xmalloc.
+struct bufpool {
+    bool active;
+    int nbufs[POOLMAXSHIFT-POOLMINSHIFT+1];
+    void *bufs[POOLMAXSHIFT-POOLMINSHIFT+1][POOLCLASSCAP];
+};
+
+static __thread struct bufpool bufpool;
+
+static int pool_class(size_t cap) {
+    if (!bufpool.active || cap > ((size_t)1<<POOLMAXSHIFT) || 
+        (cap&(cap-1)) != 0 || cap < ((size_t)1<<POOLMINSHIFT))
+    {
+        return -1;
+    }
+    return __builtin_ctzll(cap)-POOLMINSHIFT;
+}
+
+static void *pool_alloc(size_t cap) {
+    int class = pool_class(cap);
+    if (class != -1 && bufpool.nbufs[class] > 0) {
+        return bufpool.bufs[class][--bufpool.nbufs[class]];
+    }
+    return xmalloc(cap);
+}
+
+static void pool_free(void *buf, size_t cap) {
+    if (!buf) {
+        return;
+    }
+    int class = pool_class(cap);
+    if (class != -1 && bufpool.nbufs[class] < POOLCLASSCAP) {
+        bufpool.bufs[class][bufpool.nbufs[class]++] = buf;
+        return;
+    }
+    xfree(buf);
+}
+
 static struct net_conn *conn_new(int fd, struct qthreadctx *ctx) {
+    static atomic_uint_fast64_t next_id = 1;
     struct net_conn *conn = xmalloc(sizeof(struct net_conn));
     memset(conn, 0, sizeof(struct net_conn));
     conn->fd = fd;
     conn->ctx = ctx;
+    conn->id = atomic_fetch_add_explicit(&next_id, 1, __ATOMIC_RELAXED);
+    conn->listener = -1;
+    conn->created = clock_now();
+    conn->lastactive = conn->created;
     return conn;
 }
 
 static void conn_free(struct net_conn *conn) {
     if (conn) {
-        if (conn->out) {
-            xfree(conn->out);
-        }
+        pool_free(conn->out, conn->outcap);
         xfree(conn);
     }
 }
@@ -248,9 +360,11 @@ void net_conn_out_ensure(struct net_conn *conn, size_t amount) {
     while (cap-conn->outlen < amount) {
         cap *= 2;
     }
-    char *out = xmalloc(cap);
-    memcpy(out, conn->out, conn->outlen);
-    xfree(conn->out);
+    char *out = pool_alloc(cap);
+    if (conn->outlen > 0) {
+        memcpy(out, conn->out, conn->outlen);
+    }
+    pool_free(conn->out, conn->outcap);
     conn->out = out;
     conn->outcap = cap;
 }
@@ -389,51 +503,143 @@ static void cmap_delete(struct cmap *cmap, struct net_conn *conn) {
     } else {
         cmap->buckets[i] = iter->next;
     }
+    cmap->len--;
+}
+
+// Lock-free single-producer single-consumer ring of connections.
+// Each ordered pair of qthreads in shared-nothing mode has one ring. The
+// producer thread pushes connections that it wants the consumer to execute
+// a command for, and connections that it has finished executing a command
+// for on behalf of the consumer. The latter are tagged with the low bit.
+// The rings come from xmalloc, which only aligns to 16 bytes, so the
+// counters are kept a cache line apart from each other and from the rest of
+// the heap with padding rather than alignment.
+#define CACHELINE 64
+
+struct fwdring {
+    char pad0[CACHELINE];
+    atomic_size_t head; // written by producer
+    char pad1[CACHELINE-sizeof(atomic_size_t)];
+    atomic_size_t tail; // written by consumer
+    char pad2[CACHELINE-sizeof(atomic_size_t)];
+    uintptr_t msgs[FWDRINGSIZE];
+};
+
+// A thread never has more than half of the ring capacity in flight to any
+// other thread. That way requests and replies will always fit in the ring.
+#define FWDMAXINFLIGHT (FWDRINGSIZE/2)
+
+static void fwdring_push(struct fwdring *ring, struct net_conn *conn,
+    bool reply)
+{
+    size_t head = atomic_load_explicit(&ring->head, __ATOMIC_RELAXED);
+    assert(head-atomic_load_explicit(&ring->tail, __ATOMIC_ACQUIRE) < 
+        FWDRINGSIZE);
+    ring->msgs[head&(FWDRINGSIZE-1)] = (uintptr_t)(void*)conn|reply;
+    atomic_store_explicit(&ring->head, head+1, __ATOMIC_RELEASE);
 }
 
 static atomic_size_t nconns = 0;
 static atomic_size_t tconns = 0;
 static atomic_size_t rconns = 0;
 
-static pthread_mutex_t tls_ready_fds_lock = PTHREAD_MUTEX_INITIALIZER;
-static int tls_ready_fds_cap = 0;
-static int tls_ready_fds_len = 0;
-static int *tls_ready_fds = 0;
-
-static void save_tls_fd(int fd) {
-    pthread_mutex_lock(&tls_ready_fds_lock);
-    if (tls_ready_fds_len == tls_ready_fds_cap) {
-        tls_ready_fds_cap *= 2;
-        if (tls_ready_fds_cap == 0) {
-            tls_ready_fds_cap = 8;
+// Runtime changes to the listeners and threads, see net_set_nthreads.
+static pthread_mutex_t cfglock = PTHREAD_MUTEX_INITIALIZER;
+static struct net_opts *gopts;
+static int nstarted;               // threads that have been started
+static atomic_int nactive = 1;     // threads accepting new connections
+static atomic_int nbgwork = 0;     // running background workers
+static atomic_int maxbgwork = 0;   // zero for no limit
+static atomic_int qlimit = 0;      // events per pass, see net_set_queuesize
+static atomic_int busypoll = 0;    // see net_set_busypoll
+
+// The listening sockets. The first four are the shared tcp, unix, tls, and
+// shm listeners, where the fd is zero when not in use, followed by the
+// listeners from net_opts.listens.
+#define NSHARED 4
+
+struct listener {
+    int fd;
+    bool tcp;
+    bool tls;
+    bool shm;
+    int backlog;            // zero to follow net_set_backlog
+    const char *name;
+    void *udata;
+    atomic_size_t conns;
+    atomic_uint_fast64_t accepted;
+    atomic_uint_fast64_t rejected;
+};
+
+static struct listener listeners[NSHARED+NET_MAXLISTENS];
+static int nlisteners = 0;
+
+static struct listener *get_listener(int fd) {
+    for (int i = 0; i < nlisteners; i++) {
+        if (listeners[i].fd == fd && fd) {
+            return &listeners[i];
         }
-        tls_ready_fds = xrealloc(tls_ready_fds, tls_ready_fds_cap*sizeof(int));
     }
-    tls_ready_fds[tls_ready_fds_len++] = fd;
-    pthread_mutex_unlock(&tls_ready_fds_lock);
+    return 0;
 }
 
-static bool del_tls_fd(int fd) {
-    bool found = false;
-    pthread_mutex_lock(&tls_ready_fds_lock);
-    for (int i = 0; i < tls_ready_fds_len; i++) {
-        if (tls_ready_fds[i] == fd) {
-            tls_ready_fds[i] = tls_ready_fds[tls_ready_fds_len-1];
-            tls_ready_fds_len--;
-            found = true;
+// Accepted sockets, along with their listener, until they become
+// connections on the thread that they were handed to. That's where the
+// transport, such as tls or shm, is set up.
+struct readyfd {
+    int fd;
+    int listener;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    int cap;
+    int len;
+    struct readyfd *fds;
+} ready = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void save_ready_fd(int fd, int listener) {
+    pthread_mutex_lock(&ready.lock);
+    if (ready.len == ready.cap) {
+        ready.cap *= 2;
+        if (ready.cap == 0) {
+            ready.cap = 8;
+        }
+        ready.fds = xrealloc(ready.fds, ready.cap*sizeof(struct readyfd));
+    }
+    ready.fds[ready.len++] = (struct readyfd){ fd, listener };
+    pthread_mutex_unlock(&ready.lock);
+}
+
+// Returns the listener of an accepted socket, or -1 if it's not known.
+static int del_ready_fd(int fd) {
+    int listener = -1;
+    pthread_mutex_lock(&ready.lock);
+    for (int i = 0; i < ready.len; i++) {
+        if (ready.fds[i].fd == fd) {
+            listener = ready.fds[i].listener;
+            ready.fds[i] = ready.fds[ready.len-1];
+            ready.len--;
             break;
         }
     }
-    pthread_mutex_unlock(&tls_ready_fds_lock);
-    return found;
+    pthread_mutex_unlock(&ready.lock);
+    return listener;
 }
 
+// A memcache udp response datagram, framed in ctx->udpout.
+struct udpmsg {
+    size_t off;
+    size_t len;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+};
+
 struct qthreadctx {
     pthread_t th;
     int qfd;
     int index;
     int maxconns;
-    int *sfd;   // three entries
     bool tcpnodelay;
     bool keepalive;
     bool quickack;
@@ -447,10 +653,17 @@ struct qthreadctx {
     void(*data)(struct net_conn*,const void*,size_t,void*);
     void(*opened)(struct net_conn*,void*);
     void(*closed)(struct net_conn*,void*);
+    void(*processed)(void*);
+    void(*idle)(struct net_conn*,void*);
     int nevents;
     event_t *events;
     atomic_int nconns;
     int ntlsconns;
+    int nshmconns;
+    struct net_conn **pends;    // connections with requests left, see qpending
+    int npends;
+    int pendscap;
+    uint64_t pass;              // event loop pass counter
     char *inpkts;
     struct net_conn **qreads;
     struct net_conn **qins;
@@ -465,13 +678,47 @@ struct qthreadctx {
     int nqattachs;
     int nqouts;
     int nthreads;
+
+    // shared-nothing forwarding, only when sharednothing is enabled
+    int nfd[2];                 // notifier for waking this thread
+    bool fwdready;              // notifier fired, check the rings
+    struct fwdring **fwdins;    // inbound rings, indexed by source thread
+    int *fwdinflight;           // outstanding forwards per target thread
+    bool *fwdnotify;            // target thread needs a wakeup
+    int *fwdnotifys;            // list of threads to wake up
+    int nfwdnotifys;
+    
+    // memcache udp, only when udpport is provided
+    int udpfd;
+    bool udpready;              // the udp socket is readable
+    struct net_conn *udpconn;   // executes the commands of every datagram
+    char *udpin;                // receive buffers, UDPBATCH*PACKETSIZE
+    struct buf udpout;          // framed response datagrams
+    struct udpmsg *udpmsgs;     // response datagrams to send
+    int nudpmsgs;
+    int udpmsgscap;
+
+    // idle connection timer wheel
+    int64_t now;                // time of the current pass
+    int64_t idletimeout;        // close after idle, zero for never
+    int64_t idlecompact;        // release buffers after idle
+    struct net_conn **wheel;    // slot lists
+    int64_t wtick;              // last processed tick
+    int nwheel;                 // connections in the wheel
     
     uint64_t stat_cmd_get;
     uint64_t stat_cmd_set;
     uint64_t stat_get_hits;
     uint64_t stat_get_misses;
+    uint64_t stat_cmd_forwarded;
+    uint64_t stat_passes;
+    uint64_t stat_events;
+    uint64_t stat_fullpasses;
+    uint64_t stat_writestalls;
+    int emptypolls;             // empty polls since the last event
 
     struct qthreadctx *ctxs;
+    pthread_mutex_t cmaplock;   // guards cmap for net_conn_list
     struct cmap cmap;
 };
 
@@ -479,6 +726,11 @@ static atomic_uint_fast64_t g_stat_cmd_get = 0;
 static atomic_uint_fast64_t g_stat_cmd_set = 0;
 static atomic_uint_fast64_t g_stat_get_hits = 0;
 static atomic_uint_fast64_t g_stat_get_misses = 0;
+static atomic_uint_fast64_t g_stat_cmd_forwarded = 0;
+static atomic_uint_fast64_t g_stat_passes = 0;
+static atomic_uint_fast64_t g_stat_events = 0;
+static atomic_uint_fast64_t g_stat_fullpasses = 0;
+static atomic_uint_fast64_t g_stat_writestalls = 0;
 
 inline
 static void sumstats(struct net_conn *conn, struct qthreadctx *ctx) {
@@ -506,6 +758,23 @@ static void sumstats_global(struct qthreadctx *ctx) {
     atomic_fetch_add_explicit(&g_stat_get_misses, ctx->stat_get_misses, 
         __ATOMIC_RELAXED);
     ctx->stat_get_misses = 0;
+    atomic_fetch_add_explicit(&g_stat_cmd_forwarded, ctx->stat_cmd_forwarded, 
+        __ATOMIC_RELAXED);
+    ctx->stat_cmd_forwarded = 0;
+    if (ctx->stat_passes > 0 || ctx->stat_writestalls > 0) {
+        atomic_fetch_add_explicit(&g_stat_passes, ctx->stat_passes,
+            __ATOMIC_RELAXED);
+        atomic_fetch_add_explicit(&g_stat_events, ctx->stat_events,
+            __ATOMIC_RELAXED);
+        atomic_fetch_add_explicit(&g_stat_fullpasses, ctx->stat_fullpasses,
+            __ATOMIC_RELAXED);
+        atomic_fetch_add_explicit(&g_stat_writestalls, ctx->stat_writestalls,
+            __ATOMIC_RELAXED);
+        ctx->stat_passes = 0;
+        ctx->stat_events = 0;
+        ctx->stat_fullpasses = 0;
+        ctx->stat_writestalls = 0;
+    }
 }
 
 uint64_t stat_cmd_get(void) {
@@ -525,6 +794,81 @@ uint64_t stat_get_misses(void) {
     return atomic_load_explicit(&g_stat_get_misses, __ATOMIC_RELAXED);
 }
 
+uint64_t stat_cmd_forwarded(void) {
+    return atomic_load_explicit(&g_stat_cmd_forwarded, __ATOMIC_RELAXED);
+}
+
+void net_loopstats(struct net_loopstats *stats) {
+    stats->passes = atomic_load_explicit(&g_stat_passes, __ATOMIC_RELAXED);
+    stats->events = atomic_load_explicit(&g_stat_events, __ATOMIC_RELAXED);
+    stats->fullpasses = atomic_load_explicit(&g_stat_fullpasses,
+        __ATOMIC_RELAXED);
+    stats->writestalls = atomic_load_explicit(&g_stat_writestalls,
+        __ATOMIC_RELAXED);
+}
+
+int net_nlisteners(void) {
+    return nlisteners;
+}
+
+void net_listenstats(int i, struct net_listenstats *stats) {
+    struct listener *ln = &listeners[i];
+    stats->name = ln->fd ? ln->name : 0;
+    stats->conns = atomic_load_explicit(&ln->conns, __ATOMIC_RELAXED);
+    stats->accepted = atomic_load_explicit(&ln->accepted, __ATOMIC_RELAXED);
+    stats->rejected = atomic_load_explicit(&ln->rejected, __ATOMIC_RELAXED);
+}
+
+// The idle timer wheel has one slot per second. Connections are placed in
+// the slot for the tick when they are due to be checked. Activity does not
+// move a connection. Instead the connection is rechecked when its slot comes
+// around and put back in a later slot if it has been active since.
+
+static void wheel_remove(struct qthreadctx *ctx, struct net_conn *conn) {
+    if (!conn->inwheel) {
+        return;
+    }
+    if (conn->wprev) {
+        conn->wprev->wnext = conn->wnext;
+    } else {
+        ctx->wheel[conn->wdue&(WHEELSLOTS-1)] = conn->wnext;
+    }
+    if (conn->wnext) {
+        conn->wnext->wprev = conn->wprev;
+    }
+    conn->wprev = 0;
+    conn->wnext = 0;
+    conn->inwheel = false;
+    ctx->nwheel--;
+}
+
+static void wheel_insert(struct qthreadctx *ctx, struct net_conn *conn,
+    int64_t due)
+{
+    int64_t tick = due/SECOND;
+    if (tick <= ctx->wtick) {
+        tick = ctx->wtick+1;
+    }
+    conn->wdue = tick;
+    conn->wprev = 0;
+    conn->wnext = ctx->wheel[tick&(WHEELSLOTS-1)];
+    if (conn->wnext) {
+        conn->wnext->wprev = conn;
+    }
+    ctx->wheel[tick&(WHEELSLOTS-1)] = conn;
+    conn->inwheel = true;
+    ctx->nwheel++;
+}
+
+// Mark the connection as active.
+static void wheel_touch(struct qthreadctx *ctx, struct net_conn *conn) {
+    conn->lastactive = ctx->now;
+    conn->compacted = false;
+    if (!conn->inwheel && ctx->idlecompact > 0) {
+        wheel_insert(ctx, conn, ctx->now+ctx->idlecompact);
+    }
+}
+
 inline
 static void qreset(struct qthreadctx *ctx) {
     ctx->nqreads = 0;
@@ -532,16 +876,27 @@ static void qreset(struct qthreadctx *ctx) {
     ctx->nqcloses = 0;
     ctx->nqouts = 0;
     ctx->nqattachs = 0;
+    ctx->pass++;
 }
 
 inline
 static void qaccept(struct qthreadctx *ctx) {
     for (int i = 0; i < ctx->nevents; i++) {
         int fd = event_fd(&ctx->events[i]);
+        if (fd == ctx->udpfd && ctx->udpfd) {
+            ctx->udpready = true;
+            continue;
+        }
+        if (ctx->fwdins && fd == ctx->nfd[0]) {
+            // Another thread pushed onto one of our forwarding rings.
+            notifier_drain(ctx->nfd);
+            ctx->fwdready = true;
+            continue;
+        }
         struct net_conn *conn = cmap_get(&ctx->cmap, fd);
         if (!conn) {
-            if ((fd == ctx->sfd[0] || fd == ctx->sfd[1] || fd == ctx->sfd[2])) {
-                int sfd = fd;
+            struct listener *ln = get_listener(fd);
+            if (ln) {
                 fd = accept(fd, 0, 0);
                 if (fd == -1) {
                     continue;
@@ -550,7 +905,7 @@ static void qaccept(struct qthreadctx *ctx) {
                     close(fd);
                     continue;
                 }
-                if (sfd == ctx->sfd[0] || sfd == ctx->sfd[2]) {
+                if (ln->tcp) {
                     if (setkeepalive(fd, ctx->keepalive) == -1) {
                         close(fd);
                         continue;
@@ -563,31 +918,35 @@ static void qaccept(struct qthreadctx *ctx) {
                         close(fd);
                         continue;
                     }
-                    if (sfd == ctx->sfd[2]) {
-                        save_tls_fd(fd);
-                    }
                 }
+                save_ready_fd(fd, ln-listeners);
                 static atomic_uint_fast64_t next_ctx_index = 0;
-                int idx = atomic_fetch_add(&next_ctx_index, 1) % ctx->nthreads;
+                int idx = atomic_fetch_add(&next_ctx_index, 1) %
+                    atomic_load_explicit(&nactive, __ATOMIC_RELAXED);
                 if (addread(ctx->ctxs[idx].qfd, fd) == -1) {
-                    if (sfd == ctx->sfd[2]) {
-                        del_tls_fd(fd);
-                    }
+                    del_ready_fd(fd);
                     close(fd);
                     continue;
                 }
                 continue;
             }
+            int lidx = del_ready_fd(fd);
+            ln = lidx >= 0 ? &listeners[lidx] : 0;
+            bool istls = ln && ln->tls;
+            bool isshm = ln && ln->shm;
             size_t xnconns = atomic_fetch_add(&nconns, 1);
             if (xnconns >= (size_t)ctx->maxconns) {
                 // rejected
                 atomic_fetch_add(&rconns, 1);
                 atomic_fetch_sub(&nconns, 1);
+                if (ln) {
+                    atomic_fetch_add(&ln->rejected, 1);
+                }
                 close(fd);
                 continue;
             }
-            bool istls = del_tls_fd(fd);
             conn = conn_new(fd, ctx);
+            conn->listener = lidx;
             if (istls) {
                 if (!tls_accept(conn->fd, &conn->tls)) {
                     atomic_fetch_sub(&nconns, 1);
@@ -596,11 +955,34 @@ static void qaccept(struct qthreadctx *ctx) {
                     continue;
                 }
                 ctx->ntlsconns++;
+            } else if (isshm) {
+                if (!shm_accept(conn->fd, &conn->shm)) {
+                    atomic_fetch_sub(&nconns, 1);
+                    close(fd);
+                    conn_free(conn);
+                    continue;
+                }
+                ctx->nshmconns++;
             }
             atomic_fetch_add_explicit(&ctx->nconns, 1, __ATOMIC_RELEASE);
             atomic_fetch_add_explicit(&tconns, 1, __ATOMIC_RELEASE);
-            cmap_insert(&ctx->cmap, conn);
+            if (ln) {
+                atomic_fetch_add_explicit(&ln->conns, 1, __ATOMIC_RELAXED);
+                atomic_fetch_add_explicit(&ln->accepted, 1, __ATOMIC_RELAXED);
+            }
             ctx->opened(conn, ctx->udata);
+            pthread_mutex_lock(&ctx->cmaplock);
+            cmap_insert(&ctx->cmap, conn);
+            pthread_mutex_unlock(&ctx->cmaplock);
+        }
+        wheel_touch(ctx, conn);
+        if (conn->fwding) {
+            // More data arrived while the connection is forwarded to another
+            // thread. Stop reading until it comes back.
+            int ret = delread(ctx->qfd, conn->fd);
+            assert(ret == 0); (void)ret;
+            conn->fwdpaused = true;
+            continue;
         }
         if (conn->bgctx) {
             // BGWORK(2)
@@ -611,12 +993,58 @@ static void qaccept(struct qthreadctx *ctx) {
             ctx->qouts[ctx->nqouts++] = conn;
         } else if (conn->closed) {
             ctx->qcloses[ctx->nqcloses++] = conn;
-        } else {
+        } else if (conn->readpass != ctx->pass) {
             ctx->qreads[ctx->nqreads++] = conn;
         }
     }
 }
 
+static void addpend(struct qthreadctx *ctx, struct net_conn *conn) {
+    if (conn->pending) {
+        return;
+    }
+    if (ctx->npends == ctx->pendscap) {
+        ctx->pendscap = ctx->pendscap == 0 ? 16 : ctx->pendscap*2;
+        ctx->pends = xrealloc(ctx->pends, 
+            ctx->pendscap*sizeof(struct net_conn*));
+    }
+    ctx->pends[ctx->npends++] = conn;
+    conn->pending = true;
+}
+
+static void delpend(struct qthreadctx *ctx, struct net_conn *conn) {
+    if (!conn->pending) {
+        return;
+    }
+    for (int i = 0; i < ctx->npends; i++) {
+        if (ctx->pends[i] == conn) {
+            ctx->pends[i] = ctx->pends[--ctx->npends];
+            break;
+        }
+    }
+    conn->pending = false;
+}
+
+inline
+static void qpending(struct qthreadctx *ctx) {
+    // Shared-memory connections may have more requests in their rings than
+    // one read could take, and net_conn_defer leaves requests unprocessed.
+    // There's no socket event for those, so they are read again on the
+    // following passes until the ring is drained or the requests are done.
+    int room = ctx->queuesize-ctx->nevents;
+    while (ctx->npends > 0 && room > 0) {
+        struct net_conn *conn = ctx->pends[--ctx->npends];
+        conn->pending = false;
+        if (conn->bgctx || conn->fwding || conn->outlen > 0 || conn->closed) {
+            // Read again once the connection is attached.
+            continue;
+        }
+        conn->readpass = ctx->pass;
+        ctx->qreads[ctx->nqreads++] = conn;
+        room--;
+    }
+}
+
 inline
 static void handle_read(ssize_t n, char *pkt, struct net_conn *conn,
     struct qthreadctx *ctx)
@@ -648,11 +1076,15 @@ static void flush_conn(struct net_conn *conn, size_t written) {
         if (conn->tls) {
             n = tls_write(conn->tls, conn->fd, conn->out+written, 
                 conn->outlen-written);
+        } else if (conn->shm) {
+            n = shm_write(conn->shm, conn->fd, conn->out+written, 
+                conn->outlen-written);
         } else {
             n = write(conn->fd, conn->out+written, conn->outlen-written);
         }
         if (n == -1) {
             if (errno == EAGAIN) {
+                conn->ctx->stat_writestalls++;
                 continue;
             }
             conn->closed = true;
@@ -664,13 +1096,79 @@ static void flush_conn(struct net_conn *conn, size_t written) {
     conn->outlen = 0;
 }
 
+inline
+static void wakeup(struct qthreadctx *ctx, int thread) {
+    if (!ctx->fwdnotify[thread]) {
+        ctx->fwdnotify[thread] = true;
+        ctx->fwdnotifys[ctx->nfwdnotifys++] = thread;
+    }
+}
+
+inline
+static void qforward(struct qthreadctx *ctx) {
+    // Drain the inbound forwarding rings. Requests are executed right here,
+    // as this thread owns the shards, and then bounced back to the thread
+    // that owns the connection. Replies are our own connections returning.
+    if (!ctx->fwdready) {
+        return;
+    }
+    ctx->fwdready = false;
+    int room = ctx->queuesize-ctx->nqreads-ctx->nqattachs;
+    bool more = false;
+    for (int i = 0; i < ctx->nthreads; i++) {
+        struct fwdring *ring = ctx->fwdins[i];
+        size_t tail = atomic_load_explicit(&ring->tail, __ATOMIC_RELAXED);
+        size_t head = atomic_load_explicit(&ring->head, __ATOMIC_ACQUIRE);
+        for (; tail != head; tail++) {
+            uintptr_t msg = ring->msgs[tail&(FWDRINGSIZE-1)];
+            struct net_conn *conn = (struct net_conn*)(msg&~(uintptr_t)1);
+            if (msg&1) {
+                if (room == 0) {
+                    more = true;
+                    break;
+                }
+                ctx->qattachs[ctx->nqattachs++] = conn;
+                ctx->fwdinflight[i]--;
+                wheel_touch(ctx, conn);
+                room--;
+            } else {
+                conn->fwdwork(conn, conn->fwdudata);
+                fwdring_push(ctx->ctxs[i].fwdins[ctx->index], conn, true);
+                wakeup(ctx, i);
+            }
+        }
+        atomic_store_explicit(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    if (more) {
+        // Not enough room in the step queues. Continue on the next pass.
+        wakeup(ctx, ctx->index);
+    }
+}
+
 inline
 static void qattach(struct qthreadctx *ctx) {
     for (int i = 0; i < ctx->nqattachs; i++) {
+        struct net_conn *conn = ctx->qattachs[i];
+        if (conn->fwding) {
+            // The owning thread has finished the forwarded command. 
+            conn->fwding = false;
+            sumstats(conn, ctx);
+            if (conn->fwdpaused) {
+                int ret = addread(ctx->qfd, conn->fd);
+                assert(ret == 0); (void)ret;
+                conn->fwdpaused = false;
+            }
+            flush_conn(conn, 0);
+            if (conn->closed) {
+                ctx->qcloses[ctx->nqcloses++] = conn;
+            } else {
+                ctx->qreads[ctx->nqreads++] = conn;
+            }
+            continue;
+        }
         // BGWORK(3)
         // A bgworker has finished, make sure it's added back into the 
         // event loop in the correct state.
-        struct net_conn *conn = ctx->qattachs[i];
         struct bgworkctx *bgctx = conn->bgctx;
         bgctx->done(conn, bgctx->udata);
         conn->bgctx = 0;
@@ -693,7 +1191,9 @@ inline
 static void qread(struct qthreadctx *ctx) {
     // Read incoming socket data
 #ifndef NOURING
-    if (ctx->uring && ctx->nqreads >= MINURINGEVENTS && ctx->ntlsconns == 0) {
+    if (ctx->uring && ctx->nqreads >= MINURINGEVENTS && 
+        ctx->ntlsconns == 0 && ctx->nshmconns == 0)
+    {
         // read incoming using uring
         for (int i = 0; i < ctx->nqreads; i++) {
             struct net_conn *conn = ctx->qreads[i];
@@ -733,6 +1233,11 @@ static void qread(struct qthreadctx *ctx) {
             ssize_t n;
             if (conn->tls) {
                 n = tls_read(conn->tls, conn->fd, pkt, PACKETSIZE-1);
+            } else if (conn->shm) {
+                n = shm_read(conn->shm, conn->fd, pkt, PACKETSIZE-1);
+                if (n > 0 && shm_pending(conn->shm)) {
+                    addpend(ctx, conn);
+                }
             } else {
                 n = read(conn->fd, pkt, PACKETSIZE-1);
             }
@@ -752,6 +1257,19 @@ static void qprocess(struct qthreadctx *ctx) {
         char *p = ctx->qinpkts[i];
         int n = ctx->qinpktlens[i];
         ctx->data(conn, p, n, ctx->udata);
+    }
+    if (ctx->processed) {
+        // Deferred work, such as batched commands, must write its output
+        // before the connections are inspected.
+        ctx->processed(ctx->udata);
+    }
+    for (int i = 0; i < ctx->nqins; i++) {
+        struct net_conn *conn = ctx->qins[i];
+        if (conn->fwding) {
+            // Connection was forwarded to the thread that owns the shard.
+            // It must not be touched until it comes back in qforward.
+            continue;
+        }
         sumstats(conn, ctx);
         if (conn->bgctx) {
             // BGWORK(1)
@@ -767,17 +1285,164 @@ static void qprocess(struct qthreadctx *ctx) {
     }
 }
 
+// Frame the output of the udp connection as response datagrams.
+static void udp_frame(struct qthreadctx *ctx, const uint8_t hdr[UDPHDRSIZE],
+    struct sockaddr_storage *addr, socklen_t addrlen)
+{
+    struct net_conn *conn = ctx->udpconn;
+    size_t total = (conn->outlen+UDPPAYLOAD-1)/UDPPAYLOAD;
+    if (total > UINT16_MAX) {
+        // Too large for the protocol, which is capped at 64K datagrams.
+        total = 0;
+    }
+    for (size_t i = 0; i < total; i++) {
+        if (ctx->nudpmsgs == ctx->udpmsgscap) {
+            ctx->udpmsgscap = ctx->udpmsgscap == 0 ? UDPBATCH : 
+                ctx->udpmsgscap*2;
+            ctx->udpmsgs = xrealloc(ctx->udpmsgs, 
+                ctx->udpmsgscap*sizeof(struct udpmsg));
+        }
+        size_t off = i*UDPPAYLOAD;
+        size_t len = conn->outlen-off < UDPPAYLOAD ? conn->outlen-off : 
+            UDPPAYLOAD;
+        struct udpmsg *msg = &ctx->udpmsgs[ctx->nudpmsgs++];
+        msg->off = ctx->udpout.len;
+        msg->len = UDPHDRSIZE+len;
+        memcpy(&msg->addr, addr, addrlen);
+        msg->addrlen = addrlen;
+        uint8_t frame[UDPHDRSIZE] = { 
+            hdr[0], hdr[1],         // request id, from the request
+            i>>8, i,                // sequence number
+            total>>8, total,        // total datagrams
+            0, 0,                   // reserved
+        };
+        buf_append(&ctx->udpout, frame, UDPHDRSIZE);
+        buf_append(&ctx->udpout, conn->out+off, len);
+    }
+    conn->outlen = 0;
+}
+
+static void udp_send(struct qthreadctx *ctx) {
+    int i = 0;
+#ifdef __linux__
+    struct mmsghdr msgs[UDPBATCH];
+    struct iovec iovs[UDPBATCH];
+    while (i < ctx->nudpmsgs) {
+        int n = 0;
+        for (; n < UDPBATCH && i+n < ctx->nudpmsgs; n++) {
+            struct udpmsg *msg = &ctx->udpmsgs[i+n];
+            iovs[n].iov_base = ctx->udpout.data+msg->off;
+            iovs[n].iov_len = msg->len;
+            memset(&msgs[n], 0, sizeof(struct mmsghdr));
+            msgs[n].msg_hdr.msg_name = &msg->addr;
+            msgs[n].msg_hdr.msg_namelen = msg->addrlen;
+            msgs[n].msg_hdr.msg_iov = &iovs[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+        }
+        int ret = sendmmsg(ctx->udpfd, msgs, n, 0);
+        if (ret <= 0) {
+            // Datagrams may be dropped, just like on the wire.
+            break;
+        }
+        i += ret;
+    }
+#else
+    for (; i < ctx->nudpmsgs; i++) {
+        struct udpmsg *msg = &ctx->udpmsgs[i];
+        sendto(ctx->udpfd, ctx->udpout.data+msg->off, msg->len, 0,
+            (struct sockaddr*)&msg->addr, msg->addrlen);
+    }
+#endif
+    ctx->nudpmsgs = 0;
+    ctx->udpout.len = 0;
+}
+
+inline
+static void qudp(struct qthreadctx *ctx) {
+    // Execute memcache udp requests. Each datagram is a complete request
+    // with an 8 byte frame header, and its responses are sent back framed
+    // in one or more datagrams. There's no connection state, so a single
+    // connection on each thread executes every datagram from scratch.
+    if (!ctx->udpready) {
+        return;
+    }
+    ctx->udpready = false;
+    struct net_conn *conn = ctx->udpconn;
+    struct sockaddr_storage addrs[UDPBATCH];
+    socklen_t addrlens[UDPBATCH];
+    ssize_t lens[UDPBATCH];
+    int n = 0;
+#ifdef __linux__
+    struct mmsghdr msgs[UDPBATCH];
+    struct iovec iovs[UDPBATCH];
+    for (int i = 0; i < UDPBATCH; i++) {
+        iovs[i].iov_base = ctx->udpin+i*PACKETSIZE;
+        iovs[i].iov_len = PACKETSIZE;
+        memset(&msgs[i], 0, sizeof(struct mmsghdr));
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    n = recvmmsg(ctx->udpfd, msgs, UDPBATCH, MSG_DONTWAIT, 0);
+    for (int i = 0; i < n; i++) {
+        addrlens[i] = msgs[i].msg_hdr.msg_namelen;
+        lens[i] = msgs[i].msg_len;
+        if (msgs[i].msg_hdr.msg_flags&MSG_TRUNC) {
+            lens[i] = -1;
+        }
+    }
+#else
+    for (; n < UDPBATCH; n++) {
+        addrlens[n] = sizeof(struct sockaddr_storage);
+        lens[n] = recvfrom(ctx->udpfd, ctx->udpin+n*PACKETSIZE, PACKETSIZE,
+            0, (struct sockaddr*)&addrs[n], &addrlens[n]);
+        if (lens[n] == -1) {
+            break;
+        }
+    }
+#endif
+    for (int i = 0; i < n; i++) {
+        uint8_t *pkt = (uint8_t*)ctx->udpin+i*PACKETSIZE;
+        if (lens[i] <= UDPHDRSIZE || pkt[2] != 0 || pkt[3] != 0 || 
+            pkt[4] != 0 || pkt[5] != 1)
+        {
+            // Truncated, or a request spanning multiple datagrams, which
+            // is not supported by memcache either.
+            continue;
+        }
+        ctx->data(conn, pkt+UDPHDRSIZE, lens[i]-UDPHDRSIZE, ctx->udata);
+        if (ctx->processed) {
+            ctx->processed(ctx->udata);
+        }
+        // A quit or protocol error would close a stream connection.
+        conn->closed = false;
+        if (conn->outlen > 0) {
+            udp_frame(ctx, pkt, &addrs[i], addrlens[i]);
+        }
+    }
+    sumstats(conn, ctx);
+    udp_send(ctx);
+}
+
 inline
 static void qprewrite(struct qthreadctx *ctx) {
-    (void)ctx;
-    // TODO: perform any prewrite operations
+    // Wake up the threads that were handed work during this pass.
+    for (int i = 0; i < ctx->nfwdnotifys; i++) {
+        int thread = ctx->fwdnotifys[i];
+        ctx->fwdnotify[thread] = false;
+        notify(ctx->ctxs[thread].nfd);
+    }
+    ctx->nfwdnotifys = 0;
 }
 
 inline
 static void qwrite(struct qthreadctx *ctx) {
     // Flush all outgoing socket data.
 #ifndef NOURING
-    if (ctx->uring && ctx->nqreads >= MINURINGEVENTS && ctx->ntlsconns == 0) {
+    if (ctx->uring && ctx->nqreads >= MINURINGEVENTS && 
+        ctx->ntlsconns == 0 && ctx->nshmconns == 0)
+    {
         // write outgoing using uring
         for (int i = 0; i < ctx->nqouts; i++) {
             struct net_conn *conn = ctx->qouts[i];
@@ -829,22 +1494,107 @@ static void qwrite(struct qthreadctx *ctx) {
 #endif
 }
 
+static void closeconn(struct qthreadctx *ctx, struct net_conn *conn) {
+    pthread_mutex_lock(&ctx->cmaplock);
+    cmap_delete(&ctx->cmap, conn);
+    pthread_mutex_unlock(&ctx->cmaplock);
+    wheel_remove(ctx, conn);
+    delpend(ctx, conn);
+    ctx->closed(conn, ctx->udata);
+    if (conn->tls) {
+        tls_close(conn->tls, conn->fd);
+        ctx->ntlsconns--;
+    } else if (conn->shm) {
+        shm_close(conn->shm, conn->fd);
+        ctx->nshmconns--;
+    } else {
+        close(conn->fd);
+    }
+    atomic_fetch_sub_explicit(&nconns, 1, __ATOMIC_RELEASE);
+    atomic_fetch_sub_explicit(&ctx->nconns, 1, __ATOMIC_RELEASE);
+    if (conn->listener >= 0) {
+        atomic_fetch_sub_explicit(&listeners[conn->listener].conns, 1,
+            __ATOMIC_RELAXED);
+    }
+    conn_free(conn);
+}
+
 inline
 static void qclose(struct qthreadctx *ctx) {
     // Close all sockets that need to be closed
     for (int i = 0; i < ctx->nqcloses; i++) {
-        struct net_conn *conn = ctx->qcloses[i];
-        ctx->closed(conn, ctx->udata);
-        if (conn->tls) {
-            tls_close(conn->tls, conn->fd);
-            ctx->ntlsconns--;
-        } else {
-            close(conn->fd);
+        closeconn(ctx, ctx->qcloses[i]);
+    }
+}
+
+static atomic_uint_fast64_t g_stat_idle_closed = 0;
+static atomic_uint_fast64_t g_stat_idle_compacted = 0;
+
+static void idleconn(struct qthreadctx *ctx, struct net_conn *conn) {
+    if (conn->bgctx || conn->fwding) {
+        // Busy elsewhere, check again on the next tick.
+        wheel_insert(ctx, conn, ctx->now+SECOND);
+        return;
+    }
+    int64_t idle = ctx->now-conn->lastactive;
+    if (ctx->idletimeout > 0 && idle >= ctx->idletimeout) {
+        atomic_fetch_add_explicit(&g_stat_idle_closed, 1, __ATOMIC_RELAXED);
+        closeconn(ctx, conn);
+        return;
+    }
+    if (!conn->compacted && idle >= ctx->idlecompact) {
+        // Give the buffers of the idle connection back. The output buffer
+        // is always empty between passes.
+        assert(conn->outlen == 0);
+        pool_free(conn->out, conn->outcap);
+        conn->out = 0;
+        conn->outcap = 0;
+        if (ctx->idle) {
+            ctx->idle(conn, ctx->udata);
+        }
+        conn->compacted = true;
+        atomic_fetch_add_explicit(&g_stat_idle_compacted, 1, __ATOMIC_RELAXED);
+    }
+    if (!conn->compacted) {
+        wheel_insert(ctx, conn, conn->lastactive+ctx->idlecompact);
+    } else if (ctx->idletimeout > 0) {
+        wheel_insert(ctx, conn, conn->lastactive+ctx->idletimeout);
+    }
+    // Otherwise the connection stays out of the wheel until it's active.
+}
+
+inline
+static void qidle(struct qthreadctx *ctx) {
+    // Advance the idle timer wheel to the current time.
+    int64_t tick = ctx->now/SECOND;
+    if (ctx->wtick == 0 || tick-ctx->wtick > WHEELSLOTS) {
+        ctx->wtick = tick-1;
+    }
+    while (ctx->wtick < tick) {
+        ctx->wtick++;
+        struct net_conn **slot = &ctx->wheel[ctx->wtick&(WHEELSLOTS-1)];
+        struct net_conn *list = *slot;
+        *slot = 0;
+        while (list) {
+            struct net_conn *conn = list;
+            list = list->wnext;
+            conn->inwheel = false;
+            conn->wprev = 0;
+            conn->wnext = 0;
+            ctx->nwheel--;
+            if (conn->wdue > ctx->wtick) {
+                // Not due yet, more than one lap away.
+                conn->inwheel = true;
+                conn->wnext = *slot;
+                if (conn->wnext) {
+                    conn->wnext->wprev = conn;
+                }
+                *slot = conn;
+                ctx->nwheel++;
+                continue;
+            }
+            idleconn(ctx, conn);
         }
-        cmap_delete(&ctx->cmap, conn);
-        atomic_fetch_sub_explicit(&nconns, 1, __ATOMIC_RELEASE);
-        atomic_fetch_sub_explicit(&ctx->nconns, 1, __ATOMIC_RELEASE);
-        conn_free(conn);
     }
 }
 
@@ -859,11 +1609,13 @@ static void *qthread(void *arg) {
     }
 #endif
     // connection map
+    pthread_mutex_lock(&ctx->cmaplock);
     memset(&ctx->cmap, 0, sizeof(struct cmap));
     ctx->cmap.nbuckets = 64;
     size_t size = ctx->cmap.nbuckets*sizeof(struct net_conn*);
     ctx->cmap.buckets = xmalloc(size);
     memset(ctx->cmap.buckets, 0, ctx->cmap.nbuckets*sizeof(struct net_conn*));
+    pthread_mutex_unlock(&ctx->cmaplock);
 
     ctx->events = xmalloc(sizeof(event_t)*ctx->queuesize);
     ctx->qreads = xmalloc(sizeof(struct net_conn*)*ctx->queuesize);
@@ -874,26 +1626,62 @@ static void *qthread(void *arg) {
     ctx->qcloses = xmalloc(sizeof(struct net_conn*)*ctx->queuesize);
     ctx->qouts = xmalloc(sizeof(struct net_conn*)*ctx->queuesize);
     ctx->qattachs = xmalloc(sizeof(struct net_conn*)*ctx->queuesize);
+    ctx->wheel = xmalloc(sizeof(struct net_conn*)*WHEELSLOTS);
+    memset(ctx->wheel, 0, sizeof(struct net_conn*)*WHEELSLOTS);
+    bufpool.active = true;
+    if (ctx->udpfd) {
+        ctx->udpin = xmalloc(PACKETSIZE*UDPBATCH);
+        ctx->udpconn = conn_new(ctx->udpfd, ctx);
+        ctx->udpconn->datagram = true;
+        ctx->opened(ctx->udpconn, ctx->udata);
+    }
 
+    ctx->emptypolls = INT_MAX;
     while (1) {
         sumstats_global(ctx);
-        ctx->nevents = getevents(ctx->qfd, ctx->events, ctx->queuesize, 1, 0);
-        if (ctx->nevents <= 0) {
-            if (ctx->nevents == -1 && errno != EINTR) {
+        // Wake up at least every half second while the wheel has timers,
+        // and don't wait at all while shm connections have unread requests.
+        // After a busy pass, keep polling without waiting for up to the
+        // busypoll budget, which saves the wakeup when more is on the way.
+        int nevs = atomic_load_explicit(&qlimit, __ATOMIC_RELAXED);
+        nevs = nevs > 0 && nevs < ctx->queuesize ? nevs : ctx->queuesize;
+        bool poll = ctx->emptypolls <
+            atomic_load_explicit(&busypoll, __ATOMIC_RELAXED);
+        ctx->nevents = getevents(ctx->qfd, ctx->events, nevs,
+            ctx->nwheel == 0 && ctx->npends == 0 && !poll,
+            ctx->npends > 0 || poll ? 0 : SECOND/2);
+        if (ctx->nevents == -1) {
+            if (errno != EINTR) {
                 perror("# getevents");
                 abort();
             }
-            continue;
+            ctx->nevents = 0;
         }
-        // reset, accept, attach, read, process, prewrite, write, close
-        qreset(ctx);    // reset the step queues
-        qaccept(ctx);   // accept incoming connections
-        qattach(ctx);   // attach bg workers. uncommon
-        qread(ctx);     // read from sockets
-        qprocess(ctx);  // process new socket data
-        qprewrite(ctx); // perform any prewrite operations, such as fsync
-        qwrite(ctx);    // write to sockets
-        qclose(ctx);    // close any sockets that need closing
+        if (ctx->nevents > 0) {
+            ctx->stat_passes++;
+            ctx->stat_events += ctx->nevents;
+            ctx->stat_fullpasses += ctx->nevents == nevs;
+            ctx->emptypolls = 0;
+        } else if (poll) {
+            ctx->emptypolls++;
+        }
+        ctx->now = clock_refresh();
+        if (ctx->nevents > 0 || ctx->npends > 0) {
+            // reset, pending, accept, forward, attach, read, process, udp,
+            // prewrite, write, close
+            qreset(ctx);    // reset the step queues
+            qpending(ctx);  // requeue shm connections with unread requests
+            qaccept(ctx);   // accept incoming connections
+            qforward(ctx);  // execute forwarded commands, shared-nothing
+            qattach(ctx);   // attach bg workers and forwarded connections
+            qread(ctx);     // read from sockets
+            qprocess(ctx);  // process new socket data
+            qudp(ctx);      // process memcache udp datagrams
+            qprewrite(ctx); // perform any prewrite operations, such as fsync
+            qwrite(ctx);    // write to sockets
+            qclose(ctx);    // close any sockets that need closing
+        }
+        qidle(ctx);         // close or compact idle connections
     }
     return 0;
 }
@@ -959,6 +1747,53 @@ static int listen_tcp(const char *host, const char *port, bool reuseport,
     return fd;
 }
 
+// Each thread binds its own udp socket to the same port, and the kernel
+// spreads the datagrams over them.
+static int listen_udp(const char *host, const char *port) {
+    if (!port || !*port || strcmp(port, "0") == 0) {
+        return 0;
+    }
+    int ret;
+    host = host ? host : "127.0.0.1";
+    struct addrinfo hints = { 0 }, *addrs;
+    hints.ai_family = AF_UNSPEC; 
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+    ret = getaddrinfo(host, port, &hints, &addrs);
+    if (ret != 0) {
+        fprintf(stderr, "# getaddrinfo: %s: %s:%s", gai_strerror(ret), host,
+            port);
+        abort();
+    }
+    struct addrinfo *ainfo = addrs;
+    while (ainfo && ainfo->ai_family != PF_INET) {
+        ainfo = ainfo->ai_next;
+    }
+    assert(ainfo);
+    int fd = socket(ainfo->ai_family, ainfo->ai_socktype, ainfo->ai_protocol);
+    if (fd == -1) {
+        perror("# socket(udp)");
+        abort();
+    }
+    ret = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int));
+    if (ret == -1) {
+        perror("# setsockopt(reuseport)");
+        abort();
+    }
+    ret = setnonblock(fd);
+    if (ret == -1) {
+        perror("# setnonblock");
+        abort();
+    }
+    ret = bind(fd, ainfo->ai_addr, ainfo->ai_addrlen);
+    if (ret == -1) {
+        fprintf(stderr, "# bind(udp): %s:%s", host, port);
+        abort();
+    }
+    freeaddrinfo(addrs);
+    return fd;
+}
+
 static int listen_unixsock(const char *unixsock, int backlog) {
     if (!unixsock || !*unixsock) {
         return 0;
@@ -1108,23 +1943,79 @@ static void *thwarmup(void *arg) {
     return 0;
 }
 
+// Adds or removes the shared listeners from the thread's event queue. A
+// thread that is not listening keeps serving the connections it already has.
+// The udp socket is made once, when the thread is first started, and stays
+// with it since datagrams are spread over every socket bound to the port.
+static void ctx_listen(struct qthreadctx *ctx, bool listen) {
+    for (int j = 0; j < nlisteners; j++) {
+        int fd = listeners[j].fd;
+        if (fd) {
+            int ret = listen ? addread(ctx->qfd, fd) : delread(ctx->qfd, fd);
+            if (ret == -1) {
+                perror(listen ? "# addread" : "# delread");
+                abort();
+            }
+        }
+    }
+    if (listen && !ctx->udpfd) {
+        ctx->udpfd = listen_udp(gopts->host, gopts->udpport);
+        if (ctx->udpfd && addread(ctx->qfd, ctx->udpfd) == -1) {
+            perror("# addread");
+            abort();
+        }
+    }
+}
+
+static void add_listener(int fd, bool tcp, bool tls, bool shm, int backlog,
+    const char *name, void *udata)
+{
+    struct listener *ln = &listeners[nlisteners++];
+    ln->fd = fd;
+    ln->tcp = tcp;
+    ln->tls = tls;
+    ln->shm = shm;
+    ln->backlog = backlog;
+    ln->name = name;
+    ln->udata = udata;
+}
+
 void net_main(struct net_opts *opts) {
-    (void)delread;
-    int sfd[3] = {
-        listen_tcp(opts->host, opts->port, opts->reuseport, opts->backlog),
-        listen_unixsock(opts->unixsock, opts->backlog),
-        listen_tcp(opts->host, opts->tlsport, opts->reuseport, opts->backlog),
-    };
-    if (!sfd[0] && !sfd[1] && !sfd[2]) {
+    gopts = opts;
+    add_listener(listen_tcp(opts->host, opts->port, opts->reuseport,
+        opts->backlog), true, false, false, 0, "port", 0);
+    add_listener(listen_unixsock(opts->unixsock, opts->backlog), false, false,
+        false, 0, "unixsock", 0);
+    add_listener(listen_tcp(opts->host, opts->tlsport, opts->reuseport,
+        opts->backlog), true, true, false, 0, "tlsport", 0);
+    add_listener(listen_unixsock(opts->shmsock, opts->backlog), false, false,
+        true, 0, "shmsock", 0);
+    for (int i = 0; i < opts->nlistens && i < NET_MAXLISTENS; i++) {
+        struct net_listen *l = &opts->listens[i];
+        int backlog = l->backlog > 0 ? l->backlog : opts->backlog;
+        int fd = l->path ? listen_unixsock(l->path, backlog) :
+            listen_tcp(opts->host, l->port, opts->reuseport, backlog);
+        add_listener(fd, !l->path, l->tls, false, l->backlog, l->name,
+            l->udata);
+    }
+    bool any = opts->udpport && *opts->udpport;
+    for (int i = 0; i < nlisteners; i++) {
+        any = any || listeners[i].fd;
+    }
+    if (!any) {
         printf("# No listeners provided\n");
         abort();
     }
     opts->listening(opts->udata);
-    struct qthreadctx *ctxs = xmalloc(sizeof(struct qthreadctx)*opts->nthreads);
-    memset(ctxs, 0, sizeof(struct qthreadctx)*opts->nthreads);
-    for (int i = 0; i < opts->nthreads; i++) {
+    // Contexts are made for up to maxthreads, but only nthreads are started.
+    // The rest are started when net_set_nthreads asks for them.
+    int maxthreads = opts->maxthreads > opts->nthreads && !opts->sharednothing ?
+        opts->maxthreads : opts->nthreads;
+    struct qthreadctx *ctxs = xmalloc(sizeof(struct qthreadctx)*maxthreads);
+    memset(ctxs, 0, sizeof(struct qthreadctx)*maxthreads);
+    for (int i = 0; i < maxthreads; i++) {
         struct qthreadctx *ctx = &ctxs[i];
-        ctx->nthreads = opts->nthreads;
+        ctx->nthreads = maxthreads;
         ctx->tcpnodelay = opts->tcpnodelay;
         ctx->keepalive = opts->keepalive;
         ctx->quickack = opts->quickack;
@@ -1132,29 +2023,56 @@ void net_main(struct net_opts *opts) {
         ctx->ctxs = ctxs;
         ctx->index = i;
         ctx->maxconns = opts->maxconns;
-        ctx->sfd = sfd;
         ctx->data = opts->data;
         ctx->udata = opts->udata;
         ctx->opened = opts->opened;
         ctx->closed = opts->closed;
+        ctx->processed = opts->processed;
+        ctx->idle = opts->idle;
+        ctx->idletimeout = opts->idletimeout;
+        ctx->idlecompact = opts->idlecompact;
+        if (ctx->idletimeout > 0 && (ctx->idlecompact <= 0 || 
+            ctx->idlecompact > ctx->idletimeout))
+        {
+            ctx->idlecompact = ctx->idletimeout;
+        }
+        pthread_mutex_init(&ctx->cmaplock, 0);
         ctx->qfd = evqueue();
         if (ctx->qfd == -1) {
             perror("# evqueue");
             abort();
         }
         atomic_init(&ctx->nconns, 0);
-        for (int j = 0; j < 3; j++) {
-            if (sfd[j]) {
-                int ret = addread(ctx->qfd, sfd[j]);
-                if (ret == -1) {
-                    perror("# addread");
-                    abort();
-                }
+        ctx->unixsock = opts->unixsock;
+        // The queues are sized for the largest queuesize, so it can be
+        // raised later with net_set_queuesize.
+        ctx->queuesize = opts->maxqueuesize > opts->queuesize ?
+            opts->maxqueuesize : opts->queuesize;
+        if (i < opts->nthreads) {
+            ctx_listen(ctx, true);
+        }
+        if (opts->sharednothing) {
+            if (notifier(ctx->nfd) == -1 || addread(ctx->qfd, ctx->nfd[0])) {
+                perror("# notifier");
+                abort();
+            }
+            int n = opts->nthreads;
+            ctx->fwdins = xmalloc(n*sizeof(struct fwdring*));
+            for (int j = 0; j < n; j++) {
+                ctx->fwdins[j] = xmalloc(sizeof(struct fwdring));
+                memset(ctx->fwdins[j], 0, sizeof(struct fwdring));
             }
+            ctx->fwdinflight = xmalloc(n*sizeof(int));
+            memset(ctx->fwdinflight, 0, n*sizeof(int));
+            ctx->fwdnotify = xmalloc(n*sizeof(bool));
+            memset(ctx->fwdnotify, 0, n*sizeof(bool));
+            ctx->fwdnotifys = xmalloc(n*sizeof(int));
         }
-        ctx->unixsock = opts->unixsock;
-        ctx->queuesize = opts->queuesize;
     }
+    nstarted = opts->nthreads;
+    atomic_store(&nactive, opts->nthreads);
+    atomic_store(&maxbgwork, opts->maxbgwork);
+    atomic_store(&qlimit, opts->queuesize);
     atomic_store(&all_ctxs, (uintptr_t)(void*)ctxs);
     opts->ready(opts->udata);
     if (!opts->nowarmup) {
@@ -1178,9 +2096,104 @@ void net_main(struct net_opts *opts) {
     }
 }
 
+// Returns the number of threads accepting new connections.
+int net_nthreads(void) {
+    return atomic_load(&nactive);
+}
+
+// Changes the number of threads that accept new connections, up to the
+// maxthreads option. New threads are started as needed. Threads above the
+// count stop accepting, but keep serving their existing connections until
+// those close, and are reused if the count goes back up.
+// Returns false if the count is out of range.
+bool net_set_nthreads(int n) {
+    struct qthreadctx *ctxs = (void*)atomic_load(&all_ctxs);
+    if (!ctxs || n < 1 || n > ctxs[0].nthreads) {
+        return false;
+    }
+    pthread_mutex_lock(&cfglock);
+    int cur = atomic_load(&nactive);
+    for (int i = cur; i < n; i++) {
+        struct qthreadctx *ctx = &ctxs[i];
+        ctx_listen(ctx, true);
+        if (i >= nstarted) {
+            int ret = pthread_create(&ctx->th, 0, qthread, ctx);
+            if (ret != 0) {
+                ctx_listen(ctx, false);
+                n = i;
+                break;
+            }
+            pthread_detach(ctx->th);
+            nstarted++;
+        }
+    }
+    atomic_store(&nactive, n);
+    for (int i = n; i < cur; i++) {
+        ctx_listen(&ctxs[i], false);
+    }
+    pthread_mutex_unlock(&cfglock);
+    if (verb > 0) {
+        printf("# Threads changed from %d to %d\n", cur, n);
+    }
+    return true;
+}
+
+// Changes the maximum number of background workers running at once, such as
+// for KEYS and SWEEP. Zero is no limit.
+void net_set_maxbgwork(int n) {
+    atomic_store(&maxbgwork, n < 0 ? 0 : n);
+}
+
+// Changes the accept backlog of the tcp and unix listeners, other than
+// those that have their own.
+bool net_set_backlog(int backlog) {
+    if (nlisteners == 0 || backlog < 1) {
+        return false;
+    }
+    pthread_mutex_lock(&cfglock);
+    bool ok = true;
+    for (int j = 0; j < nlisteners; j++) {
+        int fd = listeners[j].fd;
+        if (fd && listeners[j].backlog == 0 && listen(fd, backlog) == -1) {
+            ok = false;
+        }
+    }
+    pthread_mutex_unlock(&cfglock);
+    return ok;
+}
+
+// Returns the number of events that each thread takes per pass.
+int net_queuesize(void) {
+    return atomic_load(&qlimit);
+}
+
+// Changes the number of events that each thread takes per pass, up to the
+// maxqueuesize option.
+void net_set_queuesize(int queuesize) {
+    struct qthreadctx *ctxs = (void*)atomic_load(&all_ctxs);
+    int max = ctxs ? ctxs[0].queuesize : queuesize;
+    atomic_store(&qlimit, queuesize < 1 ? 1 : queuesize > max ? max :
+        queuesize);
+}
+
+// Returns the busy poll budget.
+int net_busypoll(void) {
+    return atomic_load(&busypoll);
+}
+
+// Changes the number of times that a thread polls its queue without waiting
+// after a pass that had events, before it waits again. Zero turns busy
+// polling off.
+void net_set_busypoll(int polls) {
+    atomic_store(&busypoll, polls < 0 ? 0 : polls);
+}
+
 static void *bgwork(void *arg) {
     struct bgworkctx *bgctx = arg;
+    PROBE1(bgwork__start, bgctx->conn->id);
     bgctx->work(bgctx->udata);
+    PROBE1(bgwork__done, bgctx->conn->id);
+    atomic_fetch_sub(&nbgwork, 1);
     // We are not in the same thread context as the event loop that owns this
     // connection. Adding the writer to the queue will allow for the loop
     // thread to gracefully continue the operation and then call the 'done'
@@ -1196,7 +2209,12 @@ static void *bgwork(void *arg) {
 bool net_conn_bgwork(struct net_conn *conn, void (*work)(void *udata), 
     void (*done)(struct net_conn *conn, void *udata), void *udata)
 {
-    if (conn->bgctx || conn->closed) {
+    if (conn->bgctx || conn->closed || conn->datagram) {
+        return false;
+    }
+    int max = atomic_load_explicit(&maxbgwork, __ATOMIC_RELAXED);
+    if (atomic_fetch_add(&nbgwork, 1) >= max && max > 0) {
+        atomic_fetch_sub(&nbgwork, 1);
         return false;
     }
     struct qthreadctx *ctx = conn->ctx;
@@ -1211,6 +2229,7 @@ bool net_conn_bgwork(struct net_conn *conn, void (*work)(void *udata),
     pthread_t th;
     if (pthread_create(&th, 0, bgwork, conn->bgctx) == -1) {
         // Failed to create thread. Revert and return false.
+        atomic_fetch_sub(&nbgwork, 1);
         ret = addread(ctx->qfd, conn->fd);
         assert(ret == 0);
         xfree(conn->bgctx);
@@ -1223,7 +2242,115 @@ bool net_conn_bgwork(struct net_conn *conn, void (*work)(void *udata),
 }
 
 bool net_conn_bgworking(struct net_conn *conn) {
-    return conn->bgctx != 0;
+    return conn->bgctx != 0 || conn->fwding;
+}
+
+// net_conn_forward hands the connection to another qthread, which calls the
+// work function in its own event loop. The connection is returned to its
+// owning thread afterwards, where processing resumes as it does for bgwork.
+// Unlike bgwork, it's safe to use the conn in the work function.
+// Returns false if forwarding is not enabled or the target is saturated, in
+// which case the caller should do the work itself.
+bool net_conn_forward(struct net_conn *conn, int thread, 
+    void (*work)(struct net_conn *conn, void *udata), void *udata)
+{
+    struct qthreadctx *ctx = conn->ctx;
+    if (!ctx->fwdins || thread == ctx->index || thread < 0 || 
+        thread >= ctx->nthreads || conn->bgctx || conn->fwding || 
+        conn->closed || conn->datagram || 
+        ctx->fwdinflight[thread] == FWDMAXINFLIGHT)
+    {
+        return false;
+    }
+    conn->fwding = true;
+    conn->fwdwork = work;
+    conn->fwdudata = udata;
+    fwdring_push(ctx->ctxs[thread].fwdins[ctx->index], conn, false);
+    ctx->fwdinflight[thread]++;
+    ctx->stat_cmd_forwarded++;
+    wakeup(ctx, thread);
+    return true;
+}
+
+// Returns the index of the qthread that owns the connection.
+int net_conn_thread(struct net_conn *conn) {
+    return conn->ctx->index;
+}
+
+uint64_t net_conn_id(struct net_conn *conn) {
+    return conn->id;
+}
+
+int net_conn_fd(struct net_conn *conn) {
+    return conn->fd;
+}
+
+int64_t net_conn_created(struct net_conn *conn) {
+    return conn->created;
+}
+
+int64_t net_conn_lastactive(struct net_conn *conn) {
+    return conn->lastactive;
+}
+
+// Returns the memory used by the network side of the connection.
+size_t net_conn_memsize(struct net_conn *conn) {
+    return sizeof(struct net_conn)+conn->outcap;
+}
+
+void net_conn_addr(struct net_conn *conn, char *buf, size_t bufsz) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    snprintf(buf, bufsz, "?");
+    if (conn->shm) {
+        snprintf(buf, bufsz, "shm");
+        return;
+    }
+    if (getpeername(conn->fd, (struct sockaddr*)&addr, &len) == -1) {
+        return;
+    }
+    if (addr.ss_family == AF_INET) {
+        struct sockaddr_in *in = (struct sockaddr_in*)&addr;
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+        snprintf(buf, bufsz, "%s:%d", ip, ntohs(in->sin_port));
+    } else if (addr.ss_family == AF_INET6) {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6*)&addr;
+        char ip[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+        snprintf(buf, bufsz, "[%s]:%d", ip, ntohs(in6->sin6_port));
+    } else if (addr.ss_family == AF_UNIX) {
+        snprintf(buf, bufsz, "unix");
+    }
+}
+
+void net_conn_list(void (*iter)(struct net_conn *conn, void *udata), 
+    void *udata)
+{
+    struct qthreadctx *ctxs = (void*)atomic_load(&all_ctxs);
+    if (!ctxs) {
+        return;
+    }
+    for (int i = 0; i < ctxs[0].nthreads; i++) {
+        struct qthreadctx *ctx = &ctxs[i];
+        pthread_mutex_lock(&ctx->cmaplock);
+        for (size_t j = 0; j < ctx->cmap.nbuckets; j++) {
+            struct net_conn *conn = ctx->cmap.buckets[j];
+            while (conn) {
+                iter(conn, udata);
+                conn = conn->next;
+            }
+        }
+        pthread_mutex_unlock(&ctx->cmaplock);
+    }
+}
+
+uint64_t stat_idle_closed(void) {
+    return atomic_load_explicit(&g_stat_idle_closed, __ATOMIC_RELAXED);
+}
+
+uint64_t stat_idle_compacted(void) {
+    return atomic_load_explicit(&g_stat_idle_compacted, __ATOMIC_RELAXED);
 }
 
 void net_stat_cmd_get_incr(struct net_conn *conn) {
@@ -1242,6 +2369,36 @@ void net_stat_get_misses_incr(struct net_conn *conn) {
     conn->stat_get_misses++;
 }
 
+// Returns true for the connection that executes memcache udp datagrams.
+bool net_conn_isdatagram(struct net_conn *conn) {
+    return conn->datagram;
+}
+
 bool net_conn_istls(struct net_conn *conn) {
     return conn->tls != 0;
 }
+
+// Returns the index of the listener that accepted the connection, as used
+// by net_listenstats, or -1 for datagrams.
+int net_conn_listener(struct net_conn *conn) {
+    return conn->listener;
+}
+
+// Returns the event loop pass of the thread that the connection is on.
+uint64_t net_conn_pass(struct net_conn *conn) {
+    return conn->ctx->pass;
+}
+
+// Has the data callback called again, with no new data, on the next pass.
+// This is for a connection that stopped with requests left to process.
+void net_conn_defer(struct net_conn *conn) {
+    if (!conn->datagram) {
+        addpend(conn->ctx, conn);
+    }
+}
+
+// Returns the udata of the net_listen that accepted the connection, or null
+// for the shared listeners.
+void *net_conn_listen(struct net_conn *conn) {
+    return conn->listener >= 0 ? listeners[conn->listener].udata : 0;
+}
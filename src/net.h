@@ -40,21 +40,43 @@ void net_conn_out_write_byte_nocheck(struct net_conn *conn, char byte);
 void net_conn_out_write_nocheck(struct net_conn *conn, const void *data,
     size_t nbytes);
 
+#define NET_MAXLISTENS 12  // listeners in net_opts.listens
+
+// An extra listener with its own settings, such as for a single protocol.
+struct net_listen {
+    const char *name;       // option that it came from, for stats
+    const char *port;       // tcp port, or
+    const char *path;       // unix socket file
+    bool tls;
+    int backlog;            // zero to use the shared backlog
+    void *udata;            // see net_conn_listen
+};
+
 struct net_opts {
     const char *host;
     const char *port;
     const char *tlsport; 
     const char *unixsock;
+    const char *shmsock;    // unix socket for shared-memory clients
+    const char *udpport;    // memcache udp port
     bool reuseport;
     bool tcpnodelay;
     bool keepalive;
     bool quickack;
     int backlog;
     int queuesize;
+    int maxqueuesize;       // largest queuesize for net_set_queuesize
     int nthreads;
+    int maxthreads;         // threads that may be started with net_set_nthreads
+    int maxbgwork;          // running background workers, 0 = no limit
     int maxconns;
     bool nowarmup;
     bool nouring;
+    bool sharednothing;
+    struct net_listen *listens;
+    int nlistens;
+    int64_t idletimeout;    // close idle connections, nanoseconds, 0 = never
+    int64_t idlecompact;    // release idle connection buffers, nanoseconds
     void *udata;
     void(*listening)(void *udata);
     void(*ready)(void *udata);
@@ -62,6 +84,12 @@ struct net_opts {
         void *udata);
     void(*opened)(struct net_conn *conn, void *udata);
     void(*closed)(struct net_conn *conn, void *udata);
+    // Called after 'data' has been called for every connection that had
+    // incoming data in an event loop pass, and before any output is flushed.
+    void(*processed)(void *udata);
+    // Called when a connection has been idle for idlecompact. The user
+    // should release any buffers that it no longer needs.
+    void(*idle)(struct net_conn *conn, void *udata);
 };
 
 void net_main(struct net_opts *opts);
@@ -69,11 +97,67 @@ void net_main(struct net_opts *opts);
 size_t net_nconns(void);
 size_t net_tconns(void);
 size_t net_rconns(void);
+int net_nthreads(void);
+
+// Runtime changes, such as from CONFIG SET.
+bool net_set_nthreads(int n);
+void net_set_maxbgwork(int n);
+bool net_set_backlog(int backlog);
+int net_queuesize(void);
+void net_set_queuesize(int queuesize);
+int net_busypoll(void);
+void net_set_busypoll(int polls);
+
+// Event loop counters, summed over all threads.
+struct net_loopstats {
+    uint64_t passes;        // passes that had events
+    uint64_t events;        // events over those passes
+    uint64_t fullpasses;    // passes that filled the event queue
+    uint64_t writestalls;   // writes that found the socket buffer full
+};
+
+void net_loopstats(struct net_loopstats *stats);
+
+// Listener counters. The shared listeners come first, named after their
+// options, followed by net_opts.listens. The name is null for the shared
+// listeners that aren't in use.
+struct net_listenstats {
+    const char *name;
+    size_t conns;           // current connections
+    uint64_t accepted;      // connections ever
+    uint64_t rejected;      // connections over maxconns
+};
+
+int net_nlisteners(void);
+void net_listenstats(int i, struct net_listenstats *stats);
 
 bool net_conn_bgwork(struct net_conn *conn, void (*work)(void *udata), 
     void (*done)(struct net_conn *conn, void *udata), void *udata);
 bool net_conn_bgworking(struct net_conn *conn);
 bool net_conn_istls(struct net_conn *conn);
+bool net_conn_isdatagram(struct net_conn *conn);
+int net_conn_listener(struct net_conn *conn);
+uint64_t net_conn_pass(struct net_conn *conn);
+void net_conn_defer(struct net_conn *conn);
+void *net_conn_listen(struct net_conn *conn);
+
+// Shared-nothing mode. Hand the connection to another thread.
+bool net_conn_forward(struct net_conn *conn, int thread, 
+    void (*work)(struct net_conn *conn, void *udata), void *udata);
+int net_conn_thread(struct net_conn *conn);
+
+// Connection details, such as for CLIENT LIST.
+uint64_t net_conn_id(struct net_conn *conn);
+int net_conn_fd(struct net_conn *conn);
+int64_t net_conn_created(struct net_conn *conn);
+int64_t net_conn_lastactive(struct net_conn *conn);
+size_t net_conn_memsize(struct net_conn *conn);
+void net_conn_addr(struct net_conn *conn, char *buf, size_t bufsz);
+
+// Iterate over all connections on all threads. Connections may be owned by
+// other threads, so only read the fields that are safe to be stale.
+void net_conn_list(void (*iter)(struct net_conn *conn, void *udata), 
+    void *udata);
 
 // Some stats are collected in the connection and summed in the event loop.
 void net_stat_cmd_get_incr(struct net_conn *conn);
@@ -85,5 +169,8 @@ uint64_t stat_cmd_get(void);
 uint64_t stat_cmd_set(void);
 uint64_t stat_get_hits(void);
 uint64_t stat_get_misses(void);
+uint64_t stat_cmd_forwarded(void);
+uint64_t stat_idle_closed(void);
+uint64_t stat_idle_compacted(void);
 
 #endif
@@ -21,6 +21,7 @@
 #include "util.h"
 
 __thread char parse_lasterr[1024] = "";
+__thread const char *parse_auth = "";
 
 const char *parse_lasterror(void) {
     return parse_lasterr;
@@ -43,6 +43,10 @@ bool mc_valid_key(struct args *args, int i);
 
 extern __thread char parse_lasterr[1024];
 
+// Password of the connection being parsed, for protocols that send it
+// along with the request.
+extern __thread const char *parse_auth;
+
 #define parse_errorf(...) \
     snprintf(parse_lasterr, sizeof(parse_lasterr), __VA_ARGS__);
 
@@ -29,6 +29,8 @@
 #define SHRINKAT         10     // 10%
 #define DEFSHARDS        4096   // default number of shards
 #define INITCAP          64     // intial number of buckets per shard
+#define HOTVERSIONS      16384  // write versions for hot key replicas
+#define HOTSTRIPES       16     // hot key counters, one per group of threads
 
 // #define DBGCHECKENTRY
 // #define EVICTONITER
@@ -47,9 +49,27 @@
 #error Unknown pointer size
 #endif
 
+// USDT probes, the same as src/probes.h, repeated so that this file stays
+// standalone. They compile to nothing without <sys/sdt.h> or with NOUSDT.
+#if !defined(NOUSDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define USDT
+#endif
+#endif
+#ifdef USDT
+#define PROBE2(name, a, b) DTRACE_PROBE2(pogocache, name, a, b)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(pogocache, name, a, b, c, d)
+#else
+#define PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+#define PROBE4(name, a, b, c, d) ((void)sizeof(a), (void)sizeof(b), \
+    (void)sizeof(c), (void)sizeof(d))
+#endif
+
 static struct pogocache_count_opts defcountopts = { 0 };
 static struct pogocache_total_opts deftotalopts = { 0 };
 static struct pogocache_size_opts defsizeopts = { 0 };
+static struct pogocache_stats_opts defstatsopts = { 0 };
 static struct pogocache_sweep_opts defsweepopts = { 0 };
 static struct pogocache_clear_opts defclearopts = { 0 };
 static struct pogocache_store_opts defstoreopts = { 0 };
@@ -57,6 +77,7 @@ static struct pogocache_load_opts defloadopts = { 0 };
 static struct pogocache_delete_opts defdeleteopts = { 0 };
 static struct pogocache_iter_opts defiteropts = { 0 };
 static struct pogocache_sweep_poll_opts defsweeppollopts = { 0 };
+static struct pogocache_evict_opts defevictopts = { 0 };
 
 static int64_t nanotime(struct timespec *ts) {
     int64_t x = ts->tv_sec;
@@ -302,12 +323,33 @@ struct pgctx {
     bool noevict;
     bool allowshrink;
     bool usethreadbatch;
-    int nshards;
-    double loadfactor;
-    double shrinkfactor;
+    atomic_int nshards;    // live shards, see pogocache_reshard
+    int maxshards;         // shards allocated
+    atomic_int base;       // shards at the lowest level
+    atomic_int target;     // shards wanted by pogocache_reshard
+    atomic_int pins;       // see pogocache_pin
+    atomic_int loadfactor; // percent, see pogocache_set_loadfactor
+    atomic_int shrinkat;   // percent, see pogocache_set_shrinkat
+    atomic_int evictbatch; // see pogocache_set_evictbatch
+    // counters, see pogocache_counters
+    atomic_uint_fast64_t lockwaits;
+    atomic_uint_fast64_t evictions;
+    atomic_uint_fast64_t grows;
+    atomic_uint_fast64_t shrinks;
     uint64_t seed;
+    // hot key replicas, see hot_load
+    atomic_uint *versions;     // bumped by key hash on writes (null = off)
+    atomic_uint hotepoch;      // bumped when a shard is cleared
+    int hotid;                 // tells caches apart in the thread tables
+    struct {
+        atomic_uint_fast64_t reads;
+        atomic_uint_fast64_t promotions;
+        char pad[48];
+    } hotstats[HOTSTRIPES];
 };
 
+static atomic_int hotids = 0; // last pgctx.hotid
+
 // The entry structure is a simple allocation with all the fields, being 
 // variable in size, slammed together contiguously. There's a one byte header
 // that provides information about what is available in the structure.
@@ -692,6 +734,7 @@ struct map {
 
 struct shard {
     atomic_uintptr_t lock; // spinlock (batch pointer)
+    atomic_int level;      // shards at the level of this one, see shard_index
     uint64_t cas;          // compare and store value
     int64_t cleartime;     // last clear time
     int clearcount;        // number of items cleared
@@ -793,6 +836,12 @@ static uint32_t read_hash(uint8_t data[4]) {
 }
 #endif
 
+// Returns the write version slot for a key hash. Buckets only keep the
+// clipped hash, so only those bits are used.
+static int hot_slot(uint32_t hash) {
+    return clip_hash(hash)&(HOTVERSIONS-1);
+}
+
 static uint32_t get_hash(struct bucket *bucket) {
     return read_hash(bucket->hash);
 }
@@ -809,13 +858,21 @@ static void set_dib(struct bucket *bucket, uint8_t dib) {
     bucket->dib = dib;
 }
 
+static double load_factor(struct pgctx *ctx) {
+    return atomic_load_explicit(&ctx->loadfactor, __ATOMIC_RELAXED)/100.0;
+}
+
+static double shrink_factor(struct pgctx *ctx) {
+    return atomic_load_explicit(&ctx->shrinkat, __ATOMIC_RELAXED)/100.0;
+}
+
 static bool map_init(struct map *map, size_t cap, struct pgctx *ctx) {
     map->cap = cap;
     map->nbuckets = cap;
     map->count = 0;
     map->mask = map->nbuckets-1;
-    map->growat = map->nbuckets * ctx->loadfactor;
-    map->shrinkat = map->nbuckets * ctx->shrinkfactor;
+    map->growat = map->nbuckets * load_factor(ctx);
+    map->shrinkat = map->nbuckets * shrink_factor(ctx);
     size_t size = sizeof(struct bucket)*map->nbuckets;
     map->buckets = ctx->malloc(size);
     if (!map->buckets) {
@@ -828,6 +885,7 @@ static bool map_init(struct map *map, size_t cap, struct pgctx *ctx) {
 }
 
 static bool resize(struct map *map, size_t new_cap, struct pgctx *ctx) {
+    PROBE2(resize__start, map->nbuckets, new_cap);
     struct map map2;
     if (!map_init(&map2, new_cap, ctx)) {
         return false;
@@ -854,13 +912,27 @@ static bool resize(struct map *map, size_t new_cap, struct pgctx *ctx) {
     }
     int org_cap = map->cap;
     int org_count = map->count;
+    uint64_t org_total = map->total;
+    size_t org_entsize = map->entsize;
     ctx->free(map->buckets);
     memcpy(map, &map2, sizeof(struct map));
     map->cap = org_cap;
     map->count = org_count;
+    map->total = org_total;
+    map->entsize = org_entsize;
+    PROBE2(resize__done, map->nbuckets, map->count);
     return true;
 }
 
+// Invalidates the hot key replicas for the hash. Called with the shard
+// locked, whenever an entry is replaced or removed.
+static void hot_bump(struct pgctx *ctx, uint32_t hash) {
+    if (ctx->versions) {
+        atomic_fetch_add_explicit(&ctx->versions[hot_slot(hash)], 1,
+            __ATOMIC_RELEASE);
+    }
+}
+
 static bool map_insert(struct map *map, struct entry *entry, uint32_t hash,
     struct entry **old, struct pgctx *ctx)
 {
@@ -870,6 +942,7 @@ static bool map_insert(struct map *map, struct entry *entry, uint32_t hash,
             *old = 0;
             return false;
         }
+        atomic_fetch_add_explicit(&ctx->grows, 1, __ATOMIC_RELAXED);
     }
     map->entsize += entry_memsize(entry, ctx);
     struct bucket ebkt;
@@ -893,6 +966,7 @@ static bool map_insert(struct map *map, struct entry *entry, uint32_t hash,
             *old = get_entry(&map->buckets[i]);
             map->entsize -= entry_memsize(*old, ctx);
             set_entry(&map->buckets[i], get_entry(&ebkt));
+            hot_bump(ctx, hash);
             return true;
         }
         if (get_dib(&map->buckets[i]) < get_dib(&ebkt)) {
@@ -979,16 +1053,18 @@ static void tryshrink(struct map *map, bool multi, struct pgctx *ctx) {
     if (multi) {
         // Determine how many buckets are needed to store all entries.
         cap = map->cap;
-        int growat = cap * ctx->loadfactor;
+        int growat = cap * load_factor(ctx);
         while (map->count >= growat) {
             cap *= 2;
-            growat = cap * ctx->loadfactor;
+            growat = cap * load_factor(ctx);
         }
     } else {
         // Just half the buckets
         cap = map->nbuckets / 2;
     }
-    resize(map, cap, ctx);
+    if (resize(map, cap, ctx)) {
+        atomic_fetch_add_explicit(&ctx->shrinks, 1, __ATOMIC_RELAXED);
+    }
 }
 
 // delete an entry at bucket position. not called directly
@@ -998,6 +1074,7 @@ static struct entry *delentry_at_bkt(struct map *map, size_t i,
     struct entry *old = get_entry(&map->buckets[i]);
     assert(old);
     map->entsize -= entry_memsize(old, ctx);
+    hot_bump(ctx, get_hash(&map->buckets[i]));
     delbkt(map, i);
     return old;
 }
@@ -1027,6 +1104,7 @@ static size_t evict_entry(struct shard *shard, int shardidx,
     uint32_t hash = th64(key, keylen, ctx->seed);
     struct entry *del = map_delete(&shard->map, key, keylen, hash, ctx);
     assert(del == entry); (void)del;
+    PROBE4(evict, shardidx, reason, key, keylen);
     if (ctx->evicted) {
         // Notify user that an entry was evicted.
         const char *val;
@@ -1048,8 +1126,9 @@ static size_t evict_entry(struct shard *shard, int shardidx,
 // evict an entry using the 2-random algorithm.
 // Pick two random entries and delete the one with the oldest access time.
 // Do not evict the entry if it matches the provided hash.
-static void auto_evict_entry(struct shard *shard, int shardidx, uint32_t hash,
-    int64_t now, struct pgctx *ctx)
+// Returns the number of bytes freed, or zero if nothing was evicted.
+static size_t auto_evict_entry(struct shard *shard, int shardidx,
+    uint32_t hash, int64_t now, struct pgctx *ctx)
 {
     hash = clip_hash(hash);
     struct map *map = &shard->map;
@@ -1065,8 +1144,7 @@ static void auto_evict_entry(struct shard *shard, int shardidx, uint32_t hash,
         int reason = entry_alive(entry, now, shard->cleartime);
         if (reason) {
             // Entry has expired. Evict this one instead.
-            evict_entry(shard, shardidx, entry, now, reason, ctx);
-            return;
+            return evict_entry(shard, shardidx, entry, now, reason, ctx);
         }
         if (get_hash(bkt) == hash) {
             continue;
@@ -1084,10 +1162,11 @@ static void auto_evict_entry(struct shard *shard, int shardidx, uint32_t hash,
             choose = 1;
         }
     } else {
-        return;
+        return 0;
     }
-    evict_entry(shard, shardidx, entries[choose], now, POGOCACHE_REASON_LOWMEM,
-        ctx);
+    atomic_fetch_add_explicit(&ctx->evictions, 1, __ATOMIC_RELAXED);
+    return evict_entry(shard, shardidx, entries[choose], now,
+        POGOCACHE_REASON_LOWMEM, ctx);
 }
 
 static void shard_deinit(struct shard *shard, struct pgctx *ctx) {
@@ -1130,19 +1209,35 @@ void pogocache_free(struct pogocache *cache) {
         return;
     }
     struct pgctx *ctx = &cache->ctx;
-    for (int i = 0; i < cache->ctx.nshards; i++) {
+    int nshards = atomic_load(&ctx->nshards);
+    for (int i = 0; i < nshards; i++) {
         shard_deinit(&cache->shards[i], ctx);
     }
+    if (ctx->versions) {
+        ctx->free(ctx->versions);
+    }
     cache->ctx.free(cache);
 }
 
-static void opts_to_ctx(int nshards, struct pogocache_opts *opts,
-    struct pgctx *ctx)
+static int clamp_loadfactor(int loadfactor) {
+    return loadfactor == 0 ? DEFLOADFACTOR :
+        loadfactor < MINLOADFACTOR_RH ? MINLOADFACTOR_RH :
+        loadfactor > MAXLOADFACTOR_RH ? MAXLOADFACTOR_RH :
+        loadfactor;
+}
+
+static void opts_to_ctx(int nshards, int maxshards,
+    struct pogocache_opts *opts, struct pgctx *ctx)
 {
-    ctx->nshards = nshards;
+    atomic_init(&ctx->nshards, nshards);
+    ctx->maxshards = maxshards;
+    atomic_init(&ctx->base, nshards);
+    atomic_init(&ctx->target, nshards);
+    atomic_init(&ctx->pins, 0);
     int loadfactor = 0;
     if (opts) {
         ctx->yield = opts->yield;
+        ctx->malloc_size = opts->malloc_size;
         ctx->evicted = opts->evicted;
         ctx->udata = opts->udata;
         ctx->usecas = opts->usecas;
@@ -1153,13 +1248,13 @@ static void opts_to_ctx(int nshards, struct pogocache_opts *opts,
         ctx->allowshrink = opts->allowshrink;
         ctx->usethreadbatch = opts->usethreadbatch;
     }
-    // make loadfactor a floating point
-    loadfactor = loadfactor == 0 ? DEFLOADFACTOR :
-        loadfactor < MINLOADFACTOR_RH ? MINLOADFACTOR_RH :
-        loadfactor > MAXLOADFACTOR_RH ? MAXLOADFACTOR_RH :
-        loadfactor;
-    ctx->loadfactor = ((double)loadfactor/100.0);
-    ctx->shrinkfactor = ((double)SHRINKAT/100.0);
+    atomic_init(&ctx->loadfactor, clamp_loadfactor(loadfactor));
+    atomic_init(&ctx->shrinkat, SHRINKAT);
+    atomic_init(&ctx->evictbatch, 1);
+    atomic_init(&ctx->lockwaits, 0);
+    atomic_init(&ctx->evictions, 0);
+    atomic_init(&ctx->grows, 0);
+    atomic_init(&ctx->shrinks, 0);
 }
 
 static struct pogocache_opts newdefopts = { 0 };
@@ -1173,28 +1268,67 @@ struct pogocache *pogocache_new(struct pogocache_opts *opts) {
     void *(*_malloc)(size_t) = opts->malloc ? opts->malloc : malloc;
     void (*_free)(void*) = opts->free ? opts->free : free;
     int shards = !opts || opts->nshards <= 0 ? DEFSHARDS : opts->nshards;
-    size_t size = sizeof(struct pogocache)+shards*sizeof(struct shard);
+    int maxshards = opts->maxshards > shards ? opts->maxshards : shards;
+    // Room is made for maxshards up front, so that the shards never move.
+    // Only the shard structs are reserved, as a shard's buckets aren't
+    // allocated until it's first used.
+    size_t size = sizeof(struct pogocache)+maxshards*sizeof(struct shard);
     struct pogocache *cache = _malloc(size);
     if (!cache) {
         return 0;
     }
-    memset(cache, 0, sizeof(struct pogocache));
+    memset(cache, 0, size);
     struct pgctx *ctx = &cache->ctx;
-    opts_to_ctx(shards, opts, ctx);
+    opts_to_ctx(shards, maxshards, opts, ctx);
     ctx->malloc = _malloc;
     ctx->free = _free;
-    for (int i = 0; i < ctx->nshards; i++) {
+    if (opts->hotkeys) {
+        ctx->versions = _malloc(sizeof(atomic_uint)*HOTVERSIONS);
+        if (!ctx->versions) {
+            _free(cache);
+            return 0;
+        }
+        for (int i = 0; i < HOTVERSIONS; i++) {
+            atomic_init(&ctx->versions[i], 0);
+        }
+        ctx->hotid = atomic_fetch_add(&hotids, 1)+1;
+    }
+    for (int i = 0; i < shards; i++) {
         if (!shard_init(&cache->shards[i], ctx)) {
             // nomem
             pogocache_free(cache);
             return 0;
         }
+        atomic_init(&cache->shards[i].level, shards);
     }
     return cache;
 }
 
+// The shards are laid out in levels, each with twice the shards of the one
+// before. A key's shard at a level of n shards is its hash modulo n, so each
+// shard at one level has exactly two at the next: itself and the one n
+// places after it. Resharding splits the shards of a level one at a time,
+// and a shard's 'level' is how many shards were at the level where it was
+// last split. Finding a key's shard starts at the lowest level and follows
+// the splits down. The level only ever grows, so a stale 'base' still finds
+// the right shard.
+static int shard_locate(struct pogocache *cache, uint64_t hash, int *level) {
+    uint32_t h = hash>>32;
+    int n = atomic_load_explicit(&cache->ctx.base, __ATOMIC_RELAXED);
+    int i = h%n;
+    while (atomic_load_explicit(&cache->shards[i].level,
+        __ATOMIC_ACQUIRE) > n)
+    {
+        n *= 2;
+        i = h%n;
+    }
+    *level = n;
+    return i;
+}
+
 static int shard_index(struct pogocache *cache, uint64_t hash) {
-    return (hash>>32)%cache->ctx.nshards;
+    int level;
+    return shard_locate(cache, hash, &level);
 }
 
 static struct shard *shard_get(struct pogocache *cache, int index) {
@@ -1240,6 +1374,7 @@ void pogocache_end(struct pogocache *batch) {
 }
 
 static void lock(struct batch *batch, struct shard *shard, struct pgctx *ctx) {
+    int spins = 0;
     if (batch) {
         while (1) {
             uintptr_t val = 0;
@@ -1253,6 +1388,7 @@ static void lock(struct batch *batch, struct shard *shard, struct pgctx *ctx) {
             if (val == (uintptr_t)(void*)batch) {
                 break;
             }
+            spins++;
             if (ctx->yield) {
                 ctx->yield(ctx->udata);
             }
@@ -1265,11 +1401,17 @@ static void lock(struct batch *batch, struct shard *shard, struct pgctx *ctx) {
             {
                 break;
             }
+            spins++;
             if (ctx->yield) {
                 ctx->yield(ctx->udata);
             }
         }
     }
+    // 'spins' is the number of failed attempts, non-zero when contended.
+    PROBE2(lock__acquire, shard, spins);
+    if (spins > 0) {
+        atomic_fetch_add_explicit(&ctx->lockwaits, 1, __ATOMIC_RELAXED);
+    }
 }
 
 static bool acquire_for_scan(int shardidx, struct shard **shard_out, 
@@ -1303,9 +1445,22 @@ static bool acquire_for_key(const char *key, size_t keylen, uint32_t *hash_out,
     }
     struct pgctx *ctx = &cache->ctx;
     uint64_t fhash = th64(key, keylen, cache->ctx.seed);
-    int shardidx = shard_index(cache, fhash);
-    struct shard *shard = shard_get(cache, shardidx);
-    lock(batch, shard, ctx);
+    int shardidx;
+    struct shard *shard;
+    while (1) {
+        int level;
+        shardidx = shard_locate(cache, fhash, &level);
+        shard = shard_get(cache, shardidx);
+        lock(batch, shard, ctx);
+        if (atomic_load_explicit(&shard->level, __ATOMIC_RELAXED) == level) {
+            break;
+        }
+        // The shard was split while waiting for its lock. A batch keeps the
+        // lock until it ends, otherwise release it and look again.
+        if (!batch) {
+            atomic_store_explicit(&shard->lock, 0, __ATOMIC_RELEASE);
+        }
+    }
     *hash_out = fhash;
     *shard_out = shard;
     *shardidx_out = shardidx;
@@ -1342,6 +1497,186 @@ static bool acquire_for_key(const char *key, size_t keylen, uint32_t *hash_out,
     status; \
 })
 
+static void entry_info(struct map *map, struct bucket *bkt, int64_t now,
+    struct pogocache_entry_info *info, struct pgctx *ctx)
+{
+    struct entry *entry = get_entry(bkt);
+    memset(info, 0, sizeof(struct pogocache_entry_info));
+    info->idle = now-entry_time(entry);
+    info->memsize = entry_memsize(entry, ctx);
+    if (ctx->malloc_size) {
+        info->usable = ctx->malloc_size(entry);
+    }
+    info->bucketsize = sizeof(struct bucket)*map->nbuckets/map->count;
+    entry_rawkey(entry, &info->rawkeylen);
+    info->sixpacked = entry_sixpacked(entry);
+    info->dib = get_dib(bkt);
+}
+
+// Hot key replicas. A key that many threads read lands on one shard, and
+// they all wait on its lock. So each thread samples the keys it loads, and
+// a key that keeps coming up is copied into the thread's own table. Loads
+// are then served from the copy without taking the lock, for as long as the
+// key's write version and the clear epoch haven't moved. Every so often the
+// copy is refreshed under the lock, which also keeps the entry's access
+// time current for eviction.
+#define HOTSAMPLE   32         // one load in this many is counted
+#define HOTSLOTS    256        // counters of sampled keys, by hash
+#define HOTCOUNT    8          // count at which a key is copied
+#define HOTDECAY    1024       // samples between halving the counters
+#define HOTREPLICAS 64         // copies per thread, by hash
+#define HOTMAXSIZE  16384      // largest key and value to copy
+#define HOTLIFE     100000000  // nanoseconds a copy serves before a refresh
+
+struct hotreplica {
+    char *data;         // key then value, null when empty
+    size_t keylen;
+    size_t vallen;
+    uint32_t hash;
+    unsigned version;   // of the key's slot when copied
+    unsigned epoch;     // of the cache when copied
+    int shardidx;
+    int64_t until;      // refreshed under the lock from then on
+    int64_t expires;
+    uint32_t flags;
+    uint64_t cas;
+};
+
+struct hottable {
+    int hotid;             // cache that the table is for
+    void (*free)(void*);   // frees the data of the copies
+    int stripe;            // counters that the thread adds to
+    uint32_t loads;
+    uint32_t samples;
+    uint8_t counts[HOTSLOTS];
+    int nreplicas;
+    struct hotreplica replicas[HOTREPLICAS];
+};
+
+static __thread struct hottable hot;
+static atomic_int hotthreads = 0;
+
+// Returns the thread's table for the cache, starting over if it belonged to
+// another cache.
+static struct hottable *hot_table(struct pgctx *ctx) {
+    if (hot.hotid != ctx->hotid) {
+        for (int i = 0; i < HOTREPLICAS; i++) {
+            if (hot.replicas[i].data) {
+                hot.free(hot.replicas[i].data);
+            }
+        }
+        int stripe = hot.hotid ? hot.stripe :
+            atomic_fetch_add(&hotthreads, 1)%HOTSTRIPES;
+        memset(&hot, 0, sizeof(struct hottable));
+        hot.hotid = ctx->hotid;
+        hot.free = ctx->free;
+        hot.stripe = stripe;
+    }
+    return &hot;
+}
+
+static bool hot_match(struct hotreplica *r, const void *key, size_t keylen,
+    uint32_t hash)
+{
+    return r->data && r->hash == hash && r->keylen == keylen &&
+        memcmp(r->data, key, keylen) == 0;
+}
+
+// Serves a load from the thread's copy of the key, if it has a current one.
+// Returns -1 when the load needs to go to the shard.
+static int hot_load(struct pogocache *cache, const void *key, size_t keylen,
+    struct pogocache_load_opts *opts)
+{
+    if (cache->isbatch) {
+        cache = cache->batch.cache;
+    }
+    struct pgctx *ctx = &cache->ctx;
+    if (!ctx->versions || hot.hotid != ctx->hotid || hot.nreplicas == 0 ||
+        opts->info)
+    {
+        return -1;
+    }
+    uint32_t hash = th64(key, keylen, ctx->seed);
+    struct hotreplica *r = &hot.replicas[hash&(HOTREPLICAS-1)];
+    if (!hot_match(r, key, keylen, hash)) {
+        return -1;
+    }
+    int64_t now = opts->time > 0 ? opts->time : getnow();
+    if (now >= r->until || (r->expires > 0 && r->expires <= now) ||
+        atomic_load_explicit(&ctx->versions[hot_slot(hash)],
+            __ATOMIC_ACQUIRE) != r->version ||
+        atomic_load_explicit(&ctx->hotepoch, __ATOMIC_ACQUIRE) != r->epoch)
+    {
+        return -1;
+    }
+    if (opts->entry) {
+        struct pogocache_update *update = 0;
+        opts->entry(r->shardidx, now, key, keylen, r->data+keylen, r->vallen,
+            r->expires, r->flags, r->cas, &update, opts->udata);
+        assert(!update);
+    }
+    atomic_fetch_add_explicit(&ctx->hotstats[hot.stripe].reads, 1,
+        __ATOMIC_RELAXED);
+    return POGOCACHE_FOUND;
+}
+
+// Counts a load of the key, copying it once it's hot or when its copy is
+// due for a refresh. Called with the shard locked.
+static void hot_sample(const void *key, size_t keylen, uint32_t hash,
+    int shardidx, int64_t now, const char *val, size_t vallen,
+    int64_t expires, uint32_t flags, uint64_t cas, struct pgctx *ctx)
+{
+    struct hottable *t = hot_table(ctx);
+    struct hotreplica *r = &t->replicas[hash&(HOTREPLICAS-1)];
+    bool refresh = hot_match(r, key, keylen, hash);
+    if (!refresh) {
+        if ((++t->loads&(HOTSAMPLE-1)) != 0) {
+            return;
+        }
+        if (++t->samples == HOTDECAY) {
+            for (int i = 0; i < HOTSLOTS; i++) {
+                t->counts[i] /= 2;
+            }
+            t->samples = 0;
+        }
+        uint8_t *count = &t->counts[(hash>>8)&(HOTSLOTS-1)];
+        if (++(*count) < HOTCOUNT) {
+            return;
+        }
+        *count = 0;
+    }
+    if (keylen+vallen > HOTMAXSIZE) {
+        return;
+    }
+    char *data = ctx->malloc(keylen+vallen);
+    if (!data) {
+        return;
+    }
+    memcpy(data, key, keylen);
+    memcpy(data+keylen, val, vallen);
+    if (r->data) {
+        t->free(r->data);
+    } else {
+        t->nreplicas++;
+    }
+    r->data = data;
+    r->keylen = keylen;
+    r->vallen = vallen;
+    r->hash = hash;
+    r->version = atomic_load_explicit(&ctx->versions[hot_slot(hash)],
+        __ATOMIC_ACQUIRE);
+    r->epoch = atomic_load_explicit(&ctx->hotepoch, __ATOMIC_ACQUIRE);
+    r->shardidx = shardidx;
+    r->until = now+HOTLIFE;
+    r->expires = expires;
+    r->flags = flags;
+    r->cas = cas;
+    if (!refresh) {
+        atomic_fetch_add_explicit(&ctx->hotstats[t->stripe].promotions, 1,
+            __ATOMIC_RELAXED);
+    }
+}
+
 static int loadop(const void *key, size_t keylen, 
     struct pogocache_load_opts *opts, struct shard *shard, int shardidx, 
     uint32_t hash, struct pgctx *ctx)
@@ -1365,18 +1700,26 @@ static int loadop(const void *key, size_t keylen,
     int reason = entry_alive(entry, now, shard->cleartime);
     if (reason) {
         // Entry is no longer alive. Evict the entry and clear the bucket.
+        PROBE4(expire, shardidx, reason, key, keylen);
         if (ctx->evicted) {
             ctx->evicted(shardidx, reason, now, key, keylen, val, vallen,
                 expires, flags, cas, ctx->udata);
         }
         shard->clearcount -= (reason==POGOCACHE_REASON_CLEARED);
+        delentry_at_bkt(&shard->map, bidx, ctx);
         entry_free(entry, ctx);
-        delbkt(&shard->map, bidx);
         return POGOCACHE_NOTFOUND;
     }
+    if (opts->info) {
+        entry_info(&shard->map, bkt, now, opts->info, ctx);
+    }
     if (!opts->notouch) {
         entry_settime(entry, now);
     }
+    if (opts->readonly && ctx->versions) {
+        hot_sample(key, keylen, hash, shardidx, now, val, vallen, expires,
+            flags, cas, ctx);
+    }
     if (opts->entry) {
         struct pogocache_update *update = 0;
         opts->entry(shardidx, now, key, keylen, val, vallen, expires, flags,
@@ -1391,7 +1734,10 @@ static int loadop(const void *key, size_t keylen,
                 return POGOCACHE_NOMEM;
             }
             entry_settime(entry2, now);
+            shard->map.entsize += entry_memsize(entry2, ctx);
+            shard->map.entsize -= entry_memsize(entry, ctx);
             set_entry(bkt, entry2);
+            hot_bump(ctx, hash);
             entry_free(entry, ctx);
         }
     }
@@ -1408,6 +1754,12 @@ static int loadop(const void *key, size_t keylen,
 int pogocache_load(struct pogocache *cache, const void *key, size_t keylen, 
     struct pogocache_load_opts *opts)
 {
+    if (opts && opts->readonly) {
+        int status = hot_load(cache, key, keylen, opts);
+        if (status != -1) {
+            return status;
+        }
+    }
     return ACQUIRE_FOR_KEY_AND_EXECUTE(int, key, keylen, 
         loadop(key, keylen, opts, shard, shardidx, hash, ctx)
     );
@@ -1495,7 +1847,8 @@ static int storeop(const void *key, size_t keylen, const void *val,
     }
     if (opts->keepttl) {
         // User wants to keep the existing ttl. Get the existing entry from the
-        // map first and take its expiration.
+        // map first and take its expiration. Without one, the expiry from
+        // the options stands.
         int i;
         struct entry *old = map_get_entry(&shard->map, key, keylen, hash, &i);
         if (old) {
@@ -1512,7 +1865,7 @@ static int storeop(const void *key, size_t keylen, const void *val,
         goto nomem;
     }
     entry_settime(entry, now);
-    if (opts->lowmem && ctx->noevict) {
+    if (opts->lowmem && (ctx->noevict || opts->noevict)) {
         goto nomem;
     }
     // Insert new entry into map
@@ -1606,8 +1959,12 @@ static int storeop(const void *key, size_t keylen, const void *val,
     } else {
         if (opts->lowmem && shard->map.count > count) {
             // The map grew by one bucket, yet the user indicates that there is
-            // a low memory event. Evict one entry.
-            auto_evict_entry(shard, shardidx, hash, now, ctx);
+            // a low memory event. Evict one entry, or more when the eviction
+            // batch has been raised.
+            int n = atomic_load_explicit(&ctx->evictbatch, __ATOMIC_RELAXED);
+            for (int i = 0; i < n && shard->map.count > 1; i++) {
+                auto_evict_entry(shard, shardidx, hash, now, ctx);
+            }
         }
         return POGOCACHE_INSERTED;
     }
@@ -1642,7 +1999,231 @@ static struct pogocache *rootcache(struct pogocache *cache) {
 /// Returns the number of shards in cache
 int pogocache_nshards(struct pogocache *cache) {
     cache = rootcache(cache);
-    return cache->ctx.nshards;
+    return atomic_load(&cache->ctx.nshards);
+}
+
+#define RESHARDING (1<<30)
+
+/// Keeps the shards from being split until pogocache_unpin is called, so
+/// that a series of single shard operations, by index, sees every entry
+/// exactly once. Operations over all shards do this on their own.
+void pogocache_pin(struct pogocache *cache) {
+    cache = rootcache(cache);
+    while (1) {
+        int pins = atomic_fetch_add(&cache->ctx.pins, 1);
+        if (!(pins&RESHARDING)) {
+            break;
+        }
+        // Wait out a split, which never blocks.
+        atomic_fetch_sub(&cache->ctx.pins, 1);
+        if (cache->ctx.yield) {
+            cache->ctx.yield(cache->ctx.udata);
+        }
+    }
+}
+
+void pogocache_unpin(struct pogocache *cache) {
+    cache = rootcache(cache);
+    atomic_fetch_sub(&cache->ctx.pins, 1);
+}
+
+/// Starts changing the number of shards to nshards, which must be the
+/// current number doubled one or more times, and no more than the maxshards
+/// option. The shards are then split by calling pogocache_reshard_step
+/// until it returns false. Meanwhile every operation continues as normal.
+/// Returns false if nshards isn't allowed or another reshard is running.
+bool pogocache_reshard(struct pogocache *cache, int nshards) {
+    cache = rootcache(cache);
+    struct pgctx *ctx = &cache->ctx;
+    int cur = atomic_load(&ctx->nshards);
+    if (nshards == cur) {
+        return true;
+    }
+    if (atomic_load(&ctx->target) != cur || nshards < cur ||
+        nshards > ctx->maxshards)
+    {
+        return false;
+    }
+    int n = cur;
+    while (n < nshards) {
+        n *= 2;
+    }
+    if (n != nshards) {
+        return false;
+    }
+    atomic_store(&ctx->target, nshards);
+    return true;
+}
+
+/// Returns the number of shards that a running reshard is heading to, or
+/// the current number when none is running.
+int pogocache_reshard_target(struct pogocache *cache) {
+    cache = rootcache(cache);
+    return atomic_load(&cache->ctx.target);
+}
+
+static bool trylock(struct shard *shard) {
+    uintptr_t val = 0;
+    return atomic_compare_exchange_strong_explicit(&shard->lock, &val,
+        UINTPTR_MAX, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// Moves the entries of shard that belong to child at level n.
+static void splitop(struct shard *shard, struct shard *child, int childidx,
+    int n, struct pgctx *ctx)
+{
+    char buf[128];
+    int64_t now = getnow();
+    struct map *map = &shard->map;
+    for (int i = 0; i < map->nbuckets; i++) {
+        struct bucket *bkt = &map->buckets[i];
+        if (get_dib(bkt) == 0) {
+            continue;
+        }
+        struct entry *entry = get_entry(bkt);
+        size_t keylen;
+        const char *key = entry_key(entry, &keylen, buf);
+        uint64_t fhash = th64(key, keylen, ctx->seed);
+        if ((int)((fhash>>32)%n) != childidx) {
+            continue;
+        }
+        int reason = entry_alive(entry, now, shard->cleartime);
+        if (reason == POGOCACHE_REASON_CLEARED) {
+            shard->clearcount--;
+            child->clearcount++;
+        }
+        delentry_at_bkt(map, i, ctx);
+        struct entry *old;
+        map_insert(&child->map, entry, fhash, &old, ctx);
+        // Check the same bucket again, as for sweepop.
+        i--;
+    }
+}
+
+/// Splits the next shard for a running reshard. This locks two shards for
+/// as long as it takes to move about half of one shard's entries.
+/// Returns false once the reshard is done, or when none is running.
+bool pogocache_reshard_step(struct pogocache *cache) {
+    cache = rootcache(cache);
+    struct pgctx *ctx = &cache->ctx;
+    int target = atomic_load(&ctx->target);
+    if (atomic_load(&ctx->nshards) == target) {
+        return false;
+    }
+    // Splits can't happen during a pinned scan, and locks are only tried,
+    // so that a batch holding a shard never waits on a split that waits on
+    // it. Either way, try again on the next step.
+    int pins = 0;
+    if (!atomic_compare_exchange_strong(&ctx->pins, &pins, RESHARDING)) {
+        return true;
+    }
+    int n = atomic_load(&ctx->base);
+    int nshards = atomic_load(&ctx->nshards);
+    int idx = nshards-n;
+    struct shard *shard = &cache->shards[idx];
+    struct shard *child = &cache->shards[idx+n];
+    if (!trylock(shard)) {
+        goto done;
+    }
+    // The child is out of reach until the level of its parent changes.
+    // It starts with as many buckets as the parent, so that moving the
+    // entries never has to grow it.
+    memset(child, 0, sizeof(struct shard));
+    lock_init(child);
+    if (!map_init(&child->map, shard->map.nbuckets, ctx)) {
+        atomic_store_explicit(&shard->lock, 0, __ATOMIC_RELEASE);
+        goto done;
+    }
+    child->map.cap = INITCAP;
+    child->cas = shard->cas;
+    child->cleartime = shard->cleartime;
+    splitop(shard, child, idx+n, n*2, ctx);
+    child->map.total = 0; // counted by the parent already
+    tryshrink(&shard->map, true, ctx);
+    tryshrink(&child->map, true, ctx);
+    atomic_store_explicit(&child->level, n*2, __ATOMIC_RELEASE);
+    atomic_store_explicit(&shard->level, n*2, __ATOMIC_RELEASE);
+    atomic_store(&ctx->nshards, nshards+1);
+    if (nshards+1 == n*2) {
+        atomic_store(&ctx->base, n*2);
+    }
+    atomic_store_explicit(&shard->lock, 0, __ATOMIC_RELEASE);
+    PROBE2(reshard__split, idx, idx+n);
+done:
+    atomic_fetch_sub(&ctx->pins, RESHARDING);
+    return atomic_load(&ctx->nshards) != target;
+}
+
+/// Changes the hashmap load factor, in percent. Each shard starts using the
+/// new load factor the next time that it's resized.
+void pogocache_set_loadfactor(struct pogocache *cache, int loadfactor) {
+    cache = rootcache(cache);
+    atomic_store_explicit(&cache->ctx.loadfactor, clamp_loadfactor(loadfactor),
+        __ATOMIC_RELAXED);
+}
+
+/// Changes the entry count, in percent of a shard's buckets, at which the
+/// shard's hashmap is shrunk. Like the load factor, each shard starts using
+/// it the next time that it's resized. The default is 10.
+void pogocache_set_shrinkat(struct pogocache *cache, int percent) {
+    cache = rootcache(cache);
+    percent = percent < 1 ? 1 : percent > 25 ? 25 : percent;
+    atomic_store_explicit(&cache->ctx.shrinkat, percent, __ATOMIC_RELAXED);
+}
+
+/// Changes the number of entries evicted for each new entry that's stored
+/// while in low memory mode. The default is 1.
+void pogocache_set_evictbatch(struct pogocache *cache, int n) {
+    cache = rootcache(cache);
+    n = n < 1 ? 1 : n > 64 ? 64 : n;
+    atomic_store_explicit(&cache->ctx.evictbatch, n, __ATOMIC_RELAXED);
+}
+
+/// Returns counters of events that have occurred since the cache was made.
+void pogocache_counters(struct pogocache *cache,
+    struct pogocache_counters *counters)
+{
+    cache = rootcache(cache);
+    struct pgctx *ctx = &cache->ctx;
+    memset(counters, 0, sizeof(struct pogocache_counters));
+    counters->lockwaits = atomic_load_explicit(&ctx->lockwaits,
+        __ATOMIC_RELAXED);
+    counters->evictions = atomic_load_explicit(&ctx->evictions,
+        __ATOMIC_RELAXED);
+    counters->grows = atomic_load_explicit(&ctx->grows, __ATOMIC_RELAXED);
+    counters->shrinks = atomic_load_explicit(&ctx->shrinks, __ATOMIC_RELAXED);
+    for (int i = 0; i < HOTSTRIPES; i++) {
+        counters->hotreads += atomic_load_explicit(&ctx->hotstats[i].reads,
+            __ATOMIC_RELAXED);
+        counters->hotpromotions += atomic_load_explicit(
+            &ctx->hotstats[i].promotions, __ATOMIC_RELAXED);
+    }
+}
+
+/// Returns the index of the shard that key belongs to.
+int pogocache_shard(struct pogocache *cache, const void *key, size_t keylen) {
+    cache = rootcache(cache);
+    return shard_index(cache, th64(key, keylen, cache->ctx.seed));
+}
+
+/// Prefetch the memory that an operation on key is about to touch.
+/// When cache is a batch that already holds the lock for the shard of key,
+/// the first hashmap bucket for key is prefetched too. Otherwise only the
+/// shard header is.
+void pogocache_prefetch(struct pogocache *cache, const void *key, 
+    size_t keylen)
+{
+    struct pogocache *root = rootcache(cache);
+    uint64_t fhash = th64(key, keylen, root->ctx.seed);
+    struct shard *shard = shard_get(root, shard_index(root, fhash));
+    if (cache->isbatch && atomic_load_explicit(&shard->lock, 
+        __ATOMIC_RELAXED) == (uintptr_t)(void*)&cache->batch)
+    {
+        size_t i = clip_hash(fhash) & shard->map.mask;
+        __builtin_prefetch(&shard->map.buckets[i]);
+    } else {
+        __builtin_prefetch(shard);
+    }
 }
 
 static int iterop(struct shard *shard, int shardidx, int64_t now,
@@ -1672,7 +2253,7 @@ static int iterop(struct shard *shard, int shardidx, int64_t now,
             }
             shard->clearcount -= (reason==POGOCACHE_REASON_CLEARED);
             // Delete entry at bucket.
-            delbkt(&shard->map, i);
+            delentry_at_bkt(&shard->map, i, ctx);
             entry_free(entry, ctx);
             i--;
 #endif
@@ -1686,7 +2267,7 @@ static int iterop(struct shard *shard, int shardidx, int64_t now,
             if (action != POGOCACHE_ITER_CONTINUE) {
                 if (action&POGOCACHE_ITER_DELETE) {
                     // Delete entry at bucket
-                    delbkt(&shard->map, i);
+                    delentry_at_bkt(&shard->map, i, ctx);
                     entry_free(entry, ctx);
                     i--;
                 }
@@ -1720,15 +2301,16 @@ int pogocache_iter(struct pogocache *cache, struct pogocache_iter_opts *opts) {
             iterop(shard, opts->oneshardidx, now, opts, &cache->ctx)
         );
     }
-    for (int i = 0; i < nshards; i++) {
-        int status = ACQUIRE_FOR_SCAN_AND_EXECUTE(int, i,
+    pogocache_pin(cache);
+    nshards = pogocache_nshards(cache);
+    int status = POGOCACHE_FINISHED;
+    for (int i = 0; i < nshards && status == POGOCACHE_FINISHED; i++) {
+        status = ACQUIRE_FOR_SCAN_AND_EXECUTE(int, i,
             iterop(shard, i, now, opts, &cache->ctx)
         );
-        if (status != POGOCACHE_FINISHED) {
-            return status;
-        }
     }
-    return POGOCACHE_FINISHED;
+    pogocache_unpin(cache);
+    return status;
 }
 
 static size_t countop(struct shard *shard) {
@@ -1751,11 +2333,14 @@ size_t pogocache_count(struct pogocache *cache,
         );
     }
     size_t count = 0;
+    pogocache_pin(cache);
+    nshards = pogocache_nshards(cache);
     for (int i = 0; i < nshards; i++) {
         count += ACQUIRE_FOR_SCAN_AND_EXECUTE(size_t, i,
             countop(shard);
         );
     }
+    pogocache_unpin(cache);
     return count;
 }
 
@@ -1780,11 +2365,14 @@ uint64_t pogocache_total(struct pogocache *cache,
         );
     }
     uint64_t count = 0;
+    pogocache_pin(cache);
+    nshards = pogocache_nshards(cache);
     for (int i = 0; i < nshards; i++) {
         count += ACQUIRE_FOR_SCAN_AND_EXECUTE(uint64_t, i,
             totalop(shard);
         );
     }
+    pogocache_unpin(cache);
     return count;
 }
 
@@ -1798,15 +2386,46 @@ static size_t sizeop(struct shard *shard, bool entriesonly) {
     return size;
 }
 
+// Like sizeop, for a shard that isn't locked. Each field is read whole, but
+// they may be from different moments, and an entry being moved to another
+// shard by a reshard may be counted twice or not at all.
+static size_t sizeop_nolock(struct shard *shard, bool entriesonly) {
+    size_t size = 0;
+    if (!entriesonly) {
+        size += sizeof(struct shard);
+        size += sizeof(struct bucket)*
+            __atomic_load_n(&shard->map.nbuckets, __ATOMIC_RELAXED);
+    }
+    size += __atomic_load_n(&shard->map.entsize, __ATOMIC_RELAXED);
+    return size;
+}
+
 /// Returns the total memory size of the shard.
 /// This includes the memory size of all data structures and entries.
 /// Use the entriesonly option to limit the result to only the entries.
 /// There's an option to allow for isolating the operation to a single shard.
+/// With the nolock option the shards are read while they may be changing,
+/// which suits callers that poll the size often.
 size_t pogocache_size(struct pogocache *cache,
     struct pogocache_size_opts *opts)
 {
     int nshards = pogocache_nshards(cache);
     opts = opts ? opts : &defsizeopts;
+    if (opts->nolock) {
+        cache = rootcache(cache);
+        if (opts->oneshard) {
+            if (opts->oneshardidx < 0 || opts->oneshardidx >= nshards) {
+                return 0;
+            }
+            return sizeop_nolock(&cache->shards[opts->oneshardidx],
+                opts->entriesonly);
+        }
+        size_t size = 0;
+        for (int i = 0; i < nshards; i++) {
+            size += sizeop_nolock(&cache->shards[i], opts->entriesonly);
+        }
+        return size;
+    }
     if (opts->oneshard) {
         if (opts->oneshardidx < 0 || opts->oneshardidx >= nshards) {
             return 0;
@@ -1816,14 +2435,90 @@ size_t pogocache_size(struct pogocache *cache,
         );
     }
     size_t count = 0;
+    pogocache_pin(cache);
+    nshards = pogocache_nshards(cache);
     for (int i = 0; i < nshards; i++) {
         count += ACQUIRE_FOR_SCAN_AND_EXECUTE(size_t, i,
             sizeop(shard, opts->entriesonly);
         );
     }
+    pogocache_unpin(cache);
     return count;
 }
 
+static int histidx(size_t len) {
+    int i = 0;
+    while (len > 0 && i < POGOCACHE_NHIST-1) {
+        len >>= 1;
+        i++;
+    }
+    return i;
+}
+
+static int statsop(struct shard *shard, struct pogocache_stats *stats,
+    struct pgctx *ctx)
+{
+    char buf[128];
+    stats->nshards++;
+    stats->count += shard->map.count;
+    stats->nbuckets += shard->map.nbuckets;
+    stats->entsize += shard->map.entsize;
+    stats->mapsize += sizeof(struct shard);
+    stats->mapsize += sizeof(struct bucket)*shard->map.nbuckets;
+    if (ctx->malloc_size) {
+        stats->mapusable += ctx->malloc_size(shard->map.buckets);
+    }
+    for (int i = 0; i < shard->map.nbuckets; i++) {
+        struct bucket *bkt = &shard->map.buckets[i];
+        int dib = get_dib(bkt);
+        if (dib == 0) {
+            continue;
+        }
+        stats->maxdib = dib > stats->maxdib ? dib : stats->maxdib;
+        stats->dibsum += dib;
+        struct entry *entry = get_entry(bkt);
+        const char *key, *val;
+        size_t keylen, vallen;
+        entry_extract(entry, &key, &keylen, buf, &val, &vallen, 0, 0, 0, ctx);
+        stats->keyhist[histidx(keylen)]++;
+        stats->valhist[histidx(vallen)]++;
+        if (ctx->malloc_size) {
+            stats->entusable += ctx->malloc_size(entry);
+        }
+    }
+    return 0;
+}
+
+/// Collects structural statistics of the cache, such as the hashmap load,
+/// probe lengths, key and value length histograms, and allocator overhead.
+/// The allocator usable sizes are only collected when the malloc_size option
+/// was provided to pogocache_new.
+/// Each shard is locked while it's scanned, one at a time.
+/// There's an option to allow for isolating the operation to a single shard.
+void pogocache_stats(struct pogocache *cache, struct pogocache_stats *stats,
+    struct pogocache_stats_opts *opts)
+{
+    int nshards = pogocache_nshards(cache);
+    opts = opts ? opts : &defstatsopts;
+    memset(stats, 0, sizeof(struct pogocache_stats));
+    if (opts->oneshard) {
+        if (opts->oneshardidx < 0 || opts->oneshardidx >= nshards) {
+            return;
+        }
+        ACQUIRE_FOR_SCAN_AND_EXECUTE(int, opts->oneshardidx,
+            statsop(shard, stats, ctx);
+        );
+        return;
+    }
+    pogocache_pin(cache);
+    nshards = pogocache_nshards(cache);
+    for (int i = 0; i < nshards; i++) {
+        ACQUIRE_FOR_SCAN_AND_EXECUTE(int, i,
+            statsop(shard, stats, ctx);
+        );
+    }
+    pogocache_unpin(cache);
+}
 
 
 static int sweepop(struct shard *shard, int shardidx, int64_t now,
@@ -1858,7 +2553,7 @@ static int sweepop(struct shard *shard, int shardidx, int64_t now,
                 expires, flags, cas, ctx->udata);
         }
         shard->clearcount -= (reason==POGOCACHE_REASON_CLEARED);
-        delbkt(&shard->map, i);
+        delentry_at_bkt(&shard->map, i, ctx);
         entry_free(entry, ctx);
         (*swept)++;
         // Entry was deleted from bucket, which may move entries to the right
@@ -1891,6 +2586,8 @@ void pogocache_sweep(struct pogocache *cache, size_t *swept, size_t *kept,
             );
         }
     } else {
+        pogocache_pin(cache);
+        nshards = pogocache_nshards(cache);
         for (int i = 0; i < nshards; i++) {
             size_t sweptc2 = 0;
             size_t keptc2 = 0;
@@ -1900,6 +2597,7 @@ void pogocache_sweep(struct pogocache *cache, size_t *swept, size_t *kept,
             sweptc += sweptc2;
             keptc += keptc2;
         }
+        pogocache_unpin(cache);
     }
     if (swept) {
         *swept = sweptc;
@@ -1912,8 +2610,11 @@ void pogocache_sweep(struct pogocache *cache, size_t *swept, size_t *kept,
 static int clearop(struct shard *shard, int shardidx, int64_t now, 
     struct pgctx *ctx)
 {
-    (void)shardidx, (void)ctx;
+    (void)shardidx;
     shard->cleartime = now;
+    if (ctx->versions) {
+        atomic_fetch_add_explicit(&ctx->hotepoch, 1, __ATOMIC_RELEASE);
+    }
     shard->clearcount += (shard->map.count-shard->clearcount);
     return 0;
 }
@@ -1934,11 +2635,14 @@ void pogocache_clear(struct pogocache *cache, struct pogocache_clear_opts *opts)
         );
         return;
     }
-    for (int i = 0; i < cache->ctx.nshards; i++) {
+    pogocache_pin(cache);
+    nshards = pogocache_nshards(cache);
+    for (int i = 0; i < nshards; i++) {
         ACQUIRE_FOR_SCAN_AND_EXECUTE(int, i,
             clearop(shard, i, now, &cache->ctx);
         );
     }
+    pogocache_unpin(cache);
 }
 
 static int sweeppollop(struct shard *shard, int shardidx, int64_t now, 
@@ -1981,3 +2685,85 @@ double pogocache_sweep_poll(struct pogocache *cache,
     );
     return percent;
 }
+
+static int evictop(struct shard *shard, int shardidx, int64_t now, int count,
+    size_t *evicted, size_t *freed, struct pgctx *ctx)
+{
+    for (int i = 0; i < count && shard->map.count > 0; i++) {
+        // Each pick starts at a random bucket.
+        uint32_t hash = mix13(now+(uint64_t)shardidx*count+i);
+        size_t size = auto_evict_entry(shard, shardidx, hash, now, ctx);
+        if (size == 0) {
+            break;
+        }
+        (*evicted)++;
+        (*freed) += size;
+    }
+    return 0;
+}
+
+/// Evicts a batch of entries from one shard, picking each the same way as
+/// a store does in low memory mode. Expired entries found along the way are
+/// removed first.
+void pogocache_evict(struct pogocache *cache, size_t *evicted, size_t *freed,
+    struct pogocache_evict_opts *opts)
+{
+    int nshards = pogocache_nshards(cache);
+    opts = opts ? opts : &defevictopts;
+    int64_t now = opts->time > 0 ? opts->time : getnow();
+    int count = opts->count == 0 ? 1 : opts->count;
+    size_t evictedc = 0;
+    size_t freedc = 0;
+    if (opts->shardidx >= 0 && opts->shardidx < nshards) {
+        ACQUIRE_FOR_SCAN_AND_EXECUTE(int, opts->shardidx,
+            evictop(shard, opts->shardidx, now, count, &evictedc, &freedc,
+                &cache->ctx);
+        );
+    }
+    if (evicted) {
+        *evicted = evictedc;
+    }
+    if (freed) {
+        *freed = freedc;
+    }
+}
+
+static int defragop(struct shard *shard, int cursor, int count,
+    struct pogocache_defrag_opts *opts, struct pgctx *ctx)
+{
+    struct map *map = &shard->map;
+    int end = cursor+count < map->nbuckets ? cursor+count : map->nbuckets;
+    for (int i = cursor; i < end; i++) {
+        struct bucket *bkt = &map->buckets[i];
+        if (get_dib(bkt) == 0) {
+            continue;
+        }
+        struct entry *entry = get_entry(bkt);
+        size_t size = entry_memsize(entry, ctx);
+        void *mem = opts->relocate(entry, size, opts->udata);
+        if (mem) {
+            memcpy(mem, entry, size);
+            set_entry(bkt, mem);
+            entry_free(entry, ctx);
+        }
+    }
+    return end < map->nbuckets ? end : 0;
+}
+
+/// Steps through the entries of one shard, offering each to the relocate
+/// callback, which may return new memory for the entry to be moved to.
+/// Returns the cursor for the next step, or zero when the shard is done.
+/// A shard that resizes between steps may have entries visited twice or
+/// not at all.
+int pogocache_defrag(struct pogocache *cache,
+    struct pogocache_defrag_opts *opts)
+{
+    int nshards = pogocache_nshards(cache);
+    if (opts->shardidx < 0 || opts->shardidx >= nshards || opts->cursor < 0) {
+        return 0;
+    }
+    int count = opts->count == 0 ? 256 : opts->count;
+    return ACQUIRE_FOR_SCAN_AND_EXECUTE(int, opts->shardidx,
+        defragop(shard, opts->cursor, count, opts, &cache->ctx);
+    );
+}
@@ -45,6 +45,7 @@
 struct pogocache_opts {
     void *(*malloc)(size_t);      // use a custom malloc function
     void (*free)(void*);          // use a custom free function
+    size_t (*malloc_size)(void*); // usable size of an allocation (optional)
     void (*yield)(void *udata);   // contention yielder (default: no yielding)
     // The 'evicted' callback is called for every entry has been evicted due
     // to expiration, low memory, or when the cache is cleared. Check the 
@@ -59,7 +60,9 @@ struct pogocache_opts {
     bool noevict;        // disable all eviction
     bool allowshrink;    // allow hashmap shrinking
     bool usethreadbatch; // use a thread local batch (non-reentrant)
+    bool hotkeys;        // serve hot keys from per-thread copies
     int nshards;         // default 65536
+    int maxshards;       // most shards for pogocache_reshard (default: nshards)
     int loadfactor;      // default 75%
     uint64_t seed;       // custom hash seed, default zero
 };
@@ -70,11 +73,12 @@ struct pogocache_store_opts {
     int64_t ttl;     // time-to-live, nanoseconds, default: no expiration
     uint64_t cas;    // CAS value (default: auto selected)
     uint32_t flags;  // 
-    bool keepttl;    // 
+    bool keepttl;    // keep the ttl of a live entry, else use expires/ttl
     bool casop;      // perform the CAS operation (default: no)
     bool nx;         // 
     bool xx;         // 
     bool lowmem;     // tells the operation that the system is low on memory
+    bool noevict;    // when low on memory, fail rather than evict (see opts)
     // The 'entry' callback returns the value of the old entry about to be
     // replaced by the new entry. This give the caller a chance to take a peek
     // at the entry before it gets replaced. Return true to store the new entry
@@ -92,9 +96,26 @@ struct pogocache_update {
     int64_t expires;
 };
 
+// How an entry is stored. See pogocache_load_opts.info.
+struct pogocache_entry_info {
+    int64_t idle;       // time since the last access, nanoseconds
+    size_t memsize;     // size of the entry allocation
+    size_t usable;      // allocator usable size, needs the malloc_size option
+    size_t bucketsize;  // the entry's share of its shard's bucket array
+    size_t rawkeylen;   // length of the key as stored
+    bool sixpacked;     // the key is stored with sixpack compression
+    int dib;            // number of buckets probed to find the entry
+};
+
 struct pogocache_load_opts {
     int64_t time;       // current time (default: use internal monotonic clock)
     bool notouch;       // do not update lru
+    // The 'entry' callback never asks for an update. This allows hot keys to
+    // be served from a thread's own copy, see pogocache_opts.hotkeys.
+    bool readonly;
+    // When not null, 'info' is filled with storage details about the entry
+    // before it's touched and before the 'entry' callback is called.
+    struct pogocache_entry_info *info;
     // The 'entry' callback return the value of the entry. This is required to
     // retreive the value of the current entry.
     void (*entry)(int shard, int64_t time, const void *key, size_t keylen,
@@ -148,6 +169,44 @@ struct pogocache_size_opts {
     bool oneshard;      // only count one shard (default: all shards)
     int oneshardidx;    // index of one shard count, if oneshard is true.
     bool entriesonly;   // do not include the structure size.
+    bool nolock;        // read without the locks, the size is approximate
+};
+
+struct pogocache_stats_opts {
+    bool oneshard;      // only include one shard (default: all shards)
+    int oneshardidx;    // index of one shard, if oneshard is true.
+};
+
+// Entry lengths are bucketed by powers of two. Bucket zero holds empty
+// lengths and bucket i holds lengths from 2^(i-1) to 2^i-1. The last bucket
+// holds everything larger.
+#define POGOCACHE_NHIST 32
+
+// Structural statistics for one shard, or the sum of many shards.
+// The dib is the distance of an entry from its ideal bucket, plus one. It's
+// the number of buckets a lookup of that entry has to probe.
+struct pogocache_stats {
+    size_t nshards;     // number of shards included
+    size_t count;       // number of entries, including expired ones
+    size_t nbuckets;    // number of hashmap buckets
+    int maxdib;         // longest probe length
+    uint64_t dibsum;    // sum of all probe lengths, for the average
+    size_t entsize;     // logical memory size of all entries
+    size_t entusable;   // allocator usable size of all entries
+    size_t mapsize;     // memory size of the shard and bucket structures
+    size_t mapusable;   // allocator usable size of the bucket arrays
+    size_t keyhist[POGOCACHE_NHIST]; // key length histogram
+    size_t valhist[POGOCACHE_NHIST]; // value length histogram
+};
+
+// Running counters for the whole cache.
+struct pogocache_counters {
+    uint64_t lockwaits; // shard locks that were contended
+    uint64_t evictions; // entries evicted in low memory mode
+    uint64_t grows;     // shard hashmaps that were grown
+    uint64_t shrinks;   // shard hashmaps that were shrunk
+    uint64_t hotreads;  // loads served from hot key copies
+    uint64_t hotpromotions; // keys copied after turning hot
 };
 
 struct pogocache_sweep_opts {
@@ -167,6 +226,23 @@ struct pogocache_sweep_poll_opts {
     int pollsize;  // number of entries to poll (default: 20)
 };
 
+struct pogocache_evict_opts {
+    int64_t time;  // current time (default: use internal monotonic clock)
+    int count;     // number of entries to evict (default: 1)
+    int shardidx;  // index of the shard to evict from
+};
+
+struct pogocache_defrag_opts {
+    int shardidx;  // index of the shard to step through
+    int cursor;    // bucket to start at, zero for the first step
+    int count;     // number of buckets to visit (default: 256)
+    // Called for every entry, under the shard lock. Returns memory of at least
+    // 'size' bytes, from the same allocator as the cache, for the entry to
+    // move to. Or returns NULL to leave the entry where it is.
+    void *(*relocate)(const void *ptr, size_t size, void *udata);
+    void *udata;
+};
+
 struct pogocache;
 
 // initialize/destroy
@@ -193,6 +269,10 @@ void pogocache_clear(struct pogocache *cache,
     struct pogocache_clear_opts *opts);
 double pogocache_sweep_poll(struct pogocache *cache,
     struct pogocache_sweep_poll_opts *opts);
+void pogocache_evict(struct pogocache *cache, size_t *evicted, size_t *freed,
+    struct pogocache_evict_opts *opts);
+int pogocache_defrag(struct pogocache *cache,
+    struct pogocache_defrag_opts *opts);
 
 // stat operations
 size_t pogocache_count(struct pogocache *cache,
@@ -201,9 +281,24 @@ uint64_t pogocache_total(struct pogocache *cache,
     struct pogocache_total_opts *opts);
 size_t pogocache_size(struct pogocache *cache,
     struct pogocache_size_opts *opts);
+void pogocache_stats(struct pogocache *cache, struct pogocache_stats *stats,
+    struct pogocache_stats_opts *opts);
+void pogocache_counters(struct pogocache *cache,
+    struct pogocache_counters *counters);
 
 // utilities
 int pogocache_nshards(struct pogocache *cache);
+bool pogocache_reshard(struct pogocache *cache, int nshards);
+bool pogocache_reshard_step(struct pogocache *cache);
+int pogocache_reshard_target(struct pogocache *cache);
+void pogocache_pin(struct pogocache *cache);
+void pogocache_unpin(struct pogocache *cache);
+void pogocache_set_loadfactor(struct pogocache *cache, int loadfactor);
+void pogocache_set_shrinkat(struct pogocache *cache, int percent);
+void pogocache_set_evictbatch(struct pogocache *cache, int n);
+int pogocache_shard(struct pogocache *cache, const void *key, size_t keylen);
+void pogocache_prefetch(struct pogocache *cache, const void *key, 
+    size_t keylen);
 int64_t pogocache_now(void);
 
 #endif
@@ -30,7 +30,6 @@
 #define BYTEAOID    17
 
 extern const char *version;
-extern const char *auth;
 
 #ifdef PGDEBUG
 #define dprintf printf
@@ -1053,7 +1052,7 @@ static size_t parsep(const char *data, size_t len, struct args *args,
     parse_begin();
     const char *password = parse_cstr();
     parse_end();
-    if (strcmp(password, auth) != 0) {
+    if (strcmp(password, parse_auth) != 0) {
         parse_seterror(
             "WRONGPASS invalid username-password pair or user is disabled.");
         return -1;
@@ -1474,7 +1473,7 @@ bool pg_respond(struct conn *conn, struct pg *pg) {
         return true;
     }
     if (pg->startup == 1) {
-        if (auth && *auth) {
+        if (*conn_password(conn)) {
             pg_write_auth(conn, 3); // AuthenticationCleartextPassword;
         } else {
             write_auth_ok(conn, pg);
@@ -0,0 +1,46 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Statically defined tracepoints (USDT) under the 'pogocache' provider.
+// Each probe compiles to a single nop until a tracer such as bpftrace or
+// perf attaches to it. Without <sys/sdt.h>, or when built with NOUSDT=1,
+// the probes compile to nothing and their arguments are not evaluated.
+//
+//   bpftrace -l 'usdt:./pogocache:pogocache:*'
+//
+// The engine, pogocache.c, defines the same macros for itself so it stays
+// a standalone file.
+#ifndef PROBES_H
+#define PROBES_H
+
+#if !defined(NOUSDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define USDT
+#endif
+#endif
+
+#ifdef USDT
+#define PROBE0(name) DTRACE_PROBE(pogocache, name)
+#define PROBE1(name, a) DTRACE_PROBE1(pogocache, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(pogocache, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(pogocache, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(pogocache, name, a, b, c, d)
+#else
+#define PROBE0(name) ((void)0)
+#define PROBE1(name, a) ((void)sizeof(a))
+#define PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+#define PROBE3(name, a, b, c) ((void)sizeof(a), (void)sizeof(b), \
+    (void)sizeof(c))
+#define PROBE4(name, a, b, c, d) ((void)sizeof(a), (void)sizeof(b), \
+    (void)sizeof(c), (void)sizeof(d))
+#endif
+
+#endif
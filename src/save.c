@@ -29,12 +29,13 @@
 #include "lz4.h"
 #include "sys.h"
 #include "xmalloc.h"
+#include "probes.h"
 
 #define BLOCKSIZE 1048576
 #define COMPRESS
 
 extern struct pogocache *cache;
-extern const int verb;
+extern atomic_int verb;
 
 struct savectx {
     pthread_t th;          // work thread
@@ -78,6 +79,7 @@ static int flush(struct savectx *ctx) {
     uint8_t *p = (uint8_t*)ctx->dst.data;
     uint8_t *end = p + len+16;
     bool ok = true;
+    PROBE2(save__write__start, ctx->buf.len, len);
     pthread_mutex_lock(ctx->lock);
     while (p < end) {
         ssize_t n = write(ctx->fd, p, end-p);
@@ -88,6 +90,7 @@ static int flush(struct savectx *ctx) {
         p += n;
     }
     pthread_mutex_unlock(ctx->lock);
+    PROBE2(save__write__done, len, ok);
     ctx->buf.len = 0;
     ctx->nentries = 0;
     return ok ? 0 : -1;
@@ -146,7 +149,7 @@ done:
     return 0;
 }
 
-int save(const char *path, bool fast) {
+int save(const char *path, int nthreads) {
     uint64_t seed = sys_seed();
     size_t psize = strlen(path)+32;
     char *workpath = xmalloc(psize);
@@ -159,14 +162,13 @@ int save(const char *path, bool fast) {
     if (fd == -1) {
         return -1;
     }
+    // Keep the shards from being split while they're saved in ranges.
+    pogocache_pin(cache);
     int nshards = pogocache_nshards(cache);
-    int nprocs = sys_nprocs();
+    int nprocs = nthreads > 0 ? nthreads : sys_nprocs();
     if (nprocs > nshards) {
         nprocs = nshards;
     }
-    if (!fast) {
-        nprocs = 1;
-    }
     pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
     struct savectx *ctxs = xmalloc(nprocs*sizeof(struct savectx));
     memset(ctxs, 0, nprocs*sizeof(struct savectx));
@@ -189,7 +191,7 @@ int save(const char *path, bool fast) {
         }
         start += ctx->count;
     }
-    // execute operations on failed threads (or fast=false)
+    // execute operations on failed threads (or a single thread)
     for (int i = 0; i < nprocs; i++) {
         struct savectx *ctx = &ctxs[i];
         if (ctx->th == 0) {
@@ -203,6 +205,7 @@ int save(const char *path, bool fast) {
             pthread_join(ctx->th, 0);
         }
     }
+    pogocache_unpin(cache);
     // check for any failures
     for (int i = 0; i < nprocs; i++) {
         struct savectx *ctx = &ctxs[i];
@@ -409,7 +412,7 @@ static void *thload(void *arg) {
 }
 
 // load data into cache from path
-int load(const char *path, bool fast, struct load_stats *stats) {
+int load(const char *path, int nthreads, struct load_stats *stats) {
     // Use a single stream reader. Handing off blocks to threads.
     struct load_stats sstats;
     if (!stats) {
@@ -427,7 +430,7 @@ int load(const char *path, bool fast, struct load_stats *stats) {
     bool donereading = false;
     bool failure = false;
 
-    int nprocs = fast ?  sys_nprocs() : 1;
+    int nprocs = nthreads > 0 ? nthreads : sys_nprocs();
     struct loadctx *ctxs = xmalloc(nprocs*sizeof(struct loadctx));
     memset(ctxs, 0, nprocs*sizeof(struct loadctx));
     int nblocks = 0;
@@ -465,6 +468,7 @@ int load(const char *path, bool fast, struct load_stats *stats) {
     struct buf cdata = { 0 };
     bool shortread = false;
     while (ok) {
+        PROBE0(load__read__start);
         uint8_t head[16];
         ssize_t size = read(fd, head, 16);
         if (size <= 0) {
@@ -507,6 +511,7 @@ int load(const char *path, bool fast, struct load_stats *stats) {
             break;
         }
         cdata.len = clen;
+        PROBE2(load__read__done, dlen, clen);
         stats->csize += clen;
         stats->dsize += dlen;
         uint32_t crc2 = crc32(cdata.data, clen);
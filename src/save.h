@@ -19,8 +19,10 @@ struct load_stats {
     size_t dsize;     // decompressed size
 };
 
-int save(const char *path, bool fast);
-int load(const char *path, bool fast, struct load_stats *stats);
+// The save and load operations use 'nthreads' threads, or one per processor
+// when zero.
+int save(const char *path, int nthreads);
+int load(const char *path, int nthreads, struct load_stats *stats);
 bool cleanwork(const char *path);
 
 #endif
@@ -0,0 +1,205 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Unit shm.c provides the server side of the shared-memory transport.
+// A client connects to the shmsock unix socket and receives a memfd holding
+// the request and response rings (see shmring.h). From then on the socket
+// only carries doorbell bytes, and tells the server when the client is gone.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include "shm.h"
+#include "xmalloc.h"
+
+#ifndef __linux__
+
+bool shm_supported(void) {
+    return false;
+}
+bool shm_accept(int fd, struct shm **shm_out) {
+    (void)fd;
+    *shm_out = 0;
+    return false;
+}
+int shm_close(struct shm *shm, int fd) {
+    (void)shm;
+    return close(fd);
+}
+ssize_t shm_read(struct shm *shm, int fd, void *data, size_t len) {
+    (void)shm;
+    return read(fd, data, len);
+}
+ssize_t shm_write(struct shm *shm, int fd, const void *data, size_t len) {
+    (void)shm;
+    return write(fd, data, len);
+}
+bool shm_pending(struct shm *shm) {
+    (void)shm;
+    return false;
+}
+#else
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shmring.h"
+
+struct shm {
+    struct shmhdr *hdr;
+};
+
+bool shm_supported(void) {
+    return true;
+}
+
+static int memfd(const char *name) {
+    return syscall(SYS_memfd_create, name, 1U /* MFD_CLOEXEC */);
+}
+
+static void futex_wake(atomic_uint *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, 1, 0, 0, 0);
+}
+
+// Create the rings for a new connection and pass them to the client.
+bool shm_accept(int fd, struct shm **shm_out) {
+    *shm_out = 0;
+    int mfd = memfd("pogocache-shm");
+    if (mfd == -1) {
+        return false;
+    }
+    if (ftruncate(mfd, sizeof(struct shmhdr)) == -1) {
+        close(mfd);
+        return false;
+    }
+    struct shmhdr *hdr = mmap(0, sizeof(struct shmhdr),
+        PROT_READ|PROT_WRITE, MAP_SHARED, mfd, 0);
+    if (hdr == MAP_FAILED) {
+        close(mfd);
+        return false;
+    }
+    hdr->magic = SHM_MAGIC;
+    hdr->version = SHM_VERSION;
+    hdr->ringsize = SHM_RINGSIZE;
+    // The server starts out waiting for the first request.
+    atomic_store(&hdr->req.waiting, 1);
+    char byte = 'P';
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } cbuf;
+    memset(&cbuf, 0, sizeof(cbuf));
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = cbuf.buf,
+        .msg_controllen = sizeof(cbuf.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &mfd, sizeof(int));
+    ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    close(mfd);
+    if (n != 1) {
+        munmap(hdr, sizeof(struct shmhdr));
+        return false;
+    }
+    struct shm *shm = xmalloc(sizeof(struct shm));
+    shm->hdr = hdr;
+    *shm_out = shm;
+    return true;
+}
+
+int shm_close(struct shm *shm, int fd) {
+    if (shm) {
+        munmap(shm->hdr, sizeof(struct shmhdr));
+        xfree(shm);
+    }
+    return close(fd);
+}
+
+// Read requests from the ring. Returns -1 and EAGAIN when there's nothing
+// to read, zero when the client has closed the socket, and -1 and EPROTO
+// when the client broke the ring.
+ssize_t shm_read(struct shm *shm, int fd, void *data, size_t len) {
+    struct shmring *ring = &shm->hdr->req;
+    size_t n = shmring_read(ring, data, len);
+    if (n == SHMRING_BROKEN) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (shmring_len(ring) > 0) {
+        // More is waiting. The caller should check shm_pending.
+        return n;
+    }
+    // The ring is empty. Consume the doorbells and ask for another one.
+    char bells[64];
+    ssize_t ret;
+    while ((ret = read(fd, bells, sizeof(bells))) > 0) { }
+    if (ret == 0 || errno != EAGAIN) {
+        return n > 0 ? (ssize_t)n : ret;
+    }
+    atomic_store(&ring->waiting, 1);
+    atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (n == 0) {
+        // The client may have written just before the flag was set.
+        n = shmring_read(ring, data, len);
+        if (n == SHMRING_BROKEN) {
+            errno = EPROTO;
+            return -1;
+        }
+        if (n == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    return n;
+}
+
+// Write responses to the ring and wake the client if it's sleeping.
+ssize_t shm_write(struct shm *shm, int fd, const void *data, size_t len) {
+    struct shmring *ring = &shm->hdr->resp;
+    size_t n = shmring_write(ring, data, len);
+    if (n == SHMRING_BROKEN) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (n > 0) {
+        atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (atomic_exchange(&ring->waiting, 0)) {
+            atomic_fetch_add(&ring->seq, 1);
+            futex_wake(&ring->seq);
+        }
+        return n;
+    }
+    // The ring is full. Make sure the client is still around to drain it.
+    char byte;
+    ssize_t ret = recv(fd, &byte, 1, MSG_PEEK|MSG_DONTWAIT);
+    if (ret == 0) {
+        errno = EPIPE;
+    } else if (ret == 1 || errno == EAGAIN) {
+        errno = EAGAIN;
+    }
+    return -1;
+}
+
+// Returns true if there are requests that the last read did not consume.
+bool shm_pending(struct shm *shm) {
+    return shmring_len(&shm->hdr->req) > 0;
+}
+
+#endif
@@ -0,0 +1,26 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdbool.h>
+#include <unistd.h>  // For ssize_t
+#include <stddef.h>  // For size_t
+
+struct shm;
+
+bool shm_supported(void);
+bool shm_accept(int fd, struct shm **shm);
+int shm_close(struct shm *shm, int fd);
+ssize_t shm_write(struct shm *shm, int fd, const void *data, size_t len);
+ssize_t shm_read(struct shm *shm, int fd, void *data, size_t len);
+bool shm_pending(struct shm *shm);
+
+#endif
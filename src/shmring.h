@@ -0,0 +1,105 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Header shmring.h describes the memory layout of the shared-memory
+// transport. It's shared by the server and the client library, so it must
+// not depend on anything else in this directory.
+//
+// Each connection maps a single memfd holding one header followed by two
+// single-producer single-consumer byte rings. The client writes requests
+// into 'req' and the server writes responses into 'resp'. The bytes are the
+// same as would be sent over a socket, such as RESP or Memcache commands.
+//
+// Wakeups are suppressed while the consumer is busy. A consumer that finds
+// its ring empty sets 'waiting' and checks the ring once more. A producer
+// that finds 'waiting' set after publishing clears it and rings the
+// doorbell. For requests the doorbell is a byte on the handshake socket,
+// which the server is polling. For responses it's a futex on 'seq'.
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define SHM_MAGIC    0x474f5053  // "SPOG"
+#define SHM_VERSION  1
+#define SHM_RINGSIZE (1<<20)     // bytes per direction, power of two
+#define SHMRING_BROKEN ((size_t)-1)
+
+struct shmring {
+    _Alignas(64) atomic_uint_fast64_t head;  // written by the producer
+    _Alignas(64) atomic_uint_fast64_t tail;  // written by the consumer
+    _Alignas(64) atomic_uint waiting;        // consumer wants a doorbell
+    atomic_uint seq;                         // futex word for doorbells
+    _Alignas(64) uint8_t data[SHM_RINGSIZE];
+};
+
+struct shmhdr {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t ringsize;
+    struct shmring req;   // client to server
+    struct shmring resp;  // server to client
+};
+
+// Returns the number of unread bytes in the ring. The other side can write
+// anything to the counters, so this may be more than the ring holds, which
+// shmring_write and shmring_read report as broken.
+static inline size_t shmring_len(struct shmring *ring) {
+    uint64_t head = atomic_load_explicit(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = atomic_load_explicit(&ring->tail, __ATOMIC_RELAXED);
+    return head-tail;
+}
+
+// Copy up to len bytes into the ring. Returns the number of bytes written,
+// or SHMRING_BROKEN if the counters are out of range. Only the producer may
+// call this.
+static inline size_t shmring_write(struct shmring *ring, const void *data,
+    size_t len)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, __ATOMIC_RELAXED);
+    uint64_t tail = atomic_load_explicit(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head-tail > SHM_RINGSIZE) {
+        return SHMRING_BROKEN;
+    }
+    size_t room = SHM_RINGSIZE-(head-tail);
+    len = len < room ? len : room;
+    size_t off = head&(SHM_RINGSIZE-1);
+    size_t n = SHM_RINGSIZE-off < len ? SHM_RINGSIZE-off : len;
+    memcpy(ring->data+off, data, n);
+    memcpy(ring->data, (const uint8_t*)data+n, len-n);
+    atomic_store_explicit(&ring->head, head+len, __ATOMIC_RELEASE);
+    return len;
+}
+
+// Copy up to len bytes out of the ring. Returns the number of bytes read,
+// or SHMRING_BROKEN if the counters are out of range. Only the consumer may
+// call this.
+static inline size_t shmring_read(struct shmring *ring, void *data,
+    size_t len)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, __ATOMIC_RELAXED);
+    uint64_t head = atomic_load_explicit(&ring->head, __ATOMIC_ACQUIRE);
+    if (head-tail > SHM_RINGSIZE) {
+        return SHMRING_BROKEN;
+    }
+    size_t avail = head-tail;
+    len = len < avail ? len : avail;
+    size_t off = tail&(SHM_RINGSIZE-1);
+    size_t n = SHM_RINGSIZE-off < len ? SHM_RINGSIZE-off : len;
+    memcpy(data, ring->data+off, n);
+    memcpy((uint8_t*)data+n, ring->data, len-n);
+    atomic_store_explicit(&ring->tail, tail+len, __ATOMIC_RELEASE);
+    return len;
+}
+
+#endif
@@ -20,6 +20,7 @@
 #include "tls.h"
 #include "xmalloc.h"
 #include "openssl.h"
+#include "probes.h"
 
 #ifdef NOOPENSSL
 
@@ -52,8 +53,17 @@ static SSL_CTX *ctx;
 
 struct tls {
     SSL *ssl;
+    bool handshaked;
 };
 
+// Fires the handshake probe the first time data moves over the connection.
+static void handshaked(struct tls *tls, int fd) {
+    if (!tls->handshaked) {
+        tls->handshaked = true;
+        PROBE1(tls__handshake__done, fd);
+    }
+}
+
 void tls_init(void) {
     if (!usetls) {
         return;
@@ -94,6 +104,7 @@ bool tls_accept(int fd, struct tls **tls_out) {
     }
     SSL_set_fd(ssl, fd);
     SSL_set_verify(ssl, SSL_VERIFY_PEER, 0);
+    PROBE1(tls__handshake__start, fd);
     int ret = SSL_accept(ssl);
     if (ret <= 0) {
         int err = SSL_get_error(ssl, ret);
@@ -108,6 +119,9 @@ bool tls_accept(int fd, struct tls **tls_out) {
     struct tls *tls = xmalloc(sizeof(struct tls));
     memset(tls, 0, sizeof(struct tls));
     tls->ssl = ssl;
+    if (ret == 1) {
+        handshaked(tls, fd);
+    }
     *tls_out = tls;
     return true;
 }
@@ -130,6 +144,7 @@ ssize_t tls_write(struct tls *tls, int fd, const void *data, size_t len) {
     size_t nbytes;
     int ret = SSL_write_ex(tls->ssl, data, len, &nbytes);
     if (ret == 1) {
+        handshaked(tls, fd);
         return nbytes;
     }
     int err = SSL_get_error(tls->ssl, ret);
@@ -153,6 +168,7 @@ ssize_t tls_read(struct tls *tls, int fd, void *data, size_t len) {
     size_t nbytes;
     int ret = SSL_read_ex(tls->ssl, data, len, &nbytes);
     if (ret == 1) {
+        handshaked(tls, fd);
         return nbytes;
     }
     int err = SSL_get_error(tls->ssl, ret);
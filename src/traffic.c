@@ -0,0 +1,311 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Traffic classes. Every connection belongs to a class, which is "default"
+// unless its listener or a CLIENT SETCLASS command picks another. Classes are
+// given with --classes as "name:setting=value,...;name:...", and can have:
+//
+//   weight      The share of each event loop pass the class gets when
+//               several classes have work. Each thread hands out --classbudget
+//               command arguments per pass, split by weight. A connection
+//               whose class has used its share stops and goes on with the
+//               rest of its requests in the next pass, but only while
+//               another class on the thread had work in this pass or the
+//               last one. A class that's alone gets the whole pass.
+//   rate        Commands per second for the whole class.
+//   clientrate  Commands per second for each connection in the class. It's
+//               --ratelimit for classes that don't set it.
+//   bgwork      Background jobs, such as KEYS and SWEEP, running at once.
+//
+// The rates are token buckets that hold a second's worth of commands.
+// Commands over a rate are refused with an error rather than queued, and
+// so are background jobs over the limit. These are counted as shed.
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "traffic.h"
+#include "sys.h"
+
+#define SECOND 1000000000
+#define TOKEN  1000         // one command in the buckets
+
+struct class {
+    char name[32];
+    int weight;
+    int rate;
+    int clientrate;
+    int bgwork;
+    int quota;              // arguments per pass
+    atomic_int_fast64_t tokens;
+    atomic_int_fast64_t last;
+    atomic_int bgrunning;
+    atomic_size_t conns;
+    atomic_uint_fast64_t deferred;
+    atomic_uint_fast64_t shed;
+    atomic_uint_fast64_t bgshed;
+};
+
+static struct class classes[TRAFFIC_MAXCLASSES];
+static int nclasses = 0;
+static bool fairshare = false;
+
+// Arguments used by each class in the current pass of this thread, and the
+// classes that had work in this pass and the one before.
+static __thread uint64_t curpass = 0;
+static __thread int used[TRAFFIC_MAXCLASSES];
+static __thread uint32_t busy = 0;
+static __thread uint32_t lastbusy = 0;
+
+int traffic_find(const char *name, size_t len) {
+    for (int i = 0; i < nclasses; i++) {
+        if (strlen(classes[i].name) == len &&
+            memcmp(classes[i].name, name, len) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool validname(const char *name, size_t len) {
+    if (len == 0 || len >= sizeof(classes[0].name)) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '_' || c == '-'))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static struct class *addclass(const char *name, size_t len) {
+    int i = traffic_find(name, len);
+    if (i >= 0) {
+        return &classes[i];
+    }
+    if (nclasses == TRAFFIC_MAXCLASSES || !validname(name, len)) {
+        return 0;
+    }
+    struct class *c = &classes[nclasses++];
+    memcpy(c->name, name, len);
+    c->name[len] = '\0';
+    c->weight = 1;
+    c->clientrate = -1;
+    return c;
+}
+
+// Parses "setting=value" into the class.
+static bool setting(struct class *c, const char *opt, size_t len) {
+    const char *eq = memchr(opt, '=', len);
+    if (!eq || eq+1 == opt+len) {
+        return false;
+    }
+    size_t nlen = eq-opt;
+    char *end;
+    long val = strtol(eq+1, &end, 10);
+    if (end != opt+len || val < 0 || val > 1000000000) {
+        return false;
+    }
+    if (nlen == 6 && memcmp(opt, "weight", 6) == 0 && val > 0) {
+        c->weight = val > 1000 ? 1000 : val;
+    } else if (nlen == 4 && memcmp(opt, "rate", 4) == 0) {
+        c->rate = val;
+    } else if (nlen == 10 && memcmp(opt, "clientrate", 10) == 0) {
+        c->clientrate = val;
+    } else if (nlen == 6 && memcmp(opt, "bgwork", 6) == 0) {
+        c->bgwork = val;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Sets up the classes from the --classes option. Returns false, after
+// printing the reason, if the option is invalid.
+bool traffic_init(const char *spec, int budget, int ratelimit) {
+    addclass("default", 7);
+    const char *p = spec;
+    while (*p) {
+        const char *end = strchr(p, ';');
+        end = end ? end : p+strlen(p);
+        const char *colon = memchr(p, ':', end-p);
+        const char *nend = colon ? colon : end;
+        struct class *c = addclass(p, nend-p);
+        if (!c) {
+            fprintf(stderr, "# Invalid traffic class '%.*s'\n",
+                (int)(nend-p), p);
+            return false;
+        }
+        const char *opt = colon ? colon+1 : end;
+        while (opt < end) {
+            const char *oend = memchr(opt, ',', end-opt);
+            oend = oend ? oend : end;
+            if (!setting(c, opt, oend-opt)) {
+                fprintf(stderr, "# Invalid traffic class setting '%.*s'\n",
+                    (int)(oend-opt), opt);
+                return false;
+            }
+            opt = oend < end ? oend+1 : end;
+        }
+        p = *end ? end+1 : end;
+    }
+    int weights = 0;
+    for (int i = 0; i < nclasses; i++) {
+        weights += classes[i].weight;
+    }
+    int64_t now = sys_now();
+    for (int i = 0; i < nclasses; i++) {
+        struct class *c = &classes[i];
+        if (c->clientrate < 0) {
+            c->clientrate = ratelimit > 0 ? ratelimit : 0;
+        }
+        c->quota = (int64_t)budget*c->weight/weights;
+        c->quota = c->quota < 1 ? 1 : c->quota;
+        atomic_init(&c->tokens, (int64_t)c->rate*TOKEN);
+        atomic_init(&c->last, now);
+    }
+    fairshare = nclasses > 1 && budget > 0;
+    return true;
+}
+
+int traffic_nclasses(void) {
+    return nclasses;
+}
+
+const char *traffic_name(int class) {
+    return classes[class].name;
+}
+
+void traffic_join(struct traffic_client *tc, int class) {
+    tc->class = class;
+    tc->tokens = (int64_t)classes[class].clientrate*TOKEN;
+    tc->last = 0;
+    atomic_fetch_add_explicit(&classes[class].conns, 1, __ATOMIC_RELAXED);
+}
+
+void traffic_leave(struct traffic_client *tc) {
+    atomic_fetch_sub_explicit(&classes[tc->class].conns, 1,
+        __ATOMIC_RELAXED);
+}
+
+// Returns false if the class has used its share of this pass while other
+// classes are waiting.
+bool traffic_ready(struct traffic_client *tc, uint64_t pass) {
+    if (!fairshare) {
+        return true;
+    }
+    if (pass != curpass) {
+        lastbusy = pass == curpass+1 ? busy : 0;
+        busy = 0;
+        curpass = pass;
+        memset(used, 0, sizeof(used));
+    }
+    uint32_t self = UINT32_C(1)<<tc->class;
+    busy |= self;
+    return used[tc->class] < classes[tc->class].quota ||
+        ((busy|lastbusy) & ~self) == 0;
+}
+
+// Counts the arguments of a command against the class's share of the pass.
+void traffic_charge(struct traffic_client *tc, size_t cost) {
+    if (fairshare) {
+        used[tc->class] += cost > INT32_MAX ? INT32_MAX : (int)cost;
+    }
+}
+
+void traffic_defer(struct traffic_client *tc) {
+    atomic_fetch_add_explicit(&classes[tc->class].deferred, 1,
+        __ATOMIC_RELAXED);
+}
+
+// Returns the tokens that the bucket gained since 'last'.
+static int64_t gained(int64_t last, int64_t now, int rate) {
+    int64_t elapsed = now-last;
+    elapsed = elapsed > SECOND ? SECOND : elapsed;
+    return elapsed*rate/(SECOND/TOKEN);
+}
+
+static bool take_class(struct class *c, int64_t now) {
+    int64_t last = atomic_load_explicit(&c->last, __ATOMIC_RELAXED);
+    if (now > last && atomic_compare_exchange_strong(&c->last, &last, now)) {
+        int64_t add = gained(last, now, c->rate);
+        int64_t cap = (int64_t)c->rate*TOKEN;
+        int64_t tokens = atomic_fetch_add(&c->tokens, add)+add;
+        if (tokens > cap) {
+            atomic_fetch_sub(&c->tokens, tokens-cap);
+        }
+    }
+    if (atomic_fetch_sub(&c->tokens, TOKEN) < TOKEN) {
+        atomic_fetch_add(&c->tokens, TOKEN);
+        return false;
+    }
+    return true;
+}
+
+static bool take_client(struct traffic_client *tc, int rate, int64_t now) {
+    if (tc->last > 0 && now > tc->last) {
+        tc->tokens += gained(tc->last, now, rate);
+        if (tc->tokens > (int64_t)rate*TOKEN) {
+            tc->tokens = (int64_t)rate*TOKEN;
+        }
+    }
+    tc->last = now;
+    if (tc->tokens < TOKEN) {
+        return false;
+    }
+    tc->tokens -= TOKEN;
+    return true;
+}
+
+// Returns false if the command is over a rate of the client or its class,
+// in which case it's shed.
+bool traffic_admit(struct traffic_client *tc, int64_t now) {
+    struct class *c = &classes[tc->class];
+    if ((c->clientrate > 0 && !take_client(tc, c->clientrate, now)) ||
+        (c->rate > 0 && !take_class(c, now)))
+    {
+        atomic_fetch_add_explicit(&c->shed, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+// Returns false if the class has as many background jobs as it's allowed,
+// otherwise traffic_bgend must be called when the job is done.
+bool traffic_bgbegin(int class) {
+    struct class *c = &classes[class];
+    if (atomic_fetch_add(&c->bgrunning, 1) >= c->bgwork && c->bgwork > 0) {
+        atomic_fetch_sub(&c->bgrunning, 1);
+        atomic_fetch_add_explicit(&c->bgshed, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+void traffic_bgend(int class) {
+    atomic_fetch_sub(&classes[class].bgrunning, 1);
+}
+
+void traffic_stats(int class, struct traffic_stats *stats) {
+    struct class *c = &classes[class];
+    stats->name = c->name;
+    stats->conns = atomic_load_explicit(&c->conns, __ATOMIC_RELAXED);
+    stats->deferred = atomic_load_explicit(&c->deferred, __ATOMIC_RELAXED);
+    stats->shed = atomic_load_explicit(&c->shed, __ATOMIC_RELAXED);
+    stats->bgshed = atomic_load_explicit(&c->bgshed, __ATOMIC_RELAXED);
+    stats->bgrunning = atomic_load(&c->bgrunning);
+}
@@ -0,0 +1,49 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+#ifndef TRAFFIC_H
+#define TRAFFIC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRAFFIC_MAXCLASSES 16
+
+// The traffic state of a connection.
+struct traffic_client {
+    int class;
+    int64_t tokens;         // client bucket, in thousandths of a command
+    int64_t last;           // when the client bucket was last filled
+};
+
+struct traffic_stats {
+    const char *name;
+    size_t conns;           // connections in the class
+    uint64_t deferred;      // connections put off to the next pass
+    uint64_t shed;          // commands refused by the rate limits
+    uint64_t bgshed;        // background jobs refused
+    int bgrunning;          // background jobs running
+};
+
+bool traffic_init(const char *spec, int budget, int ratelimit);
+int traffic_nclasses(void);
+int traffic_find(const char *name, size_t len);
+const char *traffic_name(int class);
+void traffic_join(struct traffic_client *tc, int class);
+void traffic_leave(struct traffic_client *tc);
+bool traffic_ready(struct traffic_client *tc, uint64_t pass);
+void traffic_charge(struct traffic_client *tc, size_t cost);
+void traffic_defer(struct traffic_client *tc);
+bool traffic_admit(struct traffic_client *tc, int64_t now);
+bool traffic_bgbegin(int class);
+void traffic_bgend(int class);
+void traffic_stats(int class, struct traffic_stats *stats);
+
+#endif
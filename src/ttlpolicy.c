@@ -0,0 +1,297 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// TTL policies by key prefix. They're given with --ttlpolicy as
+// "prefix:setting=value,...;prefix:...", where the prefix is everything up
+// to the last colon, and can have:
+//
+//   default     Seconds to live for writes that don't set an expiry.
+//   max         The most seconds to live a write may set.
+//   jitter      Percent of the ttl that may be taken off at random, so keys
+//               written together don't all expire together.
+//
+// A key gets the policy of its longest matching prefix, and an empty prefix
+// matches every key. The prefixes are kept in a radix trie, which is walked
+// once for each write. CONFIG SET builds a new trie and swaps it in.
+//
+// Readers count themselves in one of two slots, picked by the generation.
+// After a swap the generation moves on, so new readers land in the other
+// slot, and the old trie is freed once the slot the previous readers used
+// drains. The wait is bounded by a single lookup.
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ttlpolicy.h"
+#include "util.h"
+#include "sys.h"
+#include "xmalloc.h"
+
+struct policy {
+    int64_t def;        // nanoseconds, or zero
+    int64_t max;        // nanoseconds, or zero
+    int jitter;         // percent
+};
+
+// A trie node is reached by the label on its edge, which is a range of the
+// pool. The children of a node are a list linked through 'next'.
+struct node {
+    size_t label;
+    size_t len;
+    int child;
+    int next;
+    int policy;
+};
+
+struct trie {
+    struct node *nodes;
+    int nnodes;
+    char *pool;
+    size_t poollen;
+    struct policy *policies;
+    int npolicies;
+};
+
+static _Atomic(struct trie *) current = 0;
+static atomic_uint gen = 0;
+static atomic_int readers[2] = { 0 };
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uint_fast64_t defaulted = 0;
+static atomic_uint_fast64_t capped = 0;
+static atomic_uint_fast64_t jittered = 0;
+static __thread uint64_t seed = 0;
+
+static int addnode(struct trie *t, const char *label, size_t len) {
+    t->nodes = xrealloc(t->nodes, (t->nnodes+1)*sizeof(struct node));
+    t->pool = xrealloc(t->pool, t->poollen+len+1);
+    memcpy(t->pool+t->poollen, label, len);
+    t->nodes[t->nnodes] = (struct node){
+        .label = t->poollen, .len = len, .child = -1, .next = -1,
+        .policy = -1,
+    };
+    t->poollen += len;
+    return t->nnodes++;
+}
+
+// Returns the child of the node whose label starts with the byte, or -1.
+static int findchild(struct trie *t, int n, char c) {
+    int i = t->nodes[n].child;
+    while (i >= 0 && t->pool[t->nodes[i].label] != c) {
+        i = t->nodes[i].next;
+    }
+    return i;
+}
+
+static void insert(struct trie *t, const char *prefix, size_t len,
+    int policy)
+{
+    int n = 0;
+    while (len > 0) {
+        int c = findchild(t, n, prefix[0]);
+        if (c < 0) {
+            c = addnode(t, prefix, len);
+            t->nodes[c].next = t->nodes[n].child;
+            t->nodes[n].child = c;
+            n = c;
+            break;
+        }
+        size_t common = 0;
+        while (common < t->nodes[c].len && common < len &&
+            t->pool[t->nodes[c].label+common] == prefix[common])
+        {
+            common++;
+        }
+        if (common < t->nodes[c].len) {
+            // Split the edge, moving the rest of the label and what hangs
+            // off it to a new child.
+            int m = addnode(t, "", 0);
+            t->nodes[m].label = t->nodes[c].label+common;
+            t->nodes[m].len = t->nodes[c].len-common;
+            t->nodes[m].child = t->nodes[c].child;
+            t->nodes[m].policy = t->nodes[c].policy;
+            t->nodes[c].len = common;
+            t->nodes[c].child = m;
+            t->nodes[c].policy = -1;
+        }
+        n = c;
+        prefix += common;
+        len -= common;
+    }
+    t->nodes[n].policy = policy;
+}
+
+// Returns the policy for the longest prefix of the key, or null.
+static struct policy *lookup(struct trie *t, const char *key, size_t keylen) {
+    int n = 0;
+    int policy = t->nodes[0].policy;
+    size_t i = 0;
+    while (i < keylen) {
+        int c = findchild(t, n, key[i]);
+        if (c < 0 || keylen-i < t->nodes[c].len ||
+            memcmp(t->pool+t->nodes[c].label, key+i, t->nodes[c].len) != 0)
+        {
+            break;
+        }
+        i += t->nodes[c].len;
+        n = c;
+        policy = t->nodes[n].policy >= 0 ? t->nodes[n].policy : policy;
+    }
+    return policy >= 0 ? &t->policies[policy] : 0;
+}
+
+static void trie_free(struct trie *t) {
+    xfree(t->nodes);
+    xfree(t->pool);
+    xfree(t->policies);
+    xfree(t);
+}
+
+// Parses "setting=value" into the policy.
+static bool setting(struct policy *p, const char *opt, size_t len) {
+    const char *eq = memchr(opt, '=', len);
+    if (!eq || eq+1 == opt+len) {
+        return false;
+    }
+    size_t nlen = eq-opt;
+    char *end;
+    long long val = strtoll(eq+1, &end, 10);
+    if (end != opt+len || val < 0 || val > INT32_MAX) {
+        return false;
+    }
+    if (nlen == 7 && memcmp(opt, "default", 7) == 0) {
+        p->def = val*SECOND;
+    } else if (nlen == 3 && memcmp(opt, "max", 3) == 0) {
+        p->max = val*SECOND;
+    } else if (nlen == 6 && memcmp(opt, "jitter", 6) == 0 && val <= 100) {
+        p->jitter = val;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Replaces the policies with the ones in the spec. Returns an error message,
+// or null on success.
+const char *ttlpolicy_set(const char *spec) {
+    struct trie *t = xmalloc(sizeof(struct trie));
+    memset(t, 0, sizeof(struct trie));
+    addnode(t, "", 0);
+    const char *p = spec;
+    while (*p) {
+        const char *end = strchr(p, ';');
+        end = end ? end : p+strlen(p);
+        const char *colon = 0;
+        for (const char *c = p; c < end; c++) {
+            colon = *c == ':' ? c : colon;
+        }
+        if (!colon || colon+1 == end) {
+            trie_free(t);
+            return "each policy must be prefix:setting=value";
+        }
+        struct policy policy = { 0 };
+        const char *opt = colon+1;
+        while (opt < end) {
+            const char *oend = memchr(opt, ',', end-opt);
+            oend = oend ? oend : end;
+            if (!setting(&policy, opt, oend-opt)) {
+                trie_free(t);
+                return "settings are default, max, and jitter";
+            }
+            opt = oend < end ? oend+1 : end;
+        }
+        t->policies = xrealloc(t->policies,
+            (t->npolicies+1)*sizeof(struct policy));
+        t->policies[t->npolicies] = policy;
+        insert(t, p, colon-p, t->npolicies);
+        t->npolicies++;
+        p = *end ? end+1 : end;
+    }
+    if (t->npolicies == 0) {
+        trie_free(t);
+        t = 0;
+    }
+    pthread_mutex_lock(&lock);
+    struct trie *old = atomic_exchange(&current, t);
+    unsigned g = atomic_fetch_add(&gen, 1);
+    while (atomic_load(&readers[g&1]) > 0) {
+        sched_yield();
+    }
+    pthread_mutex_unlock(&lock);
+    if (old) {
+        trie_free(old);
+    }
+    return 0;
+}
+
+// Returns the slot to leave once done with the trie.
+static int enter(void) {
+    while (1) {
+        unsigned g = atomic_load(&gen);
+        atomic_fetch_add(&readers[g&1], 1);
+        if (atomic_load(&gen) == g) {
+            return g&1;
+        }
+        atomic_fetch_sub(&readers[g&1], 1);
+    }
+}
+
+static void leave(int slot) {
+    atomic_fetch_sub_explicit(&readers[slot], 1, __ATOMIC_RELEASE);
+}
+
+// Returns the expiry for a write of the key, given the one the command
+// asked for, which is zero for none.
+int64_t ttlpolicy_expires(const char *key, size_t keylen, int64_t now,
+    int64_t expires)
+{
+    if (!atomic_load_explicit(&current, __ATOMIC_RELAXED)) {
+        return expires;
+    }
+    int slot = enter();
+    struct trie *t = atomic_load(&current);
+    struct policy *p = t ? lookup(t, key, keylen) : 0;
+    if (!p) {
+        leave(slot);
+        return expires;
+    }
+    if (expires == 0 && p->def > 0) {
+        expires = int64_add_clamp(now, p->def);
+        atomic_fetch_add_explicit(&defaulted, 1, __ATOMIC_RELAXED);
+    }
+    if (p->max > 0 && (expires == 0 || expires-now > p->max)) {
+        expires = int64_add_clamp(now, p->max);
+        atomic_fetch_add_explicit(&capped, 1, __ATOMIC_RELAXED);
+    }
+    if (p->jitter > 0 && expires > now) {
+        int64_t span = (expires-now)/100*p->jitter;
+        if (span > 0) {
+            if (seed == 0) {
+                seed = mix13((uintptr_t)&seed^sys_now());
+            }
+            expires -= rand_next(&seed)%(span+1);
+            atomic_fetch_add_explicit(&jittered, 1, __ATOMIC_RELAXED);
+        }
+    }
+    leave(slot);
+    return expires;
+}
+
+void ttlpolicy_stats(struct ttlpolicy_stats *stats) {
+    int slot = enter();
+    struct trie *t = atomic_load(&current);
+    stats->policies = t ? t->npolicies : 0;
+    leave(slot);
+    stats->defaulted = atomic_load_explicit(&defaulted, __ATOMIC_RELAXED);
+    stats->capped = atomic_load_explicit(&capped, __ATOMIC_RELAXED);
+    stats->jittered = atomic_load_explicit(&jittered, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,28 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+#ifndef TTLPOLICY_H
+#define TTLPOLICY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct ttlpolicy_stats {
+    int policies;           // prefixes with a policy
+    uint64_t defaulted;     // writes given the default ttl
+    uint64_t capped;        // writes cut to the max ttl
+    uint64_t jittered;      // writes with a jittered ttl
+};
+
+const char *ttlpolicy_set(const char *spec);
+int64_t ttlpolicy_expires(const char *key, size_t keylen, int64_t now,
+    int64_t expires);
+void ttlpolicy_stats(struct ttlpolicy_stats *stats);
+
+#endif
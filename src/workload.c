@@ -0,0 +1,389 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+//
+// Unit workload.c fills the cache with generated entries for DEBUG WORKLOAD.
+// Keys, value sizes, payloads and ttls follow configurable distributions,
+// or a key/value size and ttl histogram captured from a production cache.
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "workload.h"
+#include "pogocache.h"
+#include "util.h"
+#include "sys.h"
+#include "xmalloc.h"
+
+// Random payloads are taken from this far into a shared buffer so that
+// values of the same size don't repeat.
+#define RANDSLACK 4096
+
+extern struct pogocache *cache;
+
+void workload_init(struct workload *wl, int64_t count, const char *prefix,
+    size_t prefixlen)
+{
+    memset(wl, 0, sizeof(struct workload));
+    wl->count = count;
+    wl->prefix = prefix;
+    wl->prefixlen = prefixlen;
+    wl->keys = WORKLOAD_SEQ;
+    wl->theta = 0.99;
+    wl->hotkeys = 0.2;
+    wl->hotops = 0.8;
+    wl->data = WORKLOAD_ZERO;
+    wl->ttlpct = 100;
+}
+
+void workload_free(struct workload *wl) {
+    xfree(wl->hist);
+    wl->hist = 0;
+    wl->nhist = 0;
+}
+
+// Parse "N", "MIN-MAX", or "N:WEIGHT,N:WEIGHT,...".
+bool workload_parse_sizes(struct workload *wl, const char *str) {
+    char *end;
+    wl->nsizes = 0;
+    if (!strchr(str, ':')) {
+        long long min = strtoll(str, &end, 10);
+        long long max = min;
+        if (*end == '-') {
+            max = strtoll(end+1, &end, 10);
+        }
+        if (*end || min < 0 || max < min) {
+            return false;
+        }
+        wl->minsize = min;
+        wl->maxsize = max;
+        return true;
+    }
+    wl->minsize = SIZE_MAX;
+    wl->maxsize = 0;
+    const char *s = str;
+    while (*s) {
+        if (wl->nsizes == WORKLOAD_MAXSIZES) {
+            return false;
+        }
+        long long size = strtoll(s, &end, 10);
+        if (*end != ':' || size < 0) {
+            return false;
+        }
+        double weight = strtod(end+1, &end);
+        if (weight <= 0 || (*end && *end != ',')) {
+            return false;
+        }
+        wl->sizes[wl->nsizes] = size;
+        wl->weights[wl->nsizes] = weight;
+        wl->nsizes++;
+        wl->minsize = (size_t)size < wl->minsize ? (size_t)size : wl->minsize;
+        wl->maxsize = (size_t)size > wl->maxsize ? (size_t)size : wl->maxsize;
+        s = *end ? end+1 : end;
+    }
+    return wl->nsizes > 0;
+}
+
+// Loads a histogram file. Each line is a bucket of four numbers, the key
+// length, the value length, the ttl in seconds (zero for none), and the
+// number of entries. Blank lines and lines starting with '#' are skipped.
+bool workload_load_histogram(struct workload *wl, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    int cap = 0;
+    char line[256];
+    bool ok = true;
+    while (fgets(line, sizeof(line), f)) {
+        char *p = line;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+            continue;
+        }
+        long long keylen, vallen, ttl;
+        double weight;
+        if (sscanf(p, "%lld %lld %lld %lf", &keylen, &vallen, &ttl,
+            &weight) != 4 || keylen < 0 || vallen < 0 || ttl < 0 ||
+            weight < 0)
+        {
+            ok = false;
+            break;
+        }
+        if (weight == 0) {
+            continue;
+        }
+        if (wl->nhist == cap) {
+            cap = cap == 0 ? 16 : cap*2;
+            wl->hist = xrealloc(wl->hist, cap*sizeof(struct workload_bucket));
+        }
+        wl->hist[wl->nhist++] = (struct workload_bucket) {
+            .keylen = keylen,
+            .vallen = vallen,
+            .ttl = ttl,
+            .weight = weight,
+        };
+    }
+    fclose(f);
+    if (!ok || wl->nhist == 0) {
+        workload_free(wl);
+        return false;
+    }
+    // Store cumulative weights for picking buckets.
+    for (int i = 1; i < wl->nhist; i++) {
+        wl->hist[i].weight += wl->hist[i-1].weight;
+    }
+    return true;
+}
+
+static double rand_double(uint64_t *seed) {
+    return (rand_next(seed)>>11)*(1.0/9007199254740992.0);
+}
+
+// Zipfian constants, from "Quickly Generating Billion-Record Synthetic
+// Databases" by Gray et al. Shared by all threads of a run.
+struct zipf {
+    double zetan;
+    double alpha;
+    double eta;
+    double half;
+};
+
+static void zipf_init(struct zipf *z, uint64_t n, double theta) {
+    double zeta2 = 1+pow(0.5, theta);
+    z->zetan = 0;
+    for (uint64_t i = 1; i <= n; i++) {
+        z->zetan += 1/pow((double)i, theta);
+    }
+    z->alpha = 1/(1-theta);
+    z->eta = (1-pow(2.0/n, 1-theta))/(1-zeta2/z->zetan);
+    z->half = zeta2;
+}
+
+struct workctx {
+    pthread_t th;
+    struct workload *wl;
+    struct zipf *zipf;
+    const char *payload;    // shared random payload, for WORKLOAD_RANDOM
+    int64_t start;
+    int64_t count;
+    uint64_t seed;
+};
+
+static uint64_t next_key(struct workctx *ctx, int64_t i) {
+    struct workload *wl = ctx->wl;
+    uint64_t n = wl->keyspace;
+    switch (wl->keys) {
+    case WORKLOAD_ZIPF: {
+        struct zipf *z = ctx->zipf;
+        double u = rand_double(&ctx->seed);
+        double uz = u*z->zetan;
+        uint64_t rank;
+        if (uz < 1) {
+            rank = 0;
+        } else if (uz < z->half) {
+            rank = 1;
+        } else {
+            rank = (uint64_t)(n*pow(z->eta*u-z->eta+1, z->alpha));
+        }
+        // Scatter the popular ranks over the keyspace.
+        return mix13(rank < n ? rank : n-1)%n;
+    }
+    case WORKLOAD_HOTSET: {
+        uint64_t hot = (uint64_t)(n*wl->hotkeys);
+        hot = hot == 0 ? 1 : hot;
+        if (hot >= n || rand_double(&ctx->seed) < wl->hotops) {
+            return rand_next(&ctx->seed)%hot;
+        }
+        return hot+rand_next(&ctx->seed)%(n-hot);
+    }
+    case WORKLOAD_UNIFORM:
+        return rand_next(&ctx->seed)%n;
+    default:
+        return i%n;
+    }
+}
+
+static size_t next_vallen(struct workctx *ctx) {
+    struct workload *wl = ctx->wl;
+    if (wl->nsizes == 0) {
+        if (wl->maxsize == wl->minsize) {
+            return wl->minsize;
+        }
+        return wl->minsize+rand_next(&ctx->seed)%(wl->maxsize-wl->minsize+1);
+    }
+    double total = 0;
+    for (int i = 0; i < wl->nsizes; i++) {
+        total += wl->weights[i];
+    }
+    double x = rand_double(&ctx->seed)*total;
+    for (int i = 0; i < wl->nsizes-1; i++) {
+        x -= wl->weights[i];
+        if (x < 0) {
+            return wl->sizes[i];
+        }
+    }
+    return wl->sizes[wl->nsizes-1];
+}
+
+static struct workload_bucket *next_bucket(struct workctx *ctx) {
+    struct workload *wl = ctx->wl;
+    double x = rand_double(&ctx->seed)*wl->hist[wl->nhist-1].weight;
+    int lo = 0;
+    int hi = wl->nhist-1;
+    while (lo < hi) {
+        int mid = (lo+hi)/2;
+        if (x < wl->hist[mid].weight) {
+            hi = mid;
+        } else {
+            lo = mid+1;
+        }
+    }
+    return &wl->hist[lo];
+}
+
+static void fill_text(char *buf, size_t len, uint64_t *seed) {
+    static const char *words[] = {
+        "the ", "cache ", "user ", "session ", "id ", "value ", "of ",
+        "and ", "request ", "time ", "status ", "ok ", "name ", "data ",
+        "\"key\": ", "{", "}, ", "true, ", "12345, ", "https://",
+    };
+    size_t nwords = sizeof(words)/sizeof(words[0]);
+    size_t i = 0;
+    while (i < len) {
+        const char *word = words[rand_next(seed)%nwords];
+        size_t n = strlen(word);
+        n = n < len-i ? n : len-i;
+        memcpy(buf+i, word, n);
+        i += n;
+    }
+}
+
+static void *work_entry(void *arg) {
+    struct workctx *ctx = arg;
+    struct workload *wl = ctx->wl;
+    int64_t now = sys_now();
+    size_t maxsize = wl->maxsize;
+    size_t maxkey = wl->prefixlen+32;
+    for (int i = 0; i < wl->nhist; i++) {
+        maxsize = wl->hist[i].vallen > maxsize ? wl->hist[i].vallen : maxsize;
+        maxkey = wl->hist[i].keylen > maxkey ? wl->hist[i].keylen : maxkey;
+    }
+    char *key = xmalloc(maxkey);
+    memcpy(key, wl->prefix, wl->prefixlen);
+    key[wl->prefixlen] = ':';
+    size_t keyhead = wl->prefixlen+1;
+    char *val = 0;
+    if (wl->data == WORKLOAD_ZERO) {
+        val = xmalloc(maxsize+1);
+        memset(val, 0, maxsize+1);
+    } else if (wl->data == WORKLOAD_TEXT) {
+        val = xmalloc(maxsize+1);
+        fill_text(val, maxsize+1, &ctx->seed);
+    }
+    for (int64_t i = ctx->start; i < ctx->start+ctx->count; i++) {
+        size_t keylen = keyhead+i64toa(next_key(ctx, i),
+            (uint8_t*)(key+keyhead));
+        size_t vallen;
+        int64_t ttl = 0;
+        if (wl->nhist > 0) {
+            struct workload_bucket *b = next_bucket(ctx);
+            if (b->keylen > keylen) {
+                memset(key+keylen, '.', b->keylen-keylen);
+                keylen = b->keylen;
+            }
+            vallen = b->vallen;
+            ttl = b->ttl;
+        } else {
+            vallen = next_vallen(ctx);
+            if (wl->ttlmax > 0 && (int)(rand_next(&ctx->seed)%100) <
+                wl->ttlpct)
+            {
+                ttl = wl->ttlmin;
+                if (wl->ttlmax > wl->ttlmin) {
+                    ttl += rand_next(&ctx->seed)%(wl->ttlmax-wl->ttlmin+1);
+                }
+            }
+        }
+        const char *data = val;
+        if (wl->data == WORKLOAD_RANDOM) {
+            data = ctx->payload+rand_next(&ctx->seed)%RANDSLACK;
+        }
+        struct pogocache_store_opts opts = {
+            .time = now,
+            .ttl = ttl*POGOCACHE_SECOND,
+        };
+        pogocache_store(cache, key, keylen, data, vallen, &opts);
+    }
+    xfree(val);
+    xfree(key);
+    return 0;
+}
+
+// Runs the workload over one thread per processor, each with its own
+// random number generator.
+void workload_run(struct workload *wl) {
+    if (wl->keyspace <= 0) {
+        wl->keyspace = wl->count > 0 ? wl->count : 1;
+    }
+    struct zipf zipf = { 0 };
+    if (wl->keys == WORKLOAD_ZIPF) {
+        zipf_init(&zipf, wl->keyspace, wl->theta);
+    }
+    uint64_t seed = sys_seed();
+    char *payload = 0;
+    if (wl->data == WORKLOAD_RANDOM) {
+        size_t maxsize = wl->maxsize;
+        for (int i = 0; i < wl->nhist; i++) {
+            if (wl->hist[i].vallen > maxsize) {
+                maxsize = wl->hist[i].vallen;
+            }
+        }
+        size_t n = maxsize+RANDSLACK;
+        payload = xmalloc(n);
+        for (size_t i = 0; i < n; i += 8) {
+            uint64_t x = rand_next(&seed);
+            memcpy(payload+i, &x, n-i < 8 ? n-i : 8);
+        }
+    }
+    int nprocs = sys_nprocs();
+    if (nprocs < 1) {
+        nprocs = 1;
+    }
+    struct workctx *ctxs = xmalloc(nprocs*sizeof(struct workctx));
+    memset(ctxs, 0, nprocs*sizeof(struct workctx));
+    int64_t group = wl->count/nprocs;
+    int64_t start = 0;
+    for (int i = 0; i < nprocs; i++) {
+        struct workctx *ctx = &ctxs[i];
+        ctx->wl = wl;
+        ctx->zipf = &zipf;
+        ctx->payload = payload;
+        ctx->start = start;
+        ctx->count = i == nprocs-1 ? wl->count-start : group;
+        ctx->seed = rand_next(&seed);
+        if (pthread_create(&ctx->th, 0, work_entry, ctx) != 0) {
+            ctx->th = 0;
+        }
+        start += group;
+    }
+    for (int i = 0; i < nprocs; i++) {
+        struct workctx *ctx = &ctxs[i];
+        if (ctx->th == 0) {
+            work_entry(ctx);
+        } else {
+            pthread_join(ctx->th, 0);
+        }
+    }
+    xfree(ctxs);
+    xfree(payload);
+}
@@ -0,0 +1,72 @@
+// https://github.com/tidwall/pogocache
+//
+// Copyright 2025 Polypoint Labs, LLC. All rights reserved.
+// This file is part of the Pogocache project.
+// Use of this source code is governed by the AGPL that can be found in
+// the LICENSE file.
+//
+// For alternative licensing options or general questions, please contact
+// us at licensing@polypointlabs.com.
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WORKLOAD_MAXSIZES 16
+
+enum workload_keys {
+    WORKLOAD_SEQ,       // every key in the keyspace once, in order
+    WORKLOAD_UNIFORM,
+    WORKLOAD_ZIPF,
+    WORKLOAD_HOTSET,
+};
+
+enum workload_data {
+    WORKLOAD_ZERO,      // all zeros
+    WORKLOAD_TEXT,      // compressible words
+    WORKLOAD_RANDOM,    // incompressible bytes
+};
+
+// A histogram bucket, one line of a histogram file.
+struct workload_bucket {
+    size_t keylen;
+    size_t vallen;
+    int64_t ttl;        // seconds, zero for no ttl
+    double weight;
+};
+
+struct workload {
+    int64_t count;              // number of stores
+    const char *prefix;
+    size_t prefixlen;
+    enum workload_keys keys;
+    int64_t keyspace;           // keys to draw from (default: count)
+    double theta;               // zipfian skew
+    double hotkeys;             // hotset fraction of the keyspace
+    double hotops;              // hotset fraction of the stores
+    // Value sizes are either a 'minsize'-'maxsize' range or, when 'nsizes'
+    // is not zero, weighted sizes.
+    size_t minsize;
+    size_t maxsize;
+    int nsizes;
+    size_t sizes[WORKLOAD_MAXSIZES];
+    double weights[WORKLOAD_MAXSIZES];
+    enum workload_data data;
+    int64_t ttlmin;             // seconds
+    int64_t ttlmax;
+    int ttlpct;                 // percent of stores with a ttl
+    // A histogram replaces the value sizes and ttls, and sets key lengths.
+    struct workload_bucket *hist;
+    int nhist;
+};
+
+void workload_init(struct workload *wl, int64_t count, const char *prefix,
+    size_t prefixlen);
+bool workload_parse_sizes(struct workload *wl, const char *str);
+bool workload_load_histogram(struct workload *wl, const char *path);
+void workload_free(struct workload *wl);
+void workload_run(struct workload *wl);
+
+#endif
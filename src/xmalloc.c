@@ -25,6 +25,9 @@
 #if defined(__linux__) && defined(__GLIBC__)
 #include <malloc.h>
 #define HAS_MALLOC_H
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define HAS_MALLOC_SIZE
 #endif
 
 // from main.c
@@ -34,11 +37,16 @@ extern const bool usetrackallocs;
 #ifdef NOTRACKALLOCS
 #define add_alloc()
 #define sub_alloc()
+#define add_call()
 size_t xallocs(void) {
     return 0;
 }
+size_t xallocs_total(void) {
+    return 0;
+}
 #else
 static atomic_int_fast64_t nallocs = 0;
+static atomic_int_fast64_t ncalls = 0; // every xmalloc and xrealloc call
 
 size_t xallocs(void) {
     if (usetrackallocs) {
@@ -48,12 +56,26 @@ size_t xallocs(void) {
     }
 }
 
+size_t xallocs_total(void) {
+    if (usetrackallocs) {
+        return atomic_load(&ncalls);
+    } else {
+        return 0;
+    }
+}
+
 static void add_alloc(void) {
     if (usetrackallocs) {
         atomic_fetch_add_explicit(&nallocs, 1, __ATOMIC_RELAXED);
     }
 }
 
+static void add_call(void) {
+    if (usetrackallocs) {
+        atomic_fetch_add_explicit(&ncalls, 1, __ATOMIC_RELAXED);
+    }
+}
+
 static void sub_alloc(void) {
     if (usetrackallocs) {
         atomic_fetch_sub_explicit(&nallocs, 1, __ATOMIC_RELAXED);
@@ -72,6 +94,7 @@ void *xmalloc(size_t size) {
     void *ptr = malloc(size);
     check_ptr(ptr);
     add_alloc();
+    add_call();
     return ptr;
 }
 
@@ -81,6 +104,7 @@ void *xrealloc(void *ptr, size_t size) {
     }
     ptr = realloc(ptr, size);
     check_ptr(ptr);
+    add_call();
     return ptr;
 }
 
@@ -92,6 +116,44 @@ void xfree(void *ptr) {
     sub_alloc();
 }
 
+// Returns the number of bytes that the allocator reserved for the pointer,
+// which may be larger than requested. Returns zero when unknown.
+size_t xmalloc_size(void *ptr) {
+#if defined(HAS_MALLOC_H)
+    return malloc_usable_size(ptr);
+#elif defined(HAS_MALLOC_SIZE)
+    return malloc_size(ptr);
+#else
+    (void)ptr;
+    return 0;
+#endif
+}
+
+// Returns the number of bytes handed out from the heap arenas and not yet
+// freed, or zero when unknown. Large blocks that the allocator maps on their
+// own aren't included, see xmalloc_mapped.
+size_t xmalloc_used(void) {
+#if defined(HAS_MALLOC_H) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks;
+#else
+    return 0;
+#endif
+}
+
+// Returns the number of bytes in blocks that the allocator mapped on their
+// own, whether or not they have been touched, or zero when unknown.
+size_t xmalloc_mapped(void) {
+#if defined(HAS_MALLOC_H) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
 void xpurge(void) {
 #ifdef HAS_MALLOC_H
     // Releases unused heap memory to OS
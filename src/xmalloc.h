@@ -14,9 +14,13 @@
 #include <stdbool.h>
 
 size_t xallocs(void);
+size_t xallocs_total(void);
 void *xmalloc(size_t size);
 void *xrealloc(void *ptr, size_t size);
 void xfree(void *ptr);
+size_t xmalloc_size(void *ptr);
+size_t xmalloc_used(void);
+size_t xmalloc_mapped(void);
 void xpurge(void);
 
 #endif
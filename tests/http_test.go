@@ -1,7 +1,15 @@
 package tests
 
 import (
+	"bytes"
+	"io"
+	"net"
+	"net/http"
+	"strings"
 	"testing"
+
+	"github.com/gomodule/redigo/redis"
+	"github.com/stretchr/testify/assert"
 )
 
 func TestHTTP(t *testing.T) {
@@ -44,3 +52,62 @@ func TestHTTP(t *testing.T) {
 	}
 
 }
+
+func TestHTTPTTLPolicy(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	defer conn.Do("CONFIG", "SET", "ttlpolicy", "")
+	conn.Do("CONFIG", "SET", "ttlpolicy", "web:default=100,max=200")
+	resp, err := httpDo(nil, "PUT", "/web:a", "1")
+	assert.Nil(t, err)
+	assert.Equal(t, "Stored\r\n", resp)
+	ttl, err := redis.Int(conn.Do("TTL", "web:a"))
+	assert.Nil(t, err)
+	assert.InDelta(t, 100, ttl, 1)
+	resp, err = httpDo(nil, "PUT", "/web:b?ttl=5000", "1")
+	assert.Nil(t, err)
+	assert.Equal(t, "Stored\r\n", resp)
+	ttl, err = redis.Int(conn.Do("TTL", "web:b"))
+	assert.Nil(t, err)
+	assert.InDelta(t, 200, ttl, 1)
+	resp, err = httpDo(nil, "PUT", "/web:c?ttl=50", "1")
+	assert.Nil(t, err)
+	assert.Equal(t, "Stored\r\n", resp)
+	ttl, err = redis.Int(conn.Do("TTL", "web:c"))
+	assert.Nil(t, err)
+	assert.InDelta(t, 50, ttl, 1)
+}
+
+func TestHTTPListener(t *testing.T) {
+	req, err := http.NewRequest("PUT", "http://localhost:9404/hello",
+		bytes.NewBufferString("world"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	resp, err := http.DefaultClient.Do(req)
+	if err != nil {
+		t.Fatal(err)
+	}
+	resp.Body.Close()
+	assert.Equal(t, 200, resp.StatusCode)
+	resp, err = http.Get("http://localhost:9404/hello")
+	if err != nil {
+		t.Fatal(err)
+	}
+	body, err := io.ReadAll(resp.Body)
+	resp.Body.Close()
+	assert.Nil(t, err)
+	assert.Equal(t, "world", string(body))
+	// RESP isn't taken on the HTTP port.
+	conn, err := net.Dial("tcp", ":9404")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	reply, err := mcRawDo(conn, "*1\r\n$4\r\nPING\r\n")
+	assert.Nil(t, err)
+	assert.True(t, strings.HasPrefix(reply, "HTTP/1.1 400"))
+}
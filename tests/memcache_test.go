@@ -2,6 +2,7 @@ package tests
 
 import (
 	"fmt"
+	"io"
 	"net"
 	"strconv"
 	"strings"
@@ -10,6 +11,7 @@ import (
 	"time"
 
 	"github.com/bradfitz/gomemcache/memcache"
+	"github.com/gomodule/redigo/redis"
 	"github.com/stretchr/testify/assert"
 )
 
@@ -113,3 +115,79 @@ func TestMemcacheIssue15(t *testing.T) {
 	assert.Nil(t, err)
 	assert.Equal(t, "VALUE counter 16 1\r\n2\r\nEND\r\n", resp)
 }
+
+func TestMemcacheTTLPolicy(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	defer conn.Do("CONFIG", "SET", "ttlpolicy", "")
+	conn.Do("CONFIG", "SET", "ttlpolicy", "mc:default=100,max=200")
+	mc, err := net.Dial("tcp", "127.0.0.1:9401")
+	assert.Nil(t, err)
+	defer mc.Close()
+	resp, err := mcRawDo(mc, "set mc:a 0 0 1\r\nx\r\n")
+	assert.Nil(t, err)
+	assert.Equal(t, "STORED\r\n", resp)
+	ttl, err := redis.Int(conn.Do("TTL", "mc:a"))
+	assert.Nil(t, err)
+	assert.InDelta(t, 100, ttl, 1)
+	resp, err = mcRawDo(mc, "set mc:b 0 5000 1\r\nx\r\n")
+	assert.Nil(t, err)
+	assert.Equal(t, "STORED\r\n", resp)
+	ttl, err = redis.Int(conn.Do("TTL", "mc:b"))
+	assert.Nil(t, err)
+	assert.InDelta(t, 200, ttl, 1)
+	// A touch is held to the max too.
+	_, err = mcRawDo(mc, "touch mc:a 5000\r\n")
+	assert.Nil(t, err)
+	ttl, err = redis.Int(conn.Do("TTL", "mc:a"))
+	assert.Nil(t, err)
+	assert.InDelta(t, 200, ttl, 1)
+	stats, err := respStats(conn)
+	assert.Nil(t, err)
+	assert.Equal(t, "1", stats["ttl_policies"])
+}
+
+func TestMemcacheListener(t *testing.T) {
+	mc := memcache.New("127.0.0.1:9403")
+	err := mc.Set(&memcache.Item{Key: "hello", Value: []byte("world")})
+	assert.Nil(t, err)
+	item, err := mc.Get("hello")
+	assert.Nil(t, err)
+	assert.Equal(t, "world", string(item.Value))
+	// RESP isn't taken on the memcache port.
+	conn, err := net.Dial("tcp", "127.0.0.1:9403")
+	assert.Nil(t, err)
+	defer conn.Close()
+	resp, err := mcRawDo(conn, "*1\r\n$4\r\nPING\r\n")
+	assert.Nil(t, err)
+	assert.True(t, strings.HasPrefix(resp, "ERROR\r\n"))
+}
+
+func TestMemcachePipeline(t *testing.T) {
+	// Errors are written straight to the connection, so they must not pass
+	// replies that --batching still has queued.
+	mc, err := net.Dial("tcp", "127.0.0.1:9401")
+	assert.Nil(t, err)
+	defer mc.Close()
+	var packet, expect string
+	for i := 0; i < 100; i++ {
+		key := fmt.Sprintf("mcpipe:%d", i)
+		packet += fmt.Sprintf("set %s 0 0 1\r\n%d\r\nget %s\r\n", key, i%10,
+			key)
+		expect += fmt.Sprintf("STORED\r\nVALUE %s 0 1\r\n%d\r\nEND\r\n", key,
+			i%10)
+		if i%10 == 3 {
+			packet += "get\r\n\r\n"
+			expect += "ERROR\r\nERROR\r\n"
+		}
+	}
+	_, err = mc.Write([]byte(packet))
+	assert.Nil(t, err)
+	resp := make([]byte, len(expect))
+	_, err = io.ReadFull(mc, resp)
+	assert.Nil(t, err)
+	assert.Equal(t, expect, string(resp))
+}
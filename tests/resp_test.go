@@ -2,8 +2,11 @@ package tests
 
 import (
 	"fmt"
+	"net"
+	"os"
 	"sort"
 	"strings"
+	"sync"
 	"testing"
 	"time"
 
@@ -441,3 +444,624 @@ func TestRESPKeyCmds(t *testing.T) {
 		conn.Do("DEL", "hello")
 	})
 }
+
+func TestRESPConfig(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	orig, err := redis.Strings(conn.Do("CONFIG", "GET", "evictlow"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Do("CONFIG", "SET", "evictlow", orig[1])
+	t.Run("GET", func(t *testing.T) {
+		reply, err := redis.Strings(conn.Do("CONFIG", "GET", "evict*"))
+		assert.Nil(t, err)
+		assert.Equal(t, 0, len(reply)%2)
+		assert.Contains(t, reply, "evicthigh")
+		assert.Contains(t, reply, "evictlow")
+		reply, err = redis.Strings(conn.Do("CONFIG", "GET", "nosuch"))
+		assert.Nil(t, err)
+		assert.Equal(t, 0, len(reply))
+		_, err = conn.Do("CONFIG", "GET")
+		assert.NotNil(t, err)
+	})
+	t.Run("SET", func(t *testing.T) {
+		reply, err := redis.String(conn.Do("CONFIG", "SET", "evictlow", "70"))
+		assert.Nil(t, err)
+		assert.Equal(t, "OK", reply)
+		vals, err := redis.Strings(conn.Do("CONFIG", "GET", "evictlow"))
+		assert.Nil(t, err)
+		assert.Equal(t, []string{"evictlow", "70"}, vals)
+		_, err = conn.Do("CONFIG", "SET", "evictlow", "abc")
+		assert.NotNil(t, err)
+		_, err = conn.Do("CONFIG", "SET", "nosuch", "1")
+		assert.NotNil(t, err)
+		_, err = conn.Do("CONFIG", "SET", "port", "1")
+		assert.NotNil(t, err)
+	})
+	t.Run("REWRITE", func(t *testing.T) {
+		conn.Do("CONFIG", "SET", "evictlow", "75")
+		reply, err := redis.String(conn.Do("CONFIG", "REWRITE"))
+		assert.Nil(t, err)
+		assert.Equal(t, "OK", reply)
+		data, err := os.ReadFile("pogocache.conf")
+		assert.Nil(t, err)
+		assert.Contains(t, string(data), "evictlow = 75")
+	})
+}
+
+func TestRESPTTLPolicy(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	defer conn.Do("CONFIG", "SET", "ttlpolicy", "")
+	reply, err := redis.String(conn.Do("CONFIG", "SET", "ttlpolicy",
+		"sess:default=100,max=200;sess:long:max=1000"))
+	assert.Nil(t, err)
+	assert.Equal(t, "OK", reply)
+	t.Run("default", func(t *testing.T) {
+		conn.Do("SET", "sess:a", "1")
+		ttl, err := redis.Int(conn.Do("TTL", "sess:a"))
+		assert.Nil(t, err)
+		assert.InDelta(t, 100, ttl, 1)
+		conn.Do("SET", "other", "1")
+		ttl, err = redis.Int(conn.Do("TTL", "other"))
+		assert.Nil(t, err)
+		assert.Equal(t, -1, ttl)
+		conn.Do("SET", "sess:a", "2", "KEEPTTL")
+		ttl, err = redis.Int(conn.Do("TTL", "sess:a"))
+		assert.Nil(t, err)
+		assert.InDelta(t, 100, ttl, 1)
+		// A new key has no ttl to keep, so it gets the policy.
+		conn.Do("DEL", "sess:new")
+		reply, err := redis.String(conn.Do("SET", "sess:new", "1", "KEEPTTL"))
+		assert.Nil(t, err)
+		assert.Equal(t, "OK", reply)
+		ttl, err = redis.Int(conn.Do("TTL", "sess:new"))
+		assert.Nil(t, err)
+		assert.InDelta(t, 100, ttl, 1)
+	})
+	t.Run("max", func(t *testing.T) {
+		conn.Do("SET", "sess:b", "1", "EX", 5000)
+		ttl, err := redis.Int(conn.Do("TTL", "sess:b"))
+		assert.Nil(t, err)
+		assert.InDelta(t, 200, ttl, 1)
+		conn.Do("SET", "sess:b", "1", "EX", 50)
+		ttl, err = redis.Int(conn.Do("TTL", "sess:b"))
+		assert.Nil(t, err)
+		assert.InDelta(t, 50, ttl, 1)
+		n, err := redis.Int(conn.Do("EXPIRE", "sess:b", 5000))
+		assert.Nil(t, err)
+		assert.Equal(t, 1, n)
+		ttl, err = redis.Int(conn.Do("TTL", "sess:b"))
+		assert.Nil(t, err)
+		assert.InDelta(t, 200, ttl, 1)
+	})
+	t.Run("longest", func(t *testing.T) {
+		conn.Do("SET", "sess:long:a", "1", "EX", 5000)
+		ttl, err := redis.Int(conn.Do("TTL", "sess:long:a"))
+		assert.Nil(t, err)
+		assert.InDelta(t, 1000, ttl, 1)
+		conn.Do("SET", "sess:long:b", "1")
+		ttl, err = redis.Int(conn.Do("TTL", "sess:long:b"))
+		assert.Nil(t, err)
+		assert.InDelta(t, 1000, ttl, 1)
+		// A max alone also holds a new key set with KEEPTTL.
+		conn.Do("DEL", "sess:long:c")
+		conn.Do("SET", "sess:long:c", "1", "KEEPTTL")
+		ttl, err = redis.Int(conn.Do("TTL", "sess:long:c"))
+		assert.Nil(t, err)
+		assert.InDelta(t, 1000, ttl, 1)
+	})
+	t.Run("stats", func(t *testing.T) {
+		stats, err := respStats(conn)
+		assert.Nil(t, err)
+		assert.Equal(t, "2", stats["ttl_policies"])
+		assert.NotEqual(t, "0", stats["ttl_defaulted"])
+		assert.NotEqual(t, "0", stats["ttl_capped"])
+	})
+	t.Run("invalid", func(t *testing.T) {
+		_, err := conn.Do("CONFIG", "SET", "ttlpolicy", "bad")
+		assert.NotNil(t, err)
+		// The policies in place are kept.
+		conn.Do("SET", "sess:c", "1")
+		ttl, err := redis.Int(conn.Do("TTL", "sess:c"))
+		assert.Nil(t, err)
+		assert.InDelta(t, 100, ttl, 1)
+	})
+	t.Run("cleared", func(t *testing.T) {
+		conn.Do("CONFIG", "SET", "ttlpolicy", "")
+		conn.Do("SET", "sess:d", "1")
+		ttl, err := redis.Int(conn.Do("TTL", "sess:d"))
+		assert.Nil(t, err)
+		assert.Equal(t, -1, ttl)
+	})
+}
+
+func TestRESPMemoryStats(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	conn.Do("FLUSH")
+	conn.Do("SET", "hello", "world")
+	conn.Do("SET", "big", strings.Repeat("x", 10000))
+	pairs, err := redis.Values(conn.Do("MEMORY", "STATS"))
+	assert.Nil(t, err)
+	stats := make(map[string]string)
+	for _, pair := range pairs {
+		kv, err := redis.Strings(pair, nil)
+		assert.Nil(t, err)
+		stats[kv[0]] = kv[1]
+	}
+	assert.Equal(t, "128", stats["shards"])
+	// FLUSH clears lazily, so the maps may still hold flushed entries.
+	var entries, bytes int
+	fmt.Sscan(stats["entries"], &entries)
+	assert.GreaterOrEqual(t, entries, 2)
+	fmt.Sscan(stats["entry_bytes"], &bytes)
+	assert.Greater(t, bytes, 10000)
+	assert.NotEmpty(t, stats["load_factor"])
+	_, err = conn.Do("MEMORY", "BAD")
+	assert.NotNil(t, err)
+}
+
+func TestRESPDebugShards(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	conn.Do("FLUSH")
+	conn.Do("SET", "hello", "world")
+	pairs, err := redis.Values(conn.Do("DEBUG", "SHARDS"))
+	assert.Nil(t, err)
+	assert.Equal(t, 128, len(pairs))
+	var entries int
+	for i, pair := range pairs {
+		kv, err := redis.Strings(pair, nil)
+		assert.Nil(t, err)
+		assert.Equal(t, fmt.Sprintf("shard_%d", i), kv[0])
+		var n int
+		fmt.Sscanf(kv[1], "entries=%d", &n)
+		entries += n
+	}
+	assert.GreaterOrEqual(t, entries, 1)
+}
+
+func TestRESPMemoryUsage(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	conn.Do("SET", "hello", "world")
+	small, err := redis.Int(conn.Do("MEMORY", "USAGE", "hello"))
+	assert.Nil(t, err)
+	assert.Greater(t, small, len("hello")+len("world"))
+	conn.Do("SET", "big", strings.Repeat("x", 10000))
+	big, err := redis.Int(conn.Do("MEMORY", "USAGE", "big", "SAMPLES", 5))
+	assert.Nil(t, err)
+	assert.Greater(t, big, 10000)
+	reply, err := conn.Do("MEMORY", "USAGE", "nokey")
+	assert.Nil(t, err)
+	assert.Nil(t, reply)
+	_, err = conn.Do("MEMORY", "USAGE", "hello", "SAMPLES")
+	assert.NotNil(t, err)
+}
+
+func TestRESPObject(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	conn.Do("FLUSH")
+	conn.Do("SET", "hello", "world")
+	t.Run("ENCODING", func(t *testing.T) {
+		reply, err := redis.String(conn.Do("OBJECT", "ENCODING", "hello"))
+		assert.Nil(t, err)
+		assert.NotEmpty(t, reply)
+		val, err := conn.Do("OBJECT", "ENCODING", "nokey")
+		assert.Nil(t, err)
+		assert.Nil(t, val)
+	})
+	t.Run("IDLETIME", func(t *testing.T) {
+		reply, err := redis.Int(conn.Do("OBJECT", "IDLETIME", "hello"))
+		assert.Nil(t, err)
+		assert.GreaterOrEqual(t, reply, 0)
+	})
+	t.Run("BAD", func(t *testing.T) {
+		_, err := conn.Do("OBJECT", "BAD", "hello")
+		assert.NotNil(t, err)
+		_, err = conn.Do("OBJECT", "ENCODING")
+		assert.NotNil(t, err)
+	})
+}
+
+func TestRESPDebugObject(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	conn.Do("SET", "hello", "world")
+	reply, err := redis.String(conn.Do("DEBUG", "OBJECT", "hello"))
+	assert.Nil(t, err)
+	assert.Contains(t, reply, "keylen:5")
+	assert.Contains(t, reply, "vallen:5")
+	assert.Contains(t, reply, "ttl:-1")
+	_, err = conn.Do("DEBUG", "OBJECT", "nokey")
+	assert.NotNil(t, err)
+}
+
+func TestRESPListener(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9402")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	reply, err := redis.String(conn.Do("SET", "hello", "world"))
+	assert.Nil(t, err)
+	assert.Equal(t, "OK", reply)
+	reply, err = redis.String(conn.Do("GET", "hello"))
+	assert.Nil(t, err)
+	assert.Equal(t, "world", reply)
+	stats, err := respStats(conn)
+	assert.Nil(t, err)
+	assert.Equal(t, "1", stats["listener_respport_connections"])
+	// Memcache commands are taken as RESP inline commands.
+	raw, err := net.Dial("tcp", ":9402")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer raw.Close()
+	resp, err := mcRawDo(raw, "version\r\n")
+	assert.Nil(t, err)
+	assert.True(t, strings.HasPrefix(resp, "-ERR"))
+}
+
+func TestRESPClientClass(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	reply, err := redis.String(conn.Do("CLIENT", "GETCLASS"))
+	assert.Nil(t, err)
+	assert.Equal(t, "default", reply)
+	reply, err = redis.String(conn.Do("CLIENT", "SETCLASS", "bulk"))
+	assert.Nil(t, err)
+	assert.Equal(t, "OK", reply)
+	reply, err = redis.String(conn.Do("CLIENT", "GETCLASS"))
+	assert.Nil(t, err)
+	assert.Equal(t, "bulk", reply)
+	stats, err := respStats(conn)
+	assert.Nil(t, err)
+	assert.Equal(t, "1", stats["class_bulk_connections"])
+	_, err = conn.Do("CLIENT", "SETCLASS", "nope")
+	assert.NotNil(t, err)
+	reply, err = redis.String(conn.Do("CLIENT", "GETCLASS"))
+	assert.Nil(t, err)
+	assert.Equal(t, "bulk", reply)
+	// The class still serves commands.
+	reply, err = redis.String(conn.Do("SET", "hello", "world"))
+	assert.Nil(t, err)
+	assert.Equal(t, "OK", reply)
+}
+
+func TestRESPDebugWorkload(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	conn.Do("FLUSH")
+	reply, err := redis.String(conn.Do("DEBUG", "WORKLOAD", 10000, "seq"))
+	assert.Nil(t, err)
+	assert.Equal(t, "OK", reply)
+	n, err := redis.Int(conn.Do("DBSIZE"))
+	assert.Nil(t, err)
+	assert.Equal(t, 10000, n)
+	// The count is of stores, and zipfian keys repeat.
+	conn.Do("FLUSH")
+	conn.Do("DEBUG", "WORKLOAD", 10000, "zipf", "KEYS", "ZIPF")
+	n, err = redis.Int(conn.Do("DBSIZE"))
+	assert.Nil(t, err)
+	assert.Greater(t, n, 0)
+	assert.Less(t, n, 10000)
+	conn.Do("FLUSH")
+}
+
+func TestRESPPipeline(t *testing.T) {
+	// Each connection sends one long pipeline that mixes GET and SET, which
+	// --batching queues, with INCR, DEL, and EXISTS, which flush the queue.
+	// The pipeline is far larger than a read, so the queue is also flushed
+	// partway through each connection's commands.
+	var wg sync.WaitGroup
+	for c := 0; c < 4; c++ {
+		wg.Add(1)
+		go func(c int) {
+			defer wg.Done()
+			conn, err := redis.Dial("tcp", ":9401")
+			if err != nil {
+				t.Error(err)
+				return
+			}
+			defer conn.Close()
+			var expect []interface{}
+			ctr := fmt.Sprintf("pipe:%d:ctr", c)
+			conn.Send("DEL", ctr)
+			expect = append(expect, nil)
+			for i := 0; i < 5000; i++ {
+				key := fmt.Sprintf("pipe:%d:%d", c, i)
+				val := fmt.Sprintf("%d:%s", i, randString(64))
+				conn.Send("SET", key, val)
+				expect = append(expect, "OK")
+				conn.Send("GET", key)
+				expect = append(expect, val)
+				switch i % 5 {
+				case 1:
+					conn.Send("INCR", ctr)
+					expect = append(expect, int64(i/5+1))
+				case 2:
+					conn.Send("DEL", key)
+					expect = append(expect, int64(1))
+					conn.Send("GET", key)
+					expect = append(expect, "")
+				case 3:
+					conn.Send("EXISTS", key)
+					expect = append(expect, int64(1))
+				}
+			}
+			if err := conn.Flush(); err != nil {
+				t.Error(err)
+				return
+			}
+			for i, want := range expect {
+				reply, err := conn.Receive()
+				if err != nil {
+					t.Error(err)
+					return
+				}
+				switch want := want.(type) {
+				case nil:
+					continue
+				case int64:
+					assert.Equal(t, want, reply, "reply %d", i)
+				case string:
+					if want == "" {
+						assert.Nil(t, reply, "reply %d", i)
+					} else {
+						s, _ := redis.String(reply, nil)
+						assert.Equal(t, want, s, "reply %d", i)
+					}
+				}
+			}
+		}(c)
+	}
+	wg.Wait()
+}
+
+func TestRESPEvictLow(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	var orig [3][]string
+	for i, name := range []string{"maxmemory", "evicthigh", "evictlow"} {
+		orig[i], err = redis.Strings(conn.Do("CONFIG", "GET", name))
+		if err != nil || len(orig[i]) != 2 {
+			t.Fatal(err)
+		}
+	}
+	defer func() {
+		for _, kv := range orig {
+			conn.Do("CONFIG", "SET", kv[0], kv[1])
+		}
+	}()
+	conn.Do("FLUSH")
+	val := strings.Repeat("x", 1000)
+	for i := 0; i < 50000; i++ {
+		conn.Send("SET", fmt.Sprintf("evict:%d", i), val)
+	}
+	conn.Flush()
+	for i := 0; i < 50000; i++ {
+		conn.Receive()
+	}
+	stats, err := respStats(conn)
+	assert.Nil(t, err)
+	var rss, evicted0 int
+	fmt.Sscan(stats["rss"], &rss)
+	fmt.Sscan(stats["bg_evictions"], &evicted0)
+	// Put the limit at the memory in use, which starts the evictors.
+	conn.Do("CONFIG", "SET", "evictlow", "70")
+	conn.Do("CONFIG", "SET", "evicthigh", "90")
+	reply, err := redis.String(conn.Do("CONFIG", "SET", "maxmemory", rss))
+	assert.Nil(t, err)
+	assert.Equal(t, "OK", reply)
+	low, high := rss/100*70, rss/100*90
+	last := -1
+	for start := time.Now(); time.Since(start) < time.Second*10; {
+		time.Sleep(time.Millisecond * 200)
+		stats, err = respStats(conn)
+		assert.Nil(t, err)
+		var evicted int
+		fmt.Sscan(stats["bg_evictions"], &evicted)
+		if evicted > evicted0 && evicted == last {
+			break
+		}
+		last = evicted
+	}
+	// The evictors stop at the low watermark, leaving the rest of the keys.
+	var usage int
+	fmt.Sscan(stats["mem_usage"], &usage)
+	assert.LessOrEqual(t, usage, high)
+	assert.Greater(t, usage, low/10*9)
+	n, err := redis.Int(conn.Do("DBSIZE"))
+	assert.Nil(t, err)
+	assert.Greater(t, n, 0)
+	assert.Less(t, n, 50000)
+	conn.Do("FLUSH")
+}
+
+func TestRESPHotKeys(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	conn.Do("FLUSH")
+	// Reads the key until this thread serves it from a copy.
+	warm := func(t *testing.T, key string) {
+		before, err := respStats(conn)
+		assert.Nil(t, err)
+		for i := 0; i < 1000; i++ {
+			conn.Send("GET", key)
+		}
+		conn.Flush()
+		for i := 0; i < 1000; i++ {
+			conn.Receive()
+		}
+		after, err := respStats(conn)
+		assert.Nil(t, err)
+		var reads0, reads1 int
+		fmt.Sscan(before["hot_reads"], &reads0)
+		fmt.Sscan(after["hot_reads"], &reads1)
+		assert.Greater(t, reads1, reads0)
+	}
+	t.Run("SET", func(t *testing.T) {
+		conn.Do("SET", "hot:key", "v1")
+		warm(t, "hot:key")
+		conn.Do("SET", "hot:key", "v2")
+		val, err := redis.String(conn.Do("GET", "hot:key"))
+		assert.Nil(t, err)
+		assert.Equal(t, "v2", val)
+		vals, err := redis.Strings(conn.Do("MGET", "hot:key"))
+		assert.Nil(t, err)
+		assert.Equal(t, []string{"v2"}, vals)
+	})
+	t.Run("DEL", func(t *testing.T) {
+		conn.Do("SET", "hot:key", "v1")
+		warm(t, "hot:key")
+		conn.Do("DEL", "hot:key")
+		val, err := conn.Do("GET", "hot:key")
+		assert.Nil(t, err)
+		assert.Nil(t, val)
+	})
+	t.Run("EXPIRE", func(t *testing.T) {
+		conn.Do("SET", "hot:key", "v1")
+		warm(t, "hot:key")
+		n, err := redis.Int(conn.Do("EXPIRE", "hot:key", 0))
+		assert.Nil(t, err)
+		assert.Equal(t, 1, n)
+		val, err := conn.Do("GET", "hot:key")
+		assert.Nil(t, err)
+		assert.Nil(t, val)
+	})
+	t.Run("FLUSHALL", func(t *testing.T) {
+		conn.Do("SET", "hot:key", "v1")
+		warm(t, "hot:key")
+		conn.Do("FLUSHALL")
+		val, err := conn.Do("GET", "hot:key")
+		assert.Nil(t, err)
+		assert.Nil(t, val)
+	})
+}
+
+// Shards only ever grow, so this test stays last, after the ones that
+// expect the 128 shards that run.sh starts with.
+func TestRESPReshard(t *testing.T) {
+	conn, err := redis.Dial("tcp", ":9401")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	conn.Do("FLUSH")
+	for i := 0; i < 20000; i++ {
+		conn.Send("SET", fmt.Sprintf("reshard:pre:%d", i), i)
+	}
+	conn.Flush()
+	for i := 0; i < 20000; i++ {
+		conn.Receive()
+	}
+	// Writers keep storing new keys for as long as the reshard runs.
+	done := make(chan struct{})
+	counts := make([]int, 4)
+	var wg sync.WaitGroup
+	for c := 0; c < 4; c++ {
+		wg.Add(1)
+		go func(c int) {
+			defer wg.Done()
+			conn, err := redis.Dial("tcp", ":9401")
+			if err != nil {
+				t.Error(err)
+				return
+			}
+			defer conn.Close()
+			for {
+				select {
+				case <-done:
+					return
+				default:
+				}
+				key := fmt.Sprintf("reshard:%d:%d", c, counts[c])
+				reply, err := redis.String(conn.Do("SET", key, key))
+				if err != nil || reply != "OK" {
+					t.Errorf("SET %s: %v %v", key, reply, err)
+					return
+				}
+				counts[c]++
+			}
+		}(c)
+	}
+	time.Sleep(time.Millisecond * 50)
+	reply, err := redis.String(conn.Do("CONFIG", "SET", "shards", "256"))
+	assert.Nil(t, err)
+	assert.Equal(t, "OK", reply)
+	_, err = conn.Do("CONFIG", "SET", "shards", "384")
+	assert.NotNil(t, err)
+	start := time.Now()
+	for {
+		vals, err := redis.Strings(conn.Do("CONFIG", "GET", "shards"))
+		assert.Nil(t, err)
+		if len(vals) == 2 && vals[1] == "256" {
+			break
+		}
+		if time.Since(start) > time.Second*10 {
+			t.Fatal("reshard did not finish")
+		}
+		time.Sleep(time.Millisecond * 10)
+	}
+	close(done)
+	wg.Wait()
+	for i := 0; i < 20000; i++ {
+		val, err := redis.Int(conn.Do("GET", fmt.Sprintf("reshard:pre:%d", i)))
+		assert.Nil(t, err)
+		assert.Equal(t, i, val)
+	}
+	total := 0
+	for c, n := range counts {
+		total += n
+		for i := 0; i < n; i++ {
+			key := fmt.Sprintf("reshard:%d:%d", c, i)
+			val, err := redis.String(conn.Do("GET", key))
+			assert.Nil(t, err)
+			assert.Equal(t, key, val)
+		}
+	}
+	n, err := redis.Int(conn.Do("DBSIZE"))
+	assert.Nil(t, err)
+	assert.Equal(t, 20000+total, n)
+	vals, err := redis.Strings(conn.Do("CONFIG", "GET", "shards"))
+	assert.Nil(t, err)
+	assert.Equal(t, []string{"shards", "256"}, vals)
+	conn.Do("FLUSH")
+}
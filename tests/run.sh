@@ -17,6 +17,7 @@ finish() {
     # rm -fr *.wasm
     # rm -fr *.js
     pkill -9 pogocache || true
+    rm -f pogocache.conf pogocache.conf.tmp
     # if [[ "$OK" != "1" ]]; then
         # echo "FAIL"
     # fi
@@ -38,17 +39,31 @@ if [[ $buildok == "0" ]]; then
 fi
 CCSANI=1 make -C ..
 
-# Run Pogocache
-../pogocache --shards=128 --cas=yes &
-sleep 0.1
-
-
 run=$@
 if [[ "$run" == "" ]]; then
     run='.'
 fi
 
-go test -v -run $run
+# The suite runs once against each of these server modes.
+modes=(
+    ""
+    "--batching yes"
+    "--sharednothing yes --threads 4"
+)
+
+for mode in "${modes[@]}"; do
+    echo "== pogocache $mode"
+    pkill -9 pogocache || true
+    sleep 0.1
+    # Run Pogocache, with a config file for CONFIG REWRITE, a listener for
+    # each protocol, and a second traffic class.
+    echo "[pogocache]" > pogocache.conf
+    ../pogocache --shards=128 --cas=yes --config pogocache.conf \
+        --respport 9402 --memcacheport 9403 --httpport 9404 --classes bulk \
+        $mode &
+    sleep 0.1
+    go test -v -run $run
+done
 
 
 
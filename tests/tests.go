@@ -7,6 +7,8 @@ import (
 	"math/rand"
 	"net"
 	"net/http"
+
+	"github.com/gomodule/redigo/redis"
 )
 
 // randString returns random string with the random size of [0-n).
@@ -69,3 +71,22 @@ func mcRawDo(mc net.Conn, packet string) (string, error) {
 	resp := string(buf[:n])
 	return resp, nil
 }
+
+// respStats returns the fields of the STATS command.
+func respStats(conn redis.Conn) (map[string]string, error) {
+	pairs, err := redis.Values(conn.Do("STATS"))
+	if err != nil {
+		return nil, err
+	}
+	stats := make(map[string]string)
+	for _, pair := range pairs {
+		kv, err := redis.Strings(pair, nil)
+		if err != nil {
+			return nil, err
+		}
+		if len(kv) == 2 {
+			stats[kv[0]] = kv[1]
+		}
+	}
+	return stats, nil
+}